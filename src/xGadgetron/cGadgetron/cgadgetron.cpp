@@ -453,6 +453,8 @@ cGT_setAcquisitionDataStorageScheme(const char* scheme)
 	try{
 		if (scheme[0] == 'f' || strcmp(scheme, "default") == 0)
 			AcquisitionsFile::set_as_template();
+		else if (scheme[0] == 'a')
+			AcquisitionsArray::set_as_template();
 		else
 			AcquisitionsVector::set_as_template();
 		return (void*)new DataHandle;
@@ -482,6 +484,21 @@ cGT_sortAcquisitions(void* ptr_acqs)
 	CATCH;
 }
 
+extern "C"
+void*
+cGT_selectAcquisitions(void* ptr_acqs, const char* field, int first, int last)
+{
+	try {
+		CAST_PTR(DataHandle, h_acqs, ptr_acqs);
+		shared_ptr<MRAcquisitionData> sptr_acqs;
+		getObjectSptrFromHandle<MRAcquisitionData>(h_acqs, sptr_acqs);
+		shared_ptr<MRAcquisitionData> sptr_view =
+			AcquisitionsView::select(sptr_acqs, field, first, last);
+		return newObjectHandle<MRAcquisitionData>(sptr_view);
+	}
+	CATCH;
+}
+
 extern "C"
 void*
 cGT_ISMRMRDAcquisitionsFromFile(const char* file)
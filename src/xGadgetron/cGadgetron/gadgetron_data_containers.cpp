@@ -27,17 +27,21 @@ limitations under the License.
 \author Evgueni Ovtchinnikov
 \author CCP PETMR
 */
+#include <algorithm>
 #include <cmath>
+#include <cstring>
 #include <iomanip>
 
 #include "sirf/Gadgetron/cgadgetron_shared_ptr.h"
 #include "sirf/Gadgetron/gadgetron_data_containers.h"
+#include "sirf/Gadgetron/ismrmrd_reader.h"
 
 using namespace gadgetron;
 using namespace sirf;
 
 std::string MRAcquisitionData::_storage_scheme;
 shared_ptr<MRAcquisitionData> MRAcquisitionData::acqs_templ_;
+unsigned int AcquisitionsFile::write_batch_size_ = 256;
 
 static std::string get_date_time_string()
 {
@@ -56,6 +60,96 @@ static std::string get_date_time_string()
     return str.str();
 }
 
+void
+AcquisitionsHeaderIndex::clear()
+{
+	flags_.clear();
+	kspace_encode_step_1_.clear();
+	kspace_encode_step_2_.clear();
+	average_.clear();
+	slice_.clear();
+	contrast_.clear();
+	phase_.clear();
+	repetition_.clear();
+	set_.clear();
+	segment_.clear();
+	acquisition_time_stamp_.clear();
+	number_of_samples_.clear();
+	active_channels_.clear();
+}
+
+void
+AcquisitionsHeaderIndex::reserve(size_t n)
+{
+	flags_.reserve(n);
+	kspace_encode_step_1_.reserve(n);
+	kspace_encode_step_2_.reserve(n);
+	average_.reserve(n);
+	slice_.reserve(n);
+	contrast_.reserve(n);
+	phase_.reserve(n);
+	repetition_.reserve(n);
+	set_.reserve(n);
+	segment_.reserve(n);
+	acquisition_time_stamp_.reserve(n);
+	number_of_samples_.reserve(n);
+	active_channels_.reserve(n);
+}
+
+void
+AcquisitionsHeaderIndex::append(const ISMRMRD::AcquisitionHeader& head)
+{
+	flags_.push_back(head.flags);
+	kspace_encode_step_1_.push_back(head.idx.kspace_encode_step_1);
+	kspace_encode_step_2_.push_back(head.idx.kspace_encode_step_2);
+	average_.push_back(head.idx.average);
+	slice_.push_back(head.idx.slice);
+	contrast_.push_back(head.idx.contrast);
+	phase_.push_back(head.idx.phase);
+	repetition_.push_back(head.idx.repetition);
+	set_.push_back(head.idx.set);
+	segment_.push_back(head.idx.segment);
+	acquisition_time_stamp_.push_back(head.acquisition_time_stamp);
+	number_of_samples_.push_back(head.number_of_samples);
+	active_channels_.push_back(head.active_channels);
+}
+
+void
+AcquisitionsHeaderIndex::append(const Entry& entry)
+{
+	flags_.push_back(entry.flags());
+	kspace_encode_step_1_.push_back(entry.kspace_encode_step_1());
+	kspace_encode_step_2_.push_back(entry.kspace_encode_step_2());
+	average_.push_back(entry.average());
+	slice_.push_back(entry.slice());
+	contrast_.push_back(entry.contrast());
+	phase_.push_back(entry.phase());
+	repetition_.push_back(entry.repetition());
+	set_.push_back(entry.set());
+	segment_.push_back(entry.segment());
+	acquisition_time_stamp_.push_back(entry.acquisition_time_stamp());
+	number_of_samples_.push_back(entry.number_of_samples());
+	active_channels_.push_back(entry.active_channels());
+}
+
+void
+AcquisitionsHeaderIndex::set(size_t i, const ISMRMRD::AcquisitionHeader& head)
+{
+	flags_[i] = head.flags;
+	kspace_encode_step_1_[i] = head.idx.kspace_encode_step_1;
+	kspace_encode_step_2_[i] = head.idx.kspace_encode_step_2;
+	average_[i] = head.idx.average;
+	slice_[i] = head.idx.slice;
+	contrast_[i] = head.idx.contrast;
+	phase_[i] = head.idx.phase;
+	repetition_[i] = head.idx.repetition;
+	set_[i] = head.idx.set;
+	segment_[i] = head.idx.segment;
+	acquisition_time_stamp_[i] = head.acquisition_time_stamp;
+	number_of_samples_[i] = head.number_of_samples;
+	active_channels_[i] = head.active_channels;
+}
+
 void 
 MRAcquisitionData::write(const std::string &filename) const
 {
@@ -89,32 +183,23 @@ MRAcquisitionData::read( const std::string& filename_ismrmrd_with_ext )
 		std::cout<< "Started reading acquisitions from " << filename_ismrmrd_with_ext << std::endl;
 	try
 	{
-
-		ISMRMRD::Dataset d(filename_ismrmrd_with_ext.c_str(),"dataset", false);
-
-		d.readHeader(this->acqs_info_);
-
-		uint32_t num_acquis = d.getNumberOfAcquisitions();
-		for( uint32_t i_acqu=0; i_acqu<num_acquis; i_acqu++)
 		{
-			if( verbose )
-			{
-				if( i_acqu%( num_acquis/10 ) == 0 )
-					std::cout << std::ceil( float(i_acqu)/num_acquis*100 )<< " % " << " done."<< std::endl;
-			}
+			Mutex mtx;
+			boost::mutex::scoped_lock lock(mtx());
+			ISMRMRD::Dataset d(filename_ismrmrd_with_ext.c_str(),"dataset", false);
+			d.readHeader(this->acqs_info_);
+		}
 
-			ISMRMRD::Acquisition acq;
-			d.readAcquisition( i_acqu, acq);
+		// acquisitions are read in blocks, noise and calibration readouts
+		// being filtered out by TO_BE_IGNORED
+		ISMRMRDAcquisitionsReader reader(filename_ismrmrd_with_ext, "dataset");
+		reader.set_verbose(verbose);
+		reader.read(*this);
 
-			if( TO_BE_IGNORED(acq) )
-				continue;
-			else
-				this->append_acquisition( acq );
-		}
 		if( verbose )
 			std::cout<< "Finished reading acquisitions from " << filename_ismrmrd_with_ext << std::endl;
 	}
-	catch( std::runtime_error& e)
+	catch( std::exception& e)
 	{
 		std::cerr << "An exception was caught reading " << filename_ismrmrd_with_ext << std::endl;
 		std::cerr << e.what() <<std::endl;
@@ -135,7 +220,6 @@ MRAcquisitionData::undersampled() const
 int 
 MRAcquisitionData::get_acquisitions_dimensions(size_t ptr_dim) const
 {
-	ISMRMRD::Acquisition acq;
 	int* dim = (int*)ptr_dim;
 
 	int na = number();
@@ -151,8 +235,7 @@ MRAcquisitionData::get_acquisitions_dimensions(size_t ptr_dim) const
 	//int not_reg = 0;
 	for (; y < na;) {
 		for (; y < na && sorted();) {
-			get_acquisition(y, acq);
-			if (acq.isFlagSet(ISMRMRD::ISMRMRD_ACQ_FIRST_IN_SLICE))
+			if (header_entry(y).isFlagSet(ISMRMRD::ISMRMRD_ACQ_FIRST_IN_SLICE))
 				break;
 			y++;
 		}
@@ -160,7 +243,7 @@ MRAcquisitionData::get_acquisitions_dimensions(size_t ptr_dim) const
 			break;
 		ny = 0;
 		for (; y < na; y++) {
-			get_acquisition(y, acq);
+			AcquisitionsHeaderIndex::Entry acq = header_entry(y);
 			if (TO_BE_IGNORED(acq)) // not a regular acquisition
 				continue;
 			ns = acq.number_of_samples();
@@ -217,11 +300,10 @@ MRAcquisitionData::get_data(complex_float_t* z, int all)
 	unsigned int na = number();
 	unsigned int n = 0;
 	for (unsigned int a = 0, i = 0; a < na; a++) {
-		get_acquisition(a, acq);
-		if (!all && TO_BE_IGNORED(acq)) {
-			std::cout << "ignoring acquisition " << a << '\n';
+		// ignored acquisitions are skipped by their headers, without reading
+		if (!all && TO_BE_IGNORED(header_entry(a)))
 			continue;
-		}
+		get_acquisition(a, acq);
 		n++;
 		unsigned int nc = acq.active_channels();
 		unsigned int ns = acq.number_of_samples();
@@ -233,101 +315,358 @@ MRAcquisitionData::get_data(complex_float_t* z, int all)
 	}
 }
 
+// kernels of the acquisition data algebra on interleaved (re, im) pairs,
+// written out in real arithmetic so that the compiler can vectorize them;
+// z may coincide with x or y
+
+static void
+axpby_kernel_(complex_float_t a, const complex_float_t* x,
+	complex_float_t b, const complex_float_t* y, complex_float_t* z, size_t n)
+{
+	const float* u = (const float*)x;
+	const float* v = (const float*)y;
+	float* w = (float*)z;
+	const float ar = a.real();
+	const float ai = a.imag();
+	const float br = b.real();
+	const float bi = b.imag();
+	const long long m = (long long)n;
+	if (b == complex_float_t(0.0)) {
+#pragma omp simd
+		for (long long i = 0; i < m; i++) {
+			const float ur = u[2 * i];
+			const float ui = u[2 * i + 1];
+			w[2 * i] = ar*ur - ai*ui;
+			w[2 * i + 1] = ar*ui + ai*ur;
+		}
+		return;
+	}
+#pragma omp simd
+	for (long long i = 0; i < m; i++) {
+		const float ur = u[2 * i];
+		const float ui = u[2 * i + 1];
+		const float vr = v[2 * i];
+		const float vi = v[2 * i + 1];
+		w[2 * i] = ar*ur - ai*ui + br*vr - bi*vi;
+		w[2 * i + 1] = ar*ui + ai*ur + br*vi + bi*vr;
+	}
+}
+
+static void
+multiply_kernel_(const complex_float_t* x, const complex_float_t* y,
+	complex_float_t* z, size_t n)
+{
+	const float* u = (const float*)x;
+	const float* v = (const float*)y;
+	float* w = (float*)z;
+	const long long m = (long long)n;
+#pragma omp simd
+	for (long long i = 0; i < m; i++) {
+		const float ur = u[2 * i];
+		const float ui = u[2 * i + 1];
+		const float vr = v[2 * i];
+		const float vi = v[2 * i + 1];
+		w[2 * i] = ur*vr - ui*vi;
+		w[2 * i + 1] = ur*vi + ui*vr;
+	}
+}
+
+static void
+divide_kernel_(const complex_float_t* x, const complex_float_t* y,
+	complex_float_t* z, size_t n)
+{
+	const float* u = (const float*)x;
+	const float* v = (const float*)y;
+	float* w = (float*)z;
+	const long long m = (long long)n;
+	// zero denominators give zero rather than NaN or infinity, as there is
+	// no data to divide by (e.g. samples outside the acquired k-space)
+#pragma omp simd
+	for (long long i = 0; i < m; i++) {
+		const float ur = u[2 * i];
+		const float ui = u[2 * i + 1];
+		const float vr = v[2 * i];
+		const float vi = v[2 * i + 1];
+		const float d = vr*vr + vi*vi;
+		const float s = d > 0 ? 1.0f / d : 0.0f;
+		w[2 * i] = (ur*vr + ui*vi) * s;
+		w[2 * i + 1] = (ui*vr - ur*vi) * s;
+	}
+}
+
+// sum of conj(y).*x
+static complex_float_t
+dot_kernel_(const complex_float_t* x, const complex_float_t* y, size_t n)
+{
+	const float* u = (const float*)x;
+	const float* v = (const float*)y;
+	const long long m = (long long)n;
+	float sr = 0;
+	float si = 0;
+#pragma omp simd reduction(+:sr, si)
+	for (long long i = 0; i < m; i++) {
+		const float ur = u[2 * i];
+		const float ui = u[2 * i + 1];
+		const float vr = v[2 * i];
+		const float vi = v[2 * i + 1];
+		sr += vr*ur + vi*ui;
+		si += vr*ui - vi*ur;
+	}
+	return complex_float_t(sr, si);
+}
+
+// sum of |x|^2
+static float
+norm2_kernel_(const complex_float_t* x, size_t n)
+{
+	const float* u = (const float*)x;
+	const long long m = 2 * (long long)n;
+	float s = 0;
+#pragma omp simd reduction(+:s)
+	for (long long i = 0; i < m; i++)
+		s += u[i] * u[i];
+	return s;
+}
+
 void 
 MRAcquisitionData::axpby
 (complex_float_t a, const ISMRMRD::Acquisition& acq_x,
 	complex_float_t b, ISMRMRD::Acquisition& acq_y)
 {
-	complex_float_t* px;
-	complex_float_t* py;
-	for (px = acq_x.data_begin(), py = acq_y.data_begin();
-		px != acq_x.data_end() && py != acq_y.data_end(); px++, py++) {
-		if (b == complex_float_t(0.0))
-			*py = a*complex_float_t(*px);
-		else
-			*py = a*complex_float_t(*px) + b*complex_float_t(*py);
-	}
+	const size_t n = std::min(acq_x.getNumberOfDataElements(),
+		acq_y.getNumberOfDataElements());
+	axpby_kernel_(a, acq_x.getDataPtr(), b, acq_y.getDataPtr(),
+		acq_y.getDataPtr(), n);
 }
 
 void
 MRAcquisitionData::multiply
 (const ISMRMRD::Acquisition& acq_x, ISMRMRD::Acquisition& acq_y)
 {
-	complex_float_t* px;
-	complex_float_t* py;
-	for (px = acq_x.data_begin(), py = acq_y.data_begin();
-		px != acq_x.data_end() && py != acq_y.data_end(); px++, py++) {
-		*py = complex_float_t(*px) * complex_float_t(*py);
-	}
+	const size_t n = std::min(acq_x.getNumberOfDataElements(),
+		acq_y.getNumberOfDataElements());
+	multiply_kernel_(acq_x.getDataPtr(), acq_y.getDataPtr(),
+		acq_y.getDataPtr(), n);
 }
 
 void
 MRAcquisitionData::divide
 (const ISMRMRD::Acquisition& acq_x, ISMRMRD::Acquisition& acq_y)
 {
-	complex_float_t* px;
-	complex_float_t* py;
-	for (px = acq_x.data_begin(), py = acq_y.data_begin();
-		px != acq_x.data_end() && py != acq_y.data_end(); px++, py++) {
-		// TODO: check for zero denominator
-		*py = complex_float_t(*px) / complex_float_t(*py);
-	}
+	const size_t n = std::min(acq_x.getNumberOfDataElements(),
+		acq_y.getNumberOfDataElements());
+	divide_kernel_(acq_x.getDataPtr(), acq_y.getDataPtr(),
+		acq_y.getDataPtr(), n);
 }
 
 complex_float_t
 MRAcquisitionData::dot
 (const ISMRMRD::Acquisition& acq_a, const ISMRMRD::Acquisition& acq_b)
 {
-	complex_float_t* pa;
-	complex_float_t* pb;
-	complex_float_t z = 0;
-	for (pa = acq_a.data_begin(), pb = acq_b.data_begin();
-		pa != acq_a.data_end() && pb != acq_b.data_end(); pa++, pb++) {
-		z += std::conj(*pb) * (*pa);
-	}
-	return z;
+	const size_t n = std::min(acq_a.getNumberOfDataElements(),
+		acq_b.getNumberOfDataElements());
+	return dot_kernel_(acq_a.getDataPtr(), acq_b.getDataPtr(), n);
 }
 
 float 
 MRAcquisitionData::norm(const ISMRMRD::Acquisition& acq_a)
 {
-	complex_float_t* pa;
-	float r = 0;
-	for (pa = acq_a.data_begin(); pa != acq_a.data_end(); pa++) {
-		complex_float_t z = std::conj(*pa) * (*pa);
-		r += z.real();
+	return sqrt(norm2_kernel_(acq_a.getDataPtr(), 
+		acq_a.getNumberOfDataElements()));
+}
+
+void
+MRAcquisitionData::get_regular_acquisitions(std::vector<int>& nums) const
+{
+	nums.clear();
+	int n = number();
+	for (int i = 0; i < n; i++) {
+		AcquisitionsHeaderIndex::Entry acq = header_entry(i);
+		if (!TO_BE_IGNORED(acq))
+			nums.push_back(i);
+	}
+}
+
+// containers not stored in memory are processed in blocks of this many
+// acquisitions: a block is read serially and then processed in parallel
+static const int ALGEBRA_BLOCK_SIZE = 64;
+
+static void
+read_acquisitions_block_(const MRAcquisitionData& ac, const std::vector<int>& nums,
+	size_t first, int nb, std::vector<ISMRMRD::Acquisition>& acqs)
+{
+	for (int k = 0; k < nb; k++)
+		ac.get_acquisition(nums[first + k], acqs[k]);
+}
+
+struct AxpbyOp {
+	AxpbyOp(complex_float_t a, complex_float_t b) : a_(a), b_(b) {}
+	void operator()(const complex_float_t* x, const complex_float_t* y,
+		complex_float_t* z, size_t n) const
+	{
+		axpby_kernel_(a_, x, b_, y, z, n);
+	}
+	complex_float_t a_;
+	complex_float_t b_;
+};
+
+struct MultiplyOp {
+	void operator()(const complex_float_t* x, const complex_float_t* y,
+		complex_float_t* z, size_t n) const
+	{
+		multiply_kernel_(x, y, z, n);
+	}
+};
+
+struct DivideOp {
+	void operator()(const complex_float_t* x, const complex_float_t* y,
+		complex_float_t* z, size_t n) const
+	{
+		divide_kernel_(x, y, z, n);
+	}
+};
+
+// z := op(x, y) for the pairs of regular acquisitions of x and y;
+// the results are given the headers of y's acquisitions (or x's, if z is x)
+template<class Op>
+static void
+binary_op_(MRAcquisitionData& z, const MRAcquisitionData& x,
+	const MRAcquisitionData& y, const Op& op)
+{
+	std::vector<int> ix;
+	std::vector<int> iy;
+	x.get_regular_acquisitions(ix);
+	y.get_regular_acquisitions(iy);
+	const long long n = (long long)std::min(ix.size(), iy.size());
+
+	AcquisitionsArray* pz = dynamic_cast<AcquisitionsArray*>(&z);
+	const AcquisitionsArray* px = dynamic_cast<const AcquisitionsArray*>(&x);
+	const AcquisitionsArray* py = dynamic_cast<const AcquisitionsArray*>(&y);
+	if (pz && px && py && (pz == px || pz == py || pz->number() == 0)) {
+		std::vector<int> iz;
+		if (pz == py)
+			iz = iy;
+		else if (pz == px)
+			iz = ix;
+		else {
+			// allocate the result once, copying headers and trajectories
+			size_t ns = 0;
+			for (long long k = 0; k < n; k++)
+				ns += py->acquisition_view(iy[k]).size();
+			pz->reserve((unsigned int)n, ns);
+			iz.resize(n);
+			for (long long k = 0; k < n; k++) {
+				pz->append_acquisition(py->acquisition_view(iy[k]));
+				iz[k] = (int)k;
+			}
+		}
+#pragma omp parallel for schedule(dynamic, 16)
+		for (long long k = 0; k < n; k++) {
+			const size_t m = std::min(px->acquisition_view(ix[k]).size(),
+				py->acquisition_view(iy[k]).size());
+			op(px->acquisition_data(ix[k]), py->acquisition_data(iy[k]),
+				pz->acquisition_data(iz[k]), m);
+		}
+		return;
+	}
+
+	const bool in_place = (&z == &x || &z == &y);
+	const std::vector<int>& iz = (&z == &x ? ix : iy);
+	// acquisitions cannot be overwritten in a file: z is rewritten into a
+	// new file (the results replacing z's acquisitions), which then takes
+	// the place of z's file
+	AcquisitionsFile* pf = in_place ? dynamic_cast<AcquisitionsFile*>(&z) : 0;
+	shared_ptr<AcquisitionsFile> sptr_out;
+	if (pf)
+		sptr_out.reset
+			(new AcquisitionsFile(AcquisitionsInfo(z.acquisitions_info())));
+	ISMRMRD::Acquisition acq;
+	int next = 0;
+	std::vector<ISMRMRD::Acquisition> ax(ALGEBRA_BLOCK_SIZE);
+	std::vector<ISMRMRD::Acquisition> ay(ALGEBRA_BLOCK_SIZE);
+	std::vector<ISMRMRD::Acquisition>& az = (&z == &x ? ax : ay);
+	for (long long first = 0; first < n; first += ALGEBRA_BLOCK_SIZE) {
+		const int nb = (int)std::min((long long)ALGEBRA_BLOCK_SIZE, n - first);
+		read_acquisitions_block_(x, ix, first, nb, ax);
+		read_acquisitions_block_(y, iy, first, nb, ay);
+#pragma omp parallel for
+		for (int k = 0; k < nb; k++) {
+			const size_t m = std::min(ax[k].getNumberOfDataElements(),
+				ay[k].getNumberOfDataElements());
+			op(ax[k].getDataPtr(), ay[k].getDataPtr(), az[k].getDataPtr(), m);
+		}
+		for (int k = 0; k < nb; k++) {
+			if (pf) {
+				// the acquisitions of z not operated on are kept as they are
+				for (; next < iz[first + k]; next++) {
+					z.get_acquisition(next, acq);
+					sptr_out->append_acquisition(acq);
+				}
+				sptr_out->append_acquisition(az[k]);
+				next++;
+			}
+			else if (in_place)
+				z.set_acquisition(iz[first + k], az[k]);
+			else
+				z.append_acquisition(az[k]);
+		}
+	}
+	if (pf) {
+		for (; next < (int)z.number(); next++) {
+			z.get_acquisition(next, acq);
+			sptr_out->append_acquisition(acq);
+		}
+		sptr_out->flush();
+		// z's acquisitions are now stored in z's order, so z keeps its sort
+		// state without a permutation
+		sptr_out->set_sorted(z.sorted());
+		pf->take_over(*sptr_out);
 	}
-	r = sqrt(r);
-	return r;
 }
 
 void
 MRAcquisitionData::dot(const DataContainer& dc, void* ptr) const
 {
-	//MRAcquisitionData& other = (MRAcquisitionData&)dc;
 	DYNAMIC_CAST(const MRAcquisitionData, other, dc);
-	int n = number();
-	int m = other.number();
-	complex_float_t z = 0;
-	ISMRMRD::Acquisition a;
-	ISMRMRD::Acquisition b;
-	for (int i = 0, j = 0; i < n && j < m;) {
-		get_acquisition(i, a);
-		if (TO_BE_IGNORED(a)) {
-			i++;
-			continue;
+	std::vector<int> ia;
+	std::vector<int> ib;
+	get_regular_acquisitions(ia);
+	other.get_regular_acquisitions(ib);
+	const long long n = (long long)std::min(ia.size(), ib.size());
+	// partial sums are accumulated in double precision
+	double zr = 0;
+	double zi = 0;
+
+	const AcquisitionsArray* pa = dynamic_cast<const AcquisitionsArray*>(this);
+	const AcquisitionsArray* pb = dynamic_cast<const AcquisitionsArray*>(&other);
+	if (pa && pb) {
+#pragma omp parallel for schedule(dynamic, 16) reduction(+:zr, zi)
+		for (long long k = 0; k < n; k++) {
+			const size_t m = std::min(pa->acquisition_view(ia[k]).size(),
+				pb->acquisition_view(ib[k]).size());
+			const complex_float_t z = dot_kernel_
+				(pa->acquisition_data(ia[k]), pb->acquisition_data(ib[k]), m);
+			zr += z.real();
+			zi += z.imag();
 		}
-		other.get_acquisition(j, b);
-		if (TO_BE_IGNORED(b)) {
-			j++;
-			continue;
+	}
+	else {
+		std::vector<ISMRMRD::Acquisition> a(ALGEBRA_BLOCK_SIZE);
+		std::vector<ISMRMRD::Acquisition> b(ALGEBRA_BLOCK_SIZE);
+		for (long long first = 0; first < n; first += ALGEBRA_BLOCK_SIZE) {
+			const int nb = (int)std::min((long long)ALGEBRA_BLOCK_SIZE, n - first);
+			read_acquisitions_block_(*this, ia, first, nb, a);
+			read_acquisitions_block_(other, ib, first, nb, b);
+#pragma omp parallel for reduction(+:zr, zi)
+			for (int k = 0; k < nb; k++) {
+				const complex_float_t z = MRAcquisitionData::dot(a[k], b[k]);
+				zr += z.real();
+				zi += z.imag();
+			}
 		}
-		z += MRAcquisitionData::dot(a, b);
-		i++;
-		j++;
 	}
 	complex_float_t* ptr_z = (complex_float_t*)ptr;
-	*ptr_z = z;
+	*ptr_z = complex_float_t((float)zr, (float)zi);
 }
 
 void
@@ -339,30 +678,7 @@ const void* ptr_b, const DataContainer& a_y)
 	complex_float_t b = *(complex_float_t*)ptr_b;
 	DYNAMIC_CAST(const MRAcquisitionData, x, a_x);
 	DYNAMIC_CAST(const MRAcquisitionData, y, a_y);
-	//MRAcquisitionData& x = (MRAcquisitionData&)a_x;
-	//MRAcquisitionData& y = (MRAcquisitionData&)a_y;
-	int m = x.number();
-	int n = y.number();
-	ISMRMRD::Acquisition ax;
-	ISMRMRD::Acquisition ay;
-	for (int i = 0, j = 0; i < n && j < m;) {
-		y.get_acquisition(i, ay);
-		x.get_acquisition(j, ax);
-		if (TO_BE_IGNORED(ay)) {
-			std::cout << i << " ignored (ay)\n";
-			i++;
-			continue;
-		}
-		if (TO_BE_IGNORED(ax)) {
-			std::cout << j << " ignored (ax)\n";
-			j++;
-			continue;
-		}
-		MRAcquisitionData::axpby(a, ax, b, ay);
-		append_acquisition(ay);
-		i++;
-		j++;
-	}
+	binary_op_(*this, x, y, AxpbyOp(a, b));
 }
 
 void
@@ -370,32 +686,9 @@ MRAcquisitionData::multiply(
 const DataContainer& a_x,
 const DataContainer& a_y)
 {
-	//MRAcquisitionData& x = (MRAcquisitionData&)a_x;
-	//MRAcquisitionData& y = (MRAcquisitionData&)a_y;
 	DYNAMIC_CAST(const MRAcquisitionData, x, a_x);
 	DYNAMIC_CAST(const MRAcquisitionData, y, a_y);
-	int m = x.number();
-	int n = y.number();
-	ISMRMRD::Acquisition ax;
-	ISMRMRD::Acquisition ay;
-	for (int i = 0, j = 0; i < n && j < m;) {
-		y.get_acquisition(i, ay);
-		x.get_acquisition(j, ax);
-		if (TO_BE_IGNORED(ay)) {
-			std::cout << i << " ignored (ay)\n";
-			i++;
-			continue;
-		}
-		if (TO_BE_IGNORED(ax)) {
-			std::cout << j << " ignored (ax)\n";
-			j++;
-			continue;
-		}
-		MRAcquisitionData::multiply(ax, ay);
-		append_acquisition(ay);
-		i++;
-		j++;
-	}
+	binary_op_(*this, x, y, MultiplyOp());
 }
 
 void
@@ -403,49 +696,38 @@ MRAcquisitionData::divide(
 const DataContainer& a_x,
 const DataContainer& a_y)
 {
-	//MRAcquisitionData& x = (MRAcquisitionData&)a_x;
-	//MRAcquisitionData& y = (MRAcquisitionData&)a_y;
 	DYNAMIC_CAST(const MRAcquisitionData, x, a_x);
 	DYNAMIC_CAST(const MRAcquisitionData, y, a_y);
-	int m = x.number();
-	int n = y.number();
-	ISMRMRD::Acquisition ax;
-	ISMRMRD::Acquisition ay;
-	for (int i = 0, j = 0; i < n && j < m;) {
-		y.get_acquisition(i, ay);
-		x.get_acquisition(j, ax);
-		if (TO_BE_IGNORED(ay)) {
-			std::cout << i << " ignored (ay)\n";
-			i++;
-			continue;
-		}
-		if (TO_BE_IGNORED(ax)) {
-			std::cout << j << " ignored (ax)\n";
-			j++;
-			continue;
-		}
-		MRAcquisitionData::divide(ax, ay);
-		append_acquisition(ay);
-		i++;
-		j++;
-	}
+	binary_op_(*this, x, y, DivideOp());
 }
 
 float 
 MRAcquisitionData::norm() const
 {
-	int n = number();
-	float r = 0;
-	ISMRMRD::Acquisition a;
-	for (int i = 0; i < n; i++) {
-		get_acquisition(i, a);
-		if (TO_BE_IGNORED(a)) {
-			continue;
+	std::vector<int> ia;
+	get_regular_acquisitions(ia);
+	const long long n = (long long)ia.size();
+	double r = 0;
+
+	const AcquisitionsArray* pa = dynamic_cast<const AcquisitionsArray*>(this);
+	if (pa) {
+#pragma omp parallel for schedule(dynamic, 16) reduction(+:r)
+		for (long long k = 0; k < n; k++)
+			r += norm2_kernel_(pa->acquisition_data(ia[k]),
+				pa->acquisition_view(ia[k]).size());
+	}
+	else {
+		std::vector<ISMRMRD::Acquisition> a(ALGEBRA_BLOCK_SIZE);
+		for (long long first = 0; first < n; first += ALGEBRA_BLOCK_SIZE) {
+			const int nb = (int)std::min((long long)ALGEBRA_BLOCK_SIZE, n - first);
+			read_acquisitions_block_(*this, ia, first, nb, a);
+#pragma omp parallel for reduction(+:r)
+			for (int k = 0; k < nb; k++)
+				r += norm2_kernel_(a[k].getDataPtr(),
+					a[k].getNumberOfDataElements());
 		}
-		float s = MRAcquisitionData::norm(a);
-		r += s*s;
 	}
-	return sqrt(r);
+	return (float)sqrt(r);
 }
 
 MRAcquisitionData*
@@ -471,14 +753,13 @@ MRAcquisitionData::sort()
 	tuple t;
 	std::vector<tuple> vt;
 	for (int i = 0; i < na; i++) {
-		ISMRMRD::Acquisition acq;
-		get_acquisition(i, acq);
+		AcquisitionsHeaderIndex::Entry acq = stored_header_entry(i);
 		if (acq.isFlagSet(ISMRMRD::ISMRMRD_ACQ_LAST_IN_MEASUREMENT))
 			last = i;
-		t[0] = acq.idx().repetition;
-		t[1] = acq.idx().phase;
-		t[2] = acq.idx().slice;
-		t[3] = acq.idx().kspace_encode_step_1;
+		t[0] = acq.repetition();
+		t[1] = acq.phase();
+		t[2] = acq.slice();
+		t[3] = acq.kspace_encode_step_1();
 		vt.push_back(t);
 		if (t[1] > max_phase)
 			max_phase = t[1];
@@ -506,9 +787,7 @@ MRAcquisitionData::sort_by_time()
 
 	for(size_t i=0; i<num_acquis; i++)
 	{
-		ISMRMRD::Acquisition acq;
-		get_acquisition(i, acq);
-		t[0] = acq.acquisition_time_stamp();
+		t[0] = stored_header_entry(i).acquisition_time_stamp();
 		vt.push_back( t );
 	}
 
@@ -527,18 +806,26 @@ AcquisitionsFile::AcquisitionsFile
 	own_file_ = create_file;
 	filename_ = filename;
 
-	Mutex mtx;
-	mtx.lock();
-	dataset_ = shared_ptr<ISMRMRD::Dataset>
-		(new ISMRMRD::Dataset(filename.c_str(), "/dataset", create_file));
-	if (!create_file) {
-		dataset_->readHeader(acqs_info_);
+	{
+		// a missing file throws: the lock must not outlive this block
+		Mutex mtx;
+		boost::mutex::scoped_lock lock(mtx());
+		dataset_ = shared_ptr<ISMRMRD::Dataset>
+			(new ISMRMRD::Dataset(filename.c_str(), "/dataset", create_file));
+		if (!create_file) {
+			dataset_->readHeader(acqs_info_);
+		}
+		else {
+			acqs_info_ = info;
+			dataset_->writeHeader(acqs_info_);
+		}
 	}
-	else {
-		acqs_info_ = info;
-		dataset_->writeHeader(acqs_info_);
+	// index the acquisitions already in the file, reading headers only
+	if (!create_file) {
+		ISMRMRDAcquisitionsReader reader(filename, "dataset");
+		reader.read_headers(header_index_);
 	}
-	mtx.unlock();
+	cache_.reset(new ISMRMRDAcquisitionsCache(filename_));
 }
 
 AcquisitionsFile::AcquisitionsFile(AcquisitionsInfo info)
@@ -552,10 +839,21 @@ AcquisitionsFile::AcquisitionsFile(AcquisitionsInfo info)
 	acqs_info_ = info;
 	dataset_->writeHeader(acqs_info_);
 	mtx.unlock();
+	cache_.reset(new ISMRMRDAcquisitionsCache(filename_));
 }
 
 AcquisitionsFile::~AcquisitionsFile() 
 {
+	if (!own_file_) {
+		try {
+			flush();
+		}
+		catch (...) {
+			std::cerr << "failed to write acquisitions to " << filename_ << '\n';
+		}
+	}
+	// the cache keeps the file open
+	cache_.reset();
 	dataset_.reset();
 	if (own_file_) {
 		Mutex mtx;
@@ -571,7 +869,12 @@ AcquisitionsFile::take_over(AcquisitionsFile& af)
 	acqs_info_ = af.acquisitions_info();
 	sorted_ = af.sorted();
 	index_ = af.index();
+	header_index_ = af.header_index();
 	dataset_ = af.dataset_;
+	cache_ = af.cache_;
+	// acquisitions appended to af and not yet written are now ours
+	pending_.swap(af.pending_);
+	af.pending_.clear();
 	if (own_file_) {
 		Mutex mtx;
 		mtx.lock();
@@ -586,31 +889,49 @@ AcquisitionsFile::take_over(AcquisitionsFile& af)
 unsigned int 
 AcquisitionsFile::items() const
 {
-	Mutex mtx;
-	mtx.lock();
-	unsigned int na = dataset_->getNumberOfAcquisitions();
-	mtx.unlock();
-	return na;
+	// includes the appended acquisitions not yet written
+	return (unsigned int)header_index_.size();
 }
 
 void 
 AcquisitionsFile::get_acquisition(unsigned int num, ISMRMRD::Acquisition& acq) const
 {
 	int ind = index(num);
-	Mutex mtx;
-	mtx.lock();
-	dataset_->readAcquisition(ind, acq);
-	//dataset_->readAcquisition(index(num), acq); // ??? does not work!
-	mtx.unlock();
+	const int stored = (int)(header_index_.size() - pending_.size());
+	if (ind >= stored)
+		acq = pending_[ind - stored];
+	else
+		cache_->get_acquisition(ind, acq);
 }
 
 void 
 AcquisitionsFile::append_acquisition(ISMRMRD::Acquisition& acq)
 {
-	Mutex mtx;
-	mtx.lock();
-	dataset_->appendAcquisition(acq);
-	mtx.unlock();
+	pending_.push_back(acq);
+	header_index_.append(acq.getHead());
+	if (pending_.size() >= write_batch_size_)
+		flush();
+}
+
+void
+AcquisitionsFile::flush()
+{
+	if (pending_.empty())
+		return;
+	size_t written = 0;
+	try {
+		Mutex mtx;
+		boost::mutex::scoped_lock lock(mtx());
+		for (; written < pending_.size(); written++)
+			dataset_->appendAcquisition(pending_[written]);
+	}
+	catch (...) {
+		pending_.erase(pending_.begin(), pending_.begin() + written);
+		cache_->reset();
+		throw;
+	}
+	pending_.clear();
+	cache_->reset();
 }
 
 void 
@@ -639,11 +960,9 @@ AcquisitionsFile::set_data(const complex_float_t* z, int all)
 	ISMRMRD::Acquisition acq;
 	int na = number();
 	for (int a = 0, i = 0; a < na; a++) {
-		get_acquisition(a, acq);
-		if (!all && TO_BE_IGNORED(acq)) {
-			std::cout << "ignoring acquisition " << a << '\n';
+		if (!all && TO_BE_IGNORED(header_entry(a)))
 			continue;
-		}
+		get_acquisition(a, acq);
 		unsigned int nc = acq.active_channels();
 		unsigned int ns = acq.number_of_samples();
 		for (int c = 0; c < nc; c++)
@@ -651,6 +970,8 @@ AcquisitionsFile::set_data(const complex_float_t* z, int all)
 				acq.data(s, c) = z[i];
 		ac.append_acquisition(acq);
 	}
+	// the acquisitions are rewritten in our order, which needs no index
+	ac.set_sorted(sorted_);
 	take_over(ac);
 }
 
@@ -674,10 +995,8 @@ AcquisitionsVector::set_data(const complex_float_t* z, int all)
 	int na = number();
 	for (int a = 0, i = 0; a < na; a++) {
 		ISMRMRD::Acquisition& acq = *acqs_[a];
-		if (!all && TO_BE_IGNORED(acq)) {
-			std::cout << "ignoring acquisition " << a << '\n';
+		if (!all && TO_BE_IGNORED(acq))
 			continue;
-		}
 		unsigned int nc = acq.active_channels();
 		unsigned int ns = acq.number_of_samples();
 		for (int c = 0; c < nc; c++)
@@ -706,6 +1025,250 @@ AcquisitionsVector::copy_acquisitions_data(const MRAcquisitionData& ac)
 	}
 }
 
+void
+AcquisitionsArray::reserve(unsigned int na, size_t ns)
+{
+	headers_.reserve(na);
+	header_index_.reserve(na);
+	data_offset_.reserve(na + 1);
+	traj_offset_.reserve(na + 1);
+	data_.reserve(ns);
+}
+
+void
+AcquisitionsArray::append_acquisition(ISMRMRD::Acquisition& acq)
+{
+	const size_t nd = acq.getNumberOfDataElements();
+	const size_t nt = acq.getNumberOfTrajElements();
+	headers_.push_back(acq.getHead());
+	header_index_.append(acq.getHead());
+	data_.insert(data_.end(), acq.getDataPtr(), acq.getDataPtr() + nd);
+	if (nt > 0)
+		traj_.insert(traj_.end(), acq.getTrajPtr(), acq.getTrajPtr() + nt);
+	data_offset_.push_back(data_.size());
+	traj_offset_.push_back(traj_.size());
+}
+
+void
+AcquisitionsArray::append_acquisition(const AcquisitionView& acq)
+{
+	const size_t nt = (size_t)acq.number_of_samples()*acq.trajectory_dimensions();
+	headers_.push_back(acq.getHead());
+	header_index_.append(acq.getHead());
+	data_.insert(data_.end(), acq.data_begin(), acq.data_end());
+	if (nt > 0)
+		traj_.insert(traj_.end(), acq.traj_begin(), acq.traj_begin() + nt);
+	data_offset_.push_back(data_.size());
+	traj_offset_.push_back(traj_.size());
+}
+
+void
+AcquisitionsArray::get_acquisition(unsigned int num, ISMRMRD::Acquisition& acq) const
+{
+	const int i = index(num);
+	acq.setHead(headers_[i]);
+	const size_t nd = data_offset_[i + 1] - data_offset_[i];
+	const size_t nt = traj_offset_[i + 1] - traj_offset_[i];
+	if (nd > 0)
+		memcpy(acq.getDataPtr(), data_.data() + data_offset_[i],
+		nd*sizeof(complex_float_t));
+	if (nt > 0)
+		memcpy(acq.getTrajPtr(), traj_.data() + traj_offset_[i],
+		nt*sizeof(float));
+}
+
+void
+AcquisitionsArray::set_acquisition(unsigned int num, ISMRMRD::Acquisition& acq)
+{
+	const int i = index(num);
+	const size_t nd = acq.getNumberOfDataElements();
+	const size_t nt = acq.getNumberOfTrajElements();
+	if (nd != data_offset_[i + 1] - data_offset_[i] ||
+		nt != traj_offset_[i + 1] - traj_offset_[i])
+		throw LocalisedException
+		("AcquisitionsArray::set_acquisition: acquisition size mismatch",
+		__FILE__, __LINE__);
+	headers_[i] = acq.getHead();
+	header_index_.set(i, acq.getHead());
+	if (nd > 0)
+		memcpy(data_.data() + data_offset_[i], acq.getDataPtr(),
+		nd*sizeof(complex_float_t));
+	if (nt > 0)
+		memcpy(traj_.data() + traj_offset_[i], acq.getTrajPtr(),
+		nt*sizeof(float));
+}
+
+void
+AcquisitionsArray::get_data(complex_float_t* z, int all)
+{
+	unsigned int na = number();
+	if (all && index_.empty()) {
+		memcpy(z, data_.data(), data_.size()*sizeof(complex_float_t));
+		return;
+	}
+	for (unsigned int a = 0; a < na; a++) {
+		AcquisitionView acq = acquisition_view(a);
+		if (!all && TO_BE_IGNORED(acq))
+			continue;
+		memcpy(z, acq.data_begin(), acq.size()*sizeof(complex_float_t));
+		z += acq.size();
+	}
+}
+
+void
+AcquisitionsArray::set_data(const complex_float_t* z, int all)
+{
+	unsigned int na = number();
+	if (all && index_.empty()) {
+		memcpy(data_.data(), z, data_.size()*sizeof(complex_float_t));
+		return;
+	}
+	for (unsigned int a = 0; a < na; a++) {
+		if (!all && TO_BE_IGNORED(acquisition_view(a)))
+			continue;
+		const int i = index(a);
+		const size_t n = data_offset_[i + 1] - data_offset_[i];
+		memcpy(data_.data() + data_offset_[i], z, n*sizeof(complex_float_t));
+		z += n;
+	}
+}
+
+void
+AcquisitionsArray::copy_acquisitions_data(const MRAcquisitionData& ac)
+{
+	unsigned int na = number();
+	if (na != ac.number())
+		throw LocalisedException
+		("AcquisitionsArray::copy_acquisitions_data: numbers of acquisitions differ",
+		__FILE__, __LINE__);
+	const AcquisitionsArray* ptr_aa = dynamic_cast<const AcquisitionsArray*>(&ac);
+	ISMRMRD::Acquisition acq;
+	for (unsigned int a = 0; a < na; a++) {
+		const int i = index(a);
+		const size_t n = data_offset_[i + 1] - data_offset_[i];
+		const complex_float_t* src;
+		if (ptr_aa)
+			src = ptr_aa->acquisition_data(a);
+		else {
+			ac.get_acquisition(a, acq);
+			src = acq.getDataPtr();
+		}
+		memcpy(data_.data() + data_offset_[i], src, n*sizeof(complex_float_t));
+	}
+}
+
+AcquisitionsView::AcquisitionsView
+(gadgetron::shared_ptr<MRAcquisitionData> sptr_parent, const std::vector<int>& nums)
+{
+	const AcquisitionsView* ptr_view =
+		dynamic_cast<const AcquisitionsView*>(sptr_parent.get());
+	unsigned int np = sptr_parent->number();
+	nums_.reserve(nums.size());
+	for (size_t k = 0; k < nums.size(); k++) {
+		int num = nums[k];
+		if (num < 0 || num >= (int)np)
+			throw LocalisedException
+			("AcquisitionsView: acquisition number out of range",
+			__FILE__, __LINE__);
+		if (ptr_view)
+			num = ptr_view->nums_[ptr_view->index(num)];
+		nums_.push_back(num);
+	}
+	sptr_parent_ = ptr_view ? ptr_view->sptr_parent_ : sptr_parent;
+	acqs_info_ = sptr_parent_->acquisitions_info();
+}
+
+int
+AcquisitionsView::field_value
+(const AcquisitionsHeaderIndex::Entry& head, const std::string& field)
+{
+	if (boost::iequals(field, "kspace_encode_step_1"))
+		return head.kspace_encode_step_1();
+	if (boost::iequals(field, "kspace_encode_step_2"))
+		return head.kspace_encode_step_2();
+	if (boost::iequals(field, "average"))
+		return head.average();
+	if (boost::iequals(field, "slice"))
+		return head.slice();
+	if (boost::iequals(field, "contrast"))
+		return head.contrast();
+	if (boost::iequals(field, "phase"))
+		return head.phase();
+	if (boost::iequals(field, "repetition"))
+		return head.repetition();
+	if (boost::iequals(field, "set"))
+		return head.set();
+	if (boost::iequals(field, "segment"))
+		return head.segment();
+	throw LocalisedException
+		(("unknown acquisition header field " + field).c_str(),
+		__FILE__, __LINE__);
+}
+
+gadgetron::shared_ptr<AcquisitionsView>
+AcquisitionsView::select
+(gadgetron::shared_ptr<MRAcquisitionData> sptr_parent,
+const std::string& field, int first, int last)
+{
+	std::vector<int> nums;
+	unsigned int na = sptr_parent->number();
+	for (unsigned int a = 0; a < na; a++) {
+		int value = field_value(sptr_parent->header_entry(a), field);
+		if (value >= first && value <= last)
+			nums.push_back(a);
+	}
+	gadgetron::shared_ptr<AcquisitionsView>
+		sptr_view(new AcquisitionsView(sptr_parent, nums));
+	// the selection keeps the order of the parent's acquisitions
+	sptr_view->set_sorted(sptr_parent->sorted());
+	return sptr_view;
+}
+
+void
+AcquisitionsView::set_acquisition(unsigned int num, ISMRMRD::Acquisition& acq)
+{
+	sptr_parent_->set_acquisition(nums_[index(num)], acq);
+}
+
+void
+AcquisitionsView::set_data(const complex_float_t* z, int all)
+{
+	ISMRMRD::Acquisition acq;
+	unsigned int na = number();
+	for (unsigned int a = 0; a < na; a++) {
+		get_acquisition(a, acq);
+		if (!all && TO_BE_IGNORED(acq))
+			continue;
+		size_t n = acq.getNumberOfDataElements();
+		memcpy(acq.getDataPtr(), z, n*sizeof(complex_float_t));
+		z += n;
+		set_acquisition(a, acq);
+	}
+}
+
+void
+AcquisitionsView::copy_acquisitions_data(const MRAcquisitionData& ac)
+{
+	unsigned int na = number();
+	if (na != ac.number())
+		throw LocalisedException
+		("AcquisitionsView::copy_acquisitions_data: numbers of acquisitions differ",
+		__FILE__, __LINE__);
+	ISMRMRD::Acquisition acq;
+	ISMRMRD::Acquisition acq_src;
+	for (unsigned int a = 0; a < na; a++) {
+		get_acquisition(a, acq);
+		ac.get_acquisition(a, acq_src);
+		if (acq.getNumberOfDataElements() != acq_src.getNumberOfDataElements())
+			throw LocalisedException
+			("AcquisitionsView::copy_acquisitions_data: acquisition size mismatch",
+			__FILE__, __LINE__);
+		memcpy(acq.getDataPtr(), acq_src.getDataPtr(),
+			acq.getNumberOfDataElements()*sizeof(complex_float_t));
+		set_acquisition(a, acq);
+	}
+}
+
 void
 GadgetronImageData::dot(const DataContainer& dc, void* ptr) const
 {
@@ -1267,12 +1830,12 @@ CoilImagesContainer::compute(MRAcquisitionData& ac)
 	ISMRMRD::Acquisition acq;
 	par = ac.acquisitions_info();
 	ISMRMRD::deserialize(par.c_str(), header);
-	//ac.get_acquisition(0, acq);
-	for (unsigned int i = 0; i < ac.number(); i++) {
-		ac.get_acquisition(i, acq);
-		if (acq.isFlagSet(ISMRMRD::ISMRMRD_ACQ_FIRST_IN_SLICE))
+	unsigned int first = 0;
+	for (; first + 1 < ac.number(); first++) {
+		if (ac.header_entry(first).isFlagSet(ISMRMRD::ISMRMRD_ACQ_FIRST_IN_SLICE))
 			break;
 	}
+	AcquisitionsHeaderIndex::Entry head = ac.header_entry(first);
 	encoding_ = header.encoding[0];
 
 	ISMRMRD::Encoding e = header.encoding[0];
@@ -1283,8 +1846,8 @@ CoilImagesContainer::compute(MRAcquisitionData& ac)
 	//unsigned int nz = e.reconSpace.matrixSize.z;
 	unsigned int ny = e.encodedSpace.matrixSize.y;
 	unsigned int nz = e.encodedSpace.matrixSize.z;
-	unsigned int nc = acq.active_channels();
-	unsigned int readout = acq.number_of_samples();
+	unsigned int nc = head.active_channels();
+	unsigned int readout = head.number_of_samples();
 	//std::cout << readout << '\n';
 	//std::cout << nx << ' ' << ny << ' ' << nz << ' ' << nc << '\n';
 
@@ -1305,19 +1868,21 @@ CoilImagesContainer::compute(MRAcquisitionData& ac)
 
 		int y = 0;
 		for (;;) {
-			ac.get_acquisition(na + y, acq);
-			if (acq.isFlagSet(ISMRMRD::ISMRMRD_ACQ_FIRST_IN_SLICE))
+			if (ac.header_entry(na + y).isFlagSet
+				(ISMRMRD::ISMRMRD_ACQ_FIRST_IN_SLICE))
 				break;
 			y++;
 		}
 		for (;;) {
-			ac.get_acquisition(na + y, acq);
-			int yy = acq.idx().kspace_encode_step_1;
-			int zz = acq.idx().kspace_encode_step_2;
+			// the data are only read for the acquisitions used
+			AcquisitionsHeaderIndex::Entry h = ac.header_entry(na + y);
+			int yy = h.kspace_encode_step_1();
+			int zz = h.kspace_encode_step_2();
 			//if (!e.parallelImaging.is_present() ||
 			if (!parallel ||
-				acq.isFlagSet(ISMRMRD::ISMRMRD_ACQ_IS_PARALLEL_CALIBRATION) ||
-				acq.isFlagSet(ISMRMRD::ISMRMRD_ACQ_IS_PARALLEL_CALIBRATION_AND_IMAGING)) {
+				h.isFlagSet(ISMRMRD::ISMRMRD_ACQ_IS_PARALLEL_CALIBRATION) ||
+				h.isFlagSet(ISMRMRD::ISMRMRD_ACQ_IS_PARALLEL_CALIBRATION_AND_IMAGING)) {
+				ac.get_acquisition(na + y, acq);
 				for (unsigned int c = 0; c < nc; c++) {
 					for (unsigned int s = 0; s < readout; s++) {
 						ci(s, yy, zz, c) = acq.data(s, c);
@@ -1325,7 +1890,7 @@ CoilImagesContainer::compute(MRAcquisitionData& ac)
 				}
 			}
 			y++;
-			if (acq.isFlagSet(ISMRMRD::ISMRMRD_ACQ_LAST_IN_SLICE))
+			if (h.isFlagSet(ISMRMRD::ISMRMRD_ACQ_LAST_IN_SLICE))
 				break;
 		}
 		na += y;
@@ -32,9 +32,16 @@ IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR
 IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 */
 
+#include <algorithm>
+#include <array>
 #include <complex>
+#include <cstdlib>
 #include <iostream>
+#include <map>
 #include <mutex>
+#include <string>
+
+#include <boost/algorithm/string.hpp>
 
 #include <ismrmrd/ismrmrd.h>
 #include <ismrmrd/dataset.h>
@@ -42,13 +49,14 @@ IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 #include <ismrmrd/xml.h>
 
 #include <fftw3.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 #include "sirf/Gadgetron/ismrmrd_fftw.h"
 
 typedef complex_float_t ComplexType;
 
-#define USE_OMP
-
 namespace ISMRMRD {
 
 	fftwf_plan fftw_plan_dft_3d_(int n0, int n1, int n2, ComplexType* in, ComplexType * out, int sign, unsigned int flags) {
@@ -63,6 +71,163 @@ namespace ISMRMRD {
 		fftwf_destroy_plan(p);
 	}
 
+	/*
+	Cache of FFTW 3D plans, one per array shape, direction, in-place or not,
+	alignment and number of threads, so that repeated transforms of arrays
+	of the same shape pay the planning costs once. Plans are created on
+	scratch arrays (planning with FFTW_MEASURE or FFTW_PATIENT overwrites
+	the arrays) and executed on the actual ones by fftwf_execute_dft.
+
+	The number of threads is omp_get_max_threads() (1 without OpenMP),
+	capped by set_fft_threads(); the same number is used for OpenMP
+	threads transforming one volume each and for FFTW threads transforming
+	one volume (the latter only if built with FFTW threads, plans being
+	made for 1 thread otherwise).
+
+	Environment variables read on first use:
+	SIRF_FFTW_PLANNER: estimate (default), measure or patient;
+	SIRF_FFTW_WISDOM: file the FFTW wisdom is imported from and (after
+	measuring new plans) exported to.
+	*/
+	class FFTWPlans {
+	public:
+		static FFTWPlans& instance()
+		{
+			static FFTWPlans plans;
+			return plans;
+		}
+		~FFTWPlans()
+		{
+			std::lock_guard<std::mutex> guard(mutex_);
+			for (PlanMap::iterator i = plans_.begin(); i != plans_.end(); ++i)
+				fftwf_destroy_plan(i->second);
+		}
+
+		fftwf_plan plan(int n0, int n1, int n2, int sign, bool in_place,
+			bool aligned, int threads)
+		{
+			std::lock_guard<std::mutex> guard(mutex_);
+			const Key key = { { n0, n1, n2, sign, (int)in_place, (int)aligned,
+				threads, (int)flags_ } };
+			PlanMap::iterator i = plans_.find(key);
+			if (i != plans_.end())
+				return i->second;
+
+			const size_t n = (size_t)n0*n1*n2;
+			ComplexType* in = (ComplexType*)fftwf_malloc(sizeof(ComplexType)*n);
+			ComplexType* out = in_place ? in :
+				(ComplexType*)fftwf_malloc(sizeof(ComplexType)*n);
+			if (!in || !out) {
+				fftwf_free(in);
+				throw std::runtime_error("FFTWPlans: cannot allocate scratch arrays");
+			}
+			unsigned int flags = flags_;
+			if (!aligned)
+				flags |= FFTW_UNALIGNED;
+#ifdef SIRF_FFTW_THREADS
+			fftwf_plan_with_nthreads(threads);
+#endif
+			fftwf_plan p = fftw_plan_dft_3d_(n0, n1, n2, in, out, sign, flags);
+			if (!in_place)
+				fftwf_free(out);
+			fftwf_free(in);
+			if (!p)
+				throw std::runtime_error("FFTWPlans: cannot create FFTW plan");
+			plans_[key] = p;
+			if (flags_ != FFTW_ESTIMATE && !wisdom_.empty())
+				fftwf_export_wisdom_to_filename(wisdom_.c_str());
+			return p;
+		}
+
+		void set_planner(const std::string& planner)
+		{
+			std::lock_guard<std::mutex> guard(mutex_);
+			flags_ = planner_flags_(planner);
+		}
+		int max_threads() const
+		{
+			int n = 1;
+#ifdef _OPENMP
+			n = std::max(1, omp_get_max_threads());
+#endif
+			if (thread_limit_ > 0)
+				n = std::min(n, thread_limit_);
+			return n;
+		}
+		void set_max_threads(int n)
+		{
+			thread_limit_ = n > 0 ? n : 1;
+		}
+		bool import_wisdom(const std::string& filename)
+		{
+			std::lock_guard<std::mutex> guard(mutex_);
+			return fftwf_import_wisdom_from_filename(filename.c_str()) != 0;
+		}
+		bool export_wisdom(const std::string& filename)
+		{
+			std::lock_guard<std::mutex> guard(mutex_);
+			return fftwf_export_wisdom_to_filename(filename.c_str()) != 0;
+		}
+
+	private:
+		typedef std::array<int, 8> Key;
+		typedef std::map<Key, fftwf_plan> PlanMap;
+
+		// FFTW planner is not thread-safe: all planner calls are made
+		// with mutex_ locked
+		std::mutex mutex_;
+		PlanMap plans_;
+		unsigned int flags_;
+		// set by set_fft_threads(), 0 if not set
+		int thread_limit_;
+		std::string wisdom_;
+
+		FFTWPlans() : flags_(FFTW_ESTIMATE), thread_limit_(0)
+		{
+#ifdef SIRF_FFTW_THREADS
+			fftwf_init_threads();
+#endif
+			const char* planner = std::getenv("SIRF_FFTW_PLANNER");
+			if (planner)
+				flags_ = planner_flags_(planner);
+			const char* wisdom = std::getenv("SIRF_FFTW_WISDOM");
+			if (wisdom) {
+				wisdom_ = wisdom;
+				fftwf_import_wisdom_from_filename(wisdom);
+			}
+		}
+		static unsigned int planner_flags_(const std::string& planner)
+		{
+			if (boost::iequals(planner, "estimate"))
+				return FFTW_ESTIMATE;
+			if (boost::iequals(planner, "measure"))
+				return FFTW_MEASURE;
+			if (boost::iequals(planner, "patient"))
+				return FFTW_PATIENT;
+			throw std::runtime_error("unknown FFTW planner " + planner);
+		}
+	};
+
+	void set_fft_planner(const std::string& planner)
+	{
+		FFTWPlans::instance().set_planner(planner);
+	}
+
+	void set_fft_threads(int n)
+	{
+		FFTWPlans::instance().set_max_threads(n);
+	}
+
+	bool import_fft_wisdom(const std::string& filename)
+	{
+		return FFTWPlans::instance().import_wisdom(filename);
+	}
+
+	bool export_fft_wisdom(const std::string& filename)
+	{
+		return FFTWPlans::instance().export_wisdom(filename);
+	}
+
 	void fftshiftPivot3D(ComplexType* a, size_t x, size_t y, size_t z, size_t n, size_t pivotx, size_t pivoty, size_t pivotz)
 	{
 
@@ -131,6 +296,8 @@ namespace ISMRMRD {
 				memcpy(a + tt*x*y*z, tmp, sizeof(ComplexType)*x*y*z);
 				//memcpy(a + tt*x*y*z, aTmp.begin(), sizeof(ComplexType)*x*y*z);
 			}
+
+			fftwf_free(tmp);
 		}
 	}
 
@@ -179,22 +346,56 @@ namespace ISMRMRD {
 		return ifftshift3D(a.begin(), dims[0], dims[1], dims[2], n);
 	}
 
+	// volumes are transformed one per OpenMP thread if there are at least
+	// as many as threads
 	inline int get_num_threads_fft3(size_t n0, size_t n1, size_t n2, size_t num)
 	{
-		int num_of_max_threads_;
-#ifdef USE_OMP
-		num_of_max_threads_ = 8; //omp_get_num_procs();
-#else
-		num_of_max_threads_ = 1;
-#endif // USE_OMP
-		if (num_of_max_threads_ == 1)
-			return 1;
-
-		if (num >= num_of_max_threads_) {
-			return num_of_max_threads_;
+		const int max_threads = FFTWPlans::instance().max_threads();
+		if (max_threads > 1 && num >= (size_t)max_threads)
+			return max_threads;
+		return 1;
+	}
+
+	// volumes smaller than this are transformed by one thread each
+#define FFTW_THREADS_MIN_SIZE 32768
+
+	// transforms num volumes of n0*n1*n2 elements in (in place if out == in)
+	// with a cached plan, either one volume per OpenMP thread or, for fewer
+	// volumes than threads, each volume with FFTW threads
+	static void fft3_(ComplexType* in, ComplexType* out,
+		int n0, int n1, int n2, int num, bool forward)
+	{
+		FFTWPlans& plans = FFTWPlans::instance();
+		const size_t size = (size_t)n0*n1*n2;
+		const int num_thr = get_num_threads_fft3(n0, n1, n2, num);
+		// plans for FFTW threads exist only if built with them
+		int fftw_threads = 1;
+#ifdef SIRF_FFTW_THREADS
+		if (num_thr == 1 && size >= FFTW_THREADS_MIN_SIZE)
+			fftw_threads = plans.max_threads();
+#endif
+		// the plan must be made for arrays aligned like the ones it is
+		// executed on: all volumes are if the first one is and the volume
+		// size keeps the alignment
+		const bool in_place = (in == out);
+		bool aligned = fftwf_alignment_of((float*)in) == 0 &&
+			fftwf_alignment_of((float*)out) == 0 &&
+			(num == 1 || fftwf_alignment_of((float*)(in + size)) == 0);
+		fftwf_plan p = plans.plan(n0, n1, n2,
+			forward ? FFTW_FORWARD : FFTW_BACKWARD, in_place, aligned,
+			fftw_threads);
+
+		long long n;
+#pragma omp parallel for private(n) shared(num, p, in, out) if (num_thr > 1) num_threads(num_thr)
+		for (n = 0; n < num; n++)
+		{
+			fftw_execute_dft_(p, in + n*size, out + n*size);
 		}
 
-		return 1;
+		const float fftRatio = float(1.0 / std::sqrt(float(size)));
+		const long long length = (long long)(size*num);
+		for (long long i = 0; i < length; i++)
+			out[i] *= fftRatio;
 	}
 
 	void fft3(NDArray< ComplexType >& a, NDArray< ComplexType >& r, bool forward)
@@ -205,50 +406,20 @@ namespace ISMRMRD {
 		int n2 = (int)dims[0];
 		int n1 = (int)dims[1];
 		int n0 = (int)dims[2];
-
-		float fftRatio = float(1.0 / std::sqrt(float(n0*n1*n2)));
-
 		int num = (int)(a.getNumberOfElements() / (n0*n1*n2));
-		int num_thr = get_num_threads_fft3(n0, n1, n2, num);
-
-		long long n;
-
-		std::mutex mutex_;
-		fftwf_plan p;
-		//typename fftw_types<T>::plan * p;
-
-		{
-			std::lock_guard<std::mutex> guard(mutex_);
-			p = fftw_plan_dft_3d_(n0, n1, n2,
-				a.getDataPtr(),
-				r.getDataPtr(),
-				forward ? FFTW_FORWARD : FFTW_BACKWARD, FFTW_ESTIMATE);
-
-		}
-
-#pragma omp parallel for private(n) shared(num, p, a, n0, n1, n2, r) if (num_thr > 1) num_threads(num_thr)
-		for (n = 0; n < num; n++)
-		{
-			fftw_execute_dft_(p, a.begin() + n*n0*n1*n2,
-				r.begin() + n*n0*n1*n2);
-		}
-
-		{
-			std::lock_guard<std::mutex> guard(mutex_);
-			fftw_destroy_plan_(p);
-		}
-
-		for (size_t n = 0; n < a.getNumberOfElements(); n++) {
-			r.getDataPtr()[n] *= fftRatio;
-		}
-		//	r *= fftRatio;
 
+		fft3_(a.getDataPtr(), r.getDataPtr(), n0, n1, n2, num, forward);
 	}
 
 	void fft3(NDArray< ComplexType >& a, bool forward)
 	{
-		NDArray< ComplexType > res(a);
-		fft3(res, a, forward);
+		const size_t* dims = a.getDims();
+		int n2 = (int)dims[0];
+		int n1 = (int)dims[1];
+		int n0 = (int)dims[2];
+		int num = (int)(a.getNumberOfElements() / (n0*n1*n2));
+
+		fft3_(a.getDataPtr(), a.getDataPtr(), n0, n1, n2, num, forward);
 	}
 
 	inline void fft3(NDArray< ComplexType >& a)
@@ -313,12 +313,15 @@ MRAcquisitionModel::fwd_(ISMRMRD::Image<T>* ptr_img, CoilData& csm,
 	ISMRMRD::deserialize(par.c_str(), header);
 	ISMRMRD::Encoding e = header.encoding[0];
 	ISMRMRD::Acquisition acq; // (acq_);
-	//sptr_acqs_->get_acquisition(0, acq);
-	for (unsigned int i = 0; i < sptr_acqs_->number(); i++) {
-		sptr_acqs_->get_acquisition(i, acq);
-		if (acq.isFlagSet(ISMRMRD::ISMRMRD_ACQ_FIRST_IN_SLICE))
+	// dimensions are taken from the first acquisition in a slice,
+	// found in the header index without reading acquisition data
+	unsigned int first = 0;
+	for (; first + 1 < sptr_acqs_->number(); first++) {
+		if (sptr_acqs_->header_entry(first).isFlagSet
+			(ISMRMRD::ISMRMRD_ACQ_FIRST_IN_SLICE))
 			break;
 	}
+	AcquisitionsHeaderIndex::Entry head = sptr_acqs_->header_entry(first);
 
 	//int readout = e.encodedSpace.matrixSize.x;
 	unsigned int nx = e.reconSpace.matrixSize.x;
@@ -326,8 +329,8 @@ MRAcquisitionModel::fwd_(ISMRMRD::Image<T>* ptr_img, CoilData& csm,
 	//unsigned int nz = e.reconSpace.matrixSize.z;
 	unsigned int ny = e.encodedSpace.matrixSize.y;
 	unsigned int nz = e.encodedSpace.matrixSize.z;
-	unsigned int nc = acq.active_channels();
-	unsigned int readout = acq.number_of_samples();
+	unsigned int nc = head.active_channels();
+	unsigned int readout = head.number_of_samples();
 
 	std::vector<size_t> dims;
 	dims.push_back(readout);
@@ -351,14 +354,12 @@ MRAcquisitionModel::fwd_(ISMRMRD::Image<T>* ptr_img, CoilData& csm,
 		}
 	}
 
-	memset((void*)acq.getDataPtr(), 0, acq.getDataSize());
-
 	fft3c(ci);
 
 	int y = 0;
 	for (;;){
-		sptr_acqs_->get_acquisition(off + y, acq);
-		if (acq.isFlagSet(ISMRMRD::ISMRMRD_ACQ_FIRST_IN_SLICE))
+		if (sptr_acqs_->header_entry(off + y).isFlagSet
+			(ISMRMRD::ISMRMRD_ACQ_FIRST_IN_SLICE))
 			break;
 		y++;
 	}
@@ -380,6 +381,23 @@ MRAcquisitionModel::fwd_(ISMRMRD::Image<T>* ptr_img, CoilData& csm,
 
 }
 
+// copies the samples of an acquisition (or acquisition view) to k-space,
+// returns true if the acquisition is the last in its slice
+template<class A>
+static bool
+to_kspace_(A& acq, ISMRMRD::NDArray<complex_float_t>& ci,
+	unsigned int nc, unsigned int readout)
+{
+	int yy = acq.idx().kspace_encode_step_1;
+	int zz = acq.idx().kspace_encode_step_2;
+	for (unsigned int c = 0; c < nc; c++) {
+		for (unsigned int s = 0; s < readout; s++) {
+			ci(s, yy, zz, c) = acq.data(s, c);
+		}
+	}
+	return acq.isFlagSet(ISMRMRD::ISMRMRD_ACQ_LAST_IN_SLICE);
+}
+
 template< typename T>
 void 
 MRAcquisitionModel::bwd_(ISMRMRD::Image<T>* ptr_im, CoilData& csm,
@@ -393,20 +411,20 @@ MRAcquisitionModel::bwd_(ISMRMRD::Image<T>* ptr_im, CoilData& csm,
 	ISMRMRD::deserialize(par.c_str(), header);
 	ISMRMRD::Encoding e = header.encoding[0];
 	ISMRMRD::Acquisition acq;
-	//sptr_acqs_->get_acquisition(0, acq);
-	for (unsigned int i = 0; i < ac.number(); i++) {
-		ac.get_acquisition(i, acq);
-		if (acq.isFlagSet(ISMRMRD::ISMRMRD_ACQ_FIRST_IN_SLICE))
+	unsigned int first = 0;
+	for (; first + 1 < ac.number(); first++) {
+		if (ac.header_entry(first).isFlagSet(ISMRMRD::ISMRMRD_ACQ_FIRST_IN_SLICE))
 			break;
 	}
+	AcquisitionsHeaderIndex::Entry head = ac.header_entry(first);
 
 	unsigned int nx = e.reconSpace.matrixSize.x;
 	//unsigned int ny = e.reconSpace.matrixSize.y;
 	//unsigned int nz = e.reconSpace.matrixSize.z;
 	unsigned int ny = e.encodedSpace.matrixSize.y;
 	unsigned int nz = e.encodedSpace.matrixSize.z;
-	unsigned int nc = acq.active_channels();
-	unsigned int readout = acq.number_of_samples();
+	unsigned int nc = head.active_channels();
+	unsigned int readout = head.number_of_samples();
 
 	std::vector<size_t> dims;
 	dims.push_back(readout);
@@ -416,24 +434,26 @@ MRAcquisitionModel::bwd_(ISMRMRD::Image<T>* ptr_im, CoilData& csm,
 
 	ISMRMRD::NDArray<complex_float_t> ci(dims);
 	memset(ci.getDataPtr(), 0, ci.getDataSize());
+	// acquisitions stored in arrays are read in place
+	const AcquisitionsArray* ptr_aa = dynamic_cast<const AcquisitionsArray*>(&ac);
 	int y = 0;
 	for (;;){
-		ac.get_acquisition(off + y, acq);
-		if (acq.isFlagSet(ISMRMRD::ISMRMRD_ACQ_FIRST_IN_SLICE))
+		if (ac.header_entry(off + y).isFlagSet(ISMRMRD::ISMRMRD_ACQ_FIRST_IN_SLICE))
 			break;
 		y++;
 	}
 	for (;;) {
-		ac.get_acquisition(off + y, acq);
-		int yy = acq.idx().kspace_encode_step_1;
-		int zz = acq.idx().kspace_encode_step_2;
-		for (unsigned int c = 0; c < nc; c++) {
-			for (unsigned int s = 0; s < readout; s++) {
-				ci(s, yy, zz, c) = acq.data(s, c);
-			}
+		bool last;
+		if (ptr_aa) {
+			AcquisitionView view = ptr_aa->acquisition_view(off + y);
+			last = to_kspace_(view, ci, nc, readout);
+		}
+		else {
+			ac.get_acquisition(off + y, acq);
+			last = to_kspace_(acq, ci, nc, readout);
 		}
 		y++;
-		if (acq.isFlagSet(ISMRMRD::ISMRMRD_ACQ_LAST_IN_SLICE))
+		if (last)
 			break;
 	}
 	off += y;
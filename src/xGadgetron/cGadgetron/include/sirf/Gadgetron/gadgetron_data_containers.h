@@ -46,6 +46,7 @@ limitations under the License.
 #include "sirf/Gadgetron/ismrmrd_fftw.h"
 #include "sirf/Gadgetron/cgadgetron_shared_ptr.h"
 #include "sirf/Gadgetron/gadgetron_image_wrap.h"
+#include "sirf/Gadgetron/xgadgetron_utilities.h"
 #include "sirf/iUtilities/LocalisedException.h"
 
 //#define DYNAMIC_CAST(T, X, Y) T& X = (T&)Y
@@ -89,6 +90,91 @@ namespace sirf {
 		std::string data_;
 	};
 
+	/*!
+	\ingroup Gadgetron Data Containers
+	\brief Columnar index of acquisition header fields.
+
+	Keeps the header fields used for sorting, selecting and scanning
+	acquisitions (flags, encoding counters, time stamp, numbers of samples
+	and channels) in one array per field, one entry per acquisition in
+	storage order, so that these operations need not read acquisition data.
+	*/
+	class AcquisitionsHeaderIndex {
+	public:
+		/*!
+		\brief Header fields of one acquisition.
+
+		Provides the part of ISMRMRD::Acquisition interface used by
+		TO_BE_IGNORED and the acquisition scans.
+		*/
+		class Entry {
+		public:
+			Entry(const AcquisitionsHeaderIndex& index, size_t i) :
+				index_(index), i_(i)
+			{}
+			uint64_t flags() const { return index_.flags_[i_]; }
+			bool isFlagSet(const uint64_t val) const
+			{
+				const uint64_t bitmask = 1;
+				return (flags() & (bitmask << (val - 1))) > 0;
+			}
+			uint16_t kspace_encode_step_1() const
+			{
+				return index_.kspace_encode_step_1_[i_];
+			}
+			uint16_t kspace_encode_step_2() const
+			{
+				return index_.kspace_encode_step_2_[i_];
+			}
+			uint16_t average() const { return index_.average_[i_]; }
+			uint16_t slice() const { return index_.slice_[i_]; }
+			uint16_t contrast() const { return index_.contrast_[i_]; }
+			uint16_t phase() const { return index_.phase_[i_]; }
+			uint16_t repetition() const { return index_.repetition_[i_]; }
+			uint16_t set() const { return index_.set_[i_]; }
+			uint16_t segment() const { return index_.segment_[i_]; }
+			uint32_t acquisition_time_stamp() const
+			{
+				return index_.acquisition_time_stamp_[i_];
+			}
+			uint16_t number_of_samples() const
+			{
+				return index_.number_of_samples_[i_];
+			}
+			uint16_t active_channels() const
+			{
+				return index_.active_channels_[i_];
+			}
+		private:
+			const AcquisitionsHeaderIndex& index_;
+			size_t i_;
+		};
+
+		size_t size() const { return flags_.size(); }
+		Entry entry(size_t i) const { return Entry(*this, i); }
+
+		void clear();
+		void reserve(size_t n);
+		void append(const ISMRMRD::AcquisitionHeader& head);
+		void append(const Entry& entry);
+		void set(size_t i, const ISMRMRD::AcquisitionHeader& head);
+
+	private:
+		std::vector<uint64_t> flags_;
+		std::vector<uint16_t> kspace_encode_step_1_;
+		std::vector<uint16_t> kspace_encode_step_2_;
+		std::vector<uint16_t> average_;
+		std::vector<uint16_t> slice_;
+		std::vector<uint16_t> contrast_;
+		std::vector<uint16_t> phase_;
+		std::vector<uint16_t> repetition_;
+		std::vector<uint16_t> set_;
+		std::vector<uint16_t> segment_;
+		std::vector<uint32_t> acquisition_time_stamp_;
+		std::vector<uint16_t> number_of_samples_;
+		std::vector<uint16_t> active_channels_;
+	};
+
 	/*!
 	\ingroup Gadgetron Data Containers
 	\brief Abstract MR acquisition data container class.
@@ -148,7 +234,13 @@ namespace sirf {
 		virtual void set_data(const complex_float_t* z, int all = 1) = 0;
 		virtual void get_data(complex_float_t* z, int all = 1);
 
-		// acquisition data algebra
+		// numbers of the acquisitions that are not TO_BE_IGNORED, i.e.
+		// the ones taking part in the acquisition data algebra
+		virtual void get_regular_acquisitions(std::vector<int>& nums) const;
+
+		// acquisition data algebra: the result of axpby, multiply and divide
+		// overwrites x or y if this container is one of them and is an
+		// AcquisitionsArray, and is appended to this container otherwise
 		virtual void dot(const DataContainer& dc, void* ptr) const;
 		virtual void axpby(
 			const void* ptr_a, const DataContainer& a_x,
@@ -192,6 +284,19 @@ namespace sirf {
 				return i;
 		}
 
+		// header fields of the acquisitions in storage order, maintained
+		// by append_acquisition() and set_acquisition() (empty for views,
+		// which read the headers of their parents)
+		const AcquisitionsHeaderIndex& header_index() const
+		{
+			return header_index_;
+		}
+		// header fields of acquisition num (mapped by index() if sorted)
+		AcquisitionsHeaderIndex::Entry header_entry(unsigned int num) const
+		{
+			return stored_header_entry(index(num));
+		}
+
     	/*! 
     		\brief Reader for ISMRMRD::Acquisition from ISMRMRD file. 
       		*	filename_ismrmrd_with_ext:	filename of ISMRMRD rawdata file with .h5 extension.
@@ -206,8 +311,16 @@ namespace sirf {
 	protected:
 		bool sorted_=false;
 		std::vector<int> index_;
+		AcquisitionsHeaderIndex header_index_;
 		AcquisitionsInfo acqs_info_;
 
+		// header fields of the acquisition stored i-th
+		virtual AcquisitionsHeaderIndex::Entry stored_header_entry
+			(unsigned int i) const
+		{
+			return header_index_.entry(i);
+		}
+
 		static std::string _storage_scheme;
 		// new MRAcquisitionData objects will be created from this template
 		// using same_acquisitions_container()
@@ -217,11 +330,16 @@ namespace sirf {
 		MRAcquisitionData* clone_base() const;
 	};
 
+	class ISMRMRDAcquisitionsCache;
+
 	/*!
 	\ingroup Gadgetron Data Containers
 	\brief File implementation of Abstract MR acquisition data container class.
 
-	Acquisitions are stored in HDF5 file.
+	Acquisitions are stored in HDF5 file. Acquisitions are read from the file
+	through a block cache (see ISMRMRDAcquisitionsCache), and appended ones
+	are kept in memory until write_batch_size() of them are written together
+	by flush().
 	*/
 	class AcquisitionsFile : public MRAcquisitionData {
 	public:
@@ -256,6 +374,15 @@ namespace sirf {
 
 		void write_acquisitions_info();
 
+		//! Writes the appended acquisitions still kept in memory to the file
+		void flush();
+		//! Number of appended acquisitions written to the file at once
+		static unsigned int write_batch_size() { return write_batch_size_; }
+		static void set_write_batch_size(unsigned int n)
+		{
+			write_batch_size_ = n > 0 ? n : 1;
+		}
+
 		// implementations of abstract methods
 
 		virtual void set_data(const complex_float_t* z, int all = 1);
@@ -290,9 +417,14 @@ namespace sirf {
 		}
 
 	private:
+		static unsigned int write_batch_size_;
+
 		bool own_file_;
 		std::string filename_;
 		gadgetron::shared_ptr<ISMRMRD::Dataset> dataset_;
+		gadgetron::shared_ptr<ISMRMRDAcquisitionsCache> cache_;
+		// appended acquisitions not yet written to the file
+		std::vector<ISMRMRD::Acquisition> pending_;
 		virtual AcquisitionsFile* clone_impl() const
 		{
 			init();
@@ -330,6 +462,7 @@ namespace sirf {
 		{
 			acqs_.push_back(gadgetron::shared_ptr<ISMRMRD::Acquisition>
 				(new ISMRMRD::Acquisition(acq)));
+			header_index_.append(acq.getHead());
 		}
 		virtual void get_acquisition(unsigned int num, ISMRMRD::Acquisition& acq) const
 		{
@@ -340,6 +473,7 @@ namespace sirf {
 		{
 			int ind = index(num);
 			*acqs_[ind] = acq;
+			header_index_.set(ind, acq.getHead());
 		}
 		virtual void copy_acquisitions_info(const MRAcquisitionData& ac)
 		{
@@ -377,6 +511,282 @@ namespace sirf {
 		}
 	};
 
+	/*!
+	\ingroup Gadgetron Data Containers
+	\brief Read-only view of an acquisition stored in AcquisitionsArray.
+
+	Provides, without copying, the part of ISMRMRD::Acquisition interface
+	used by SIRF (including TO_BE_IGNORED).
+	*/
+	class AcquisitionView {
+	public:
+		AcquisitionView(const ISMRMRD::AcquisitionHeader& head,
+			const complex_float_t* data, const float* traj) :
+			head_(head), data_(data), traj_(traj)
+		{}
+		const ISMRMRD::AcquisitionHeader& getHead() const { return head_; }
+		uint64_t flags() const { return head_.flags; }
+		bool isFlagSet(const uint64_t val) const
+		{
+			const uint64_t bitmask = 1;
+			return (head_.flags & (bitmask << (val - 1))) > 0;
+		}
+		const ISMRMRD::EncodingCounters& idx() const { return head_.idx; }
+		uint16_t number_of_samples() const { return head_.number_of_samples; }
+		uint16_t active_channels() const { return head_.active_channels; }
+		uint16_t trajectory_dimensions() const
+		{
+			return head_.trajectory_dimensions;
+		}
+		size_t size() const
+		{
+			return (size_t)head_.number_of_samples*head_.active_channels;
+		}
+		const complex_float_t& data(uint16_t sample, uint16_t channel) const
+		{
+			return data_[sample + (size_t)channel*head_.number_of_samples];
+		}
+		const complex_float_t* data_begin() const { return data_; }
+		const complex_float_t* data_end() const { return data_ + size(); }
+		const float* traj_begin() const { return traj_; }
+
+	private:
+		const ISMRMRD::AcquisitionHeader& head_;
+		const complex_float_t* data_;
+		const float* traj_;
+	};
+
+	/*!
+	\ingroup Gadgetron Data Containers
+	\brief A structure-of-arrays implementation of the abstract MR acquisition
+	data container class.
+
+	All acquisition headers are kept in one array, all samples in one
+	aligned complex array (readout x channel x acquisition, i.e. the samples
+	of each acquisition in ISMRMRD order, acquisitions one after another)
+	and all trajectories in one float array. This avoids allocating three
+	heap blocks per readout, and lets acquisitions be accessed in place via
+	acquisition_view() and acquisition_data(), and all samples at once via
+	data_begin()/data_end().
+	*/
+	class AcquisitionsArray : public MRAcquisitionData {
+	public:
+		typedef std::vector<complex_float_t, AlignedAllocator<complex_float_t> >
+			DataArray;
+
+		AcquisitionsArray(AcquisitionsInfo info = AcquisitionsInfo())
+		{
+			acqs_info_ = info;
+			data_offset_.push_back(0);
+			traj_offset_.push_back(0);
+		}
+		static void init()
+		{
+			AcquisitionsFile::init();
+		}
+		static void set_as_template()
+		{
+			init();
+			acqs_templ_.reset(new AcquisitionsArray);
+			_storage_scheme = "array";
+		}
+		virtual unsigned int number() const
+		{
+			return (unsigned int)headers_.size();
+		}
+		virtual unsigned int items() const
+		{
+			return (unsigned int)headers_.size();
+		}
+		virtual void append_acquisition(ISMRMRD::Acquisition& acq);
+		virtual void get_acquisition(unsigned int num, ISMRMRD::Acquisition& acq) const;
+		virtual void set_acquisition(unsigned int num, ISMRMRD::Acquisition& acq);
+		virtual void copy_acquisitions_info(const MRAcquisitionData& ac)
+		{
+			acqs_info_ = ac.acquisitions_info();
+		}
+		virtual void copy_acquisitions_data(const MRAcquisitionData& ac);
+		virtual void set_data(const complex_float_t* z, int all = 1);
+		virtual void get_data(complex_float_t* z, int all = 1);
+
+		//! Appends a copy of an acquisition viewed in another AcquisitionsArray
+		void append_acquisition(const AcquisitionView& acq);
+
+		virtual AcquisitionsArray* same_acquisitions_container
+			(const AcquisitionsInfo& info) const
+		{
+			return new AcquisitionsArray(info);
+		}
+		virtual ObjectHandle<DataContainer>* new_data_container_handle() const
+		{
+			init();
+			DataContainer* ptr = acqs_templ_->same_acquisitions_container(acqs_info_);
+			return new ObjectHandle<DataContainer>
+				(gadgetron::shared_ptr<DataContainer>(ptr));
+		}
+		virtual gadgetron::unique_ptr<MRAcquisitionData>
+			new_acquisitions_container()
+		{
+			init();
+			return gadgetron::unique_ptr<MRAcquisitionData>
+				(acqs_templ_->same_acquisitions_container(acqs_info_));
+		}
+
+		//! Reserves space for na acquisitions with ns samples in total
+		void reserve(unsigned int na, size_t ns);
+
+		// in-place access to acquisition num (mapped by index() if sorted)
+		AcquisitionView acquisition_view(unsigned int num) const
+		{
+			const int i = index(num);
+			return AcquisitionView(headers_[i], data_.data() + data_offset_[i],
+				traj_.data() + traj_offset_[i]);
+		}
+		const ISMRMRD::AcquisitionHeader& acquisition_header(unsigned int num) const
+		{
+			return headers_[index(num)];
+		}
+		complex_float_t* acquisition_data(unsigned int num)
+		{
+			return data_.data() + data_offset_[index(num)];
+		}
+		const complex_float_t* acquisition_data(unsigned int num) const
+		{
+			return data_.data() + data_offset_[index(num)];
+		}
+
+		// all samples in storage order (i.e. ignoring index())
+		complex_float_t* data_begin() { return data_.data(); }
+		complex_float_t* data_end() { return data_.data() + data_.size(); }
+		const complex_float_t* data_begin() const { return data_.data(); }
+		const complex_float_t* data_end() const
+		{
+			return data_.data() + data_.size();
+		}
+		size_t data_size() const { return data_.size(); }
+
+	private:
+		std::vector<ISMRMRD::AcquisitionHeader> headers_;
+		DataArray data_;
+		std::vector<float> traj_;
+		// offsets of the acquisitions' samples and trajectories,
+		// number() + 1 of each
+		std::vector<size_t> data_offset_;
+		std::vector<size_t> traj_offset_;
+		virtual AcquisitionsArray* clone_impl() const
+		{
+			init();
+			return (AcquisitionsArray*)clone_base();
+		}
+	};
+
+	/*!
+	\ingroup Gadgetron Data Containers
+	\brief A view of selected acquisitions of another MR acquisition data
+	container.
+
+	Refers to the acquisitions of the parent container by their numbers,
+	copying neither headers nor samples: get_acquisition() reads, and
+	set_acquisition(), set_data() and copy_acquisitions_data() write,
+	the parent's acquisitions (the latter requires a parent that implements
+	set_acquisition(), i.e. not AcquisitionsFile). Headers are read
+	through the parent too, so the view sees the parent's acquisitions as
+	they are now; the viewed acquisitions are identified by their numbers
+	in the parent, which therefore must not be sorted again or shortened
+	while viewed. Containers created from a view (e.g. by the algebra or
+	the acquisition model) follow the storage scheme.
+	*/
+	class AcquisitionsView : public MRAcquisitionData {
+	public:
+		//! Views acquisitions nums of the parent (a view of a view
+		//! refers to the parent of the latter)
+		AcquisitionsView(gadgetron::shared_ptr<MRAcquisitionData> sptr_parent,
+			const std::vector<int>& nums);
+
+		/*!
+		\brief Selects the acquisitions of sptr_parent whose encoding counter
+		field (e.g. "slice", "contrast", "repetition", "phase") is in
+		[first, last].
+		*/
+		static gadgetron::shared_ptr<AcquisitionsView> select
+			(gadgetron::shared_ptr<MRAcquisitionData> sptr_parent,
+			const std::string& field, int first, int last);
+		//! Value of the named encoding counter field of an acquisition
+		static int field_value
+			(const AcquisitionsHeaderIndex::Entry& head, const std::string& field);
+
+		static void init()
+		{
+			AcquisitionsFile::init();
+		}
+		virtual unsigned int number() const
+		{
+			return (unsigned int)nums_.size();
+		}
+		virtual unsigned int items() const
+		{
+			return (unsigned int)nums_.size();
+		}
+		virtual void get_acquisition(unsigned int num, ISMRMRD::Acquisition& acq) const
+		{
+			sptr_parent_->get_acquisition(nums_[index(num)], acq);
+		}
+		virtual void set_acquisition(unsigned int num, ISMRMRD::Acquisition& acq);
+		virtual void append_acquisition(ISMRMRD::Acquisition& acq)
+		{
+			throw LocalisedException
+				("cannot append acquisitions to a view", __FILE__, __LINE__);
+		}
+		virtual void copy_acquisitions_info(const MRAcquisitionData& ac)
+		{
+			acqs_info_ = ac.acquisitions_info();
+		}
+		virtual void copy_acquisitions_data(const MRAcquisitionData& ac);
+		virtual void set_data(const complex_float_t* z, int all = 1);
+
+		virtual MRAcquisitionData* same_acquisitions_container
+			(const AcquisitionsInfo& info) const
+		{
+			init();
+			return acqs_templ_->same_acquisitions_container(info);
+		}
+		virtual ObjectHandle<DataContainer>* new_data_container_handle() const
+		{
+			init();
+			DataContainer* ptr = acqs_templ_->same_acquisitions_container(acqs_info_);
+			return new ObjectHandle<DataContainer>
+				(gadgetron::shared_ptr<DataContainer>(ptr));
+		}
+		virtual gadgetron::unique_ptr<MRAcquisitionData>
+			new_acquisitions_container()
+		{
+			init();
+			return gadgetron::unique_ptr<MRAcquisitionData>
+				(acqs_templ_->same_acquisitions_container(acqs_info_));
+		}
+
+		const MRAcquisitionData& parent() const { return *sptr_parent_; }
+		// numbers of the viewed acquisitions in the parent
+		const std::vector<int>& parent_numbers() const { return nums_; }
+
+	protected:
+		virtual AcquisitionsHeaderIndex::Entry stored_header_entry
+			(unsigned int i) const
+		{
+			return sptr_parent_->header_entry(nums_[i]);
+		}
+
+	private:
+		gadgetron::shared_ptr<MRAcquisitionData> sptr_parent_;
+		std::vector<int> nums_;
+		// clones are copies of the viewed acquisitions
+		virtual MRAcquisitionData* clone_impl() const
+		{
+			init();
+			return clone_base();
+		}
+	};
+
 	/*!
 	\ingroup Gadgetron Data Containers
 	\brief Abstract Gadgetron image data container class.
@@ -37,6 +37,8 @@ IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR
 IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 */
 
+#include <string>
+
 namespace ISMRMRD {
 	template<typename TI, typename TO> 
 	void 
@@ -54,6 +56,27 @@ namespace ISMRMRD {
 	int ifft2c(NDArray<complex_float_t> &a);
 	void fft3c(NDArray<complex_float_t> &a);
 	void ifft3c(NDArray<complex_float_t> &a);
+	// unshifted transforms of the 3D volumes of a, normalised by the
+	// square root of the volume size, out of place (into r) and in place
+	void fft3(NDArray<complex_float_t> &a, NDArray<complex_float_t> &r,
+		bool forward);
+	void fft3(NDArray<complex_float_t> &a, bool forward);
+
+	// fft3c/ifft3c plans are cached; the planner (also settable by
+	// SIRF_FFTW_PLANNER environment variable) is "estimate" (default),
+	// "measure" or "patient", the latter two taking longer to plan
+	// and producing faster plans
+	void set_fft_planner(const std::string& planner);
+	// maximal number of threads used by fft3c/ifft3c (by default
+	// omp_get_max_threads()): OpenMP threads transforming one volume each
+	// or, for fewer volumes, FFTW threads per volume (if cgadgetron is
+	// built with FFTW threads)
+	void set_fft_threads(int n);
+	// FFTW wisdom (saved plans) import and export; SIRF_FFTW_WISDOM
+	// environment variable names a file imported on first use and
+	// updated after new plans are measured
+	bool import_fft_wisdom(const std::string& filename);
+	bool export_fft_wisdom(const std::string& filename);
 };
 
 #endif
\ No newline at end of file
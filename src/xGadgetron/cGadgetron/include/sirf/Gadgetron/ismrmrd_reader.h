@@ -0,0 +1,189 @@
+/*
+CCP PETMR Synergistic Image Reconstruction Framework (SIRF)
+Copyright 2019 Rutherford Appleton Laboratory STFC
+
+This is software developed for the Collaborative Computational
+Project in Positron Emission Tomography and Magnetic Resonance imaging
+(http://www.ccppetmr.ac.uk/).
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+http://www.apache.org/licenses/LICENSE-2.0
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+*/
+
+/*!
+\file
+\ingroup Gadgetron Data Containers
+\brief Specification file for the bulk reader and the block cache of ISMRMRD
+acquisitions.
+
+\author Evgueni Ovtchinnikov
+\author CCP PETMR
+*/
+
+#ifndef ISMRMRD_ACQUISITIONS_READER
+#define ISMRMRD_ACQUISITIONS_READER
+
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <boost/thread.hpp>
+#include <hdf5.h>
+
+#include "sirf/Gadgetron/gadgetron_data_containers.h"
+
+namespace sirf {
+
+	/*!
+	\ingroup Gadgetron Data Containers
+	\brief Bulk reader of acquisitions from an ISMRMRD file.
+
+	Reads the acquisitions dataset of an ISMRMRD (HDF5) file in blocks of
+	consecutive acquisitions, one HDF5 hyperslab read per block rather than
+	one read per acquisition. The next block is read by a background thread
+	while the current one is filtered (by TO_BE_IGNORED) and copied into the
+	target container, directly into its storage if it is AcquisitionsArray.
+	*/
+	class ISMRMRDAcquisitionsReader {
+	public:
+		ISMRMRDAcquisitionsReader
+			(const std::string& filename, const std::string& group = "dataset");
+		~ISMRMRDAcquisitionsReader();
+
+		//! Total number of acquisitions in the file
+		unsigned int number() const { return num_acqs_; }
+
+		//! Number of acquisitions read per HDF5 call
+		unsigned int block_size() const { return block_size_; }
+		void set_block_size(unsigned int n) { block_size_ = n > 0 ? n : 1; }
+
+		//! Prints progress (percentage read) to std::cout if set
+		void set_verbose(bool verbose) { verbose_ = verbose; }
+
+		/*!
+		\brief Appends the acquisitions in the file to ac.
+
+		Only the acquisitions that are not TO_BE_IGNORED are appended unless
+		all is true. Returns the number of acquisitions appended.
+		*/
+		unsigned int read(MRAcquisitionData& ac, bool all = false);
+
+		/*!
+		\brief Appends the headers of all acquisitions in the file to index.
+
+		Only the headers are read from the file, not the acquisition data.
+		*/
+		void read_headers(AcquisitionsHeaderIndex& index);
+
+		/*!
+		\brief Reads n acquisitions starting with acquisition first.
+
+		All acquisitions in the range are read (including the ones that are
+		TO_BE_IGNORED), with one HDF5 call.
+		*/
+		void read(unsigned int first, unsigned int n,
+			std::vector<ISMRMRD::Acquisition>& acqs) const;
+
+	private:
+		// memory layout of an acquisition read from the file
+		struct Record {
+			ISMRMRD::AcquisitionHeader head;
+			hvl_t traj;
+			hvl_t data;
+		};
+
+		std::string filename_;
+		hid_t file_;
+		hid_t dataset_;
+		hid_t type_;
+		unsigned int num_acqs_;
+		unsigned int block_size_;
+		bool verbose_;
+
+		void close_();
+		void read_block_
+			(unsigned int first, unsigned int n, std::vector<Record>& block,
+			std::string& error) const;
+		void release_block_(std::vector<Record>& block, unsigned int n) const;
+		unsigned int append_block_
+			(const std::vector<Record>& block, unsigned int n,
+			MRAcquisitionData& ac, bool all) const;
+		void check_record_(const Record& r) const;
+	};
+
+	/*!
+	\ingroup Gadgetron Data Containers
+	\brief Read-through block cache of the acquisitions in an ISMRMRD file.
+
+	Acquisitions are read in blocks of block_size() consecutive acquisitions
+	(one HDF5 hyperslab read per block) and kept in a least recently used
+	list of blocks taking at most memory_budget() bytes. When blocks are
+	accessed in storage order, the next block is read in the background.
+	Acquisitions are addressed by their position in the file.
+	*/
+	class ISMRMRDAcquisitionsCache {
+	public:
+		ISMRMRDAcquisitionsCache(const std::string& filename);
+		~ISMRMRDAcquisitionsCache();
+
+		//! Memory (in bytes) each cache may use, 256 MB by default
+		static size_t memory_budget() { return memory_budget_; }
+		static void set_memory_budget(size_t bytes) { memory_budget_ = bytes; }
+		//! Number of acquisitions per block, 256 by default
+		static unsigned int block_size() { return block_size_; }
+		static void set_block_size(unsigned int n)
+		{
+			block_size_ = n > 0 ? n : 1;
+		}
+
+		//! Copies acquisition i of the file to acq
+		void get_acquisition(unsigned int i, ISMRMRD::Acquisition& acq);
+		//! Drops cached blocks, to be called after the file is modified
+		void reset();
+
+	private:
+		struct Block {
+			unsigned int first;
+			std::vector<ISMRMRD::Acquisition> acqs;
+			size_t bytes;
+		};
+		typedef std::list<Block> BlockList;
+
+		static size_t memory_budget_;
+		static unsigned int block_size_;
+
+		std::string filename_;
+		gadgetron::shared_ptr<ISMRMRDAcquisitionsReader> reader_;
+		// block size fixed at construction
+		unsigned int bs_;
+		// most recently used block first
+		BlockList blocks_;
+		std::map<unsigned int, BlockList::iterator> cached_;
+		size_t bytes_;
+		unsigned int last_block_;
+		// the block being read in the background
+		boost::thread prefetch_thread_;
+		Block prefetched_;
+		unsigned int prefetched_block_;
+		std::string prefetch_error_;
+		boost::mutex mutex_;
+
+		void open_();
+		void read_block_(unsigned int b, Block& block) const;
+		void prefetch_(unsigned int b);
+		void collect_prefetched_();
+		BlockList::iterator insert_(unsigned int b, Block& block);
+	};
+
+}
+
+#endif
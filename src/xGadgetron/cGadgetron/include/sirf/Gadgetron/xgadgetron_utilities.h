@@ -100,6 +100,49 @@ namespace sirf {
 
 	};
 
+	/*!
+	\brief Allocator of memory aligned to A bytes (a power of 2).
+
+	Aligned arrays let the compiler use aligned vector loads and keep
+	blocks of elements processed by different threads in separate cache
+	lines.
+	*/
+	template<class T, size_t A = 64>
+	class AlignedAllocator {
+	public:
+		typedef T value_type;
+		template<class U>
+		struct rebind {
+			typedef AlignedAllocator<U, A> other;
+		};
+		AlignedAllocator() {}
+		template<class U>
+		AlignedAllocator(const AlignedAllocator<U, A>&) {}
+		T* allocate(size_t n)
+		{
+			// the address of the raw block is kept just before the aligned one
+			char* raw = (char*)::operator new(n*sizeof(T) + A + sizeof(void*));
+			size_t addr = (size_t)(raw + sizeof(void*));
+			addr = (addr + A - 1) & ~(size_t)(A - 1);
+			((void**)addr)[-1] = raw;
+			return (T*)addr;
+		}
+		void deallocate(T* p, size_t)
+		{
+			::operator delete(((void**)p)[-1]);
+		}
+		template<class U>
+		bool operator==(const AlignedAllocator<U, A>&) const
+		{
+			return true;
+		}
+		template<class U>
+		bool operator!=(const AlignedAllocator<U, A>&) const
+		{
+			return false;
+		}
+	};
+
 	class Mutex {
 	public:
 		Mutex()
@@ -0,0 +1,540 @@
+/*
+CCP PETMR Synergistic Image Reconstruction Framework (SIRF)
+Copyright 2019 Rutherford Appleton Laboratory STFC
+
+This is software developed for the Collaborative Computational
+Project in Positron Emission Tomography and Magnetic Resonance imaging
+(http://www.ccppetmr.ac.uk/).
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+http://www.apache.org/licenses/LICENSE-2.0
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+*/
+
+/*!
+\file
+\ingroup Gadgetron Data Containers
+\brief Implementation file for the bulk reader and the block cache of ISMRMRD
+acquisitions.
+
+\author Evgueni Ovtchinnikov
+\author CCP PETMR
+*/
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
+#include "sirf/Gadgetron/ismrmrd_reader.h"
+
+using namespace gadgetron;
+using namespace sirf;
+
+// HDF5 memory types matching the ISMRMRD file format: HDF5 converts
+// compound types member by member using member names, so these must be
+// the names used by ISMRMRD when writing acquisitions
+
+static void
+insert_array_(hid_t type, const char* name, size_t offset, hid_t base, hsize_t n)
+{
+	hid_t array_type = H5Tarray_create2(base, 1, &n);
+	H5Tinsert(type, name, offset, array_type);
+	H5Tclose(array_type);
+}
+
+static hid_t
+encoding_counters_type_()
+{
+	typedef ISMRMRD::ISMRMRD_EncodingCounters EC;
+	hid_t type = H5Tcreate(H5T_COMPOUND, sizeof(EC));
+	H5Tinsert(type, "kspace_encode_step_1",
+		HOFFSET(EC, kspace_encode_step_1), H5T_NATIVE_UINT16);
+	H5Tinsert(type, "kspace_encode_step_2",
+		HOFFSET(EC, kspace_encode_step_2), H5T_NATIVE_UINT16);
+	H5Tinsert(type, "average", HOFFSET(EC, average), H5T_NATIVE_UINT16);
+	H5Tinsert(type, "slice", HOFFSET(EC, slice), H5T_NATIVE_UINT16);
+	H5Tinsert(type, "contrast", HOFFSET(EC, contrast), H5T_NATIVE_UINT16);
+	H5Tinsert(type, "phase", HOFFSET(EC, phase), H5T_NATIVE_UINT16);
+	H5Tinsert(type, "repetition", HOFFSET(EC, repetition), H5T_NATIVE_UINT16);
+	H5Tinsert(type, "set", HOFFSET(EC, set), H5T_NATIVE_UINT16);
+	H5Tinsert(type, "segment", HOFFSET(EC, segment), H5T_NATIVE_UINT16);
+	insert_array_(type, "user", HOFFSET(EC, user), H5T_NATIVE_UINT16,
+		ISMRMRD::ISMRMRD_USER_INTS);
+	return type;
+}
+
+static hid_t
+acquisition_header_type_()
+{
+	typedef ISMRMRD::ISMRMRD_AcquisitionHeader AH;
+	hid_t type = H5Tcreate(H5T_COMPOUND, sizeof(AH));
+	H5Tinsert(type, "version", HOFFSET(AH, version), H5T_NATIVE_UINT16);
+	H5Tinsert(type, "flags", HOFFSET(AH, flags), H5T_NATIVE_UINT64);
+	H5Tinsert(type, "measurement_uid",
+		HOFFSET(AH, measurement_uid), H5T_NATIVE_UINT32);
+	H5Tinsert(type, "scan_counter", HOFFSET(AH, scan_counter), H5T_NATIVE_UINT32);
+	H5Tinsert(type, "acquisition_time_stamp",
+		HOFFSET(AH, acquisition_time_stamp), H5T_NATIVE_UINT32);
+	insert_array_(type, "physiology_time_stamp",
+		HOFFSET(AH, physiology_time_stamp), H5T_NATIVE_UINT32,
+		ISMRMRD::ISMRMRD_PHYS_STAMPS);
+	H5Tinsert(type, "number_of_samples",
+		HOFFSET(AH, number_of_samples), H5T_NATIVE_UINT16);
+	H5Tinsert(type, "available_channels",
+		HOFFSET(AH, available_channels), H5T_NATIVE_UINT16);
+	H5Tinsert(type, "active_channels",
+		HOFFSET(AH, active_channels), H5T_NATIVE_UINT16);
+	insert_array_(type, "channel_mask", HOFFSET(AH, channel_mask),
+		H5T_NATIVE_UINT64, ISMRMRD::ISMRMRD_CHANNEL_MASKS);
+	H5Tinsert(type, "discard_pre", HOFFSET(AH, discard_pre), H5T_NATIVE_UINT16);
+	H5Tinsert(type, "discard_post", HOFFSET(AH, discard_post), H5T_NATIVE_UINT16);
+	H5Tinsert(type, "center_sample",
+		HOFFSET(AH, center_sample), H5T_NATIVE_UINT16);
+	H5Tinsert(type, "encoding_space_ref",
+		HOFFSET(AH, encoding_space_ref), H5T_NATIVE_UINT16);
+	H5Tinsert(type, "trajectory_dimensions",
+		HOFFSET(AH, trajectory_dimensions), H5T_NATIVE_UINT16);
+	H5Tinsert(type, "sample_time_us",
+		HOFFSET(AH, sample_time_us), H5T_NATIVE_FLOAT);
+	insert_array_(type, "position", HOFFSET(AH, position),
+		H5T_NATIVE_FLOAT, ISMRMRD::ISMRMRD_POSITION_LENGTH);
+	insert_array_(type, "read_dir", HOFFSET(AH, read_dir),
+		H5T_NATIVE_FLOAT, ISMRMRD::ISMRMRD_DIRECTION_LENGTH);
+	insert_array_(type, "phase_dir", HOFFSET(AH, phase_dir),
+		H5T_NATIVE_FLOAT, ISMRMRD::ISMRMRD_DIRECTION_LENGTH);
+	insert_array_(type, "slice_dir", HOFFSET(AH, slice_dir),
+		H5T_NATIVE_FLOAT, ISMRMRD::ISMRMRD_DIRECTION_LENGTH);
+	insert_array_(type, "patient_table_position",
+		HOFFSET(AH, patient_table_position),
+		H5T_NATIVE_FLOAT, ISMRMRD::ISMRMRD_POSITION_LENGTH);
+	hid_t idx_type = encoding_counters_type_();
+	H5Tinsert(type, "idx", HOFFSET(AH, idx), idx_type);
+	H5Tclose(idx_type);
+	insert_array_(type, "user_int", HOFFSET(AH, user_int),
+		H5T_NATIVE_INT32, ISMRMRD::ISMRMRD_USER_INTS);
+	insert_array_(type, "user_float", HOFFSET(AH, user_float),
+		H5T_NATIVE_FLOAT, ISMRMRD::ISMRMRD_USER_FLOATS);
+	return type;
+}
+
+ISMRMRDAcquisitionsReader::ISMRMRDAcquisitionsReader
+(const std::string& filename, const std::string& group) :
+	filename_(filename), file_(-1), dataset_(-1), type_(-1),
+	num_acqs_(0), block_size_(1024), verbose_(false)
+{
+	Mutex mtx;
+	boost::mutex::scoped_lock lock(mtx());
+	file_ = H5Fopen(filename.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
+	if (file_ < 0)
+		throw LocalisedException
+		(("cannot open ISMRMRD file " + filename).c_str(), __FILE__, __LINE__);
+	// a file without acquisitions has no acquisitions dataset
+	const std::string path = group + "/data";
+	if (H5Lexists(file_, group.c_str(), H5P_DEFAULT) <= 0 ||
+		H5Lexists(file_, path.c_str(), H5P_DEFAULT) <= 0)
+		return;
+	dataset_ = H5Dopen2(file_, path.c_str(), H5P_DEFAULT);
+	if (dataset_ < 0) {
+		close_();
+		throw LocalisedException
+		(("cannot open acquisitions in " + filename).c_str(), __FILE__, __LINE__);
+	}
+	hid_t space = H5Dget_space(dataset_);
+	hsize_t dims[1] = { 0 };
+	H5Sget_simple_extent_dims(space, dims, 0);
+	H5Sclose(space);
+	num_acqs_ = (unsigned int)dims[0];
+
+	type_ = H5Tcreate(H5T_COMPOUND, sizeof(Record));
+	hid_t head_type = acquisition_header_type_();
+	H5Tinsert(type_, "head", HOFFSET(Record, head), head_type);
+	H5Tclose(head_type);
+	// ISMRMRD stores both trajectories and samples as variable length arrays
+	// of floats, the samples with real and imaginary parts interleaved
+	hid_t vlen_type = H5Tvlen_create(H5T_NATIVE_FLOAT);
+	H5Tinsert(type_, "traj", HOFFSET(Record, traj), vlen_type);
+	H5Tinsert(type_, "data", HOFFSET(Record, data), vlen_type);
+	H5Tclose(vlen_type);
+}
+
+ISMRMRDAcquisitionsReader::~ISMRMRDAcquisitionsReader()
+{
+	Mutex mtx;
+	boost::mutex::scoped_lock lock(mtx());
+	close_();
+}
+
+void
+ISMRMRDAcquisitionsReader::close_()
+{
+	if (type_ >= 0)
+		H5Tclose(type_);
+	if (dataset_ >= 0)
+		H5Dclose(dataset_);
+	if (file_ >= 0)
+		H5Fclose(file_);
+	type_ = dataset_ = file_ = -1;
+}
+
+void
+ISMRMRDAcquisitionsReader::read_block_
+(unsigned int first, unsigned int n, std::vector<Record>& block,
+	std::string& error) const
+{
+	// members missing from the file (if any) stay zero
+	memset((void*)block.data(), 0, n*sizeof(Record));
+	Mutex mtx;
+	boost::mutex::scoped_lock lock(mtx());
+	hsize_t offset[1] = { first };
+	hsize_t count[1] = { n };
+	hid_t file_space = H5Dget_space(dataset_);
+	H5Sselect_hyperslab(file_space, H5S_SELECT_SET, offset, 0, count, 0);
+	hid_t mem_space = H5Screate_simple(1, count, 0);
+	herr_t status = H5Dread(dataset_, type_, mem_space, file_space,
+		H5P_DEFAULT, block.data());
+	H5Sclose(mem_space);
+	H5Sclose(file_space);
+	if (status < 0)
+		error = "failed to read acquisitions from " + filename_;
+}
+
+void
+ISMRMRDAcquisitionsReader::release_block_
+(std::vector<Record>& block, unsigned int n) const
+{
+	Mutex mtx;
+	boost::mutex::scoped_lock lock(mtx());
+	hsize_t count[1] = { n };
+	hid_t mem_space = H5Screate_simple(1, count, 0);
+	H5Dvlen_reclaim(type_, mem_space, H5P_DEFAULT, block.data());
+	H5Sclose(mem_space);
+}
+
+void
+ISMRMRDAcquisitionsReader::check_record_(const Record& r) const
+{
+	// r.data.len counts floats, two per complex sample
+	const size_t nd = (size_t)r.head.number_of_samples*r.head.active_channels;
+	const size_t nt = (size_t)r.head.number_of_samples*
+		r.head.trajectory_dimensions;
+	if (r.data.len < 2*nd || r.traj.len < nt)
+		throw LocalisedException
+		(("corrupt acquisition data in " + filename_).c_str(),
+		__FILE__, __LINE__);
+}
+
+unsigned int
+ISMRMRDAcquisitionsReader::append_block_
+(const std::vector<Record>& block, unsigned int n,
+	MRAcquisitionData& ac, bool all) const
+{
+	AcquisitionsArray* ptr_array = dynamic_cast<AcquisitionsArray*>(&ac);
+	ISMRMRD::Acquisition acq;
+	unsigned int appended = 0;
+	for (unsigned int i = 0; i < n; i++) {
+		const Record& r = block[i];
+		AcquisitionView view(r.head, (const complex_float_t*)r.data.p,
+			(const float*)r.traj.p);
+		if (!all && TO_BE_IGNORED(view))
+			continue;
+		check_record_(r);
+		const size_t nt = (size_t)r.head.number_of_samples*
+			r.head.trajectory_dimensions;
+		if (ptr_array)
+			ptr_array->append_acquisition(view);
+		else {
+			acq.setHead(r.head);
+			if (view.size() > 0)
+				memcpy(acq.getDataPtr(), r.data.p,
+				view.size()*sizeof(complex_float_t));
+			if (nt > 0)
+				memcpy(acq.getTrajPtr(), r.traj.p, nt*sizeof(float));
+			ac.append_acquisition(acq);
+		}
+		appended++;
+	}
+	return appended;
+}
+
+unsigned int
+ISMRMRDAcquisitionsReader::read(MRAcquisitionData& ac, bool all)
+{
+	const unsigned int na = num_acqs_;
+	const unsigned int bs = std::min(block_size_, std::max(na, 1u));
+	// double buffering: block b is appended to ac while block 1 - b is read
+	std::vector<Record> blocks[2];
+	blocks[0].resize(bs);
+	blocks[1].resize(bs);
+	std::string errors[2];
+	unsigned int appended = 0;
+	int percent = -1;
+
+	unsigned int first = 0;
+	unsigned int n = std::min(bs, na);
+	if (n > 0)
+		read_block_(first, n, blocks[0], errors[0]);
+	for (int b = 0; n > 0; b = 1 - b) {
+		const unsigned int next = first + n;
+		const unsigned int m = std::min(bs, na - next);
+		boost::thread reader;
+		if (m > 0)
+			reader = boost::thread(boost::bind
+			(&ISMRMRDAcquisitionsReader::read_block_, this,
+			next, m, boost::ref(blocks[1 - b]), boost::ref(errors[1 - b])));
+		try {
+			if (!errors[b].empty())
+				throw LocalisedException(errors[b].c_str(), __FILE__, __LINE__);
+			appended += append_block_(blocks[b], n, ac, all);
+		}
+		catch (...) {
+			if (reader.joinable())
+				reader.join();
+			release_block_(blocks[b], n);
+			if (m > 0 && errors[1 - b].empty())
+				release_block_(blocks[1 - b], m);
+			throw;
+		}
+		release_block_(blocks[b], n);
+		if (reader.joinable())
+			reader.join();
+		if (verbose_ && (int)(10 * (first + n) / na) > percent) {
+			percent = 10 * (first + n) / na;
+			std::cout << std::ceil(float(first + n) / na * 100)
+				<< " % " << " done." << std::endl;
+		}
+		first = next;
+		n = m;
+	}
+	return appended;
+}
+
+void
+ISMRMRDAcquisitionsReader::read_headers(AcquisitionsHeaderIndex& index)
+{
+	const unsigned int na = num_acqs_;
+	if (na == 0)
+		return;
+	index.reserve(index.size() + na);
+	const unsigned int bs = std::min(block_size_, na);
+	std::vector<ISMRMRD::AcquisitionHeader> heads(bs);
+	Mutex mtx;
+	boost::mutex::scoped_lock lock(mtx());
+	// a memory type with the header member only: HDF5 then skips
+	// the trajectories and samples, which are stored elsewhere in the file
+	hid_t type = H5Tcreate(H5T_COMPOUND, sizeof(ISMRMRD::AcquisitionHeader));
+	hid_t head_type = acquisition_header_type_();
+	H5Tinsert(type, "head", 0, head_type);
+	H5Tclose(head_type);
+	hid_t file_space = H5Dget_space(dataset_);
+	herr_t status = 0;
+	for (unsigned int first = 0; first < na && status >= 0; first += bs) {
+		hsize_t offset[1] = { first };
+		hsize_t count[1] = { std::min(bs, na - first) };
+		H5Sselect_hyperslab(file_space, H5S_SELECT_SET, offset, 0, count, 0);
+		hid_t mem_space = H5Screate_simple(1, count, 0);
+		status = H5Dread(dataset_, type, mem_space, file_space,
+			H5P_DEFAULT, heads.data());
+		H5Sclose(mem_space);
+		for (unsigned int i = 0; i < count[0] && status >= 0; i++)
+			index.append(heads[i]);
+	}
+	H5Sclose(file_space);
+	H5Tclose(type);
+	if (status < 0)
+		throw LocalisedException
+		(("failed to read acquisition headers from " + filename_).c_str(),
+		__FILE__, __LINE__);
+}
+
+void
+ISMRMRDAcquisitionsReader::read
+(unsigned int first, unsigned int n, std::vector<ISMRMRD::Acquisition>& acqs) const
+{
+	if (first > num_acqs_ || n > num_acqs_ - first)
+		throw LocalisedException
+		("acquisitions range out of bounds", __FILE__, __LINE__);
+	acqs.resize(n);
+	if (n == 0)
+		return;
+	std::vector<Record> block(n);
+	std::string error;
+	read_block_(first, n, block, error);
+	if (!error.empty())
+		throw LocalisedException(error.c_str(), __FILE__, __LINE__);
+	try {
+		for (unsigned int i = 0; i < n; i++) {
+			const Record& r = block[i];
+			check_record_(r);
+			ISMRMRD::Acquisition& acq = acqs[i];
+			acq.setHead(r.head);
+			const size_t nd = acq.getNumberOfDataElements();
+			const size_t nt = acq.getNumberOfTrajElements();
+			if (nd > 0)
+				memcpy(acq.getDataPtr(), r.data.p, nd*sizeof(complex_float_t));
+			if (nt > 0)
+				memcpy(acq.getTrajPtr(), r.traj.p, nt*sizeof(float));
+		}
+	}
+	catch (...) {
+		release_block_(block, n);
+		throw;
+	}
+	release_block_(block, n);
+}
+
+// no block accessed yet: the first access to block 0 counts as in order
+static const unsigned int NO_BLOCK = (unsigned int)-1;
+
+size_t ISMRMRDAcquisitionsCache::memory_budget_ = size_t(256) << 20;
+unsigned int ISMRMRDAcquisitionsCache::block_size_ = 256;
+
+ISMRMRDAcquisitionsCache::ISMRMRDAcquisitionsCache(const std::string& filename) :
+	filename_(filename), bs_(block_size_), bytes_(0), last_block_(NO_BLOCK),
+	prefetched_block_(NO_BLOCK)
+{}
+
+ISMRMRDAcquisitionsCache::~ISMRMRDAcquisitionsCache()
+{
+	if (prefetch_thread_.joinable())
+		prefetch_thread_.join();
+}
+
+void
+ISMRMRDAcquisitionsCache::reset()
+{
+	boost::mutex::scoped_lock lock(mutex_);
+	if (prefetch_thread_.joinable())
+		prefetch_thread_.join();
+	prefetched_.acqs.clear();
+	prefetched_block_ = NO_BLOCK;
+	prefetch_error_.clear();
+	blocks_.clear();
+	cached_.clear();
+	bytes_ = 0;
+	last_block_ = NO_BLOCK;
+	// the number of acquisitions in the file may have changed
+	reader_.reset();
+}
+
+void
+ISMRMRDAcquisitionsCache::open_()
+{
+	if (!reader_)
+		reader_.reset(new ISMRMRDAcquisitionsReader(filename_));
+}
+
+void
+ISMRMRDAcquisitionsCache::read_block_(unsigned int b, Block& block) const
+{
+	block.first = b*bs_;
+	const unsigned int n = std::min(bs_, reader_->number() - block.first);
+	reader_->read(block.first, n, block.acqs);
+	block.bytes = 0;
+	for (unsigned int i = 0; i < n; i++) {
+		const ISMRMRD::Acquisition& acq = block.acqs[i];
+		block.bytes += sizeof(ISMRMRD::AcquisitionHeader) +
+			acq.getNumberOfDataElements()*sizeof(complex_float_t) +
+			acq.getNumberOfTrajElements()*sizeof(float);
+	}
+}
+
+void
+ISMRMRDAcquisitionsCache::prefetch_(unsigned int b)
+{
+	// runs in prefetch_thread_
+	try {
+		read_block_(b, prefetched_);
+	}
+	catch (std::exception& e) {
+		prefetch_error_ = e.what();
+	}
+	catch (...) {
+		prefetch_error_ = "failed to read acquisitions from " + filename_;
+	}
+}
+
+void
+ISMRMRDAcquisitionsCache::collect_prefetched_()
+{
+	if (!prefetch_thread_.joinable())
+		return;
+	prefetch_thread_.join();
+	const unsigned int b = prefetched_block_;
+	prefetched_block_ = NO_BLOCK;
+	// a block that failed to read is read again (and the error reported)
+	// when it is accessed
+	if (!prefetch_error_.empty())
+		prefetch_error_.clear();
+	else if (cached_.find(b) == cached_.end())
+		insert_(b, prefetched_);
+}
+
+ISMRMRDAcquisitionsCache::BlockList::iterator
+ISMRMRDAcquisitionsCache::insert_(unsigned int b, Block& block)
+{
+	blocks_.push_front(Block());
+	Block& front = blocks_.front();
+	front.first = block.first;
+	front.acqs.swap(block.acqs);
+	front.bytes = block.bytes;
+	bytes_ += front.bytes;
+	cached_[b] = blocks_.begin();
+	// evict the least recently used blocks, always keeping the new one
+	while (bytes_ > memory_budget_ && blocks_.size() > 1) {
+		const Block& last = blocks_.back();
+		bytes_ -= last.bytes;
+		cached_.erase(last.first / bs_);
+		blocks_.pop_back();
+	}
+	return blocks_.begin();
+}
+
+void
+ISMRMRDAcquisitionsCache::get_acquisition(unsigned int i, ISMRMRD::Acquisition& acq)
+{
+	boost::mutex::scoped_lock lock(mutex_);
+	open_();
+	const unsigned int na = reader_->number();
+	if (i >= na)
+		throw LocalisedException
+		("acquisition number out of range", __FILE__, __LINE__);
+	const unsigned int b = i / bs_;
+	if (prefetched_block_ == b)
+		collect_prefetched_();
+	BlockList::iterator block;
+	std::map<unsigned int, BlockList::iterator>::iterator cached = cached_.find(b);
+	if (cached != cached_.end()) {
+		block = cached->second;
+		blocks_.splice(blocks_.begin(), blocks_, block);
+	}
+	else {
+		Block fresh;
+		read_block_(b, fresh);
+		block = insert_(b, fresh);
+	}
+	acq = block->acqs[i - block->first];
+
+	// blocks accessed in storage order: read the next one in the background
+	if (b != last_block_) {
+		const unsigned int next = b + 1;
+		if (b == last_block_ + 1 && next < (na + bs_ - 1) / bs_ &&
+			cached_.find(next) == cached_.end() && prefetched_block_ != next) {
+			collect_prefetched_();
+			prefetched_block_ = next;
+			prefetch_thread_ = boost::thread(boost::bind
+				(&ISMRMRDAcquisitionsCache::prefetch_, this, next));
+		}
+		last_block_ = b;
+	}
+}
@@ -0,0 +1,92 @@
+/*
+CCP PETMR Synergistic Image Reconstruction Framework (SIRF)
+Copyright 2019 Rutherford Appleton Laboratory STFC
+
+This is software developed for the Collaborative Computational
+Project in Positron Emission Tomography and Magnetic Resonance imaging
+(http://www.ccppetmr.ac.uk/).
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+http://www.apache.org/licenses/LICENSE-2.0
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+*/
+
+/*!
+\file
+\ingroup Gadgetron Data Containers
+\brief Synthetic acquisitions shared by the MR data container tests.
+
+Acquisition i has 16 + i % 5 samples of 3 coils, kspace_encode_step_1
+equal to i and samples (i, c*ns + s), so that any acquisition read back
+can be checked against the one written.
+
+\author Evgueni Ovtchinnikov
+\author CCP PETMR
+*/
+
+#ifndef SIRF_TEST_ACQUISITIONS
+#define SIRF_TEST_ACQUISITIONS
+
+#include <stdexcept>
+
+#include <ismrmrd/ismrmrd.h>
+
+static const unsigned int NUM_COILS = 3;
+static const unsigned int TRAJ_DIMS = 2;
+
+inline unsigned int num_samples(unsigned int i)
+{
+	return 16 + i % 5;
+}
+
+// every 9th acquisition is a noise readout, which is TO_BE_IGNORED
+inline bool noise(unsigned int i)
+{
+	return i % 9 == 4;
+}
+
+inline void make_acquisition(unsigned int i, ISMRMRD::Acquisition& acq)
+{
+	const unsigned int ns = num_samples(i);
+	acq = ISMRMRD::Acquisition();
+	acq.resize(ns, NUM_COILS, TRAJ_DIMS);
+	acq.idx().kspace_encode_step_1 = i;
+	if (noise(i))
+		acq.setFlag(ISMRMRD::ISMRMRD_ACQ_IS_NOISE_MEASUREMENT);
+	for (unsigned int c = 0; c < NUM_COILS; c++)
+		for (unsigned int s = 0; s < ns; s++)
+			acq.data(s, c) = complex_float_t((float)i, (float)(c*ns + s));
+	for (unsigned int s = 0; s < ns; s++)
+		for (unsigned int d = 0; d < TRAJ_DIMS; d++)
+			acq.traj(d, s) = (float)(i + d);
+}
+
+inline void check_acquisition(unsigned int i, const ISMRMRD::Acquisition& acq)
+{
+	ISMRMRD::Acquisition expected;
+	make_acquisition(i, expected);
+	const ISMRMRD::AcquisitionHeader& head = acq.getHead();
+	if (head.idx.kspace_encode_step_1 != i ||
+		head.number_of_samples != num_samples(i) ||
+		head.active_channels != NUM_COILS ||
+		head.trajectory_dimensions != TRAJ_DIMS ||
+		head.flags != expected.getHead().flags)
+		throw std::runtime_error("acquisition header read incorrectly");
+	const size_t nd = acq.getNumberOfDataElements();
+	for (size_t k = 0; k < nd; k++)
+		if (acq.getDataPtr()[k] != expected.getDataPtr()[k])
+			throw std::runtime_error("acquisition samples read incorrectly");
+	const size_t nt = acq.getNumberOfTrajElements();
+	for (size_t k = 0; k < nt; k++)
+		if (acq.getTrajPtr()[k] != expected.getTrajPtr()[k])
+			throw std::runtime_error("acquisition trajectory read incorrectly");
+}
+
+#endif
@@ -0,0 +1,221 @@
+/*
+CCP PETMR Synergistic Image Reconstruction Framework (SIRF)
+Copyright 2019 Rutherford Appleton Laboratory STFC
+
+This is software developed for the Collaborative Computational
+Project in Positron Emission Tomography and Magnetic Resonance imaging
+(http://www.ccppetmr.ac.uk/).
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+http://www.apache.org/licenses/LICENSE-2.0
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+*/
+
+/*!
+\file
+\ingroup Gadgetron Data Containers
+\brief Test of the MR acquisition data algebra on each storage scheme,
+out of place and in place.
+
+\author Evgueni Ovtchinnikov
+\author CCP PETMR
+*/
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+#include "sirf/Gadgetron/gadgetron_data_containers.h"
+
+#include "test_acquisitions.h"
+
+using namespace sirf;
+
+static const unsigned int NUM_ACQS = 300;
+
+// the second operand: acquisition i has samples (1 + c, s/2) except
+// every 4th sample, which is zero
+static void make_denominator(unsigned int i, ISMRMRD::Acquisition& acq)
+{
+	make_acquisition(i, acq);
+	const unsigned int ns = num_samples(i);
+	for (unsigned int c = 0; c < NUM_COILS; c++)
+		for (unsigned int s = 0; s < ns; s++)
+			acq.data(s, c) = s % 4 == 0 ? complex_float_t(0.0f) :
+			complex_float_t(1.0f + c, 0.5f*s);
+}
+
+struct AxpbyRef {
+	AxpbyRef(complex_float_t a, complex_float_t b) : a_(a), b_(b) {}
+	complex_float_t operator()(complex_float_t x, complex_float_t y) const
+	{
+		return a_*x + b_*y;
+	}
+	complex_float_t a_;
+	complex_float_t b_;
+};
+
+struct MultiplyRef {
+	complex_float_t operator()(complex_float_t x, complex_float_t y) const
+	{
+		return x*y;
+	}
+};
+
+// zero denominators give zero
+struct DivideRef {
+	complex_float_t operator()(complex_float_t x, complex_float_t y) const
+	{
+		return std::norm(y) > 0 ? x / y : complex_float_t(0.0f);
+	}
+};
+
+/*
+Checks z against op applied to the operands' samples. The results of an
+operation out of place are the regular (not ignored) acquisitions only, in
+order; the result of an operation in place on the first operand also keeps
+the ignored acquisitions, unchanged.
+*/
+template<class Op>
+static void check_result
+(const MRAcquisitionData& z, bool in_place, Op op, const std::string& what)
+{
+	unsigned int num_regular = 0;
+	for (unsigned int i = 0; i < NUM_ACQS; i++)
+		if (!noise(i))
+			num_regular++;
+	if (z.number() != (in_place ? NUM_ACQS : num_regular))
+		throw std::runtime_error(what + ": wrong number of acquisitions");
+	ISMRMRD::Acquisition acq;
+	ISMRMRD::Acquisition x;
+	ISMRMRD::Acquisition y;
+	for (unsigned int i = 0, k = 0; i < NUM_ACQS; i++) {
+		if (noise(i) && !in_place)
+			continue;
+		z.get_acquisition(k++, acq);
+		make_acquisition(i, x);
+		make_denominator(i, y);
+		if (acq.getHead().idx.kspace_encode_step_1 != i)
+			throw std::runtime_error(what + ": acquisitions out of order");
+		const size_t n = acq.getNumberOfDataElements();
+		for (size_t j = 0; j < n; j++) {
+			const complex_float_t expected = noise(i) ? x.getDataPtr()[j] :
+				op(x.getDataPtr()[j], y.getDataPtr()[j]);
+			const float tol = 1e-5f * std::max(1.0f, std::abs(expected));
+			if (std::abs(acq.getDataPtr()[j] - expected) > tol)
+				throw std::runtime_error(what + ": wrong result");
+		}
+	}
+}
+
+/*
+The first operand is appended in reverse order and sorted, the second in
+storage order, so that the acquisitions of the first are accessed through
+its sort index.
+*/
+template<class Container>
+static void fill_operands(Container& x, Container& y)
+{
+	ISMRMRD::Acquisition acq;
+	for (unsigned int k = 0; k < NUM_ACQS; k++) {
+		make_acquisition(NUM_ACQS - 1 - k, acq);
+		x.append_acquisition(acq);
+		make_denominator(k, acq);
+		y.append_acquisition(acq);
+	}
+	x.sort();
+}
+
+template<class Container>
+static void test_algebra(const std::string& name)
+{
+	std::cout << "testing " << name << " algebra...\n";
+	const AcquisitionsInfo info("<ismrmrdHeader></ismrmrdHeader>");
+	const complex_float_t a(2.0f, -1.0f);
+	const complex_float_t b(0.5f, 3.0f);
+	{
+		Container x(info);
+		Container y(info);
+		fill_operands(x, y);
+
+		Container z_axpby(info);
+		z_axpby.axpby(&a, x, &b, y);
+		check_result(z_axpby, false, AxpbyRef(a, b), name + " axpby");
+		Container z_multiply(info);
+		z_multiply.multiply(x, y);
+		check_result(z_multiply, false, MultiplyRef(), name + " multiply");
+		Container z_divide(info);
+		z_divide.divide(x, y);
+		check_result(z_divide, false, DivideRef(), name + " divide");
+
+		double dot_re = 0;
+		double dot_im = 0;
+		double norm2 = 0;
+		ISMRMRD::Acquisition ax;
+		ISMRMRD::Acquisition ay;
+		for (unsigned int i = 0; i < NUM_ACQS; i++) {
+			if (noise(i))
+				continue;
+			make_acquisition(i, ax);
+			make_denominator(i, ay);
+			for (size_t j = 0; j < ax.getNumberOfDataElements(); j++) {
+				const complex_float_t p =
+					std::conj(ay.getDataPtr()[j]) * ax.getDataPtr()[j];
+				dot_re += p.real();
+				dot_im += p.imag();
+				norm2 += std::norm(ax.getDataPtr()[j]);
+			}
+		}
+		complex_float_t dot;
+		x.dot(y, &dot);
+		const double dot_abs = std::sqrt(dot_re*dot_re + dot_im*dot_im);
+		if (std::abs(dot.real() - dot_re) > 1e-5*dot_abs ||
+			std::abs(dot.imag() - dot_im) > 1e-5*dot_abs)
+			throw std::runtime_error(name + " dot: wrong result");
+		if (std::abs(x.norm() - std::sqrt(norm2)) > 1e-5*std::sqrt(norm2))
+			throw std::runtime_error(name + " norm: wrong result");
+	}
+	{
+		Container x(info);
+		Container y(info);
+		fill_operands(x, y);
+		x.axpby(&a, x, &b, y);
+		if (!x.sorted())
+			throw std::runtime_error(name + " in-place axpby: sort state lost");
+		check_result(x, true, AxpbyRef(a, b), name + " in-place axpby");
+	}
+	{
+		Container x(info);
+		Container y(info);
+		fill_operands(x, y);
+		x.divide(x, y);
+		if (!x.sorted())
+			throw std::runtime_error(name + " in-place divide: sort state lost");
+		check_result(x, true, DivideRef(), name + " in-place divide");
+	}
+}
+
+int main()
+{
+	try {
+		test_algebra<AcquisitionsVector>("AcquisitionsVector");
+		test_algebra<AcquisitionsArray>("AcquisitionsArray");
+		test_algebra<AcquisitionsFile>("AcquisitionsFile");
+	}
+	catch (const std::exception& error) {
+		std::cerr << "\nHere's the error:\n\t" << error.what() << "\n\n";
+		return EXIT_FAILURE;
+	}
+	std::cout << "done.\n";
+	return EXIT_SUCCESS;
+}
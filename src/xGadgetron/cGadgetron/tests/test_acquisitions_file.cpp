@@ -0,0 +1,127 @@
+/*
+CCP PETMR Synergistic Image Reconstruction Framework (SIRF)
+Copyright 2019 Rutherford Appleton Laboratory STFC
+
+This is software developed for the Collaborative Computational
+Project in Positron Emission Tomography and Magnetic Resonance imaging
+(http://www.ccppetmr.ac.uk/).
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+http://www.apache.org/licenses/LICENSE-2.0
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+*/
+
+/*!
+\file
+\ingroup Gadgetron Data Containers
+\brief Round trip test of AcquisitionsFile: batched writes through
+ISMRMRD::Dataset and reads through the block cache.
+
+\author Evgueni Ovtchinnikov
+\author CCP PETMR
+*/
+
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+
+#include "sirf/Gadgetron/gadgetron_data_containers.h"
+#include "sirf/Gadgetron/ismrmrd_reader.h"
+
+#include "test_acquisitions.h"
+
+using namespace sirf;
+
+static const unsigned int NUM_ACQS = 1000;
+static const unsigned int BLOCK_SIZE = 16;
+
+static void check_storage_order(const MRAcquisitionData& ac, unsigned int na)
+{
+	if (ac.number() != na)
+		throw std::runtime_error("wrong number of acquisitions in the file");
+	ISMRMRD::Acquisition acq;
+	for (unsigned int i = 0; i < na; i++) {
+		ac.get_acquisition(i, acq);
+		check_acquisition(i, acq);
+	}
+}
+
+static void check_random_order
+(const MRAcquisitionData& ac, unsigned int na, unsigned int nr)
+{
+	std::mt19937 generator(1);
+	std::uniform_int_distribution<unsigned int> distribution(0, na - 1);
+	ISMRMRD::Acquisition acq;
+	for (unsigned int r = 0; r < nr; r++) {
+		const unsigned int i = distribution(generator);
+		ac.get_acquisition(i, acq);
+		check_acquisition(i, acq);
+	}
+}
+
+int main()
+{
+	try {
+		const AcquisitionsInfo info("<ismrmrdHeader></ismrmrdHeader>");
+
+		// small blocks and a budget of about 3 blocks, so that reading the
+		// file goes through the background prefetch and evicts blocks
+		ISMRMRDAcquisitionsCache::set_block_size(BLOCK_SIZE);
+		size_t block_bytes = 0;
+		ISMRMRD::Acquisition acq;
+		for (unsigned int i = 0; i < BLOCK_SIZE; i++) {
+			make_acquisition(i, acq);
+			block_bytes += sizeof(ISMRMRD::AcquisitionHeader) +
+				acq.getNumberOfDataElements()*sizeof(complex_float_t) +
+				acq.getNumberOfTrajElements()*sizeof(float);
+		}
+		ISMRMRDAcquisitionsCache::set_memory_budget(3 * block_bytes);
+		AcquisitionsFile::set_write_batch_size(64);
+
+		std::cout << "appending acquisitions to a scratch file...\n";
+		AcquisitionsFile af(info);
+		for (unsigned int i = 0; i < NUM_ACQS; i++) {
+			make_acquisition(i, acq);
+			af.append_acquisition(acq);
+		}
+		// the last batch is still in memory
+		check_storage_order(af, NUM_ACQS);
+		af.flush();
+
+		std::cout << "reading acquisitions in storage order...\n";
+		for (int pass = 0; pass < 2; pass++)
+			check_storage_order(af, NUM_ACQS);
+
+		std::cout << "reading acquisitions in random order...\n";
+		check_random_order(af, NUM_ACQS, 5 * NUM_ACQS);
+
+		std::cout << "reading acquisitions in reverse order...\n";
+		for (unsigned int i = NUM_ACQS; i-- > 0;) {
+			af.get_acquisition(i, acq);
+			check_acquisition(i, acq);
+		}
+
+		std::cout << "appending after reading...\n";
+		for (unsigned int i = NUM_ACQS; i < NUM_ACQS + 10; i++) {
+			make_acquisition(i, acq);
+			af.append_acquisition(acq);
+		}
+		check_random_order(af, NUM_ACQS + 10, NUM_ACQS);
+		af.flush();
+		check_storage_order(af, NUM_ACQS + 10);
+	}
+	catch (const std::exception& error) {
+		std::cerr << "\nHere's the error:\n\t" << error.what() << "\n\n";
+		return EXIT_FAILURE;
+	}
+	std::cout << "done.\n";
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,205 @@
+/*
+CCP PETMR Synergistic Image Reconstruction Framework (SIRF)
+Copyright 2019 Rutherford Appleton Laboratory STFC
+
+This is software developed for the Collaborative Computational
+Project in Positron Emission Tomography and Magnetic Resonance imaging
+(http://www.ccppetmr.ac.uk/).
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+http://www.apache.org/licenses/LICENSE-2.0
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+*/
+
+/*!
+\file
+\ingroup Gadgetron Data Containers
+\brief Test of the acquisition header index against the acquisition
+headers, before and after sorting, on each storage scheme.
+
+\author Evgueni Ovtchinnikov
+\author CCP PETMR
+*/
+
+#include <algorithm>
+#include <array>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "sirf/Gadgetron/gadgetron_data_containers.h"
+
+#include "test_acquisitions.h"
+
+using namespace sirf;
+
+static const unsigned int NUM_ACQS = 300;
+
+// encoding counters that put the acquisitions out of order: sort() must
+// reorder them by repetition, phase, slice and kspace_encode_step_1,
+// sort_by_time() reverses them
+static void make_counted_acquisition(unsigned int i, ISMRMRD::Acquisition& acq)
+{
+	make_acquisition(i, acq);
+	ISMRMRD::EncodingCounters& idx = acq.idx();
+	idx.kspace_encode_step_2 = i % 7;
+	idx.average = i % 4;
+	idx.slice = i % 3;
+	idx.contrast = i % 2;
+	idx.phase = (i / 3) % 2;
+	idx.repetition = (NUM_ACQS - 1 - i) / 50;
+	idx.set = i % 5;
+	idx.segment = i % 6;
+	acq.acquisition_time_stamp() = NUM_ACQS - i;
+}
+
+static void check_entry
+(const AcquisitionsHeaderIndex::Entry& e, const ISMRMRD::Acquisition& acq,
+	const std::string& what)
+{
+	const ISMRMRD::AcquisitionHeader& head = acq.getHead();
+	const ISMRMRD::EncodingCounters& idx = head.idx;
+	if (e.flags() != head.flags ||
+		e.kspace_encode_step_1() != idx.kspace_encode_step_1 ||
+		e.kspace_encode_step_2() != idx.kspace_encode_step_2 ||
+		e.average() != idx.average ||
+		e.slice() != idx.slice ||
+		e.contrast() != idx.contrast ||
+		e.phase() != idx.phase ||
+		e.repetition() != idx.repetition ||
+		e.set() != idx.set ||
+		e.segment() != idx.segment ||
+		e.acquisition_time_stamp() != head.acquisition_time_stamp ||
+		e.number_of_samples() != head.number_of_samples ||
+		e.active_channels() != head.active_channels)
+		throw std::runtime_error(what + ": header index entry differs from header");
+	if (bool(TO_BE_IGNORED(e)) != bool(TO_BE_IGNORED(acq)))
+		throw std::runtime_error(what + ": TO_BE_IGNORED differs");
+}
+
+// header_entry(k) describes get_acquisition(k), sorted or not
+static void check_entries(const MRAcquisitionData& ac, const std::string& what)
+{
+	if (ac.header_index().size() != ac.items())
+		throw std::runtime_error(what + ": wrong header index size");
+	ISMRMRD::Acquisition acq;
+	for (unsigned int k = 0; k < ac.number(); k++) {
+		ac.get_acquisition(k, acq);
+		check_entry(ac.header_entry(k), acq, what);
+	}
+}
+
+// acquisition numbers i in the order sort() must produce
+static std::vector<unsigned int> sorted_order()
+{
+	typedef std::array<unsigned int, 5> tuple;
+	std::vector<tuple> vt;
+	ISMRMRD::Acquisition acq;
+	for (unsigned int i = 0; i < NUM_ACQS; i++) {
+		make_counted_acquisition(i, acq);
+		const ISMRMRD::EncodingCounters& idx = acq.idx();
+		tuple t = { { idx.repetition, idx.phase, idx.slice,
+			idx.kspace_encode_step_1, i } };
+		vt.push_back(t);
+	}
+	std::sort(vt.begin(), vt.end());
+	std::vector<unsigned int> order;
+	for (size_t k = 0; k < vt.size(); k++)
+		order.push_back(vt[k][4]);
+	return order;
+}
+
+static void check_order
+(const MRAcquisitionData& ac, const std::vector<unsigned int>& order,
+	const std::string& what)
+{
+	ISMRMRD::Acquisition acq;
+	for (unsigned int k = 0; k < ac.number(); k++) {
+		ac.get_acquisition(k, acq);
+		if (acq.idx().kspace_encode_step_1 != order[k])
+			throw std::runtime_error(what + ": acquisitions in wrong order");
+	}
+}
+
+template<class Container>
+static void test_index(Container& ac, const std::string& name, bool settable)
+{
+	std::cout << "testing " << name << " header index...\n";
+	ISMRMRD::Acquisition acq;
+	for (unsigned int i = 0; i < NUM_ACQS; i++) {
+		make_counted_acquisition(i, acq);
+		ac.append_acquisition(acq);
+	}
+	check_entries(ac, name + " appended");
+
+	ac.sort();
+	check_order(ac, sorted_order(), name + " sort");
+	check_entries(ac, name + " sorted");
+
+	std::vector<unsigned int> reversed;
+	for (unsigned int i = NUM_ACQS; i-- > 0;)
+		reversed.push_back(i);
+	ac.sort_by_time();
+	check_order(ac, reversed, name + " sort_by_time");
+	check_entries(ac, name + " sorted by time");
+
+	if (!settable)
+		return;
+	// replacing an acquisition updates its entry, found via the sort index
+	for (unsigned int k = 0; k < NUM_ACQS; k += 7) {
+		ac.get_acquisition(k, acq);
+		acq.idx().slice += 10;
+		acq.setFlag(ISMRMRD::ISMRMRD_ACQ_IS_NOISE_MEASUREMENT);
+		ac.set_acquisition(k, acq);
+	}
+	check_entries(ac, name + " after set_acquisition");
+}
+
+int main()
+{
+	const std::string filename = "test_acquisitions_header_index.h5";
+	try {
+		const AcquisitionsInfo info("<ismrmrdHeader></ismrmrdHeader>");
+		AcquisitionsVector av(info);
+		test_index(av, "AcquisitionsVector", true);
+		AcquisitionsArray aa(info);
+		test_index(aa, "AcquisitionsArray", true);
+		AcquisitionsFile af(info);
+		test_index(af, "AcquisitionsFile", false);
+
+		// the index of an existing file is read from the headers alone
+		std::cout << "testing the header index of a file read...\n";
+		{
+			AcquisitionsVector written(info);
+			ISMRMRD::Acquisition acq;
+			for (unsigned int i = 0; i < NUM_ACQS; i++) {
+				make_counted_acquisition(i, acq);
+				written.append_acquisition(acq);
+			}
+			written.write(filename);
+		}
+		AcquisitionsFile read(filename);
+		check_entries(read, "AcquisitionsFile read");
+		read.sort();
+		check_order(read, sorted_order(), "AcquisitionsFile read sort");
+		check_entries(read, "AcquisitionsFile read sorted");
+	}
+	catch (const std::exception& error) {
+		std::cerr << "\nHere's the error:\n\t" << error.what() << "\n\n";
+		std::remove(filename.c_str());
+		return EXIT_FAILURE;
+	}
+	std::remove(filename.c_str());
+	std::cout << "done.\n";
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,227 @@
+/*
+CCP PETMR Synergistic Image Reconstruction Framework (SIRF)
+Copyright 2019 Rutherford Appleton Laboratory STFC
+
+This is software developed for the Collaborative Computational
+Project in Positron Emission Tomography and Magnetic Resonance imaging
+(http://www.ccppetmr.ac.uk/).
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+http://www.apache.org/licenses/LICENSE-2.0
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+*/
+
+/*!
+\file
+\ingroup Gadgetron Data Containers
+\brief Test of acquisition views: selection, headers, algebra and writing
+through to the parent.
+
+\author Evgueni Ovtchinnikov
+\author CCP PETMR
+*/
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "sirf/Gadgetron/gadgetron_data_containers.h"
+
+#include "test_acquisitions.h"
+
+using namespace sirf;
+
+static const unsigned int NUM_ACQS = 300;
+
+// acquisitions in blocks of 5 of alternating contrast, so that the k-th
+// acquisitions of the two contrasts (i and i + 5) have the same size;
+// none is ignored
+static void make_contrast_acquisition(unsigned int i, ISMRMRD::Acquisition& acq)
+{
+	make_acquisition(i, acq);
+	acq.clearAllFlags();
+	acq.idx().contrast = (i / 5) % 2;
+}
+
+// the acquisition number of the k-th acquisition of a contrast
+static unsigned int contrast_acquisition(unsigned int contrast, unsigned int k)
+{
+	return (k / 5) * 10 + contrast * 5 + k % 5;
+}
+
+static complex_float_t expected_sample(unsigned int i, size_t j)
+{
+	ISMRMRD::Acquisition expected;
+	make_contrast_acquisition(i, expected);
+	return expected.getDataPtr()[j];
+}
+
+// the parent is appended in reverse order and sorted, so that the view
+// reaches the parent's acquisitions through the parent's sort index
+static gadgetron::shared_ptr<MRAcquisitionData> make_parent()
+{
+	gadgetron::shared_ptr<MRAcquisitionData> sptr_parent
+		(new AcquisitionsVector(AcquisitionsInfo("<ismrmrdHeader></ismrmrdHeader>")));
+	ISMRMRD::Acquisition acq;
+	for (unsigned int i = NUM_ACQS; i-- > 0;) {
+		make_contrast_acquisition(i, acq);
+		sptr_parent->append_acquisition(acq);
+	}
+	sptr_parent->sort();
+	return sptr_parent;
+}
+
+static void check_selection
+(const AcquisitionsView& view, unsigned int contrast, const std::string& what)
+{
+	if (view.number() != NUM_ACQS / 2)
+		throw std::runtime_error(what + ": wrong number of acquisitions");
+	ISMRMRD::Acquisition acq;
+	for (unsigned int k = 0; k < view.number(); k++) {
+		const unsigned int i = contrast_acquisition(contrast, k);
+		view.get_acquisition(k, acq);
+		if (acq.idx().kspace_encode_step_1 != i || acq.idx().contrast != contrast)
+			throw std::runtime_error(what + ": wrong acquisition selected");
+		const AcquisitionsHeaderIndex::Entry e = view.header_entry(k);
+		if (e.kspace_encode_step_1() != i || e.contrast() != contrast ||
+			e.number_of_samples() != num_samples(i))
+			throw std::runtime_error(what + ": wrong header entry");
+	}
+}
+
+int main()
+{
+	try {
+		const complex_float_t a(2.0f, -1.0f);
+		const complex_float_t b(0.5f, 3.0f);
+
+		std::cout << "selecting acquisitions...\n";
+		gadgetron::shared_ptr<MRAcquisitionData> sptr_parent = make_parent();
+		gadgetron::shared_ptr<AcquisitionsView> sptr_x =
+			AcquisitionsView::select(sptr_parent, "contrast", 0, 0);
+		gadgetron::shared_ptr<AcquisitionsView> sptr_y =
+			AcquisitionsView::select(sptr_parent, "contrast", 1, 1);
+		check_selection(*sptr_x, 0, "contrast 0");
+		check_selection(*sptr_y, 1, "contrast 1");
+
+		// a view of a view refers to the parent directly
+		gadgetron::shared_ptr<AcquisitionsView> sptr_xx =
+			AcquisitionsView::select(sptr_x, "kspace_encode_step_1", 100, 199);
+		if (&sptr_xx->parent() != sptr_parent.get())
+			throw std::runtime_error("view of a view: wrong parent");
+		ISMRMRD::Acquisition acq;
+		for (unsigned int k = 0; k < sptr_xx->number(); k++) {
+			sptr_xx->get_acquisition(k, acq);
+			const unsigned int i = acq.idx().kspace_encode_step_1;
+			if (i < 100 || i > 199 || acq.idx().contrast != 0)
+				throw std::runtime_error("view of a view: wrong acquisition");
+		}
+
+		std::cout << "algebra on views...\n";
+		const unsigned int n = sptr_x->number();
+		AcquisitionsVector z;
+		z.axpby(&a, *sptr_x, &b, *sptr_y);
+		if (z.number() != n)
+			throw std::runtime_error("axpby: wrong number of acquisitions");
+		double dot_re = 0;
+		double dot_im = 0;
+		double norm2 = 0;
+		for (unsigned int k = 0; k < n; k++) {
+			const unsigned int ix = contrast_acquisition(0, k);
+			const unsigned int iy = contrast_acquisition(1, k);
+			z.get_acquisition(k, acq);
+			for (size_t j = 0; j < acq.getNumberOfDataElements(); j++) {
+				const complex_float_t x = expected_sample(ix, j);
+				const complex_float_t y = expected_sample(iy, j);
+				const complex_float_t expected = a*x + b*y;
+				if (std::abs(acq.getDataPtr()[j] - expected) >
+					1e-5f * std::max(1.0f, std::abs(expected)))
+					throw std::runtime_error("axpby: wrong result");
+				const complex_float_t p = std::conj(y) * x;
+				dot_re += p.real();
+				dot_im += p.imag();
+				norm2 += std::norm(x);
+			}
+		}
+		complex_float_t dot;
+		sptr_x->dot(*sptr_y, &dot);
+		const double dot_abs = std::sqrt(dot_re*dot_re + dot_im*dot_im);
+		if (std::abs(dot.real() - dot_re) > 1e-5*dot_abs ||
+			std::abs(dot.imag() - dot_im) > 1e-5*dot_abs)
+			throw std::runtime_error("dot: wrong result");
+		if (std::abs(sptr_x->norm() - std::sqrt(norm2)) > 1e-5*std::sqrt(norm2))
+			throw std::runtime_error("norm: wrong result");
+
+		std::cout << "writing through views...\n";
+		// in place: the results replace the parent's contrast 0 acquisitions
+		sptr_x->axpby(&a, *sptr_x, &b, *sptr_y);
+		for (unsigned int k = 0; k < NUM_ACQS; k++) {
+			sptr_parent->get_acquisition(k, acq);
+			const unsigned int i = acq.idx().kspace_encode_step_1;
+			const bool changed = acq.idx().contrast == 0;
+			for (size_t j = 0; j < acq.getNumberOfDataElements(); j++) {
+				const complex_float_t x = expected_sample(i, j);
+				const complex_float_t expected = changed ?
+					a*x + b*expected_sample(i + 5, j) : x;
+				if (std::abs(acq.getDataPtr()[j] - expected) >
+					1e-5f * std::max(1.0f, std::abs(expected)))
+					throw std::runtime_error("in-place axpby: wrong parent data");
+			}
+		}
+		// copy_acquisitions_data: contrast 1 acquisitions become z's
+		sptr_y->copy_acquisitions_data(z);
+		// set_data: contrast 0 acquisitions become (k, j)
+		std::vector<complex_float_t> data;
+		for (unsigned int k = 0; k < n; k++)
+			for (unsigned int j = 0; j < NUM_COILS*num_samples
+				(contrast_acquisition(0, k)); j++)
+				data.push_back(complex_float_t((float)k, (float)j));
+		sptr_x->set_data(&data[0]);
+		ISMRMRD::Acquisition acq_z;
+		for (unsigned int k = 0, d = 0; k < n; k++) {
+			sptr_parent->get_acquisition(contrast_acquisition(1, k), acq);
+			z.get_acquisition(k, acq_z);
+			for (size_t j = 0; j < acq.getNumberOfDataElements(); j++)
+				if (acq.getDataPtr()[j] != acq_z.getDataPtr()[j])
+					throw std::runtime_error
+					("copy_acquisitions_data: wrong parent data");
+			sptr_parent->get_acquisition(contrast_acquisition(0, k), acq);
+			for (size_t j = 0; j < acq.getNumberOfDataElements(); j++, d++)
+				if (acq.getDataPtr()[j] != data[d])
+					throw std::runtime_error("set_data: wrong parent data");
+		}
+
+		std::cout << "reading headers through views...\n";
+		// headers changed in the parent are seen by the view
+		for (unsigned int k = 0; k < n; k += 3) {
+			const unsigned int i = contrast_acquisition(0, k);
+			sptr_parent->get_acquisition(i, acq);
+			acq.setFlag(ISMRMRD::ISMRMRD_ACQ_IS_NOISE_MEASUREMENT);
+			sptr_parent->set_acquisition(i, acq);
+		}
+		std::vector<int> regular;
+		sptr_x->get_regular_acquisitions(regular);
+		if (regular.size() != n - (n + 2) / 3)
+			throw std::runtime_error("ignored acquisitions not seen by the view");
+		for (unsigned int k = 0; k < n; k++)
+			if (bool(TO_BE_IGNORED(sptr_x->header_entry(k))) != (k % 3 == 0))
+				throw std::runtime_error("parent header change not seen by the view");
+	}
+	catch (const std::exception& error) {
+		std::cerr << "\nHere's the error:\n\t" << error.what() << "\n\n";
+		return EXIT_FAILURE;
+	}
+	std::cout << "done.\n";
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,191 @@
+/*
+CCP PETMR Synergistic Image Reconstruction Framework (SIRF)
+Copyright 2019 Rutherford Appleton Laboratory STFC
+
+This is software developed for the Collaborative Computational
+Project in Positron Emission Tomography and Magnetic Resonance imaging
+(http://www.ccppetmr.ac.uk/).
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+http://www.apache.org/licenses/LICENSE-2.0
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+*/
+
+/*!
+\file
+\ingroup Gadgetron Extensions
+\brief Test of the 3D FFTs with cached plans: the transform against the
+discrete Fourier transform, in place against out of place, and fft3c
+followed by ifft3c against the identity, for each FFTW planner and
+number of threads.
+
+\author Evgueni Ovtchinnikov
+\author CCP PETMR
+*/
+
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <ismrmrd/ismrmrd.h>
+
+#include "sirf/Gadgetron/ismrmrd_fftw.h"
+
+using namespace ISMRMRD;
+
+typedef NDArray<complex_float_t> Array;
+
+static void fill_random(Array& a, unsigned int seed)
+{
+	std::mt19937 generator(seed);
+	std::uniform_real_distribution<float> distribution(-1.0f, 1.0f);
+	complex_float_t* ptr = a.getDataPtr();
+	for (size_t i = 0; i < a.getNumberOfElements(); i++)
+		ptr[i] = complex_float_t(distribution(generator), distribution(generator));
+}
+
+// relative l2 distance between a and b
+static double difference(const Array& a, const Array& b)
+{
+	const complex_float_t* pa = a.getDataPtr();
+	const complex_float_t* pb = b.getDataPtr();
+	double d = 0;
+	double s = 0;
+	for (size_t i = 0; i < a.getNumberOfElements(); i++) {
+		d += std::norm(pa[i] - pb[i]);
+		s += std::norm(pa[i]);
+	}
+	return std::sqrt(d / s);
+}
+
+// fft3 of a (dims[0] varying fastest) computed from the definition
+static void dft3(const Array& a, Array& r)
+{
+	const size_t* dims = a.getDims();
+	const size_t nx = dims[0];
+	const size_t ny = dims[1];
+	const size_t nz = dims[2];
+	const size_t size = nx*ny*nz;
+	const size_t num = a.getNumberOfElements() / size;
+	const double pi = std::acos(-1.0);
+	const double scale = 1.0 / std::sqrt((double)size);
+	for (size_t v = 0; v < num; v++) {
+		const complex_float_t* in = a.getDataPtr() + v*size;
+		complex_float_t* out = r.getDataPtr() + v*size;
+		for (size_t kz = 0; kz < nz; kz++)
+		for (size_t ky = 0; ky < ny; ky++)
+		for (size_t kx = 0; kx < nx; kx++) {
+			std::complex<double> sum = 0;
+			for (size_t z = 0; z < nz; z++)
+			for (size_t y = 0; y < ny; y++)
+			for (size_t x = 0; x < nx; x++) {
+				const double phase = -2 * pi*((double)(kx*x) / nx +
+					(double)(ky*y) / ny + (double)(kz*z) / nz);
+				sum += std::complex<double>(in[(z*ny + y)*nx + x]) *
+					std::polar(1.0, phase);
+			}
+			out[(kz*ny + ky)*nx + kx] = complex_float_t(sum * scale);
+		}
+	}
+}
+
+static void check(double d, double tol, const std::string& what)
+{
+	if (!(d <= tol))
+		throw std::runtime_error(what + ": relative difference too large");
+}
+
+/*
+Shapes covering the three paths of fft3c/ifft3c: small volumes, one
+per OpenMP thread if there are enough; a single large volume, transformed
+by FFTW threads if available; and the odd dimensions that make the
+centring shifts differ from their inverses.
+*/
+static void test_shape(size_t nx, size_t ny, size_t nz, size_t num,
+	const std::string& what)
+{
+	std::vector<size_t> dims;
+	dims.push_back(nx);
+	dims.push_back(ny);
+	dims.push_back(nz);
+	if (num > 1)
+		dims.push_back(num);
+	Array a(dims);
+	fill_random(a, (unsigned int)(nx*ny*nz*num));
+
+	// in place and out of place give the same result, forward and back
+	for (int forward = 1; forward >= 0; forward--) {
+		Array b(a);
+		Array r(dims);
+		fft3(b, r, forward != 0);
+		fft3(b, forward != 0);
+		check(difference(r, b), 1e-5, what + " in place vs out of place");
+	}
+
+	Array b(a);
+	fft3c(b);
+	// the transform is unitary
+	double na = 0;
+	double nb = 0;
+	for (size_t i = 0; i < a.getNumberOfElements(); i++) {
+		na += std::norm(a.getDataPtr()[i]);
+		nb += std::norm(b.getDataPtr()[i]);
+	}
+	check(std::abs(std::sqrt(nb) - std::sqrt(na)) / std::sqrt(na), 1e-5,
+		what + " norm");
+	ifft3c(b);
+	check(difference(a, b), 1e-5, what + " ifft3c(fft3c(a))");
+}
+
+int main()
+{
+	try {
+		std::cout << "checking fft3 against the DFT...\n";
+		{
+			std::vector<size_t> dims;
+			dims.push_back(5);
+			dims.push_back(4);
+			dims.push_back(3);
+			dims.push_back(2);
+			Array a(dims);
+			fill_random(a, 1);
+			Array b(a);
+			fft3(b, true);
+			Array r(dims);
+			dft3(a, r);
+			check(difference(r, b), 1e-5, "fft3 vs DFT");
+		}
+
+		const char* planners[] = { "estimate", "measure", "patient" };
+		const int threads[] = { 1, 4 };
+		for (int p = 0; p < 3; p++) {
+			set_fft_planner(planners[p]);
+			for (int t = 0; t < 2; t++) {
+				set_fft_threads(threads[t]);
+				const std::string what = std::string("planner ") + planners[p] +
+					", threads " + std::to_string(threads[t]) + ":";
+				std::cout << what << '\n';
+				test_shape(16, 16, 8, 12, what + " 12 volumes");
+				test_shape(64, 32, 16, 1, what + " large volume");
+				test_shape(7, 5, 3, 2, what + " odd dimensions");
+			}
+		}
+	}
+	catch (const std::exception& error) {
+		std::cerr << "\nHere's the error:\n\t" << error.what() << "\n\n";
+		return EXIT_FAILURE;
+	}
+	std::cout << "done.\n";
+	return EXIT_SUCCESS;
+}
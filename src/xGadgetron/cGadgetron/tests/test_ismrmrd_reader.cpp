@@ -0,0 +1,128 @@
+/*
+CCP PETMR Synergistic Image Reconstruction Framework (SIRF)
+Copyright 2019 Rutherford Appleton Laboratory STFC
+
+This is software developed for the Collaborative Computational
+Project in Positron Emission Tomography and Magnetic Resonance imaging
+(http://www.ccppetmr.ac.uk/).
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+http://www.apache.org/licenses/LICENSE-2.0
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+*/
+
+/*!
+\file
+\ingroup Gadgetron Data Containers
+\brief Test of the bulk reader of ISMRMRD acquisitions on a file written
+by the ISMRMRD library.
+
+\author Evgueni Ovtchinnikov
+\author CCP PETMR
+*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <ismrmrd/dataset.h>
+
+#include "sirf/Gadgetron/gadgetron_data_containers.h"
+#include "sirf/Gadgetron/ismrmrd_reader.h"
+
+#include "test_acquisitions.h"
+
+using namespace sirf;
+
+static const unsigned int NUM_ACQS = 1000;
+
+int main()
+{
+	const std::string filename = "test_ismrmrd_reader.h5";
+	try {
+		// the file is written by the ISMRMRD library, one acquisition at a time
+		{
+			ISMRMRD::Dataset dataset(filename.c_str(), "dataset", true);
+			dataset.writeHeader("<ismrmrdHeader></ismrmrdHeader>");
+			ISMRMRD::Acquisition acq;
+			for (unsigned int i = 0; i < NUM_ACQS; i++) {
+				make_acquisition(i, acq);
+				dataset.appendAcquisition(acq);
+			}
+		}
+		unsigned int num_ignored = 0;
+		for (unsigned int i = 0; i < NUM_ACQS; i++)
+			if (noise(i))
+				num_ignored++;
+
+		ISMRMRD::Acquisition acq;
+		// the ISMRMRD library opens files for writing, which HDF5 refuses
+		// while the reader has the file open: the reader is closed first
+		{
+			std::cout << "reading all acquisitions in blocks...\n";
+			ISMRMRDAcquisitionsReader reader(filename);
+			if (reader.number() != NUM_ACQS)
+				throw std::runtime_error("wrong number of acquisitions in the file");
+			// a block size that does not divide the number of acquisitions
+			reader.set_block_size(77);
+			AcquisitionsVector all;
+			if (reader.read(all, true) != NUM_ACQS || all.number() != NUM_ACQS)
+				throw std::runtime_error("wrong number of acquisitions read");
+			for (unsigned int i = 0; i < NUM_ACQS; i++) {
+				all.get_acquisition(i, acq);
+				check_acquisition(i, acq);
+			}
+		}
+
+		std::cout << "reading acquisitions skipping the ignored ones...\n";
+		AcquisitionsVector av;
+		av.read(filename);
+		if (av.number() != NUM_ACQS - num_ignored)
+			throw std::runtime_error("wrong number of acquisitions not ignored");
+		for (unsigned int i = 0, a = 0; i < NUM_ACQS; i++) {
+			if (noise(i))
+				continue;
+			av.get_acquisition(a++, acq);
+			check_acquisition(i, acq);
+		}
+
+		std::cout << "reading a range of acquisitions...\n";
+		ISMRMRDAcquisitionsReader reader(filename);
+		std::vector<ISMRMRD::Acquisition> acqs;
+		reader.read(NUM_ACQS - 10, 10, acqs);
+		for (unsigned int i = 0; i < 10; i++)
+			check_acquisition(NUM_ACQS - 10 + i, acqs[i]);
+
+		std::cout << "reading acquisition headers...\n";
+		AcquisitionsHeaderIndex index;
+		reader.read_headers(index);
+		if (index.size() != NUM_ACQS)
+			throw std::runtime_error("wrong number of acquisition headers read");
+		for (unsigned int i = 0; i < NUM_ACQS; i++) {
+			AcquisitionsHeaderIndex::Entry e = index.entry(i);
+			if (e.kspace_encode_step_1() != i ||
+				e.number_of_samples() != num_samples(i) ||
+				e.active_channels() != NUM_COILS ||
+				bool(TO_BE_IGNORED(e)) != noise(i))
+				throw std::runtime_error("acquisition header indexed incorrectly");
+		}
+	}
+	catch (const std::exception& error) {
+		std::cerr << "\nHere's the error:\n\t" << error.what() << "\n\n";
+		std::remove(filename.c_str());
+		return EXIT_FAILURE;
+	}
+	std::remove(filename.c_str());
+	std::cout << "done.\n";
+	return EXIT_SUCCESS;
+}
@@ -700,6 +700,10 @@ class AcquisitionData(DataContainer):
         scheme = 'memory':
             all acquisition data generated from now on will be kept in RAM
             (avoid if data is very large)
+        scheme = 'array':
+            as 'memory', but with all acquisition headers and all samples
+            kept in two contiguous arrays, which is faster and takes less
+            memory for data with many readouts
         '''
         try_calling(pygadgetron.cGT_setAcquisitionDataStorageScheme(scheme))
     @staticmethod
@@ -748,6 +752,35 @@ class AcquisitionData(DataContainer):
         '''
         ap = AcquisitionDataProcessor(list)
         return ap.process(self)
+    def select(self, **criteria):
+        '''
+        Returns a view of the acquisitions satisfying given criteria on
+        their encoding counters, e.g.
+            acq_data.select(slice = 2, repetition = (0, 3))
+        selects the acquisitions in slice 2 and repetitions 0 to 3.
+        criteria: keyword arguments named after encoding counters
+                  (kspace_encode_step_1, kspace_encode_step_2, average,
+                  slice, contrast, phase, repetition, set, segment), each
+                  value being either an int or an inclusive range (first, last)
+        No acquisition data is copied: the view reads (and writes) the
+        acquisitions of self, and can be used wherever AcquisitionData can.
+        '''
+        assert self.handle is not None
+        if len(criteria) < 1:
+            raise error('no selection criteria specified')
+        view = self
+        for field, value in criteria.items():
+            if isinstance(value, (tuple, list)):
+                first, last = value
+            else:
+                first = last = value
+            selected = AcquisitionData()
+            selected.handle = pygadgetron.cGT_selectAcquisitions\
+                (view.handle, field, int(first), int(last))
+            check_status(selected.handle)
+            selected.sorted = view.sorted
+            view = selected
+        return view
     def acquisition(self, num):
         '''
         Returns the specified acquisition.
@@ -0,0 +1,558 @@
+/*
+CCP PETMR Synergistic Image Reconstruction Framework (SIRF)
+Copyright 2019 Rutherford Appleton Laboratory STFC
+
+This is software developed for the Collaborative Computational
+Project in Positron Emission Tomography and Magnetic Resonance imaging
+(http://www.ccppetmr.ac.uk/).
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+http://www.apache.org/licenses/LICENSE-2.0
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+*/
+/*!
+\file
+\ingroup STIR Extensions
+\brief Synthetic performance benchmarks of the SIRF interface to STIR.
+
+Builds mMR acquisition geometries (span, maximum ring difference and view
+mashing set on the command line), a random phantom and synthetic listmode
+data, and times DataContainer algebra, forward and backward projection,
+sensitivity computation, subset gradients and listmode-to-sinograms
+conversion. No external data are needed; the results are written as JSON
+for tracking performance between SIRF versions.
+
+Usage:
+
+	sirf_bench_pet [-o <file>] [-r <repeats>] [-s <subsets>]
+		[-g <span>,<max ring difference>,<view mash factor>]...
+		[-e <listmode events>] [--storage memory|file|compressed] [--full]
+
+By default two reduced geometries are benchmarked (span 11 with view
+mashing 4, and span 1 with maximum ring difference 10 and view mashing 8);
+--full adds the full span 11 and span 1 geometries.
+
+\author Evgueni Ovtchinnikov
+\author CCP PETMR
+*/
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "stir/ExamInfo.h"
+#include "stir/HighResWallClockTimer.h"
+#include "stir/ImagingModality.h"
+#include "stir/Scanner.h"
+
+#include "sirf/STIR/stir_x.h"
+
+#ifndef SIRF_VERSION
+#define SIRF_VERSION "unknown"
+#endif
+
+using namespace stir;
+using namespace sirf;
+
+struct Geometry {
+	int span;
+	int max_ring_diff;
+	int view_mash_factor;
+	std::string name() const
+	{
+		std::stringstream s;
+		s << "mMR span " << span << " mrd " << max_ring_diff
+			<< " mash " << view_mash_factor;
+		return s.str();
+	}
+};
+
+struct CaseResult {
+	std::string name;
+	std::string geometry;
+	std::vector<double> times;
+	std::string status;
+};
+
+class Benchmark {
+public:
+	Benchmark(int repeats) : _repeats(repeats) {}
+	//! Times repeats calls of f, recording the failure message if it throws
+	void run(const std::string& name, const std::string& geometry,
+		std::function<void()> f, int repeats = 0)
+	{
+		CaseResult result;
+		result.name = name;
+		result.geometry = geometry;
+		result.status = "ok";
+		if (repeats < 1)
+			repeats = _repeats;
+		std::cerr << geometry << ": " << name << "..." << std::flush;
+		try {
+			for (int i = 0; i < repeats; i++) {
+				HighResWallClockTimer timer;
+				timer.start();
+				f();
+				timer.stop();
+				result.times.push_back(timer.value());
+			}
+		}
+		catch (LocalisedException& le) {
+			result.status = le.what();
+		}
+		catch (std::exception& e) {
+			result.status = e.what();
+		}
+		catch (...) {
+			result.status = "unhandled exception";
+		}
+		std::cerr << ' ' << result.status << std::endl;
+		_results.push_back(result);
+	}
+	void write_json(std::ostream& out) const;
+
+private:
+	int _repeats;
+	std::vector<CaseResult> _results;
+};
+
+static std::string
+json_string(const std::string& s)
+{
+	std::string js("\"");
+	for (size_t i = 0; i < s.size(); i++) {
+		const char c = s[i];
+		if (c == '"' || c == '\\')
+			js += '\\';
+		if (c == '\n')
+			js += "\\n";
+		else
+			js += c;
+	}
+	return js + '"';
+}
+
+void
+Benchmark::write_json(std::ostream& out) const
+{
+	int threads = 1;
+#ifdef _OPENMP
+	threads = omp_get_max_threads();
+#endif
+	out << "{\n  \"benchmark\": \"sirf_bench_pet\",\n";
+	out << "  \"sirf_version\": " << json_string(SIRF_VERSION) << ",\n";
+	out << "  \"threads\": " << threads << ",\n";
+	out << "  \"cases\": [";
+	for (size_t i = 0; i < _results.size(); i++) {
+		const CaseResult& r = _results[i];
+		double tmin = 0, tmax = 0, tsum = 0;
+		for (size_t j = 0; j < r.times.size(); j++) {
+			const double t = r.times[j];
+			if (j == 0 || t < tmin)
+				tmin = t;
+			if (t > tmax)
+				tmax = t;
+			tsum += t;
+		}
+		const size_t n = r.times.size();
+		out << (i ? ",\n" : "\n");
+		out << "    {\"name\": " << json_string(r.name)
+			<< ", \"geometry\": " << json_string(r.geometry)
+			<< ", \"repeats\": " << n
+			<< ", \"min\": " << tmin
+			<< ", \"mean\": " << (n ? tsum / n : 0.0)
+			<< ", \"max\": " << tmax
+			<< ", \"status\": " << json_string(r.status) << "}";
+	}
+	out << "\n  ]\n}\n";
+}
+
+// uniform cylinder with a few random hot spheres
+static void
+make_phantom(STIRImageData& image, std::mt19937& rng)
+{
+	Image3DF& data = image.data();
+	const int nz = data.get_max_index() - data.get_min_index() + 1;
+	const int ny = data[0].get_max_index() - data[0].get_min_index() + 1;
+	const int nx = data[0][0].get_max_index() - data[0][0].get_min_index() + 1;
+	std::uniform_real_distribution<float> u(0.0f, 1.0f);
+	const int num_spheres = 5;
+	float cz[num_spheres], cy[num_spheres], cx[num_spheres];
+	float r2[num_spheres], value[num_spheres];
+	for (int s = 0; s < num_spheres; s++) {
+		cz[s] = nz*(0.25f + 0.5f*u(rng));
+		cy[s] = ny*(0.35f + 0.3f*u(rng));
+		cx[s] = nx*(0.35f + 0.3f*u(rng));
+		const float r = 0.02f*nx + 0.05f*nx*u(rng);
+		r2[s] = r*r;
+		value[s] = 2.0f + 8.0f*u(rng);
+	}
+	const float ry = 0.4f*ny;
+	const float rx = 0.4f*nx;
+	for (int z = 0; z < nz; z++)
+		for (int y = 0; y < ny; y++)
+			for (int x = 0; x < nx; x++) {
+				const float dy = (y - 0.5f*ny) / ry;
+				const float dx = (x - 0.5f*nx) / rx;
+				float v = (dx*dx + dy*dy <= 1.0f) ? 1.0f : 0.0f;
+				for (int s = 0; s < num_spheres; s++) {
+					const float d2 = (z - cz[s])*(z - cz[s]) +
+						(y - cy[s])*(y - cy[s]) + (x - cx[s])*(x - cx[s]);
+					if (d2 <= r2[s])
+						v = value[s];
+				}
+				data[z + data.get_min_index()]
+					[y + data[0].get_min_index()]
+					[x + data[0][0].get_min_index()] = v;
+			}
+}
+
+// Writes num_events random prompts in the mMR 32-bit listmode format with
+// a time mark every millisecond; returns the acquisition duration in seconds.
+// Each event word is 0x40000000 + offset, offset being the bin address
+// (sinogram * views + view) * tangential positions + tangential position in
+// the span 1 data (4084 sinograms), and each time mark is 0x80000000 + time
+// in milliseconds.
+static double
+make_listmode(const std::string& prefix, long long num_events, std::mt19937& rng)
+{
+	Scanner scanner(Scanner::Siemens_mMR);
+	const int num_rings = scanner.get_num_rings();
+	const int num_views = scanner.get_num_detectors_per_ring() / 2;
+	const int num_tang = scanner.get_max_num_non_arccorrected_bins();
+	// the mMR records ring differences up to 60
+	const int max_ring_diff = num_rings - 4;
+	std::stringstream segment_table;
+	long long num_sinograms = 0;
+	for (int d = 0; d <= max_ring_diff; d++) {
+		const int n = num_rings - d;
+		if (d == 0)
+			segment_table << n;
+		else
+			segment_table << ',' << n << ',' << n;
+		num_sinograms += d ? 2 * n : n;
+	}
+	const unsigned long long num_bins =
+		(unsigned long long)num_sinograms * num_views * num_tang;
+
+	const int events_per_ms = 10000;
+	const long long num_ms = (num_events + events_per_ms - 1) / events_per_ms;
+	std::string data_file = prefix + ".l";
+	std::ofstream out(data_file.c_str(), std::ios::binary);
+	std::uniform_int_distribution<unsigned long long> bin(0, num_bins - 1);
+	long long words = 0;
+	long long events = 0;
+	for (long long ms = 0; ms < num_ms; ms++) {
+		const unsigned int tag = 0x80000000u | (unsigned int)ms;
+		out.write((const char*)&tag, sizeof(tag));
+		words++;
+		for (int e = 0; e < events_per_ms && events < num_events; e++, events++) {
+			const unsigned int word = 0x40000000u | (unsigned int)bin(rng);
+			out.write((const char*)&word, sizeof(word));
+			words++;
+		}
+	}
+	const unsigned int tag = 0x80000000u | (unsigned int)num_ms;
+	out.write((const char*)&tag, sizeof(tag));
+	words++;
+	out.close();
+	if (!out) {
+		std::string msg = "failed to write " + data_file;
+		THROW(msg.c_str());
+	}
+
+	std::string header_file = data_file + ".hdr";
+	std::ofstream hdr(header_file.c_str());
+	hdr << "!INTERFILE:=\n"
+		<< "%comment:=SIRF synthetic listmode\n"
+		<< "!originating system:=2008\n"
+		<< "%SMS-MI header name space:=sinogram subheader\n"
+		<< "%SMS-MI version number:=3.4\n"
+		<< "!GENERAL DATA:=\n"
+		<< "%listmode header file:=" << header_file << '\n'
+		<< "%listmode data file:=" << data_file << '\n'
+		<< "!name of data file:=" << data_file << '\n'
+		<< "!GENERAL IMAGE DATA:=\n"
+		<< "%study date (yyyy:mm:dd):=2019:01:01\n"
+		<< "%study time (hh:mm:ss GMT+00:00):=00:00:00\n"
+		<< "isotope name:=F-18\n"
+		<< "isotope gamma halflife (sec):=6586.2\n"
+		<< "isotope branching factor:=0.967\n"
+		<< "image data byte order:=LITTLEENDIAN\n"
+		<< "%patient orientation:=HFS\n"
+		<< "!PET data type:=emission\n"
+		<< "data format:=listmode\n"
+		<< "!number format:=unsigned integer\n"
+		<< "!number of bytes per pixel:=4\n"
+		<< "%number of projections:=" << num_tang << '\n'
+		<< "%number of views:=" << num_views << '\n'
+		<< "%number of segments:=" << 2 * max_ring_diff + 1 << '\n'
+		<< "%segment table:={" << segment_table.str() << "}\n"
+		<< "%axial compression:=1\n"
+		<< "%maximum ring difference:=" << max_ring_diff << '\n'
+		<< "%number of rings:=" << num_rings << '\n'
+		<< "%total listmode word counts:=" << words << '\n'
+		<< "%image duration (sec):=" << num_ms / 1000 + 1 << '\n'
+		<< "!END OF INTERFILE:=\n";
+	hdr.close();
+	if (!hdr) {
+		std::string msg = "failed to write " + header_file;
+		THROW(msg.c_str());
+	}
+	return num_ms / 1000.0;
+}
+
+static void
+remove_interfile(const std::string& prefix)
+{
+	std::remove((prefix + ".hs").c_str());
+	std::remove((prefix + ".s").c_str());
+}
+
+static void
+bench_geometry(Benchmark& bench, const Geometry& g, int num_subsets,
+	const std::string& lm_prefix, double lm_duration, std::mt19937& rng)
+{
+	const std::string gname = g.name();
+	shared_ptr<PETAcquisitionData> sptr_ad;
+	bench.run("acquisition_data_allocation", gname, [&]() {
+		shared_ptr<ExamInfo> sptr_ei(new ExamInfo);
+		sptr_ei->imaging_modality = ImagingModality::PT;
+		sptr_ad.reset(PETAcquisitionData::storage_template()->same_acquisition_data
+			(sptr_ei, PETAcquisitionData::proj_data_info_from_scanner
+			("Siemens_mMR", g.span, g.max_ring_diff, g.view_mash_factor)));
+	}, 1);
+	if (!sptr_ad.get())
+		return;
+	shared_ptr<STIRImageData> sptr_image(new STIRImageData(*sptr_ad));
+	make_phantom(*sptr_image, rng);
+
+	shared_ptr<RayTracingMatrix> sptr_matrix(new RayTracingMatrix);
+	shared_ptr<AcqModUsingMatrix3DF> sptr_am(new AcqModUsingMatrix3DF);
+	sptr_am->set_matrix(sptr_matrix);
+	bench.run("acquisition_model_set_up", gname, [&]() {
+		if (sptr_am->set_up(sptr_ad, sptr_image) != Succeeded::yes)
+			THROW("acquisition model set_up failed");
+	}, 1);
+
+	shared_ptr<PETAcquisitionData> sptr_fwd;
+	bench.run("forward_projection", gname, [&]() {
+		sptr_fwd = sptr_am->forward(*sptr_image);
+	});
+	if (!sptr_fwd.get())
+		return;
+	bench.run("backward_projection", gname, [&]() {
+		sptr_am->backward(*sptr_fwd);
+	});
+
+	// DataContainer algebra
+	shared_ptr<PETAcquisitionData> sptr_x(sptr_fwd->new_acquisition_data());
+	shared_ptr<PETAcquisitionData> sptr_y(sptr_fwd->new_acquisition_data());
+	sptr_x->fill(*sptr_fwd);
+	sptr_y->fill(1.0f);
+	float a = 2.0f;
+	float b = -1.0f;
+	float s = 0;
+	bench.run("acquisition_data_norm", gname, [&]() {
+		s = sptr_x->norm();
+	});
+	bench.run("acquisition_data_dot", gname, [&]() {
+		sptr_x->dot(*sptr_y, &s);
+	});
+	bench.run("acquisition_data_axpby", gname, [&]() {
+		sptr_y->axpby(&a, *sptr_x, &b, *sptr_fwd);
+	});
+	bench.run("acquisition_data_multiply", gname, [&]() {
+		sptr_y->multiply(*sptr_x, *sptr_fwd);
+	});
+	bench.run("acquisition_data_copy_to", gname, [&]() {
+		std::vector<float> v((size_t)sptr_x->get_num_sinograms()*
+			sptr_x->get_num_views()*sptr_x->get_num_tangential_poss());
+		sptr_x->copy_to(v.data());
+	});
+	STIRImageData image_x(*sptr_image);
+	STIRImageData image_y(*sptr_image);
+	bench.run("image_data_norm", gname, [&]() {
+		s = image_x.norm();
+	});
+	bench.run("image_data_dot", gname, [&]() {
+		image_x.dot(*sptr_image, &s);
+	});
+	bench.run("image_data_axpby", gname, [&]() {
+		image_y.axpby(&a, image_x, &b, *sptr_image);
+	});
+	sptr_x.reset();
+	sptr_y.reset();
+
+	// objective function
+	shared_ptr<PoissonLogLhLinModMeanProjData3DF> sptr_obj
+		(new PoissonLogLhLinModMeanProjData3DF);
+	sptr_obj->set_acquisition_data(sptr_fwd);
+	sptr_obj->set_acquisition_model(sptr_am);
+	sptr_obj->set_num_subsets(num_subsets);
+	sptr_obj->set_recompute_sensitivity(true);
+	bool obj_ok = false;
+	bench.run("sensitivity", gname, [&]() {
+		if (sptr_obj->set_up(sptr_image->data_sptr()) != Succeeded::yes)
+			THROW("objective function set_up failed");
+		obj_ok = true;
+	}, 1);
+	if (obj_ok) {
+		STIRImageData grad(*sptr_image);
+		int subset = 0;
+		bench.run("subset_gradient", gname, [&]() {
+			sptr_obj->compute_sub_gradient
+				(grad.data(), sptr_image->data(), subset);
+			subset = (subset + 1) % num_subsets;
+		});
+	}
+	sptr_obj.reset();
+
+	// listmode to sinograms using this geometry as the template
+	if (lm_prefix.empty())
+		return;
+	const std::string template_prefix = SIRFUtilities::scratch_file_name();
+	const std::string output_prefix = SIRFUtilities::scratch_file_name();
+	bench.run("listmode_to_sinograms", gname, [&]() {
+		sptr_ad->write(template_prefix + ".hs");
+		ListmodeToSinograms converter;
+		converter.set_input(lm_prefix + ".l.hdr");
+		converter.set_output(output_prefix);
+		converter.set_template(template_prefix + ".hs");
+		converter.set_time_interval(0, lm_duration);
+		if (converter.set_up())
+			THROW("listmode converter set_up failed");
+		converter.process_data();
+	}, 1);
+	remove_interfile(template_prefix);
+	remove_interfile(output_prefix + "_f1g1d0b0");
+}
+
+static void
+usage()
+{
+	std::cerr << "usage: sirf_bench_pet [-o <file>] [-r <repeats>] [-s <subsets>]\n"
+		<< "\t[-g <span>,<max ring difference>,<view mash factor>]...\n"
+		<< "\t[-e <listmode events>] [--storage memory|file|compressed] [--full]\n";
+}
+
+int
+main(int argc, char** argv)
+{
+	std::string output;
+	std::string storage("memory");
+	int repeats = 3;
+	int num_subsets = 4;
+	long long num_events = 1000000;
+	bool full = false;
+	std::vector<Geometry> geometries;
+	for (int i = 1; i < argc; i++) {
+		const std::string arg(argv[i]);
+		const bool has_value = i + 1 < argc;
+		if (arg == "-o" && has_value)
+			output = argv[++i];
+		else if (arg == "-r" && has_value)
+			repeats = std::max(1, atoi(argv[++i]));
+		else if (arg == "-s" && has_value)
+			num_subsets = std::max(1, atoi(argv[++i]));
+		else if (arg == "-e" && has_value)
+			num_events = atoll(argv[++i]);
+		else if (arg == "--storage" && has_value)
+			storage = argv[++i];
+		else if (arg == "--full")
+			full = true;
+		else if (arg == "-g" && has_value) {
+			Geometry g;
+			if (sscanf(argv[++i], "%d,%d,%d",
+				&g.span, &g.max_ring_diff, &g.view_mash_factor) != 3) {
+				usage();
+				return 1;
+			}
+			geometries.push_back(g);
+		}
+		else {
+			usage();
+			return arg == "-h" || arg == "--help" ? 0 : 1;
+		}
+	}
+	if (geometries.empty()) {
+		Geometry g11 = { 11, 60, 4 };
+		Geometry g1 = { 1, 10, 8 };
+		geometries.push_back(g11);
+		geometries.push_back(g1);
+		if (full) {
+			Geometry g11_full = { 11, 60, 1 };
+			Geometry g1_full = { 1, 60, 1 };
+			geometries.push_back(g11_full);
+			geometries.push_back(g1_full);
+		}
+	}
+
+	try {
+		PETAcquisitionDataInMemory::init();
+		if (storage == "file")
+			PETAcquisitionDataInFile::set_as_template();
+		else if (storage == "compressed")
+			PETAcquisitionDataCompressed::set_as_template();
+		else
+			PETAcquisitionDataInMemory::set_as_template();
+
+		std::mt19937 rng(2019);
+		Benchmark bench(repeats);
+		std::string lm_prefix;
+		double lm_duration = 0;
+		if (num_events > 0) {
+			const std::string prefix = SIRFUtilities::scratch_file_name();
+			bench.run("listmode_generation", "mMR span 1", [&]() {
+				lm_duration = make_listmode(prefix, num_events, rng);
+				lm_prefix = prefix;
+			}, 1);
+		}
+		for (size_t i = 0; i < geometries.size(); i++)
+			bench_geometry(bench, geometries[i], num_subsets,
+				lm_prefix, lm_duration, rng);
+		if (!lm_prefix.empty()) {
+			std::remove((lm_prefix + ".l").c_str());
+			std::remove((lm_prefix + ".l.hdr").c_str());
+		}
+
+		if (output.empty())
+			bench.write_json(std::cout);
+		else {
+			std::ofstream out(output.c_str());
+			bench.write_json(out);
+			if (!out) {
+				std::cerr << "failed to write " << output << std::endl;
+				return 1;
+			}
+		}
+	}
+	catch (LocalisedException& le) {
+		std::cerr << le.what() << std::endl;
+		return 1;
+	}
+	catch (std::exception& e) {
+		std::cerr << e.what() << std::endl;
+		return 1;
+	}
+	return 0;
+}
@@ -23,6 +23,9 @@ limitations under the License.
 #include "sirf/STIR/stir_types.h"
 #include "sirf/STIR/cstir_p.h"
 #include "sirf/STIR/stir_x.h"
+#include "sirf/STIR/stir_multiresolution.h"
+#include "sirf/STIR/stir_separable_filter.h"
+#include "sirf/STIR/stir_data_cursor.h"
 #include "stir/ImagingModality.h"
 
 using namespace stir;
@@ -75,18 +78,27 @@ void* cSTIR_newObject(const char* name)
 			"PoissonLogLikelihoodWithLinearModelForMeanAndProjData"))
 			return NEW_OBJECT_HANDLE
 			(xSTIR_PoissonLogLikelihoodWithLinearModelForMeanAndProjData3DF);
+		if (boost::iequals(name,
+			"PoissonLogLikelihoodWithLinearModelForMeanAndListModeDataWithProjMatrixByBin"))
+			return NEW_OBJECT_HANDLE(PoissonLogLhLinModMeanListData3DF);
 		if (boost::iequals(name, "AcqModUsingMatrix"))
 			return NEW_OBJECT_HANDLE(AcqModUsingMatrix3DF);
+		if (boost::iequals(name, "MultiresolutionReconstruction"))
+			return NEW_OBJECT_HANDLE(PETMultiresolutionReconstruction);
 		if (boost::iequals(name, "RayTracingMatrix"))
 			return NEW_OBJECT_HANDLE(RayTracingMatrix);
 		if (boost::iequals(name, "QuadraticPrior"))
-			return NEW_OBJECT_HANDLE(QuadPrior3DF);
+			return NEW_OBJECT_HANDLE(xSTIR_QuadraticPrior3DF);
 		if (boost::iequals(name, "PLSPrior"))
-			return NEW_OBJECT_HANDLE(PLSPrior<float>);
+			return NEW_OBJECT_HANDLE(xSTIR_PLSPrior3DF);
 		if (boost::iequals(name, "TruncateToCylindricalFOVImageProcessor"))
 			return NEW_OBJECT_HANDLE(CylindricFilter3DF);
+		if (boost::iequals(name, "SeparableImageFilter"))
+			return NEW_OBJECT_HANDLE(SeparableImageFilter);
 		if (boost::iequals(name, "EllipsoidalCylinder"))
 			return NEW_OBJECT_HANDLE(EllipsoidalCylinder);
+		if (boost::iequals(name, "SubsetScheduler"))
+			return NEW_OBJECT_HANDLE(SubsetScheduler);
 		return unknownObject("object", name, __FILE__, __LINE__);
 	}
 	CATCH;
@@ -108,6 +120,8 @@ void* cSTIR_setParameter
 		else if (boost::iequals(obj, "TruncateToCylindricalFOVImageProcessor"))
 			return cSTIR_setTruncateToCylindricalFOVImageProcessorParameter
 			(hs, name, hv);
+		else if (boost::iequals(obj, "SeparableImageFilter"))
+			return cSTIR_setSeparableImageFilterParameter(hs, name, hv);
 		else if (boost::iequals(obj, "AcquisitionModel"))
 			return cSTIR_setAcquisitionModelParameter(hs, name, hv);
 		else if (boost::iequals(obj, "AcqModUsingMatrix"))
@@ -130,6 +144,11 @@ void* cSTIR_setParameter
 			return
 			cSTIR_setPoissonLogLikelihoodWithLinearModelForMeanAndProjDataParameter
 			(hs, name, hv);
+		else if (boost::iequals(obj,
+			"PoissonLogLikelihoodWithLinearModelForMeanAndListModeDataWithProjMatrixByBin"))
+			return
+			cSTIR_setPoissonLogLikelihoodWithLinearModelForMeanAndListModeDataParameter
+			(hs, name, hv);
 		else if (boost::iequals(obj, "Reconstruction"))
 			return cSTIR_setReconstructionParameter(hs, name, hv);
 		else if (boost::iequals(obj, "IterativeReconstruction"))
@@ -138,6 +157,10 @@ void* cSTIR_setParameter
 			return cSTIR_setOSMAPOSLParameter(hs, name, hv);
 		else if (boost::iequals(obj, "OSSPS"))
 			return cSTIR_setOSSPSParameter(hs, name, hv);
+		else if (boost::iequals(obj, "MultiresolutionReconstruction"))
+			return cSTIR_setMultiresolutionReconstructionParameter(hs, name, hv);
+		else if (boost::iequals(obj, "SubsetScheduler"))
+			return cSTIR_setSubsetSchedulerParameter(hs, name, hv);
 		else if (boost::iequals(obj, "FBP2D"))
 			return cSTIR_setFBP2DParameter(hs, name, hv);
 		else
@@ -158,8 +181,12 @@ void* cSTIR_parameter(const void* ptr, const char* obj, const char* name)
 		else if (boost::iequals(obj, "TruncateToCylindricalFOVImageProcessor"))
 			return cSTIR_truncateToCylindricalFOVImageProcessorParameter
 			(handle, name);
+		else if (boost::iequals(obj, "SeparableImageFilter"))
+			return cSTIR_separableImageFilterParameter(handle, name);
 		else if (boost::iequals(obj, "RayTracingMatrix"))
 			return cSTIR_rayTracingMatrixParameter(handle, name);
+		else if (boost::iequals(obj, "AcquisitionModel"))
+			return cSTIR_acquisitionModelParameter(handle, name);
 		else if (boost::iequals(obj, "AcqModUsingMatrix"))
 			return cSTIR_acqModUsingMatrixParameter(handle, name);
 		else if (boost::iequals(obj, "GeneralisedPrior"))
@@ -173,12 +200,21 @@ void* cSTIR_parameter(const void* ptr, const char* obj, const char* name)
 			return
 			cSTIR_PoissonLogLikelihoodWithLinearModelForMeanAndProjDataParameter
 			(handle, name);
+		else if (boost::iequals(obj,
+			"PoissonLogLikelihoodWithLinearModelForMeanAndListModeDataWithProjMatrixByBin"))
+			return
+			cSTIR_PoissonLogLikelihoodWithLinearModelForMeanAndListModeDataParameter
+			(handle, name);
 		else if (boost::iequals(obj, "IterativeReconstruction"))
 			return cSTIR_iterativeReconstructionParameter(handle, name);
 		else if (boost::iequals(obj, "OSMAPOSL"))
 			return cSTIR_OSMAPOSLParameter(handle, name);
 		else if (boost::iequals(obj, "OSSPS"))
 			return cSTIR_OSSPSParameter(handle, name);
+		else if (boost::iequals(obj, "SubsetScheduler"))
+			return cSTIR_subsetSchedulerParameter(handle, name);
+		else if (boost::iequals(obj, "MultiresolutionReconstruction"))
+			return cSTIR_multiresolutionReconstructionParameter(handle, name);
 		else if (boost::iequals(obj, "FBP2D"))
 			return cSTIR_FBP2DParameter(handle, name);
 		return unknownObject("object", obj, __FILE__, __LINE__);
@@ -192,7 +228,7 @@ void* cSTIR_objectFromFile(const char* name, const char* filename)
 	try {
 		if (boost::iequals(name, "OSMAPOSLReconstruction"))
 			return cSTIR_newReconstructionMethod
-			<OSMAPOSLReconstruction<Image3DF> >
+			<xSTIR_OSMAPOSLReconstruction3DF>
 			(filename);
 		if (boost::iequals(name, "OSSPSReconstruction"))
 			return cSTIR_newReconstructionMethod
@@ -457,6 +493,69 @@ void* cSTIR_acquisitionModelBwd(void* ptr_am, void* ptr_ad,
 	CATCH;
 }
 
+extern "C"
+void* cSTIR_acquisitionModelFwdFrames(void* ptr_am, const void* ptr_ims,
+	int subset_num, int num_subsets, const void* ptr_ads)
+{
+	try {
+		AcqMod3DF& am = objectFromHandle<AcqMod3DF>(ptr_am);
+		const DataHandleVector& ims = objectFromHandle<const DataHandleVector>(ptr_ims);
+		const DataHandleVector& ads = objectFromHandle<const DataHandleVector>(ptr_ads);
+		std::vector<const STIRImageData*> images;
+		std::vector<PETAcquisitionData*> acq_data;
+		for (unsigned i = 0; i < ims.size(); i++)
+			images.push_back(&objectFromHandle<STIRImageData>(ims.at(i)));
+		for (unsigned i = 0; i < ads.size(); i++)
+			acq_data.push_back(&objectFromHandle<PETAcquisitionData>(ads.at(i)));
+		am.forward(acq_data, images, subset_num, num_subsets, num_subsets > 1);
+		return new DataHandle;
+	}
+	CATCH;
+}
+
+extern "C"
+void* cSTIR_acquisitionModelBwdFrames(void* ptr_am, const void* ptr_ads,
+	int subset_num, int num_subsets, const void* ptr_ims)
+{
+	try {
+		AcqMod3DF& am = objectFromHandle<AcqMod3DF>(ptr_am);
+		const DataHandleVector& ads = objectFromHandle<const DataHandleVector>(ptr_ads);
+		const DataHandleVector& ims = objectFromHandle<const DataHandleVector>(ptr_ims);
+		std::vector<PETAcquisitionData*> acq_data;
+		std::vector<STIRImageData*> images;
+		for (unsigned i = 0; i < ads.size(); i++)
+			acq_data.push_back(&objectFromHandle<PETAcquisitionData>(ads.at(i)));
+		for (unsigned i = 0; i < ims.size(); i++)
+			images.push_back(&objectFromHandle<STIRImageData>(ims.at(i)));
+		am.backward(images, acq_data, subset_num, num_subsets);
+		return new DataHandle;
+	}
+	CATCH;
+}
+
+extern "C"
+void* cSTIR_resetAcquisitionModelStatistics(void* ptr_am)
+{
+	try {
+		AcqMod3DF& am = objectFromHandle<AcqMod3DF>(ptr_am);
+		am.statistics().reset();
+		return new DataHandle;
+	}
+	CATCH;
+}
+
+extern "C"
+void* cSTIR_writeAcquisitionModelStatistics
+	(const void* ptr_am, const char* filename)
+{
+	try {
+		const AcqMod3DF& am = objectFromHandle<const AcqMod3DF>(ptr_am);
+		am.statistics().write_json(filename);
+		return new DataHandle;
+	}
+	CATCH;
+}
+
 extern "C"
 void*
 cSTIR_setAcquisitionDataStorageScheme(const char* scheme)
@@ -464,6 +563,8 @@ cSTIR_setAcquisitionDataStorageScheme(const char* scheme)
 	try {
 		if (scheme[0] == 'f' || strcmp(scheme, "default") == 0)
 			PETAcquisitionDataInFile::set_as_template();
+		else if (scheme[0] == 'c')
+			PETAcquisitionDataCompressed::set_as_template();
 		else
 			PETAcquisitionDataInMemory::set_as_template();
 		return (void*)new DataHandle;
@@ -620,6 +721,77 @@ void* cSTIR_writeAcquisitionData(void* ptr_acq, const char* filename)
 	CATCH;
 }
 
+extern "C"
+void* cSTIR_acquisitionDataCursor(void* ptr_acq, const char* unit)
+{
+	try {
+		SPTR_FROM_HANDLE(PETAcquisitionData, sptr_ad, ptr_acq);
+		shared_ptr<PETAcquisitionDataCursor> sptr(new PETAcquisitionDataCursor
+			(sptr_ad, PETAcquisitionDataCursor::unit(unit)));
+		return newObjectHandle(sptr);
+	}
+	CATCH;
+}
+
+extern "C"
+void* cSTIR_resetAcquisitionDataCursor(void* ptr_c)
+{
+	try {
+		PETAcquisitionDataCursor& cursor =
+			objectFromHandle<PETAcquisitionDataCursor>(ptr_c);
+		cursor.reset();
+		return (void*)new DataHandle;
+	}
+	CATCH;
+}
+
+extern "C"
+void* cSTIR_nextAcquisitionDataBlock(void* ptr_c)
+{
+	try {
+		PETAcquisitionDataCursor& cursor =
+			objectFromHandle<PETAcquisitionDataCursor>(ptr_c);
+		return dataHandle<int>(cursor.next());
+	}
+	CATCH;
+}
+
+extern "C"
+void* cSTIR_getAcquisitionDataBlockInfo(const void* ptr_c, size_t ptr_info)
+{
+	try {
+		PETAcquisitionDataCursor& cursor =
+			objectFromHandle<PETAcquisitionDataCursor>(ptr_c);
+		cursor.get_info((int*)ptr_info);
+		return (void*)new DataHandle;
+	}
+	CATCH;
+}
+
+extern "C"
+void* cSTIR_getAcquisitionDataBlock(const void* ptr_c, size_t ptr_data)
+{
+	try {
+		PETAcquisitionDataCursor& cursor =
+			objectFromHandle<PETAcquisitionDataCursor>(ptr_c);
+		cursor.get_block((float*)ptr_data);
+		return (void*)new DataHandle;
+	}
+	CATCH;
+}
+
+extern "C"
+void* cSTIR_setAcquisitionDataBlock(void* ptr_c, size_t ptr_data)
+{
+	try {
+		PETAcquisitionDataCursor& cursor =
+			objectFromHandle<PETAcquisitionDataCursor>(ptr_c);
+		cursor.set_block((const float*)ptr_data);
+		return (void*)new DataHandle;
+	}
+	CATCH;
+}
+
 extern "C"
 void* cSTIR_setupFBP2DReconstruction(void* ptr_r, void* ptr_i)
 {
@@ -664,8 +836,13 @@ void* cSTIR_setupReconstruction(void* ptr_r, void* ptr_i)
 		sptrImage3DF sptr_image = id.data_sptr();
 		xSTIR_IterativeReconstruction3DF& recon =
 			objectFromHandle<xSTIR_IterativeReconstruction3DF>(ptr_r);
+		xSTIR_OSMAPOSLReconstruction3DF* ptr_os =
+			dynamic_cast<xSTIR_OSMAPOSLReconstruction3DF*>
+			(&objectFromHandle<Reconstruction<Image3DF> >(ptr_r));
 		Succeeded s = Succeeded::no;
 		if (!recon.post_process()) {
+			if (ptr_os)
+				ptr_os->set_up_prefetch();
 			s = recon.setup(sptr_image);
 			recon.subiteration() = recon.get_start_subiteration_num();
 		}
@@ -704,6 +881,13 @@ void* cSTIR_updateReconstruction(void* ptr_r, void* ptr_i)
 	try {
 		STIRImageData& id = objectFromHandle<STIRImageData>(ptr_i);
 		Image3DF& image = id.data();
+		xSTIR_OSMAPOSLReconstruction3DF* ptr_os =
+			dynamic_cast<xSTIR_OSMAPOSLReconstruction3DF*>
+			(&objectFromHandle<Reconstruction<Image3DF> >(ptr_r));
+		if (ptr_os) {
+			ptr_os->update(image);
+			return (void*) new DataHandle;
+		}
 		xSTIR_IterativeReconstruction3DF& recon =
 			objectFromHandle<xSTIR_IterativeReconstruction3DF>(ptr_r);
 		recon.update(image);
@@ -712,6 +896,93 @@ void* cSTIR_updateReconstruction(void* ptr_r, void* ptr_i)
 	CATCH;
 }
 
+extern "C"
+void* cSTIR_saveReconstructionState
+(void* ptr_r, void* ptr_i, const char* filename)
+{
+	try {
+		STIRImageData& id = objectFromHandle<STIRImageData>(ptr_i);
+		xSTIR_IterativeReconstruction3DF& recon =
+			objectFromHandle<xSTIR_IterativeReconstruction3DF>(ptr_r);
+		xSTIR_OSMAPOSLReconstruction3DF* ptr_os =
+			dynamic_cast<xSTIR_OSMAPOSLReconstruction3DF*>
+			(&objectFromHandle<Reconstruction<Image3DF> >(ptr_r));
+		recon.save_state(filename, id.data(),
+			ptr_os ? ptr_os->subset_scheduler_sptr().get() : 0);
+		return (void*) new DataHandle;
+	}
+	CATCH;
+}
+
+extern "C"
+void* cSTIR_loadReconstructionState
+(void* ptr_r, void* ptr_i, const char* filename)
+{
+	try {
+		DataHandle* handle = new DataHandle;
+		STIRImageData& id = objectFromHandle<STIRImageData>(ptr_i);
+		xSTIR_IterativeReconstruction3DF& recon =
+			objectFromHandle<xSTIR_IterativeReconstruction3DF>(ptr_r);
+		xSTIR_OSMAPOSLReconstruction3DF* ptr_os =
+			dynamic_cast<xSTIR_OSMAPOSLReconstruction3DF*>
+			(&objectFromHandle<Reconstruction<Image3DF> >(ptr_r));
+		if (ptr_os)
+			ptr_os->set_up_prefetch();
+		if (recon.load_state(filename, id.data_sptr(),
+			ptr_os ? ptr_os->subset_scheduler_sptr().get() : 0) != Succeeded::yes) {
+			ExecutionStatus status("cSTIR_loadReconstructionState failed",
+				__FILE__, __LINE__);
+			handle->set(0, &status);
+		}
+		return (void*)handle;
+	}
+	CATCH;
+}
+
+extern "C"
+void* cSTIR_addMultiresolutionLevel
+(void* ptr_r, int factor, int num_subiterations)
+{
+	try {
+		PETMultiresolutionReconstruction& recon =
+			objectFromHandle<PETMultiresolutionReconstruction>(ptr_r);
+		recon.add_level(factor, num_subiterations);
+		return (void*) new DataHandle;
+	}
+	CATCH;
+}
+
+extern "C"
+void* cSTIR_setupMultiresolutionReconstruction(void* ptr_r, void* ptr_i)
+{
+	try {
+		DataHandle* handle = new DataHandle;
+		PETMultiresolutionReconstruction& recon =
+			objectFromHandle<PETMultiresolutionReconstruction>(ptr_r);
+		SPTR_FROM_HANDLE(STIRImageData, sptr_id, ptr_i);
+		if (recon.set_up(sptr_id) != Succeeded::yes) {
+			ExecutionStatus status("cSTIR_setupMultiresolutionReconstruction failed",
+				__FILE__, __LINE__);
+			handle->set(0, &status);
+		}
+		return (void*)handle;
+	}
+	CATCH;
+}
+
+extern "C"
+void* cSTIR_runMultiresolutionReconstruction(void* ptr_r, void* ptr_i)
+{
+	try {
+		PETMultiresolutionReconstruction& recon =
+			objectFromHandle<PETMultiresolutionReconstruction>(ptr_r);
+		STIRImageData& id = objectFromHandle<STIRImageData>(ptr_i);
+		recon.process(id);
+		return (void*) new DataHandle;
+	}
+	CATCH;
+}
+
 extern "C"
 void* cSTIR_setupObjectiveFunction(void* ptr_r, void* ptr_i)
 {
@@ -863,6 +1134,52 @@ cSTIR_PLSPriorGradient(void* ptr_p, int dir)
 	CATCH;
 }
 
+extern "C"
+void*
+cSTIR_nextSubset(void* ptr_s)
+{
+	try {
+		SubsetScheduler& scheduler = objectFromHandle<SubsetScheduler>(ptr_s);
+		return dataHandle<int>(scheduler.next());
+	}
+	CATCH;
+}
+
+extern "C"
+void*
+cSTIR_peekSubset(void* ptr_s)
+{
+	try {
+		SubsetScheduler& scheduler = objectFromHandle<SubsetScheduler>(ptr_s);
+		return dataHandle<int>(scheduler.peek());
+	}
+	CATCH;
+}
+
+extern "C"
+void*
+cSTIR_setSubsetWeight(void* ptr_s, int subset, float weight)
+{
+	try {
+		SubsetScheduler& scheduler = objectFromHandle<SubsetScheduler>(ptr_s);
+		scheduler.set_weight(subset, weight);
+		return new DataHandle;
+	}
+	CATCH;
+}
+
+extern "C"
+void*
+cSTIR_resetSubsetScheduler(void* ptr_s)
+{
+	try {
+		SubsetScheduler& scheduler = objectFromHandle<SubsetScheduler>(ptr_s);
+		scheduler.reset();
+		return new DataHandle;
+	}
+	CATCH;
+}
+
 extern "C"
 void* cSTIR_voxels3DF
 (int nx, int ny, int nz,
@@ -1069,8 +1386,7 @@ void* cSTIR_setImageDataFromImage(void* ptr_im, const void* ptr_src)
 	try {
 		STIRImageData& id = objectFromHandle<STIRImageData>(ptr_im);
 		STIRImageData& id_src = objectFromHandle<STIRImageData>(ptr_src);
-		Image3DF& data = id.data();
-		data = id_src.data();
+		id.fill(id_src);
 		return new DataHandle;
 	}
 	CATCH;
@@ -73,6 +73,13 @@ extern "C" {
 		(void* ptr_am, void* ptr_im, int subset_num, int num_subsets, void* ptr_ad);
 	void* cSTIR_acquisitionModelBwd(void* ptr_am, void* ptr_ad,
 		int subset_num, int num_subsets);
+	void* cSTIR_acquisitionModelFwdFrames(void* ptr_am, const void* ptr_ims,
+		int subset_num, int num_subsets, const void* ptr_ads);
+	void* cSTIR_acquisitionModelBwdFrames(void* ptr_am, const void* ptr_ads,
+		int subset_num, int num_subsets, const void* ptr_ims);
+	void* cSTIR_resetAcquisitionModelStatistics(void* ptr_am);
+	void* cSTIR_writeAcquisitionModelStatistics
+		(const void* ptr_am, const char* filename);
 
 	// Acquisition data methods
 	void* cSTIR_getAcquisitionDataStorageScheme();
@@ -95,6 +102,12 @@ extern "C" {
 	void* cSTIR_fillAcquisitionDataFromAcquisitionData
 		(void* ptr_acq, const void * ptr_from);
 	void* cSTIR_writeAcquisitionData(void* ptr_acq, const char* filename);
+	void* cSTIR_acquisitionDataCursor(void* ptr_acq, const char* unit);
+	void* cSTIR_resetAcquisitionDataCursor(void* ptr_c);
+	void* cSTIR_nextAcquisitionDataBlock(void* ptr_c);
+	void* cSTIR_getAcquisitionDataBlockInfo(const void* ptr_c, PTR_INT ptr_info);
+	void* cSTIR_getAcquisitionDataBlock(const void* ptr_c, PTR_FLOAT ptr_data);
+	void* cSTIR_setAcquisitionDataBlock(void* ptr_c, PTR_FLOAT ptr_data);
 
 	// Reconstruction methods
 	void* cSTIR_setupFBP2DReconstruction(void* ptr_r, void* ptr_i);
@@ -102,6 +115,14 @@ extern "C" {
 	void* cSTIR_setupReconstruction(void* ptr_r, void* ptr_i);
 	void* cSTIR_runReconstruction(void* ptr_r, void* ptr_i);
 	void* cSTIR_updateReconstruction(void* ptr_r, void* ptr_i);
+	void* cSTIR_saveReconstructionState
+		(void* ptr_r, void* ptr_i, const char* filename);
+	void* cSTIR_loadReconstructionState
+		(void* ptr_r, void* ptr_i, const char* filename);
+	void* cSTIR_addMultiresolutionLevel
+		(void* ptr_r, int factor, int num_subiterations);
+	void* cSTIR_setupMultiresolutionReconstruction(void* ptr_r, void* ptr_i);
+	void* cSTIR_runMultiresolutionReconstruction(void* ptr_r, void* ptr_i);
 
 	// Objective function methods
 	void* cSTIR_setupObjectiveFunction(void* ptr_r, void* ptr_i);
@@ -112,6 +133,12 @@ extern "C" {
 	void* cSTIR_objectiveFunctionGradientNotDivided
 		(void* ptr_f, void* ptr_i, int subset);
 
+	// Subset scheduler methods
+	void* cSTIR_nextSubset(void* ptr_s);
+	void* cSTIR_peekSubset(void* ptr_s);
+	void* cSTIR_setSubsetWeight(void* ptr_s, int subset, float weight);
+	void* cSTIR_resetSubsetScheduler(void* ptr_s);
+
 	// Prior methods
 	void* cSTIR_setupPrior(void* ptr_p, void* ptr_i);
 	void* cSTIR_priorGradient(void* ptr_p, void* ptr_i);
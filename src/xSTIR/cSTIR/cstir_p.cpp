@@ -18,6 +18,7 @@ limitations under the License.
 
 */
 
+#include <ctype.h>
 #include <stdio.h>
 #include <stdlib.h>
 
@@ -25,6 +26,8 @@ limitations under the License.
 #include "sirf/STIR/stir_types.h"
 #include "sirf/STIR/cstir_p.h"
 #include "sirf/STIR/stir_x.h"
+#include "sirf/STIR/stir_multiresolution.h"
+#include "sirf/STIR/stir_separable_filter.h"
 
 using namespace stir;
 using namespace sirf;
@@ -187,6 +190,66 @@ sirf::cSTIR_truncateToCylindricalFOVImageProcessorParameter
 		return parameterNotFound(name, __FILE__, __LINE__);
 }
 
+// axis (0 for z, 1 for y, 2 for x) given by the suffix of a parameter name
+// such as "fwhm_x", -1 if the name does not start with prefix
+static int
+filter_axis(const char* name, const char* prefix)
+{
+	std::string s(name);
+	std::string p = std::string(prefix) + "_";
+	if (s.size() != p.size() + 1 || !boost::iequals(s.substr(0, p.size()), p))
+		return -1;
+	switch (tolower(s[p.size()])) {
+	case 'z':
+		return 0;
+	case 'y':
+		return 1;
+	case 'x':
+		return 2;
+	}
+	return -1;
+}
+
+void*
+sirf::cSTIR_setSeparableImageFilterParameter
+(DataHandle* hp, const char* name, const DataHandle* hv)
+{
+	SeparableImageFilter& filter =
+		objectFromHandle<SeparableImageFilter>(hp);
+	int axis;
+	if ((axis = filter_axis(name, "fwhm")) >= 0)
+		filter.set_fwhm(axis, dataFromHandle<float>(hv));
+	else if ((axis = filter_axis(name, "metz_power")) >= 0)
+		filter.set_metz_power(axis, dataFromHandle<float>(hv));
+	else if ((axis = filter_axis(name, "max_kernel_size")) >= 0)
+		filter.set_max_kernel_size(axis, dataFromHandle<int>((void*)hv));
+	else if (boost::iequals(name, "fft_threshold"))
+		filter.set_fft_threshold(dataFromHandle<int>((void*)hv));
+	else
+		return parameterNotFound(name, __FILE__, __LINE__);
+	return new DataHandle;
+}
+
+void*
+sirf::cSTIR_separableImageFilterParameter
+(const DataHandle* handle, const char* name)
+{
+	SeparableImageFilter& filter =
+		objectFromHandle<SeparableImageFilter>(handle);
+	int axis;
+	if ((axis = filter_axis(name, "fwhm")) >= 0)
+		return dataHandle<float>(filter.fwhm(axis));
+	if ((axis = filter_axis(name, "metz_power")) >= 0)
+		return dataHandle<float>(filter.metz_power(axis));
+	if ((axis = filter_axis(name, "max_kernel_size")) >= 0)
+		return dataHandle<int>(filter.max_kernel_size(axis));
+	if ((axis = filter_axis(name, "kernel_length")) >= 0)
+		return dataHandle<int>((int)filter.kernel(axis).size());
+	if (boost::iequals(name, "fft_threshold"))
+		return dataHandle<int>(filter.fft_threshold());
+	return parameterNotFound(name, __FILE__, __LINE__);
+}
+
 void*
 sirf::cSTIR_setRayTracingMatrixParameter
 (DataHandle* hp, const char* name, const DataHandle* hv)
@@ -228,11 +291,75 @@ sirf::cSTIR_setAcquisitionModelParameter
 		SPTR_FROM_HANDLE(PETAcquisitionSensitivityModel, sptr_asm, hv);
 		am.set_asm(sptr_asm);
 	}
+	else if (boost::iequals(name, "image_support")) {
+		SPTR_FROM_HANDLE(STIRImageData, sptr_id, hv);
+		am.set_image_support(sptr_id);
+	}
+	else if (boost::iequals(name, "cancel_image_support"))
+		am.cancel_image_support();
+	else if (boost::iequals(name, "verbose"))
+		am.set_verbose(dataFromHandle<int>((void*)hv) != 0);
 	else
 		return parameterNotFound(name, __FILE__, __LINE__);
 	return new DataHandle;
 }
 
+// handles "<stage>_wall_time", "<stage>_cpu_time", "<stage>_calls" and
+// "<stage>_bytes", e.g. "projection_wall_time"; returns 0 if name is not
+// of this form
+static void*
+stage_statistics(const AcquisitionModelStatistics& stats, const char* name)
+{
+	static const char* suffixes[] = { "_wall_time", "_cpu_time", "_calls", "_bytes" };
+	std::string s(name);
+	for (int i = 0; i < 4; i++) {
+		const std::string suffix(suffixes[i]);
+		if (s.size() <= suffix.size() ||
+			!boost::iequals(s.substr(s.size() - suffix.size()), suffix))
+			continue;
+		AcquisitionModelStatistics::Stage stage =
+			AcquisitionModelStatistics::stage(s.substr(0, s.size() - suffix.size()));
+		if (stage == AcquisitionModelStatistics::NUM_STAGES)
+			return 0;
+		const AcquisitionModelStatistics::StageStatistics& st = stats.stage(stage);
+		switch (i) {
+		case 0:
+			return dataHandle<float>((float)st.wall_time);
+		case 1:
+			return dataHandle<float>((float)st.cpu_time);
+		case 2:
+			return dataHandle<int>((int)st.calls);
+		default:
+			return dataHandle<float>((float)st.bytes);
+		}
+	}
+	return 0;
+}
+
+void*
+sirf::cSTIR_acquisitionModelParameter(DataHandle* hp, const char* name)
+{
+	AcqMod3DF& am = objectFromHandle< AcqMod3DF >(hp);
+	if (boost::iequals(name, "image_support"))
+		return newObjectHandle(am.image_support_sptr());
+	else if (boost::iequals(name, "acquisition_support"))
+		return newObjectHandle(am.acquisition_support_sptr());
+	else if (boost::iequals(name, "support_fraction"))
+		return dataHandle<float>(am.support_fraction());
+	else if (boost::iequals(name, "verbose"))
+		return dataHandle<int>(am.verbose());
+	else if (boost::iequals(name, "statistics_json"))
+		return charDataHandleFromCharData(am.statistics().json().c_str());
+	else if (boost::iequals(name, "forward_calls"))
+		return dataHandle<int>((int)am.statistics().forward_calls());
+	else if (boost::iequals(name, "backward_calls"))
+		return dataHandle<int>((int)am.statistics().backward_calls());
+	void* h = stage_statistics(am.statistics(), name);
+	if (h)
+		return h;
+	return parameterNotFound(name, __FILE__, __LINE__);
+}
+
 void*
 sirf::cSTIR_setAcqModUsingMatrixParameter
 (DataHandle* hm, const char* name, const DataHandle* hv)
@@ -242,6 +369,10 @@ sirf::cSTIR_setAcqModUsingMatrixParameter
 		SPTR_FROM_HANDLE(ProjMatrixByBin, sptr_m, hv);
 		am.set_matrix(sptr_m);
 	}
+	else if (boost::iequals(name, "matrix_cache_path"))
+		am.set_matrix_cache_path(charDataFromDataHandle(hv));
+	else if (boost::iequals(name, "sparse_matrix"))
+		am.set_use_sparse_matrix(dataFromHandle<int>((void*)hv) != 0);
 	else
 		return parameterNotFound(name, __FILE__, __LINE__);
 	return new DataHandle;
@@ -254,6 +385,10 @@ sirf::cSTIR_acqModUsingMatrixParameter
 	AcqModUsingMatrix3DF& am = objectFromHandle<AcqModUsingMatrix3DF>(hm);
 	if (boost::iequals(name, "matrix"))
 		return newObjectHandle(am.matrix_sptr());
+	else if (boost::iequals(name, "matrix_cache_path"))
+		return charDataHandleFromCharData(am.matrix_cache_path().c_str());
+	else if (boost::iequals(name, "sparse_matrix"))
+		return dataHandle<int>(am.use_sparse_matrix());
 	else
 		return parameterNotFound(name, __FILE__, __LINE__);
 	return new DataHandle;
@@ -446,6 +581,46 @@ sirf::cSTIR_PoissonLogLikelihoodWithLinearModelForMeanAndProjDataParameter
 	return parameterNotFound(name, __FILE__, __LINE__);
 }
 
+void*
+sirf::cSTIR_setPoissonLogLikelihoodWithLinearModelForMeanAndListModeDataParameter
+(DataHandle* hp, const char* name, const DataHandle* hv)
+{
+	PoissonLogLhLinModMeanListData3DF& obj_fun =
+		objectFromHandle<PoissonLogLhLinModMeanListData3DF>(hp);
+	if (boost::iequals(name, "listmode_file"))
+		obj_fun.set_input_file(charDataFromDataHandle(hv));
+	else if (boost::iequals(name, "matrix")) {
+		SPTR_FROM_HANDLE(ProjMatrixByBin, sptr_m, hv);
+		obj_fun.set_proj_matrix(sptr_m);
+	}
+	else if (boost::iequals(name, "additive_term")) {
+		SPTR_FROM_HANDLE(PETAcquisitionData, sptr_ad, hv);
+		obj_fun.set_additive_term(sptr_ad);
+	}
+	else if (boost::iequals(name, "batch_size"))
+		obj_fun.set_batch_size(dataFromHandle<int>((void*)hv));
+	else if (boost::iequals(name, "verbose"))
+		obj_fun.set_verbose(dataFromHandle<int>((void*)hv) != 0);
+	else
+		return parameterNotFound(name, __FILE__, __LINE__);
+	return new DataHandle;
+}
+
+void*
+sirf::cSTIR_PoissonLogLikelihoodWithLinearModelForMeanAndListModeDataParameter
+(const DataHandle* handle, const char* name)
+{
+	PoissonLogLhLinModMeanListData3DF& obj_fun =
+		objectFromHandle<PoissonLogLhLinModMeanListData3DF>(handle);
+	if (boost::iequals(name, "matrix"))
+		return newObjectHandle(obj_fun.proj_matrix_sptr());
+	if (boost::iequals(name, "batch_size"))
+		return dataHandle<int>(obj_fun.batch_size());
+	if (boost::iequals(name, "verbose"))
+		return dataHandle<int>(obj_fun.verbose());
+	return parameterNotFound(name, __FILE__, __LINE__);
+}
+
 void*
 sirf::cSTIR_setReconstructionParameter
 (DataHandle* hp, const char* name, const DataHandle* hv)
@@ -536,6 +711,20 @@ sirf::cSTIR_iterativeReconstructionParameter
 	return parameterNotFound(name, __FILE__, __LINE__);
 }
 
+static xSTIR_OSMAPOSLReconstruction3DF&
+xOSMAPOSL(OSMAPOSLReconstruction<Image3DF>& recon, const char* name)
+{
+	xSTIR_OSMAPOSLReconstruction3DF* ptr =
+		dynamic_cast<xSTIR_OSMAPOSLReconstruction3DF*>(&recon);
+	if (!ptr) {
+		std::string msg = "parameter ";
+		msg += name;
+		msg += " requires a SIRF OSMAPOSL reconstruction object";
+		THROW(msg.c_str());
+	}
+	return *ptr;
+}
+
 void*
 sirf::cSTIR_setOSMAPOSLParameter
 (DataHandle* hp, const char* name, const DataHandle* hv)
@@ -544,6 +733,15 @@ sirf::cSTIR_setOSMAPOSLParameter
 		objectFromHandle<OSMAPOSLReconstruction<Image3DF> >(hp);
 	if (boost::iequals(name, "MAP_model"))
 		recon.set_MAP_model(charDataFromDataHandle(hv));
+	else if (boost::iequals(name, "prefetch_memory")) {
+		xSTIR_OSMAPOSLReconstruction3DF& xrecon = xOSMAPOSL(recon, name);
+		xrecon.set_prefetch_memory(dataFromHandle<int>((void*)hv));
+	}
+	else if (boost::iequals(name, "subset_scheduler")) {
+		xSTIR_OSMAPOSLReconstruction3DF& xrecon = xOSMAPOSL(recon, name);
+		SPTR_FROM_HANDLE(SubsetScheduler, sptr_s, hv);
+		xrecon.set_subset_scheduler(sptr_s);
+	}
 	else
 		return parameterNotFound(name, __FILE__, __LINE__);
 	return new DataHandle;
@@ -556,6 +754,10 @@ sirf::cSTIR_OSMAPOSLParameter(const DataHandle* handle, const char* name)
 		objectFromHandle<OSMAPOSLReconstruction<Image3DF> >(handle);
 	if (boost::iequals(name, "objective_function"))
 		return newObjectHandle(recon.get_objective_function_sptr());
+	if (boost::iequals(name, "prefetch_memory")) {
+		xSTIR_OSMAPOSLReconstruction3DF& xrecon = xOSMAPOSL(recon, name);
+		return dataHandle<int>(xrecon.prefetch_memory());
+	}
 	return parameterNotFound(name, __FILE__, __LINE__);
 }
 
@@ -579,6 +781,75 @@ sirf::cSTIR_OSSPSParameter(const DataHandle* handle, const char* name)
 	return parameterNotFound(name, __FILE__, __LINE__);
 }
 
+void*
+sirf::cSTIR_setSubsetSchedulerParameter
+(DataHandle* hp, const char* name, const DataHandle* hv)
+{
+	SubsetScheduler& scheduler = objectFromHandle<SubsetScheduler>(hp);
+	if (boost::iequals(name, "num_subsets"))
+		scheduler.set_num_subsets(dataFromHandle<int>((void*)hv));
+	else if (boost::iequals(name, "policy"))
+		scheduler.set_policy(charDataFromDataHandle(hv));
+	else if (boost::iequals(name, "seed"))
+		scheduler.set_seed(dataFromHandle<int>((void*)hv));
+	else
+		return parameterNotFound(name, __FILE__, __LINE__);
+	return new DataHandle;
+}
+
+void*
+sirf::cSTIR_subsetSchedulerParameter(const DataHandle* handle, const char* name)
+{
+	SubsetScheduler& scheduler = objectFromHandle<SubsetScheduler>(handle);
+	if (boost::iequals(name, "num_subsets"))
+		return dataHandle<int>(scheduler.num_subsets());
+	if (boost::iequals(name, "policy"))
+		return charDataHandleFromCharData(scheduler.policy().c_str());
+	if (boost::iequals(name, "seed"))
+		return dataHandle<int>(scheduler.seed());
+	if (boost::iequals(name, "num_calls"))
+		return dataHandle<int>((int)scheduler.num_calls());
+	return parameterNotFound(name, __FILE__, __LINE__);
+}
+
+void*
+sirf::cSTIR_setMultiresolutionReconstructionParameter
+(DataHandle* hp, const char* name, const DataHandle* hv)
+{
+	PETMultiresolutionReconstruction& recon =
+		objectFromHandle<PETMultiresolutionReconstruction>(hp);
+	if (boost::iequals(name, "acquisition_data")) {
+		SPTR_FROM_HANDLE(PETAcquisitionData, sptr_ad, hv);
+		recon.set_acquisition_data(sptr_ad);
+	}
+	else if (boost::iequals(name, "acquisition_model")) {
+		SPTR_FROM_HANDLE(AcqModUsingMatrix3DF, sptr_am, hv);
+		recon.set_acquisition_model(sptr_am);
+	}
+	else if (boost::iequals(name, "num_subsets"))
+		recon.set_num_subsets(dataFromHandle<int>((void*)hv));
+	else if (boost::iequals(name, "output_filename_prefix"))
+		recon.set_output_filename_prefix(charDataFromDataHandle(hv));
+	else if (boost::iequals(name, "clear_levels"))
+		recon.clear_levels();
+	else
+		return parameterNotFound(name, __FILE__, __LINE__);
+	return new DataHandle;
+}
+
+void*
+sirf::cSTIR_multiresolutionReconstructionParameter
+(const DataHandle* handle, const char* name)
+{
+	PETMultiresolutionReconstruction& recon =
+		objectFromHandle<PETMultiresolutionReconstruction>(handle);
+	if (boost::iequals(name, "num_subsets"))
+		return dataHandle<int>(recon.num_subsets());
+	if (boost::iequals(name, "num_levels"))
+		return dataHandle<int>(recon.num_levels());
+	return parameterNotFound(name, __FILE__, __LINE__);
+}
+
 void*
 sirf::cSTIR_setFBP2DParameter(DataHandle* hp, const char* name, const DataHandle* hv)
 {
@@ -604,6 +875,8 @@ sirf::cSTIR_setFBP2DParameter(DataHandle* hp, const char* name, const DataHandle
 		double fc = dataFromHandle<float>(hv);
 		recon.set_frequency_cut_off(fc);
 	}
+	else if (boost::iequals(name, "num_threads"))
+		recon.set_num_threads(dataFromHandle<int>(hv));
 	else
 		return parameterNotFound(name, __FILE__, __LINE__);
 	return new DataHandle;
@@ -616,6 +889,8 @@ sirf::cSTIR_FBP2DParameter(DataHandle* hp, const char* name)
 		objectFromHandle<xSTIR_FBP2DReconstruction >(hp);
 	if (boost::iequals(name, "output"))
 		return newObjectHandle(recon.get_output());
+	if (boost::iequals(name, "num_threads"))
+		return dataHandle<int>(recon.num_threads());
 	return parameterNotFound(name, __FILE__, __LINE__);
 }
 
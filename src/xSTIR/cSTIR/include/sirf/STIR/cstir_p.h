@@ -52,6 +52,9 @@ namespace sirf {
 		cSTIR_setAcquisitionModelParameter
 		(DataHandle* hp, const char* name, const DataHandle* hv);
 
+	void*
+		cSTIR_acquisitionModelParameter(DataHandle* hp, const char* name);
+
 	void*
 		cSTIR_setAcqModUsingMatrixParameter
 		(DataHandle* hp, const char* name, const DataHandle* hv);
@@ -67,6 +70,14 @@ namespace sirf {
 		cSTIR_truncateToCylindricalFOVImageProcessorParameter
 		(const DataHandle* handle, const char* name);
 
+	void*
+		cSTIR_setSeparableImageFilterParameter
+		(DataHandle* hp, const char* name, const DataHandle* hv);
+
+	void*
+		cSTIR_separableImageFilterParameter
+		(const DataHandle* handle, const char* name);
+
 	void*
 		cSTIR_setGeneralisedPriorParameter
 		(DataHandle* hp, const char* name, const DataHandle* hv);
@@ -106,6 +117,14 @@ namespace sirf {
 		cSTIR_PoissonLogLikelihoodWithLinearModelForMeanAndProjDataParameter
 		(const DataHandle* handle, const char* name);
 
+	void*
+		cSTIR_setPoissonLogLikelihoodWithLinearModelForMeanAndListModeDataParameter
+		(DataHandle* hp, const char* name, const DataHandle* hv);
+
+	void*
+		cSTIR_PoissonLogLikelihoodWithLinearModelForMeanAndListModeDataParameter
+		(const DataHandle* handle, const char* name);
+
 	void*
 		cSTIR_setReconstructionParameter
 		(DataHandle* hp, const char* name, const DataHandle* hv);
@@ -130,6 +149,21 @@ namespace sirf {
 	void*
 		cSTIR_OSSPSParameter(const DataHandle* handle, const char* name);
 
+	void*
+		cSTIR_setSubsetSchedulerParameter
+		(DataHandle* hp, const char* name, const DataHandle* hv);
+
+	void*
+		cSTIR_subsetSchedulerParameter(const DataHandle* handle, const char* name);
+
+	void*
+		cSTIR_setMultiresolutionReconstructionParameter
+		(DataHandle* hp, const char* name, const DataHandle* hv);
+
+	void*
+		cSTIR_multiresolutionReconstructionParameter
+		(const DataHandle* handle, const char* name);
+
 	void*
 		cSTIR_setFBP2DParameter(DataHandle* hp, const char* name, const DataHandle* hv);
 
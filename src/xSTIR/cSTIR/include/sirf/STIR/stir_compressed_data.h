@@ -0,0 +1,160 @@
+/*
+CCP PETMR Synergistic Image Reconstruction Framework (SIRF)
+Copyright 2019 Rutherford Appleton Laboratory STFC
+
+This is software developed for the Collaborative Computational
+Project in Positron Emission Tomography and Magnetic Resonance imaging
+(http://www.ccppetmr.ac.uk/).
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+http://www.apache.org/licenses/LICENSE-2.0
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+*/
+
+/*!
+\file
+\ingroup STIR Extensions
+\brief Specification file for losslessly compressed acquisition data storage.
+
+\author Evgueni Ovtchinnikov
+\author CCP PETMR
+*/
+
+#ifndef SIRF_STIR_COMPRESSED_DATA
+#define SIRF_STIR_COMPRESSED_DATA
+
+#include <stdint.h>
+
+#include <fstream>
+#include <list>
+#include <string>
+#include <vector>
+
+#include <boost/thread/mutex.hpp>
+
+#include "stir/ProjData.h"
+#include "stir/SegmentBySinogram.h"
+#include "stir/SegmentByView.h"
+#include "stir/Sinogram.h"
+#include "stir/Viewgram.h"
+
+namespace sirf {
+
+	/*!
+	\ingroup STIR Extensions
+	\brief Lossless codec for arrays of floats.
+
+	The values are split into 4 byte planes (all first bytes, then all
+	second bytes etc.), which turns the slowly varying exponent bytes of
+	typical sinogram values into long runs, and the planes are then
+	run-length encoded: a control byte c < 128 is followed by c + 1
+	literal bytes, c >= 128 by one byte repeated c - 125 times.
+	Zero or low-count data compress by 1 to 2 orders of magnitude.
+	*/
+	class FloatArrayCodec {
+	public:
+		static void encode(const float* data, size_t n,
+			std::vector<unsigned char>& code);
+		static void decode(const std::vector<unsigned char>& code,
+			float* data, size_t n);
+	};
+
+	/*!
+	\ingroup STIR Extensions
+	\brief ProjData stored as losslessly compressed segments.
+
+	Each segment is kept compressed by FloatArrayCodec (a segment never
+	written to is all zeros and takes no space). Segments accessed by
+	viewgram or sinogram are decompressed into a small LRU cache, and
+	modified cached segments are recompressed when evicted or read as a
+	whole; whole segments are compressed directly by set_segment.
+
+	If a file name is given, the compressed segments are stored in that
+	file, which is created by the constructor and removed by the
+	destructor; otherwise they are kept in memory. A segment that
+	compresses to more bytes than its space in the file is rewritten at
+	the end of the file, the old space being left unused.
+	*/
+	class ProjDataCompressed : public stir::ProjData {
+	public:
+		ProjDataCompressed(stir::shared_ptr<stir::ExamInfo> sptr_exam_info,
+			stir::shared_ptr<stir::ProjDataInfo> sptr_proj_data_info,
+			int cache_size = 2, const std::string& filename = "");
+		~ProjDataCompressed();
+
+		//! The file storing the compressed segments ("" if in memory)
+		const std::string& filename() const
+		{
+			return _filename;
+		}
+
+		//! Number of segments kept decompressed
+		int cache_size() const
+		{
+			return _cache_size;
+		}
+		//! Size in bytes of the compressed segments (excluding cached ones)
+		size_t compressed_size() const;
+		//! Size in bytes of all data if uncompressed
+		size_t uncompressed_size() const;
+
+		virtual stir::Viewgram<float> get_viewgram(const int view_num,
+			const int segment_num,
+			const bool make_num_tangential_poss_odd = false) const;
+		virtual stir::Succeeded set_viewgram(const stir::Viewgram<float>& v);
+		virtual stir::Sinogram<float> get_sinogram(const int ax_pos_num,
+			const int segment_num,
+			const bool make_num_tangential_poss_odd = false) const;
+		virtual stir::Succeeded set_sinogram(const stir::Sinogram<float>& s);
+
+		virtual stir::SegmentBySinogram<float>
+			get_segment_by_sinogram(const int segment_num) const;
+		virtual stir::SegmentByView<float>
+			get_segment_by_view(const int segment_num) const;
+		virtual stir::Succeeded set_segment(const stir::SegmentBySinogram<float>& s);
+		virtual stir::Succeeded set_segment(const stir::SegmentByView<float>& s);
+
+	private:
+		struct CachedSegment {
+			int segment_num;
+			stir::shared_ptr<stir::SegmentBySinogram<float> > sptr_segment;
+			bool modified;
+		};
+
+		// place and size of a compressed segment in the file
+		struct FileBlock {
+			uint64_t offset;
+			size_t size;
+			size_t capacity;
+		};
+
+		int _cache_size;
+		std::string _filename;
+		mutable std::fstream _file;
+		mutable uint64_t _file_end;
+		mutable std::vector<FileBlock> _file_blocks;
+		mutable std::vector<std::vector<unsigned char> > _blocks;
+		mutable std::list<CachedSegment> _cache;
+		mutable boost::mutex _mutex;
+
+		void write_block_(int segment_num,
+			const std::vector<unsigned char>& code) const;
+		// the block in memory, or read from the file into buffer
+		const std::vector<unsigned char>& read_block_(int segment_num,
+			std::vector<unsigned char>& buffer) const;
+		void compress_(const stir::SegmentBySinogram<float>& s) const;
+		void decompress_(stir::SegmentBySinogram<float>& s) const;
+		stir::SegmentBySinogram<float>&
+			cached_segment_(int segment_num, bool modify) const;
+	};
+
+}
+
+#endif
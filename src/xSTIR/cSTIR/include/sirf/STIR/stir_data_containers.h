@@ -35,6 +35,7 @@ limitations under the License.
 #include <chrono>
 #include <fstream>
 #include <exception>
+#include <vector>
 
 #include "sirf/iUtilities/LocalisedException.h"
 #include "sirf/iUtilities/DataHandle.h"
@@ -42,6 +43,7 @@ limitations under the License.
 #include "sirf/common/ANumRef.h"
 #include "sirf/common/PETImageData.h"
 #include "sirf/STIR/stir_types.h"
+#include "sirf/STIR/stir_compressed_data.h"
 #include "sirf/common/GeometricalInfo.h"
 
 namespace sirf {
@@ -136,6 +138,9 @@ namespace sirf {
 
 	class PETAcquisitionData : public DataContainer {
 	public:
+		//! Per-sinogram flags indexed by [segment - min segment][axial position - min axial position]
+		typedef std::vector<std::vector<unsigned char> > SinogramFlags;
+
 		virtual ~PETAcquisitionData() {}
 
 		// virtual constructors
@@ -144,27 +149,18 @@ namespace sirf {
 			stir::shared_ptr<stir::ProjDataInfo> sptr_proj_data_info) const = 0;
 		virtual stir::shared_ptr<PETAcquisitionData> new_acquisition_data() const = 0;
 
+		//! Returns data rebinned by STIR SSRB
+		/*!
+		If both this and the rebinned data are stored in memory, the rebinning
+		is done by a multithreaded in-memory version of STIR SSRB.
+		*/
 		stir::shared_ptr<PETAcquisitionData> single_slice_rebinned_data(
 			const int num_segments_to_combine,
 			const int num_views_to_combine = 1,
 			const int num_tang_poss_to_trim = 0,
 			const bool do_normalisation = true,
 			const int max_in_segment_num_to_process = -1
-			)
-		{
-			stir::shared_ptr<stir::ProjDataInfo> out_proj_data_info_sptr(
-				stir::SSRB(*data()->get_proj_data_info_ptr(),
-				num_segments_to_combine,
-				num_views_to_combine,
-				num_tang_poss_to_trim,
-				max_in_segment_num_to_process
-				));
-			stir::shared_ptr<PETAcquisitionData> 
-				sptr(same_acquisition_data
-				(data()->get_exam_info_sptr(), out_proj_data_info_sptr));
-			SSRB(*sptr, *data(), do_normalisation);
-			return sptr;
-		}
+			);
 
 		static std::string storage_scheme()
 		{
@@ -180,25 +176,65 @@ namespace sirf {
 			return _template;
 		}
 
+		// non-const access may modify the data, hence drops the zero flags;
+		// const access keeps them and does not allow modifying the data
 		stir::shared_ptr<stir::ProjData> data()
 		{
+			_zero_sinograms.clear();
 			return _data;
 		}
-		const stir::shared_ptr<stir::ProjData> data() const
+		stir::shared_ptr<const stir::ProjData> data() const
 		{
 			return _data;
 		}
 		void set_data(stir::shared_ptr<stir::ProjData> data)
 		{
+			_zero_sinograms.clear();
 			_data = data;
 		}
 
+		//! Marks the sinograms known to be zero
+		/*!
+		A non-zero flag tells that the respective sinogram contains only zeros,
+		which lets norm, dot, axpby and multiply skip it (the result gets its
+		own flags). The flags are set by fill(0) and by the forward projection
+		of an acquisition model with an image support, and are dropped by any
+		non-const access to the underlying STIR ProjData. Since writes through
+		a shared pointer obtained earlier from data() (e.g. one held by a STIR
+		normalisation or objective function) cannot be detected, the flags are
+		only kept while this object is the sole owner of its ProjData.
+		*/
+		void set_zero_sinograms(const SinogramFlags& flags)
+		{
+			SinogramFlags f(flags);
+			set_zero_sinograms_(f);
+		}
+		const SinogramFlags& zero_sinograms() const
+		{
+			return _zero_sinograms;
+		}
+		bool has_zero_sinograms() const
+		{
+			return !_zero_sinograms.empty();
+		}
+		void clear_zero_sinograms()
+		{
+			_zero_sinograms.clear();
+		}
+
 		// data import/export
-		void fill(float v) { data()->fill(v); }
+		void fill(float v)
+		{
+			data()->fill(v);
+			if (v == 0)
+				mark_all_zero_();
+		}
 		void fill(const PETAcquisitionData& ad)
 		{
-			stir::shared_ptr<stir::ProjData> sptr = ad.data();
+			stir::shared_ptr<const stir::ProjData> sptr = ad.data();
+			SinogramFlags flags = ad.zero_sinograms();
 			data()->fill(*sptr);
+			set_zero_sinograms_(flags);
 		}
 		void fill_from(const float* d) { data()->fill_from(d); }
 		void copy_to(float* d) { data()->copy_to(d); }
@@ -226,19 +262,19 @@ namespace sirf {
 		}
 
 		// ProjData methods
-		int get_num_tangential_poss()
+		int get_num_tangential_poss() const
 		{
 			return data()->get_num_tangential_poss();
 		}
-		int get_num_views()
+		int get_num_views() const
 		{
 			return data()->get_num_views();
 		}
-		int get_num_sinograms()
+		int get_num_sinograms() const
 		{
 			return data()->get_num_sinograms();
 		}
-		int get_num_TOF_bins()
+		int get_num_TOF_bins() const
 		{
 			return 1;
 		}
@@ -296,7 +332,21 @@ namespace sirf {
 		static std::string _storage_scheme;
 		static stir::shared_ptr<PETAcquisitionData> _template;
 		stir::shared_ptr<stir::ProjData> _data;
+		SinogramFlags _zero_sinograms;
 		virtual PETAcquisitionData* clone_impl() const = 0;
+		void mark_all_zero_();
+		// takes the flags (swapping them in) unless the ProjData is shared
+		void set_zero_sinograms_(SinogramFlags& flags)
+		{
+			if (_data.use_count() == 1)
+				_zero_sinograms.swap(flags);
+			else
+				_zero_sinograms.clear();
+		}
+		// this = op(x, y) segment by segment, skipping zero sinograms
+		template<class Op>
+		void binary_op_(const PETAcquisitionData& x, const PETAcquisitionData& y,
+			const Op& op);
 		PETAcquisitionData* clone_base() const
 		{
 			stir::shared_ptr<stir::ExamInfo> sptr_ei = get_exam_info_sptr();
@@ -478,6 +528,161 @@ namespace sirf {
 		}
 	};
 
+	/*!
+	\ingroup STIR Extensions
+	\brief Implementation of the PET acquisition data storing losslessly
+	compressed segments in a scratch file (see ProjDataCompressed).
+
+	Trades some CPU time for disk space and I/O: useful for the scratch
+	copies created by the algebra when acquisition data are large and
+	mostly zero or low-count. The scratch file is removed with the data.
+	*/
+	class PETAcquisitionDataCompressed : public PETAcquisitionData {
+	public:
+		PETAcquisitionDataCompressed() {}
+		PETAcquisitionDataCompressed(stir::shared_ptr<stir::ExamInfo> sptr_exam_info,
+			stir::shared_ptr<stir::ProjDataInfo> sptr_proj_data_info)
+		{
+			_data = stir::shared_ptr<stir::ProjData>
+				(new ProjDataCompressed(sptr_exam_info, sptr_proj_data_info,
+				2, SIRFUtilities::scratch_file_name()));
+		}
+		PETAcquisitionDataCompressed(const stir::ProjData& pd)
+		{
+			_data = stir::shared_ptr<stir::ProjData>
+				(new ProjDataCompressed(pd.get_exam_info_sptr(),
+				pd.get_proj_data_info_sptr(), 2, SIRFUtilities::scratch_file_name()));
+		}
+		PETAcquisitionDataCompressed
+			(stir::shared_ptr<stir::ExamInfo> sptr_ei, std::string scanner_name,
+			int span = 1, int max_ring_diff = -1, int view_mash_factor = 1)
+		{
+			stir::shared_ptr<stir::ProjDataInfo> sptr_pdi =
+				PETAcquisitionData::proj_data_info_from_scanner
+				(scanner_name, span, max_ring_diff, view_mash_factor);
+			// segments not yet written to are zero
+			_data.reset(new ProjDataCompressed(sptr_ei, sptr_pdi,
+				2, SIRFUtilities::scratch_file_name()));
+		}
+
+		static void init()
+		{
+			PETAcquisitionDataInFile::init();
+		}
+		static void set_as_template()
+		{
+			init();
+			_storage_scheme = "compressed";
+			_template.reset(new PETAcquisitionDataCompressed);
+		}
+
+		//! Size in bytes of the compressed data
+		size_t compressed_size() const
+		{
+			return ((ProjDataCompressed*)_data.get())->compressed_size();
+		}
+
+		virtual PETAcquisitionData* same_acquisition_data
+			(stir::shared_ptr<stir::ExamInfo> sptr_exam_info,
+			stir::shared_ptr<stir::ProjDataInfo> sptr_proj_data_info) const
+		{
+			PETAcquisitionData* ptr_ad =
+				new PETAcquisitionDataCompressed(sptr_exam_info, sptr_proj_data_info);
+			return ptr_ad;
+		}
+		virtual ObjectHandle<DataContainer>* new_data_container_handle() const
+		{
+			init();
+			DataContainer* ptr = _template->same_acquisition_data
+				(this->get_exam_info_sptr(), this->get_proj_data_info_sptr());
+			return new ObjectHandle<DataContainer>
+				(stir::shared_ptr<DataContainer>(ptr));
+		}
+		virtual stir::shared_ptr<PETAcquisitionData> new_acquisition_data() const
+		{
+			init();
+			return stir::shared_ptr < PETAcquisitionData >
+				(_template->same_acquisition_data
+				(this->get_exam_info_sptr(), this->get_proj_data_info_sptr()));
+		}
+	private:
+		virtual PETAcquisitionDataCompressed* clone_impl() const
+		{
+			init();
+			return (PETAcquisitionDataCompressed*)clone_base();
+		}
+	};
+
+	/*!
+	\ingroup STIR Extensions
+	\brief Pointers to the x-rows of a regular STIR image.
+
+	Each row of a regular image is a contiguous array of nx floats, so that
+	element-wise operations can run plain (vectorisable) loops over rows,
+	and copies can be done by memcpy. If all rows follow each other in
+	memory, the whole image is one contiguous array starting at row(0).
+	For an irregular image the table is empty (regular() returns false).
+	*/
+	template<typename T>
+	class ImageRowTable {
+	public:
+		template<class Image>
+		ImageRowTable(Image& image) : nz(0), ny(0), nx(0), contiguous(false)
+		{
+			stir::Coordinate3D<int> min_ind;
+			stir::Coordinate3D<int> max_ind;
+			if (!image.get_regular_range(min_ind, max_ind))
+				return;
+			nz = max_ind[1] - min_ind[1] + 1;
+			ny = max_ind[2] - min_ind[2] + 1;
+			nx = max_ind[3] - min_ind[3] + 1;
+			if (nz < 1 || ny < 1 || nx < 1) {
+				nz = ny = nx = 0;
+				return;
+			}
+			rows.resize(size_t(nz)*ny);
+			contiguous = true;
+			for (int z = 0; z < nz; z++)
+				for (int y = 0; y < ny; y++) {
+					size_t r = size_t(z)*ny + y;
+					rows[r] = &image[min_ind[1] + z][min_ind[2] + y][min_ind[3]];
+					if (r > 0 && rows[r] != rows[r - 1] + nx)
+						contiguous = false;
+				}
+		}
+		bool regular() const
+		{
+			return nx > 0;
+		}
+		size_t num_rows() const
+		{
+			return rows.size();
+		}
+		size_t size() const
+		{
+			return rows.size()*nx;
+		}
+		T* row(size_t r) const
+		{
+			return rows[r];
+		}
+		T* row(int z, int y) const
+		{
+			return rows[size_t(z)*ny + y];
+		}
+		template<typename S>
+		bool same_size(const ImageRowTable<S>& other) const
+		{
+			return regular() &&
+				nz == other.nz && ny == other.ny && nx == other.nx;
+		}
+		int nz;
+		int ny;
+		int nx;
+		bool contiguous;
+		std::vector<T*> rows;
+	};
+
 	/*!
 	\ingroup STIR Extensions
 	\brief STIR DiscretisedDensity<3, float> wrapper with added functionality.
@@ -701,6 +906,8 @@ namespace sirf {
 		{
 			_data->fill(v);
 		}
+		//! Copies the values of x (by memcpy if the images are regular and of the same size)
+		void fill(const STIRImageData& x);
 		virtual Dimensions dimensions() const
 		{
 			Dimensions dim;
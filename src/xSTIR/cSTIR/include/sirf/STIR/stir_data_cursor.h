@@ -0,0 +1,122 @@
+/*
+CCP PETMR Synergistic Image Reconstruction Framework (SIRF)
+Copyright 2019 Rutherford Appleton Laboratory STFC
+
+This is software developed for the Collaborative Computational
+Project in Positron Emission Tomography and Magnetic Resonance imaging
+(http://www.ccppetmr.ac.uk/).
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+http://www.apache.org/licenses/LICENSE-2.0
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+*/
+/*!
+\file
+\ingroup STIR Extensions
+\brief Specification file for block-wise access to acquisition data.
+
+\author Evgueni Ovtchinnikov
+\author CCP PETMR
+*/
+
+#ifndef SIRF_STIR_DATA_CURSOR
+#define SIRF_STIR_DATA_CURSOR
+
+#include <string>
+#include <vector>
+
+#include "sirf/STIR/stir_data_containers.h"
+
+namespace sirf {
+
+	/*!
+	\ingroup STIR Extensions
+	\brief Cursor moving over acquisition data in segment, viewgram or
+	sinogram blocks.
+
+	Segments are visited in the order in which copy_to and fill_from store
+	them (0, 1, -1, 2, -2, ...), and viewgrams or sinograms within a
+	segment in ascending order, so that only one block at a time needs to
+	be in the caller's memory. Each block is a C-ordered array of
+	num_sinograms x num_views x num_tangential_poss values: a segment block
+	has all views and axial positions of the segment, a viewgram block one
+	view and all axial positions, a sinogram block one axial position and
+	all views.
+
+	Segment and sinogram blocks are contiguous slabs of the array filled by
+	copy_to, starting at sinogram FIRST_SINOGRAM, and are visited in its
+	storage order. Viewgram blocks are neither: their values are strided in
+	that array, so callers must place them using MIN_VIEW_NUM (the view)
+	and FIRST_SINOGRAM (the first sinogram of the block's segment).
+
+	Writing a block back (set_block) goes through the STIR ProjData
+	set_segment/set_viewgram/set_sinogram methods, so that file-based
+	and compressed data are updated without being read as a whole.
+	*/
+	class PETAcquisitionDataCursor {
+	public:
+		enum Unit { SEGMENT, VIEWGRAM, SINOGRAM };
+		//! Block index metadata
+		enum { SEGMENT_NUM, MIN_AXIAL_POS_NUM, NUM_SINOGRAMS, MIN_VIEW_NUM,
+			NUM_VIEWS, NUM_TANGENTIAL_POSS, FIRST_SINOGRAM, INFO_SIZE };
+
+		PETAcquisitionDataCursor(stir::shared_ptr<PETAcquisitionData> sptr_ad,
+			Unit unit = SINOGRAM);
+		//! Unit by name: "segment", "viewgram" (or "view") or "sinogram"
+		static Unit unit(const std::string& name);
+
+		//! Moves before the first block
+		void reset();
+		//! Moves to the next block, returns false after the last one
+		bool next();
+		bool valid() const
+		{
+			return _started && _seg < _segments.size();
+		}
+
+		int segment_num() const;
+		int min_axial_pos_num() const;
+		int num_sinograms() const;
+		int min_view_num() const;
+		int num_views() const;
+		int num_tangential_poss() const;
+		//! Index of the block's first sinogram in the whole data array
+		int first_sinogram() const;
+		//! Number of values in the current block
+		size_t size() const
+		{
+			return (size_t)num_sinograms()*num_views()*num_tangential_poss();
+		}
+		//! Fills info[INFO_SIZE] with the current block metadata
+		void get_info(int* info) const;
+
+		//! Copies the current block to data[size()]
+		void get_block(float* data) const;
+		//! Overwrites the current block with data[size()]
+		void set_block(const float* data);
+
+	private:
+		const stir::ProjData& proj_data_() const;
+		void check_valid_() const;
+
+		stir::shared_ptr<PETAcquisitionData> _sptr_ad;
+		Unit _unit;
+		// segment numbers in storage order
+		std::vector<int> _segments;
+		bool _started;
+		size_t _seg;
+		// axial position or view number within the segment
+		int _pos;
+		int _first_sinogram;
+	};
+
+}
+
+#endif
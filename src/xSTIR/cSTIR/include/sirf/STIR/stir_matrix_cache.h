@@ -0,0 +1,180 @@
+/*
+CCP PETMR Synergistic Image Reconstruction Framework (SIRF)
+Copyright 2019 Rutherford Appleton Laboratory STFC
+
+This is software developed for the Collaborative Computational
+Project in Positron Emission Tomography and Magnetic Resonance imaging
+(http://www.ccppetmr.ac.uk/).
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+http://www.apache.org/licenses/LICENSE-2.0
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+*/
+
+/*!
+\file
+\ingroup STIR Extensions
+\brief Specification file for the persistent projection matrix cache.
+
+\author Evgueni Ovtchinnikov
+\author CCP PETMR
+*/
+
+#ifndef SIRF_STIR_MATRIX_CACHE
+#define SIRF_STIR_MATRIX_CACHE
+
+#include <stdint.h>
+#include <string>
+
+#include <boost/interprocess/mapped_region.hpp>
+
+#include "stir/Bin.h"
+#include "stir/RegisteredParsingObject.h"
+#include "stir/recon_buildblock/ProjMatrixByBin.h"
+#include "stir/recon_buildblock/ProjMatrixElemsForOneBin.h"
+
+#include "sirf/STIR/stir_types.h"
+
+namespace sirf {
+
+	/*!
+	\ingroup STIR Extensions
+	\brief Projection matrix read from a memory-mapped cache file.
+
+	STIR projection matrices compute their elements lazily and keep them
+	in the memory of the current process only, so that every new process
+	has to recompute them. This class wraps a source matrix (e.g. a
+	RayTracingMatrix) and on set_up looks for a cache file in the cache
+	directory, whose name is derived from the scanner, acquisition data
+	geometry, image geometry and the source matrix parameters. If there is
+	no such file, the elements of all basic bins (those not related to
+	others by symmetries) are computed once by the source matrix and
+	written to it. The file is then memory-mapped read-only, so that all
+	processes on the same node share one copy of it via the page cache.
+
+	The cache file layout is: a fixed-size header, the matrix key string,
+	the elements of all basic bins (stored contiguously bin after bin) and
+	the bin index sorted by (segment, view, axial position, tangential position).
+	*/
+	class ProjMatrixByBinFromCache : public stir::RegisteredParsingObject
+		<ProjMatrixByBinFromCache, stir::ProjMatrixByBin, stir::ProjMatrixByBin> {
+	public:
+		//! Name which will be used when parsing a ProjMatrixByBin object
+		static const char* const registered_name;
+
+		struct Header {
+			char magic[8];
+			uint64_t key_length;
+			uint64_t num_bins;
+			uint64_t num_elems;
+			uint64_t elems_offset;
+			uint64_t index_offset;
+		};
+		struct BinRecord {
+			int32_t segment;
+			int32_t view;
+			int32_t axial_pos;
+			int32_t tangential_pos;
+			uint64_t first;
+			uint64_t count;
+		};
+		struct Element {
+			int16_t z;
+			int16_t y;
+			int16_t x;
+			int16_t unused;
+			float value;
+		};
+
+		ProjMatrixByBinFromCache();
+		ProjMatrixByBinFromCache(stir::shared_ptr<stir::ProjMatrixByBin> sptr_source,
+			const std::string& cache_path);
+
+		void set_source_matrix_sptr(stir::shared_ptr<stir::ProjMatrixByBin> sptr)
+		{
+			_sptr_source = sptr;
+		}
+		stir::shared_ptr<stir::ProjMatrixByBin> source_matrix_sptr()
+		{
+			return _sptr_source;
+		}
+		void set_cache_path(const std::string& path)
+		{
+			_cache_path = path;
+		}
+		const std::string& cache_path() const
+		{
+			return _cache_path;
+		}
+		//! Reports the computation of the cache file on stdout if verbose
+		void set_verbose(bool verbose)
+		{
+			_verbose = verbose;
+		}
+		//! Name of the cache file used (available after set_up)
+		const std::string& filename() const
+		{
+			return _filename;
+		}
+		//! Number of basic bins in the mapped cache file
+		uint64_t num_bins() const
+		{
+			return _ptr_header ? _ptr_header->num_bins : 0;
+		}
+		//! Number of non-zero elements in the mapped cache file
+		uint64_t num_elems() const
+		{
+			return _ptr_header ? _ptr_header->num_elems : 0;
+		}
+		const BinRecord* index() const
+		{
+			return _ptr_index;
+		}
+		//! Returns the index record of a basic bin (0 if not found)
+		const BinRecord* find(const stir::Bin& bin) const;
+		const Element* elements() const
+		{
+			return _ptr_elems;
+		}
+
+		virtual void set_up(
+			const stir::shared_ptr<stir::ProjDataInfo>& sptr_pdi,
+			const stir::shared_ptr<Image3DF>& sptr_image);
+
+		virtual ProjMatrixByBinFromCache* clone() const
+		{
+			return new ProjMatrixByBinFromCache(*this);
+		}
+
+		//! Returns the string identifying the matrix for given geometries
+		static std::string key(stir::ProjMatrixByBin& matrix,
+			stir::ProjDataInfo& pdi, const Image3DF& image);
+		//! Computes all basic bins of the (set up) matrix and writes them to file
+		static void write(const std::string& filename, const std::string& key,
+			stir::ProjMatrixByBin& matrix, const stir::ProjDataInfo& pdi);
+
+	private:
+		stir::shared_ptr<stir::ProjMatrixByBin> _sptr_source;
+		std::string _cache_path;
+		std::string _filename;
+		bool _verbose;
+		stir::shared_ptr<boost::interprocess::mapped_region> _sptr_region;
+		const Header* _ptr_header;
+		const BinRecord* _ptr_index;
+		const Element* _ptr_elems;
+
+		void map_(const std::string& key);
+		virtual void calculate_proj_matrix_elems_for_one_bin
+			(stir::ProjMatrixElemsForOneBin& lor) const;
+	};
+
+}
+
+#endif
@@ -0,0 +1,137 @@
+/*
+CCP PETMR Synergistic Image Reconstruction Framework (SIRF)
+Copyright 2019 Rutherford Appleton Laboratory STFC
+
+This is software developed for the Collaborative Computational
+Project in Positron Emission Tomography and Magnetic Resonance imaging
+(http://www.ccppetmr.ac.uk/).
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+http://www.apache.org/licenses/LICENSE-2.0
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+*/
+
+/*!
+\file
+\ingroup STIR Extensions
+\brief Specification file for acquisition model instrumentation.
+
+\author Evgueni Ovtchinnikov
+\author CCP PETMR
+*/
+
+#ifndef SIRF_STIR_MODEL_STATS
+#define SIRF_STIR_MODEL_STATS
+
+#include <string>
+
+#include <boost/thread/mutex.hpp>
+
+#include "stir/CPUTimer.h"
+#include "stir/HighResWallClockTimer.h"
+
+namespace sirf {
+
+	/*!
+	\ingroup STIR Extensions
+	\brief Per-stage timings and data volumes of an acquisition model.
+
+	For each stage of forward and backward projection (the projection
+	itself, adding the additive and background terms, applying the
+	acquisition sensitivity model and allocating the output) the wall
+	clock and CPU times (the latter summed over threads), the number of
+	calls and the number of bytes read and written are accumulated.
+	*/
+	class AcquisitionModelStatistics {
+	public:
+		enum Stage {
+			PROJECTION, ADDITIVE, NORMALISATION, BACKGROUND, ALLOCATION,
+			NUM_STAGES
+		};
+		struct StageStatistics {
+			double wall_time;
+			double cpu_time;
+			long long calls;
+			double bytes;
+		};
+
+		AcquisitionModelStatistics()
+		{
+			reset();
+		}
+		void reset();
+		void add(Stage stage, double wall_time, double cpu_time, double bytes);
+		void count_forward()
+		{
+			boost::mutex::scoped_lock lock(_mutex);
+			_forward_calls++;
+		}
+		void count_backward()
+		{
+			boost::mutex::scoped_lock lock(_mutex);
+			_backward_calls++;
+		}
+		long long forward_calls() const
+		{
+			return _forward_calls;
+		}
+		long long backward_calls() const
+		{
+			return _backward_calls;
+		}
+		const StageStatistics& stage(Stage s) const
+		{
+			return _stages[s];
+		}
+		//! Stage name: "projection", "additive", "normalisation" etc.
+		static const char* stage_name(Stage s);
+		//! Stage of given name, NUM_STAGES if unknown
+		static Stage stage(const std::string& name);
+		//! All statistics as a JSON object
+		std::string json() const;
+		void write_json(const std::string& filename) const;
+
+	private:
+		StageStatistics _stages[NUM_STAGES];
+		long long _forward_calls;
+		long long _backward_calls;
+		mutable boost::mutex _mutex;
+	};
+
+	/*!
+	\ingroup STIR Extensions
+	\brief Times the enclosing scope as one call of a stage.
+	*/
+	class StageTimer {
+	public:
+		StageTimer(AcquisitionModelStatistics& stats,
+			AcquisitionModelStatistics::Stage stage, double bytes = 0) :
+			_stats(stats), _stage(stage), _bytes(bytes)
+		{
+			_wall.start();
+			_cpu.start();
+		}
+		~StageTimer()
+		{
+			_cpu.stop();
+			_wall.stop();
+			_stats.add(_stage, _wall.value(), _cpu.value(), _bytes);
+		}
+	private:
+		AcquisitionModelStatistics& _stats;
+		AcquisitionModelStatistics::Stage _stage;
+		double _bytes;
+		stir::HighResWallClockTimer _wall;
+		stir::CPUTimer _cpu;
+	};
+
+}
+
+#endif
@@ -0,0 +1,153 @@
+/*
+CCP PETMR Synergistic Image Reconstruction Framework (SIRF)
+Copyright 2019 Rutherford Appleton Laboratory STFC
+
+This is software developed for the Collaborative Computational
+Project in Positron Emission Tomography and Magnetic Resonance imaging
+(http://www.ccppetmr.ac.uk/).
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+http://www.apache.org/licenses/LICENSE-2.0
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+*/
+
+/*!
+\file
+\ingroup STIR Extensions
+\brief Specification file for the coarse-to-fine multiresolution reconstruction.
+
+\author Evgueni Ovtchinnikov
+\author CCP PETMR
+*/
+
+#ifndef SIRF_STIR_MULTIRESOLUTION
+#define SIRF_STIR_MULTIRESOLUTION
+
+#include <string>
+#include <vector>
+
+#include "sirf/STIR/stir_x.h"
+
+namespace sirf {
+
+	/*!
+	\ingroup STIR Extensions
+	\brief Coarse-to-fine OSMAPOSL reconstruction.
+
+	The reconstruction goes through a sequence of levels, each running a
+	given number of OSMAPOSL subiterations on the full resolution image
+	grid downsampled transaxially by an integer factor, each coarse grid
+	covering the index range of the full resolution one and centred on the
+	same point (the last level must have factor 1 and uses the grid of the
+	full resolution image itself). The estimate is bilinearly interpolated
+	to the grid of the next level and scaled by the ratio of the total
+	sensitivities of the two levels, which keeps the forward projection of
+	the estimate unchanged whatever the units of the projection matrix.
+
+	Each level has its own ray tracing matrix (with the parameters of the
+	matrix of the acquisition model given, which must be a ray tracing
+	matrix, and its cache path and sparse matrix choice), acquisition
+	model, objective function and reconstruction, all created and set up
+	by set_up(), so that the sensitivities and the cached matrices are
+	computed once and reused by subsequent process() calls (until a
+	parameter is changed or the image geometry differs).
+	The additive term and the acquisition sensitivity model of the given
+	acquisition model are shared by all levels.
+	*/
+	class PETMultiresolutionReconstruction {
+	public:
+		PETMultiresolutionReconstruction() :
+			_num_subsets(1), _is_set_up(false)
+		{}
+
+		void set_acquisition_data(stir::shared_ptr<PETAcquisitionData> sptr_ad)
+		{
+			_sptr_ad = sptr_ad;
+			reset_();
+		}
+		void set_acquisition_model
+			(stir::shared_ptr<PETAcquisitionModelUsingMatrix> sptr_am)
+		{
+			_sptr_am = sptr_am;
+			reset_();
+		}
+		void set_num_subsets(int n)
+		{
+			if (n < 1)
+				THROW("number of subsets must be positive");
+			_num_subsets = n;
+			reset_();
+		}
+		int num_subsets() const
+		{
+			return _num_subsets;
+		}
+		//! Writes the image of each level at the end of the level ("" does not)
+		/*! The files are <prefix>_levelN_<subiteration>, none by default. */
+		void set_output_filename_prefix(const std::string& prefix)
+		{
+			_output_filename_prefix = prefix;
+			reset_();
+		}
+		//! Appends a level with given downsampling factor and subiterations
+		void add_level(int factor, int num_subiterations);
+		void clear_levels()
+		{
+			_levels.clear();
+			_is_set_up = false;
+		}
+		int num_levels() const
+		{
+			return (int)_levels.size();
+		}
+		//! Sets up all levels for the full resolution image geometry
+		stir::Succeeded set_up(stir::shared_ptr<STIRImageData> sptr_image);
+		//! Reconstructs from the initial estimate in image, replacing it
+		void process(STIRImageData& image);
+
+		//! Interpolates an image into another one with the same origin
+		/*!
+		The interpolation is bilinear in each plane; both images must have
+		the same planes, and the values outside the input grid are those
+		at its nearest edge.
+		*/
+		static void resample(const Voxels3DF& in, Voxels3DF& out);
+
+	private:
+		struct Level {
+			int factor;
+			int num_subiterations;
+			stir::shared_ptr<STIRImageData> sptr_image;
+			stir::shared_ptr<AcqModUsingMatrix3DF> sptr_am;
+			stir::shared_ptr<PoissonLogLhLinModMeanProjData3DF> sptr_obj;
+			stir::shared_ptr<OSMAPOSLReconstruction3DF> sptr_recon;
+			// total sensitivity
+			double sensitivity;
+		};
+
+		stir::shared_ptr<PETAcquisitionData> _sptr_ad;
+		stir::shared_ptr<PETAcquisitionModelUsingMatrix> _sptr_am;
+		int _num_subsets;
+		std::string _output_filename_prefix;
+		std::vector<Level> _levels;
+		stir::shared_ptr<STIRImageData> _sptr_image;
+		bool _is_set_up;
+
+		// discards the set-up of all levels
+		void reset_();
+		stir::Succeeded set_up_level_(Level& level, int level_num);
+		// interpolates image into the grid of level and scales it
+		void transfer_(const Image3DF& image, double sensitivity,
+			const Level& level, Image3DF& out) const;
+	};
+
+}
+
+#endif
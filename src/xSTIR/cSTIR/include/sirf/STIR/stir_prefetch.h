@@ -0,0 +1,147 @@
+/*
+CCP PETMR Synergistic Image Reconstruction Framework (SIRF)
+Copyright 2019 Rutherford Appleton Laboratory STFC
+
+This is software developed for the Collaborative Computational
+Project in Positron Emission Tomography and Magnetic Resonance imaging
+(http://www.ccppetmr.ac.uk/).
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+http://www.apache.org/licenses/LICENSE-2.0
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+*/
+
+/*!
+\file
+\ingroup STIR Extensions
+\brief Specification file for the prefetching acquisition data reader.
+
+\author Evgueni Ovtchinnikov
+\author CCP PETMR
+*/
+
+#ifndef SIRF_STIR_PREFETCH
+#define SIRF_STIR_PREFETCH
+
+#include <atomic>
+#include <map>
+#include <utility>
+#include <vector>
+
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+#include "stir/ProjData.h"
+#include "stir/Sinogram.h"
+#include "stir/Viewgram.h"
+#include "stir/ViewSegmentNumbers.h"
+#include "stir/recon_buildblock/DataSymmetriesForViewSegmentNumbers.h"
+
+namespace sirf {
+
+	/*!
+	\ingroup STIR Extensions
+	\brief Acquisition data reader that reads subsets ahead on a background thread.
+
+	Wraps a (typically file-based) ProjData object. prefetch() starts reading
+	the given viewgrams into memory on a background thread and returns
+	immediately; get_viewgram() serves the viewgrams already read from
+	memory (releasing them, as each viewgram is used once per subset
+	iteration) and reads the rest from the source as usual.
+
+	The amount of memory held by prefetched viewgrams never exceeds the
+	memory budget: the background reading stops when the next viewgram
+	would not fit. Viewgrams prefetched by all but the last two calls of
+	prefetch() that have not been used are discarded, so that the subset
+	being processed and the next one can be held together.
+
+	Access to the source is serialised, as STIR file-based ProjData objects
+	are not thread-safe.
+	*/
+	class ProjDataWithPrefetch : public stir::ProjData {
+	public:
+		ProjDataWithPrefetch(stir::shared_ptr<stir::ProjData> sptr_source,
+			size_t memory_budget);
+		virtual ~ProjDataWithPrefetch();
+
+		stir::shared_ptr<stir::ProjData> source_sptr()
+		{
+			return _sptr_source;
+		}
+		//! Memory budget in bytes
+		size_t memory_budget() const
+		{
+			return _budget;
+		}
+		void set_memory_budget(size_t bytes)
+		{
+			_budget = bytes;
+		}
+		//! Number of viewgrams served from prefetched ones
+		size_t num_hits() const
+		{
+			return _hits;
+		}
+		//! Number of viewgrams read from the source on request
+		size_t num_misses() const
+		{
+			return _misses;
+		}
+
+		//! Starts reading the viewgrams with given numbers in the background
+		void prefetch(const std::vector<stir::ViewSegmentNumbers>& vs_nums);
+		//! Starts reading the viewgrams of given subset in the background
+		/*! The subset is defined as in STIR ordered subsets reconstructions:
+		basic view-segments in the subset and all view-segments related to
+		them by symmetries.
+		*/
+		void prefetch_subset(
+			const stir::DataSymmetriesForViewSegmentNumbers& symmetries,
+			int min_segment_num, int max_segment_num,
+			int subset_num, int num_subsets);
+		//! Stops background reading and discards all prefetched viewgrams
+		void clear();
+
+		virtual stir::Viewgram<float> get_viewgram(const int view_num,
+			const int segment_num,
+			const bool make_num_tangential_poss_odd = false) const;
+		virtual stir::Succeeded set_viewgram(const stir::Viewgram<float>& v);
+		virtual stir::Sinogram<float> get_sinogram(const int ax_pos_num,
+			const int segment_num,
+			const bool make_num_tangential_poss_odd = false) const;
+		virtual stir::Succeeded set_sinogram(const stir::Sinogram<float>& s);
+
+	private:
+		typedef std::pair<int, int> Key; // (segment, view)
+		struct Entry {
+			stir::shared_ptr<stir::Viewgram<float> > sptr_viewgram;
+			unsigned generation;
+		};
+
+		stir::shared_ptr<stir::ProjData> _sptr_source;
+		size_t _budget;
+		mutable boost::mutex _source_mutex;
+		mutable boost::mutex _cache_mutex;
+		mutable std::map<Key, Entry> _cache;
+		mutable size_t _cached_bytes;
+		mutable size_t _hits;
+		mutable size_t _misses;
+		unsigned _generation;
+		std::atomic<bool> _stop;
+		boost::thread _thread;
+
+		void stop_();
+		void run_(std::vector<stir::ViewSegmentNumbers> vs_nums, unsigned gen);
+		size_t viewgram_bytes_(int segment_num) const;
+	};
+
+}
+
+#endif
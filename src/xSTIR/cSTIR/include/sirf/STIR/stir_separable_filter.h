@@ -0,0 +1,148 @@
+/*
+CCP PETMR Synergistic Image Reconstruction Framework (SIRF)
+Copyright 2019 Rutherford Appleton Laboratory STFC
+
+This is software developed for the Collaborative Computational
+Project in Positron Emission Tomography and Magnetic Resonance imaging
+(http://www.ccppetmr.ac.uk/).
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+http://www.apache.org/licenses/LICENSE-2.0
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+*/
+
+/*!
+\file
+\ingroup STIR Extensions
+\brief Specification file for the multithreaded separable image filter.
+
+\author Evgueni Ovtchinnikov
+\author CCP PETMR
+*/
+
+#ifndef SIRF_STIR_SEPARABLE_FILTER
+#define SIRF_STIR_SEPARABLE_FILTER
+
+#include <vector>
+
+#include "stir/DataProcessor.h"
+#include "stir/RegisteredParsingObject.h"
+
+#include "sirf/STIR/stir_types.h"
+
+namespace sirf {
+
+	/*!
+	\ingroup STIR Extensions
+	\brief Separable Gaussian/Metz image filter with multithreaded kernels.
+
+	A STIR image processor (usable e.g. as an inter-iteration filter): the
+	image is convolved with a 1D kernel along each axis in turn (z, y, x),
+	the values outside the image being taken as zeros. The kernel of each
+	axis is that of the Metz filter with the given FWHM (in mm) and power,
+	computed by set_up() for the voxel size of the image (power 0 gives a
+	Gaussian), unless it is set explicitly by set_kernel(). The kernels
+	are computed by this class, and the results are not meant to match
+	those of STIR's SeparableCartesianMetzImageFilter exactly.
+
+	The kernels computed by set_up() are reused by every application to
+	an image of the same voxel sizes and dimensions; the kernels for other
+	images are computed on each application. Changing a parameter makes
+	the next application set up the filter again.
+
+	Short kernels are applied by direct convolution: the x-pass runs
+	vectorisable loops over padded rows, the y- and z-passes accumulate
+	whole rows of neighbouring lines, and rows or planes are shared
+	between threads. Kernels longer than the FFT threshold are applied
+	by zero-padded real DFT, line by line in parallel.
+
+	Axis numbering follows STIR: 0 is z, 1 is y and 2 is x.
+	*/
+	class SeparableImageFilter : public stir::RegisteredParsingObject
+		<SeparableImageFilter, stir::DataProcessor<Image3DF>,
+		stir::DataProcessor<Image3DF> > {
+	public:
+		//! Name which will be used when parsing a DataProcessor object
+		static const char* const registered_name;
+
+		SeparableImageFilter();
+
+		//! FWHM in mm along an axis, 0 for no filtering
+		void set_fwhm(int axis, float fwhm);
+		float fwhm(int axis) const
+		{
+			return _fwhms[check_axis_(axis)];
+		}
+		void set_metz_power(int axis, float power);
+		float metz_power(int axis) const
+		{
+			return _metz_powers[check_axis_(axis)];
+		}
+		//! Largest kernel length along an axis, non-positive for no limit
+		void set_max_kernel_size(int axis, int size);
+		int max_kernel_size(int axis) const
+		{
+			return _max_kernel_sizes[check_axis_(axis)];
+		}
+		//! Sets an explicit centred kernel of odd length (empty to cancel)
+		void set_kernel(int axis, const std::vector<float>& kernel);
+		//! Kernels longer than this are applied via FFT
+		void set_fft_threshold(int length)
+		{
+			_fft_threshold = length;
+		}
+		int fft_threshold() const
+		{
+			return _fft_threshold;
+		}
+		//! Kernel applied along an axis (available after set_up)
+		const std::vector<float>& kernel(int axis) const
+		{
+			return _kernels[check_axis_(axis)];
+		}
+
+		//! Computes the Metz kernel for given FWHM and power in voxels
+		static void metz_kernel(float fwhm, float power, int max_half_length,
+			std::vector<float>& kernel);
+
+	protected:
+		virtual void set_defaults();
+		virtual void initialise_keymap();
+		virtual bool post_processing();
+
+		virtual stir::Succeeded virtual_set_up(const Image3DF& image);
+		virtual void virtual_apply(Image3DF& data) const;
+		virtual void virtual_apply(Image3DF& out, const Image3DF& in) const;
+
+	private:
+		typedef stir::DataProcessor<Image3DF> base_type;
+
+		std::vector<float> _fwhms;
+		std::vector<float> _metz_powers;
+		std::vector<int> _max_kernel_sizes;
+		std::vector<std::vector<float> > _user_kernels;
+		std::vector<std::vector<float> > _kernels;
+		int _fft_threshold;
+		// voxel sizes and dimensions (z, y, x) of the set_up() image, if
+		// voxelised
+		std::vector<float> _voxel_sizes;
+		std::vector<int> _sizes;
+
+		static int check_axis_(int axis);
+		static void get_geometry_(const Image3DF& image,
+			std::vector<float>& voxel_sizes, std::vector<int>& sizes);
+		void compute_kernels_(const std::vector<float>& voxel_sizes,
+			const std::vector<int>& sizes,
+			std::vector<std::vector<float> >& kernels) const;
+	};
+
+}
+
+#endif
@@ -0,0 +1,366 @@
+/*
+CCP PETMR Synergistic Image Reconstruction Framework (SIRF)
+Copyright 2019 Rutherford Appleton Laboratory STFC
+
+This is software developed for the Collaborative Computational
+Project in Positron Emission Tomography and Magnetic Resonance imaging
+(http://www.ccppetmr.ac.uk/).
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+http://www.apache.org/licenses/LICENSE-2.0
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+*/
+
+/*!
+\file
+\ingroup STIR Extensions
+\brief Specification file for the compressed sparse system matrix projectors.
+
+\author Evgueni Ovtchinnikov
+\author CCP PETMR
+*/
+
+#ifndef SIRF_STIR_SPARSE_MATRIX
+#define SIRF_STIR_SPARSE_MATRIX
+
+#include <algorithm>
+#include <vector>
+
+#include "stir/RegisteredParsingObject.h"
+#include "stir/RelatedViewgrams.h"
+#include "stir/recon_buildblock/BackProjectorByBin.h"
+#include "stir/recon_buildblock/ForwardProjectorByBin.h"
+#include "stir/recon_buildblock/ProjectorByBinPair.h"
+
+#include "sirf/iUtilities/DataHandle.h"
+#include "sirf/STIR/stir_matrix_cache.h"
+
+namespace sirf {
+
+	/*!
+	\ingroup STIR Extensions
+	\brief Compressed symmetry-reduced PET system matrix.
+
+	Only the rows of basic bins are stored (in the memory-mapped file of
+	a ProjMatrixByBinFromCache). Every other row is obtained from a basic
+	one by a symmetry operation, which for the STIR cartesian grid
+	symmetries is an affine map of voxel coordinates: a signed permutation
+	of the (z, y, x) axes plus a shift. These maps are found once on
+	set_up by probing the STIR symmetry operations and stored in a small
+	table, so that the projection kernels need neither virtual calls nor
+	temporary objects per bin.
+
+	The rows are grouped into lines of constant (segment, view, axial
+	position), laid out in the order of PETAcquisitionData::copy_to()
+	(segments 0, 1, -1, 2, -2, ..., each by sinogram). Each line is a short
+	list of runs of consecutive tangential positions that map to consecutive
+	basic rows by the same symmetry operation, so the whole structure takes
+	a few tens of bytes per line rather than per bin.
+	*/
+	class PETSparseProjMatrix {
+	public:
+		typedef ProjMatrixByBinFromCache::BinRecord BinRecord;
+		typedef ProjMatrixByBinFromCache::Element Element;
+
+		//! Affine voxel coordinate map: c'[k] = sign[k]*c[axis[k]] + shift[k]
+		struct SymmetryOp {
+			int axis[3];
+			int sign[3];
+			int shift[3];
+			bool operator<(const SymmetryOp& op) const;
+		};
+		struct Run {
+			int tang_first;
+			int tang_last;
+			int op;
+			int basic_step;
+			int64_t basic_first;
+		};
+		//! Row pointers of an image, for kernels working on any image storage
+		template<typename T>
+		struct ImageRows {
+			std::vector<T*> rows;
+			int min_z, max_z, min_y, max_y, min_x, max_x;
+			int ny;
+		};
+
+		PETSparseProjMatrix(stir::shared_ptr<ProjMatrixByBinFromCache> sptr_matrix) :
+			_sptr_matrix(sptr_matrix)
+		{}
+
+		//! Builds the line/run structure; the matrix must be set up first
+		void set_up(const stir::ProjDataInfo& pdi, const Voxels3DF& image);
+		//! Throws unless the geometries are those the matrix was set up for
+		void check_geometry
+			(const stir::ProjDataInfo& pdi, const Image3DF& image) const;
+
+		stir::shared_ptr<ProjMatrixByBinFromCache> matrix_sptr() const
+		{
+			return _sptr_matrix;
+		}
+		size_t num_lines() const
+		{
+			return _line_first_run.size() - 1;
+		}
+		//! Number of bins (size of the data array)
+		size_t num_bins() const
+		{
+			return num_lines()*_num_tang;
+		}
+		//! Number of voxels (size of the image array)
+		size_t num_voxels() const
+		{
+			return size_t(_nz)*_ny*_nx;
+		}
+		size_t num_symmetry_ops() const
+		{
+			return _ops.size();
+		}
+		size_t num_runs() const
+		{
+			return _runs.size();
+		}
+		size_t line_index(int segment, int view, int axial_pos) const
+		{
+			return _seg_first_line[segment - _min_seg] +
+				size_t(axial_pos - _seg_min_axial[segment - _min_seg])*_num_views +
+				view - _min_view;
+		}
+		//! Range [first, last) of the lines of a segment
+		void segment_lines(int segment, size_t& first, size_t& last) const
+		{
+			first = _seg_first_line[segment - _min_seg];
+			last = _seg_last_line[segment - _min_seg];
+		}
+
+		//! Restricts the projections to a range of tangential positions per line
+		/*!
+		Bins outside the range of their line are assumed to see no voxel of
+		interest: forward projection sets them to zero and backprojection
+		ignores them; lines with min_tang[line] > max_tang[line] are skipped
+		altogether. Empty vectors remove the restriction.
+		*/
+		void set_line_support(const std::vector<int>& min_tang,
+			const std::vector<int>& max_tang);
+		bool has_line_support() const
+		{
+			return !_support_min_tang.empty();
+		}
+		//! Subset membership of the lines [first, last)
+		/*!
+		Subsets are those of the STIR projectors: the basic view/segment
+		numbers with view % num_subsets == subset_num together with all
+		view/segment numbers related to them by symmetries.
+		*/
+		void subset_lines(size_t first, size_t last,
+			int subset_num, int num_subsets, std::vector<char>& in_subset) const;
+
+		//! Forward projects image into data in PETAcquisitionData::copy_to() order
+		/*! Only the bins of the views in the subset are assigned. */
+		void forward(const float* image, float* data,
+			int subset_num = 0, int num_subsets = 1) const;
+		//! Adds the backprojection of data to image (stored in z, y, x order)
+		void backward(const float* data, float* image,
+			int subset_num = 0, int num_subsets = 1) const;
+
+		//! Multithreaded kernels for the lines [first, last) of several frames
+		/*!
+		All frames must have the same geometry; data[f] points to the first
+		bin of line first in frame f. Each matrix row is decoded once and
+		applied to all frames.
+		*/
+		void forward(const std::vector<ImageRows<const float> >& images,
+			size_t first, size_t last, float* const* data,
+			int subset_num, int num_subsets) const;
+		void backward(const float* const* data, size_t first, size_t last,
+			std::vector<ImageRows<float> >& images,
+			int subset_num, int num_subsets) const;
+
+		//! Single line kernels
+		void forward_line(size_t line, int min_tang, int max_tang,
+			const ImageRows<const float>* images, int num_frames,
+			float* const* out) const;
+		void backward_line(size_t line, int min_tang, int max_tang,
+			const float* const* in, ImageRows<float>* images, int num_frames) const;
+		void forward_line(size_t line, int min_tang, int max_tang,
+			const ImageRows<const float>& image, float* out) const
+		{
+			forward_line(line, min_tang, max_tang, &image, 1, &out);
+		}
+		void backward_line(size_t line, int min_tang, int max_tang,
+			const float* in, ImageRows<float>& image) const
+		{
+			backward_line(line, min_tang, max_tang, &in, &image, 1);
+		}
+
+		template<typename T>
+		static void image_rows(const Image3DF& image, ImageRows<T>& ir)
+		{
+			stir::BasicCoordinate<3, int> min_indices;
+			stir::BasicCoordinate<3, int> max_indices;
+			if (!image.get_regular_range(min_indices, max_indices))
+				THROW("sparse matrix projectors require a regular image");
+			ir.min_z = min_indices[1];
+			ir.max_z = max_indices[1];
+			ir.min_y = min_indices[2];
+			ir.max_y = max_indices[2];
+			ir.min_x = min_indices[3];
+			ir.max_x = max_indices[3];
+			ir.ny = ir.max_y - ir.min_y + 1;
+			ir.rows.resize(size_t(ir.max_z - ir.min_z + 1)*ir.ny);
+			size_t i = 0;
+			for (int z = ir.min_z; z <= ir.max_z; z++)
+				for (int y = ir.min_y; y <= ir.max_y; y++, i++)
+					ir.rows[i] = (T*)&image[z][y][ir.min_x];
+		}
+
+	private:
+		stir::shared_ptr<ProjMatrixByBinFromCache> _sptr_matrix;
+		stir::shared_ptr<stir::ProjDataInfo> _sptr_pdi;
+		stir::shared_ptr<Voxels3DF> _sptr_image_template;
+		std::vector<SymmetryOp> _ops;
+		std::vector<Run> _runs;
+		std::vector<size_t> _line_first_run;
+		std::vector<size_t> _seg_first_line;
+		std::vector<size_t> _seg_last_line;
+		std::vector<int> _seg_min_axial;
+		int _min_seg;
+		int _min_view;
+		int _num_views;
+		int _min_tang;
+		int _num_tang;
+		int _nz, _ny, _nx;
+		int _min_z, _min_y, _min_x;
+		std::vector<int> _support_min_tang;
+		std::vector<int> _support_max_tang;
+
+		template<typename T>
+		void flat_image_rows_(T* image, ImageRows<T>& ir) const;
+		// tangential range of a line to project, false if none
+		bool line_range_(size_t line, int& min_tang, int& max_tang) const
+		{
+			min_tang = _min_tang;
+			max_tang = _min_tang + _num_tang - 1;
+			if (_support_min_tang.empty())
+				return true;
+			min_tang = std::max(min_tang, _support_min_tang[line]);
+			max_tang = std::min(max_tang, _support_max_tang[line]);
+			return min_tang <= max_tang;
+		}
+	};
+
+	/*!
+	\ingroup STIR Extensions
+	\brief STIR forward projector using PETSparseProjMatrix.
+	*/
+	class ForwardProjectorByBinUsingSparseMatrix :
+		public stir::RegisteredParsingObject<ForwardProjectorByBinUsingSparseMatrix,
+		stir::ForwardProjectorByBin, stir::ForwardProjectorByBin> {
+	public:
+		static const char* const registered_name;
+		ForwardProjectorByBinUsingSparseMatrix() {}
+		ForwardProjectorByBinUsingSparseMatrix
+			(stir::shared_ptr<PETSparseProjMatrix> sptr) : _sptr_matrix(sptr)
+		{}
+		virtual void set_up(const stir::shared_ptr<stir::ProjDataInfo>& sptr_pdi,
+			const stir::shared_ptr<Image3DF>& sptr_image)
+		{}
+		virtual const stir::DataSymmetriesForViewSegmentNumbers*
+			get_symmetries_used() const
+		{
+			return _sptr_matrix->matrix_sptr()->get_symmetries_ptr();
+		}
+	private:
+		stir::shared_ptr<PETSparseProjMatrix> _sptr_matrix;
+		virtual void actual_forward_project(stir::RelatedViewgrams<float>&,
+			const Image3DF&,
+			const int min_axial_pos_num, const int max_axial_pos_num,
+			const int min_tangential_pos_num, const int max_tangential_pos_num);
+	};
+
+	/*!
+	\ingroup STIR Extensions
+	\brief STIR back projector using PETSparseProjMatrix.
+	*/
+	class BackProjectorByBinUsingSparseMatrix :
+		public stir::RegisteredParsingObject<BackProjectorByBinUsingSparseMatrix,
+		stir::BackProjectorByBin, stir::BackProjectorByBin> {
+	public:
+		static const char* const registered_name;
+		BackProjectorByBinUsingSparseMatrix() {}
+		BackProjectorByBinUsingSparseMatrix
+			(stir::shared_ptr<PETSparseProjMatrix> sptr) : _sptr_matrix(sptr)
+		{}
+		virtual void set_up(const stir::shared_ptr<stir::ProjDataInfo>& sptr_pdi,
+			const stir::shared_ptr<Image3DF>& sptr_image)
+		{}
+		virtual const stir::DataSymmetriesForViewSegmentNumbers*
+			get_symmetries_used() const
+		{
+			return _sptr_matrix->matrix_sptr()->get_symmetries_ptr();
+		}
+	private:
+		stir::shared_ptr<PETSparseProjMatrix> _sptr_matrix;
+		virtual void actual_back_project(Image3DF&,
+			const stir::RelatedViewgrams<float>&,
+			const int min_axial_pos_num, const int max_axial_pos_num,
+			const int min_tangential_pos_num, const int max_tangential_pos_num);
+	};
+
+	/*!
+	\ingroup STIR Extensions
+	\brief Projector pair using the compressed sparse system matrix.
+
+	Can be used wherever a STIR ProjectorByBinPair is expected (e.g. by
+	PETAcquisitionModel::set_projectors() or STIR objective functions).
+	In addition, PETAcquisitionModel uses forward() and backward() below,
+	which project the whole of the data in one multithreaded matrix-vector
+	product instead of going through STIR related viewgrams.
+	*/
+	class ProjectorByBinPairUsingSparseMatrix :
+		public stir::RegisteredParsingObject<ProjectorByBinPairUsingSparseMatrix,
+		stir::ProjectorByBinPair, stir::ProjectorByBinPair> {
+	public:
+		static const char* const registered_name;
+		ProjectorByBinPairUsingSparseMatrix() : _verbose(false) {}
+		ProjectorByBinPairUsingSparseMatrix
+			(stir::shared_ptr<ProjMatrixByBinFromCache> sptr_matrix);
+		//! Reports the matrix set-up on stdout if verbose (silent by default)
+		void set_verbose(bool verbose)
+		{
+			_verbose = verbose;
+		}
+		virtual stir::Succeeded set_up(
+			const stir::shared_ptr<stir::ProjDataInfo>& sptr_pdi,
+			const stir::shared_ptr<Image3DF>& sptr_image);
+		stir::shared_ptr<PETSparseProjMatrix> sparse_matrix_sptr()
+		{
+			return _sptr_sparse;
+		}
+		void forward(stir::ProjData& pd, const Image3DF& image,
+			int subset_num, int num_subsets, bool zero) const;
+		void backward(Image3DF& image, const stir::ProjData& pd,
+			int subset_num, int num_subsets) const;
+		//! Projects several frames sharing the geometry in one pass over the matrix
+		void forward(const std::vector<stir::ProjData*>& pds,
+			const std::vector<const Image3DF*>& images,
+			int subset_num, int num_subsets, bool zero) const;
+		void backward(const std::vector<Image3DF*>& images,
+			const std::vector<const stir::ProjData*>& pds,
+			int subset_num, int num_subsets) const;
+	private:
+		stir::shared_ptr<ProjMatrixByBinFromCache> _sptr_matrix;
+		stir::shared_ptr<PETSparseProjMatrix> _sptr_sparse;
+		bool _verbose;
+	};
+
+}
+
+#endif
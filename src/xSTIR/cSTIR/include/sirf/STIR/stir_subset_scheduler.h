@@ -0,0 +1,125 @@
+/*
+CCP PETMR Synergistic Image Reconstruction Framework (SIRF)
+Copyright 2019 Rutherford Appleton Laboratory STFC
+
+This is software developed for the Collaborative Computational
+Project in Positron Emission Tomography and Magnetic Resonance imaging
+(http://www.ccppetmr.ac.uk/).
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+http://www.apache.org/licenses/LICENSE-2.0
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+*/
+
+/*!
+\file
+\ingroup STIR Extensions
+\brief Specification file for the subset ordering scheduler.
+
+\author Evgueni Ovtchinnikov
+\author CCP PETMR
+*/
+
+#ifndef SIRF_STIR_SUBSET_SCHEDULER
+#define SIRF_STIR_SUBSET_SCHEDULER
+
+#include <deque>
+#include <iosfwd>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace sirf {
+
+	/*!
+	\ingroup STIR Extensions
+	\brief Generator of the order in which subsets are processed.
+
+	Supported policies:
+	- "sequential": 0, 1, ..., n - 1, 0, 1, ...
+	- "herman_meyer": the Herman-Meyer order (mixed-radix digit reversal
+	  over the prime factors of n), which makes consecutive subsets (hence
+	  their views) as far apart as possible;
+	- "golden_ratio": subsets placed on a circle, each next one being the
+	  unused subset nearest to the previous position plus n times the
+	  golden ratio conjugate;
+	- "random": random order without replacement, reshuffled every epoch
+	  (pass through all subsets);
+	- "importance": random with replacement, subset i being chosen with
+	  probability proportional to its weight (e.g. the norm of its gradient,
+	  as in importance-sampled stochastic gradient methods); all weights
+	  are 1 by default.
+
+	The first three policies repeat the same order every epoch.
+	*/
+	class SubsetScheduler {
+	public:
+		SubsetScheduler(int num_subsets = 1,
+			const std::string& policy = "sequential", unsigned int seed = 0);
+
+		int num_subsets() const
+		{
+			return _num_subsets;
+		}
+		void set_num_subsets(int n);
+		const std::string& policy() const
+		{
+			return _policy;
+		}
+		void set_policy(const std::string& policy);
+		unsigned int seed() const
+		{
+			return _seed;
+		}
+		//! Resets the random number generator and restarts the order
+		void set_seed(unsigned int seed);
+		//! Restarts the order from the beginning of an epoch
+		void reset();
+
+		//! Returns the subset to process next and advances the schedule
+		int next();
+		//! Returns the subset next() would return, without advancing
+		int peek();
+		//! Number of calls to next() since the last reset
+		long long num_calls() const
+		{
+			return _num_calls;
+		}
+
+		//! Sets the weight of a subset for the "importance" policy
+		void set_weight(int subset_num, float weight);
+		float weight(int subset_num) const;
+
+		//! Writes the whole state (settings, position and generator) as text
+		void save_state(std::ostream& out) const;
+		//! Restores the state written by save_state
+		void load_state(std::istream& in);
+
+		//! Herman-Meyer order of n subsets
+		static std::vector<int> herman_meyer_order(int n);
+		//! Golden ratio order of n subsets
+		static std::vector<int> golden_ratio_order(int n);
+
+	private:
+		int _num_subsets;
+		std::string _policy;
+		unsigned int _seed;
+		std::mt19937 _generator;
+		std::vector<float> _weights;
+		std::deque<int> _upcoming;
+		long long _num_calls;
+
+		void check_subset_(int subset_num) const;
+		void schedule_();
+	};
+
+}
+
+#endif
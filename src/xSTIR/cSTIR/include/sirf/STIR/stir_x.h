@@ -35,6 +35,11 @@ limitations under the License.
 #include <stdlib.h>
 
 #include "sirf/STIR/stir_data_containers.h"
+#include "sirf/STIR/stir_matrix_cache.h"
+#include "sirf/STIR/stir_model_stats.h"
+#include "sirf/STIR/stir_prefetch.h"
+#include "sirf/STIR/stir_sparse_matrix.h"
+#include "sirf/STIR/stir_subset_scheduler.h"
 
 #define MIN_BIN_EFFICIENCY 1.0e-20f
 //#define MIN_BIN_EFFICIENCY 1.0e-6f
@@ -313,6 +318,7 @@ The actual algorithm is described in
 
 	class PETAcquisitionModel {
 	public:
+		PETAcquisitionModel() : support_fraction_(1.0f), verbose_(false) {}
 		void set_projectors(stir::shared_ptr<stir::ProjectorByBinPair> sptr_projectors)
 		{
 			sptr_projectors_ = sptr_projectors;
@@ -359,6 +365,10 @@ The actual algorithm is described in
 			//sptr_normalisation_ = sptr_asm->data();
 			sptr_asm_ = sptr_asm;
 		}
+		stir::shared_ptr<PETAcquisitionSensitivityModel> asm_sptr()
+		{
+			return sptr_asm_;
+		}
 
 		void cancel_background_term()
 		{
@@ -374,6 +384,53 @@ The actual algorithm is described in
 			//sptr_normalisation_.reset();
 		}
 
+		//! Sets the image support mask (e.g. a thresholded mu-map)
+		/*!
+		Voxels where the mask is not positive are treated as outside the
+		object: images are zeroed there before forward projection and after
+		backprojection. The support in acquisition space is obtained on
+		set_up by forward-projecting the mask, and the bins outside it
+		(whose LORs miss the object) are skipped by both projections.
+		Forward-projected data get the zero flags of the sinograms outside
+		the support (see PETAcquisitionData::set_zero_sinograms()).
+		*/
+		void set_image_support(stir::shared_ptr<STIRImageData> sptr_mask);
+		void cancel_image_support();
+		stir::shared_ptr<STIRImageData> image_support_sptr()
+		{
+			return sptr_image_support_;
+		}
+		//! Forward projection of the binary image support
+		/*! Positive for the bins whose LORs intersect the support. */
+		stir::shared_ptr<PETAcquisitionData> acquisition_support_sptr()
+		{
+			return sptr_acq_support_;
+		}
+		//! Fraction of bins in the acquisition support (1 if no support)
+		float support_fraction() const
+		{
+			return support_fraction_;
+		}
+
+		//! Per-stage timings, call counts and data volumes of projections
+		AcquisitionModelStatistics& statistics()
+		{
+			return stats_;
+		}
+		const AcquisitionModelStatistics& statistics() const
+		{
+			return stats_;
+		}
+		//! Reports projection stages on stdout if true (default false)
+		void set_verbose(bool verbose)
+		{
+			verbose_ = verbose;
+		}
+		bool verbose() const
+		{
+			return verbose_;
+		}
+
 		virtual stir::Succeeded set_up(
 			stir::shared_ptr<PETAcquisitionData> sptr_acq,
 			stir::shared_ptr<STIRImageData> sptr_image);
@@ -389,7 +446,47 @@ The actual algorithm is described in
 		stir::shared_ptr<STIRImageData> backward(PETAcquisitionData& ad,
 			int subset_num = 0, int num_subsets = 1);
 
+		// replaces a subset of each acquisition data with forward projection
+		// of the respective image; all images (e.g. time frames or gates) must
+		// share the geometry, and each view-segment is projected for all of
+		// them before moving to the next one
+		void forward(const std::vector<PETAcquisitionData*>& ads,
+			const std::vector<const STIRImageData*>& images,
+			int subset_num, int num_subsets, bool zero = false);
+		// replaces each image with backward projection of the respective
+		// subset of acquisition data, projecting all frames together as above
+		void backward(const std::vector<STIRImageData*>& images,
+			const std::vector<PETAcquisitionData*>& ads,
+			int subset_num = 0, int num_subsets = 1);
+
 	protected:
+		// forward projection without additive terms and normalisation
+		void project_(PETAcquisitionData& ad, const STIRImageData& image,
+			int subset_num, int num_subsets, bool zero);
+		void back_project_(Image3DF& image, PETAcquisitionData& ad,
+			int subset_num, int num_subsets);
+		void add_terms_(PETAcquisitionData& ad);
+
+		// projections by STIR projectors view-segment by view-segment,
+		// restricted to the support if present
+		void forward_vs_(const std::vector<stir::ProjData*>& pds,
+			const std::vector<const Image3DF*>& images,
+			int subset_num, int num_subsets, bool zero);
+		void backward_vs_(const std::vector<Image3DF*>& images,
+			const std::vector<const stir::ProjData*>& pds,
+			int subset_num, int num_subsets);
+
+		bool has_support_() const
+		{
+			return sptr_image_support_.get() && sptr_acq_support_.get();
+		}
+		void set_up_support_();
+		void mask_image_(Image3DF& image) const;
+		// symmetric range of tangential positions covering the support of
+		// the view-segments related to vs, false if none is in the support
+		bool support_tang_range_(const stir::DataSymmetriesForViewSegmentNumbers& symm,
+			const stir::ViewSegmentNumbers& vs, int& min_tang, int& max_tang) const;
+
 		stir::shared_ptr<stir::ProjectorByBinPair> sptr_projectors_;
 		stir::shared_ptr<PETAcquisitionData> sptr_acq_template_;
 		stir::shared_ptr<STIRImageData> sptr_image_template_;
@@ -397,6 +494,17 @@ The actual algorithm is described in
 		stir::shared_ptr<PETAcquisitionData> sptr_background_;
 		stir::shared_ptr<PETAcquisitionSensitivityModel> sptr_asm_;
 		//shared_ptr<stir::BinNormalisation> sptr_normalisation_;
+
+		stir::shared_ptr<STIRImageData> sptr_image_support_;
+		stir::shared_ptr<PETAcquisitionData> sptr_acq_support_;
+		// largest |tangential position| in the support for each (segment, view)
+		// (-1 if none), indexed by (segment - min segment)*num views + view - min view
+		std::vector<int> support_extent_;
+		PETAcquisitionData::SinogramFlags support_zero_sinograms_;
+		float support_fraction_;
+
+		bool verbose_;
+		AcquisitionModelStatistics stats_;
 	};
 
 	/*!
@@ -411,36 +519,63 @@ The actual algorithm is described in
 	Furthermore, owing to symmetries, many rows have the same values only
 	in different order, and thus only one set of values needs to be computed
 	and stored (see STIR documentation for details).
+
+	If a matrix cache path is set, the matrix elements are computed once
+	and stored in a file in that directory, which is memory-mapped by
+	set_up() in this and all subsequent processes using the same scanner,
+	acquisition data geometry, image geometry and matrix parameters
+	(see ProjMatrixByBinFromCache).
+
+	If the use of sparse matrix is selected, the cached matrix is used by the
+	projectors ProjectorByBinPairUsingSparseMatrix, which apply the symmetries
+	to the stored rows on the fly in multithreaded matrix-vector products
+	(these require a matrix cache path, set_up() throws if none is set).
 	*/
 
 	class PETAcquisitionModelUsingMatrix : public PETAcquisitionModel {
 	public:
-		PETAcquisitionModelUsingMatrix()
+		PETAcquisitionModelUsingMatrix() : use_sparse_matrix_(false)
 		{
 			this->sptr_projectors_.reset(new ProjectorPairUsingMatrix);
 		}
 		void set_matrix(stir::shared_ptr<stir::ProjMatrixByBin> sptr_matrix)
 		{
 			sptr_matrix_ = sptr_matrix;
-			((ProjectorPairUsingMatrix*)this->sptr_projectors_.get())->
-				set_proj_matrix_sptr(sptr_matrix);
+			ProjectorPairUsingMatrix* ptr_pp = dynamic_cast<ProjectorPairUsingMatrix*>
+				(this->sptr_projectors_.get());
+			if (ptr_pp)
+				ptr_pp->set_proj_matrix_sptr(sptr_matrix);
 		}
 		stir::shared_ptr<stir::ProjMatrixByBin> matrix_sptr()
 		{
-			return ((ProjectorPairUsingMatrix*)this->sptr_projectors_.get())->
-				get_proj_matrix_sptr();
+			return sptr_matrix_;
 		}
-		virtual stir::Succeeded set_up(
-			stir::shared_ptr<PETAcquisitionData> sptr_acq,
-			stir::shared_ptr<STIRImageData> sptr_image)
+		//! Sets the directory for the persistent matrix cache ("" disables it)
+		void set_matrix_cache_path(std::string path)
 		{
-			if (!sptr_matrix_.get())
-				return stir::Succeeded::no;
-			return PETAcquisitionModel::set_up(sptr_acq, sptr_image);
+			matrix_cache_path_ = path;
 		}
+		const std::string& matrix_cache_path() const
+		{
+			return matrix_cache_path_;
+		}
+		//! Selects the compressed sparse matrix projectors
+		void set_use_sparse_matrix(bool use)
+		{
+			use_sparse_matrix_ = use;
+		}
+		bool use_sparse_matrix() const
+		{
+			return use_sparse_matrix_;
+		}
+		virtual stir::Succeeded set_up(
+			stir::shared_ptr<PETAcquisitionData> sptr_acq,
+			stir::shared_ptr<STIRImageData> sptr_image);
 
 	private:
 		stir::shared_ptr<stir::ProjMatrixByBin> sptr_matrix_;
+		std::string matrix_cache_path_;
+		bool use_sparse_matrix_;
 	};
 
 	typedef PETAcquisitionModel AcqMod3DF;
@@ -480,18 +615,60 @@ The actual algorithm is described in
 		}
 	};
 
+	/*!
+	\ingroup STIR Extensions
+	\brief Quadratic prior with a multithreaded gradient.
+
+	Computes the same gradient as STIR's QuadraticPrior, but traverses the
+	image row by row: each row of the gradient is accumulated from the
+	neighbouring rows by contiguous (vectorisable) loops over x, with the
+	image edges handled by loop bounds rather than per-voxel tests, and
+	rows are distributed among OpenMP threads.
+	*/
 	class xSTIR_QuadraticPrior3DF : public stir::QuadraticPrior < float > {
 	public:
 		void only2D(int only) {
 			only_2D = only != 0;
 		}
+		virtual void compute_gradient(Image3DF& prior_gradient,
+			const Image3DF& current_image_estimate);
 	};
 
+	/*!
+	\ingroup STIR Extensions
+	\brief PLS prior with a multithreaded gradient.
+
+	The normalised gradient of the anatomical image
+	xi = grad(v)/sqrt(eta^2 + |grad(v)|^2) is computed once on set_up
+	(and again only if the anatomical image, eta or only_2D change).
+	The value of the prior is
+	penalisation_factor * sum_j kappa_j sqrt(alpha^2 + |grad(u)_j|^2 - <grad(u)_j, xi_j>^2),
+	where grad is the forward difference gradient (zero at the upper
+	image edges), and its gradient is computed as the exact adjoint of it.
+	*/
 	class xSTIR_PLSPrior3DF : public stir::PLSPrior < float > {
 	public:
+		xSTIR_PLSPrior3DF() : _xi_eta(0), _xi_only_2D(false) {}
 		void only2D(int only) {
 			only_2D = only != 0;
 		}
+		virtual stir::Succeeded set_up
+			(stir::shared_ptr<Image3DF> const& target_sptr);
+		virtual double compute_value(const Image3DF& current_image_estimate);
+		virtual void compute_gradient(Image3DF& prior_gradient,
+			const Image3DF& current_image_estimate);
+
+	private:
+		// normalised anatomical gradient (z, y and x components)
+		std::vector<float> _xi[3];
+		stir::shared_ptr<Image3DF> _sptr_xi_source;
+		float _xi_eta;
+		bool _xi_only_2D;
+		// work arrays for the gradient
+		std::vector<float> _q[3];
+
+		void update_anatomical_gradient_(const Image3DF& image);
+		double penalty_(const Image3DF& image, bool compute_q);
 	};
 
 	class xSTIR_GeneralisedObjectiveFunction3DF :
@@ -537,6 +714,89 @@ The actual algorithm is described in
 	typedef xSTIR_PoissonLogLikelihoodWithLinearModelForMeanAndProjData3DF
 		PoissonLogLhLinModMeanProjData3DF;
 
+	/*!
+	\ingroup STIR Extensions
+	\brief Poisson log-likelihood for listmode data with event-batched gradient.
+
+	The gradient is computed directly from the listmode events, so that its
+	cost scales with the number of counts rather than the sinogram size:
+	events are read in batches (the file being sequential), and the matrix
+	rows of the LORs hit by the events of a batch are projected by several
+	threads, each backprojecting into its own image. With a
+	ProjMatrixByBinFromCache (see PETAcquisitionModelUsingMatrix) the rows
+	are read from the mapped cache file without locking; other matrices are
+	accessed one thread at a time.
+
+	The listmode file is opened and the additive term is loaded into memory
+	by set_up().
+
+	To avoid the costly sensitivity computation, set a precomputed
+	sensitivity image by set_sensitivity_filename() and
+	set_recompute_sensitivity(false).
+	*/
+	class xSTIR_PoissonLogLikelihoodWithLinearModelForMeanAndListModeDataWithProjMatrixByBin3DF :
+		public stir::PoissonLogLikelihoodWithLinearModelForMeanAndListModeDataWithProjMatrixByBin < Image3DF > {
+	public:
+		xSTIR_PoissonLogLikelihoodWithLinearModelForMeanAndListModeDataWithProjMatrixByBin3DF() :
+			_batch_size(1 << 20), _verbose(false), _add_min_seg(0)
+		{}
+		void set_input_file(const char* filename)
+		{
+			list_mode_filename = filename;
+		}
+		void set_proj_matrix(stir::shared_ptr<stir::ProjMatrixByBin> sptr_matrix)
+		{
+			PM_sptr = sptr_matrix;
+		}
+		stir::shared_ptr<stir::ProjMatrixByBin> proj_matrix_sptr()
+		{
+			return PM_sptr;
+		}
+		//! Sets the additive term (in the geometry of the uncompressed data)
+		void set_additive_term(stir::shared_ptr<PETAcquisitionData> sptr_ad)
+		{
+			additive_proj_data_sptr = sptr_ad->data();
+			_add_segments.clear();
+		}
+		//! Number of events read and projected at a time
+		void set_batch_size(int n)
+		{
+			if (n < 1)
+				THROW("listmode batch size must be positive");
+			_batch_size = n;
+		}
+		int batch_size() const
+		{
+			return _batch_size;
+		}
+		//! Reports the number of events processed by each gradient computation
+		void set_verbose(bool verbose)
+		{
+			_verbose = verbose;
+		}
+		bool verbose() const
+		{
+			return _verbose;
+		}
+
+		virtual stir::Succeeded set_up(stir::shared_ptr<Image3DF> const& sptr_image);
+		virtual void compute_sub_gradient_without_penalty_plus_sensitivity
+			(Image3DF& gradient, const Image3DF& current_estimate,
+			const int subset_num);
+
+	private:
+		int _batch_size;
+		bool _verbose;
+		// the additive term by segment, read from it once by set_up()
+		int _add_min_seg;
+		std::vector<stir::shared_ptr<stir::SegmentBySinogram<float> > > _add_segments;
+
+		void load_additive_term_();
+	};
+
+	typedef xSTIR_PoissonLogLikelihoodWithLinearModelForMeanAndListModeDataWithProjMatrixByBin3DF
+		PoissonLogLhLinModMeanListData3DF;
+
 	class xSTIR_IterativeReconstruction3DF :
 		public stir::IterativeReconstruction < Image3DF > {
 	public:
@@ -562,30 +822,101 @@ The actual algorithm is described in
 		void set_initial_estimate_file(const char* filename) {
 			initial_data_filename = filename;
 		}
+		//! Saves the current estimate, iteration counters and sensitivities
+		/*!
+		The file is binary, in the native byte order. If a subset scheduler
+		is given, its state (position in the order and random number
+		generator) is saved too.
+		*/
+		void save_state(const std::string& filename, const Image3DF& image,
+			const SubsetScheduler* ptr_scheduler = 0);
+		//! Restores the state saved by save_state and sets up the reconstruction
+		/*!
+		The estimate is copied into image, which must have the same sizes as
+		the saved one. The saved sensitivities are given to the objective
+		function (via Interfile files in a scratch directory next to the
+		state file, removed once set-up has read them), so that set-up does
+		not recompute them; a later set-up recomputes them. Subsequent
+		updates continue from the saved subiteration. If the state includes
+		that of a subset scheduler, it is restored into the scheduler given,
+		which must then not be null.
+		*/
+		stir::Succeeded load_state(const std::string& filename,
+			stir::shared_ptr<Image3DF> sptr_image,
+			SubsetScheduler* ptr_scheduler = 0);
 	};
 
+	/*!
+	\ingroup STIR Extensions
+	\brief OSMAPOSL reconstruction with optional subset prefetching.
+
+	If the prefetch memory is set to a positive number of megabytes and the
+	acquisition data of the objective function are not stored in memory,
+	set_up wraps them into a ProjDataWithPrefetch object, and each update
+	starts reading the data of the next subset on a background thread
+	before processing the current one.
+
+	If a subset scheduler is set, each update processes the subset it
+	returns rather than the next one in STIR order.
+	*/
 	class xSTIR_OSMAPOSLReconstruction3DF :
 		public stir::OSMAPOSLReconstruction < Image3DF > {
 	public:
+		xSTIR_OSMAPOSLReconstruction3DF() : _prefetch_memory(0) {}
+		xSTIR_OSMAPOSLReconstruction3DF(const char* par_file) :
+			stir::OSMAPOSLReconstruction < Image3DF >(par_file),
+			_prefetch_memory(0)
+		{}
+		//! Memory (in MB) for prefetched acquisition data, 0 disables prefetching
+		void set_prefetch_memory(int mb)
+		{
+			if (mb < 0)
+				THROW("prefetch memory must be non-negative");
+			_prefetch_memory = mb;
+		}
+		int prefetch_memory() const
+		{
+			return _prefetch_memory;
+		}
+		stir::shared_ptr<ProjDataWithPrefetch> prefetch_sptr()
+		{
+			return _sptr_prefetch;
+		}
+		void set_subset_scheduler(stir::shared_ptr<SubsetScheduler> sptr)
+		{
+			_sptr_scheduler = sptr;
+		}
+		stir::shared_ptr<SubsetScheduler> subset_scheduler_sptr()
+		{
+			return _sptr_scheduler;
+		}
+		//! Installs (or removes) the prefetching reader, called by set_up
+		void set_up_prefetch();
 		stir::Succeeded set_up(stir::shared_ptr<STIRImageData> sptr_id)
 		{
 			stir::Succeeded s = stir::Succeeded::no;
 			xSTIR_IterativeReconstruction3DF* ptr_r =
 				(xSTIR_IterativeReconstruction3DF*)this;
 			if (!ptr_r->post_process()) {
+				set_up_prefetch();
 				s = ptr_r->setup(sptr_id->data_sptr());
 				ptr_r->subiteration() = ptr_r->get_start_subiteration_num();
 			}
 			return s;
 		}
+		void update(Image3DF& image);
 		void update(STIRImageData& id)
 		{
-			((xSTIR_IterativeReconstruction3DF*)this)->update(id.data());
+			update(id.data());
 		}
 		void update(stir::shared_ptr<STIRImageData> sptr_id)
 		{
 			update(*sptr_id);
 		}
+	private:
+		int _prefetch_memory;
+		stir::shared_ptr<ProjDataWithPrefetch> _sptr_prefetch;
+		stir::shared_ptr<SubsetScheduler> _sptr_scheduler;
 	};
 
 	typedef xSTIR_OSMAPOSLReconstruction3DF OSMAPOSLReconstruction3DF;
@@ -602,10 +933,17 @@ The actual algorithm is described in
 		xSTIR_FBP2DReconstruction()
 		{
 			_is_set_up = false;
+			_num_threads = 1;
 		}
+		//! Sets the data to reconstruct from
+		/*!
+		STIR takes a pointer to mutable data, hence a copy (in the current
+		storage scheme) is reconstructed from rather than acq itself.
+		*/
 		void set_input(const PETAcquisitionData& acq)
 		{
-			set_input_data(acq.data());
+			_sptr_input.reset(acq.clone().release());
+			set_input_data(_sptr_input->data());
 		}
 		void set_zoom(float v)
 		{
@@ -633,15 +971,35 @@ The actual algorithm is described in
 			_is_set_up = true;
 			return stir::Succeeded::yes;
 		}
+		//! Sets the number of threads reconstructing slabs of slices in parallel
+		/*!
+		1 (default) runs STIR FBP2D as is, 0 uses all available threads.
+		Slabs are only used if the image has one plane per direct sinogram,
+		otherwise STIR FBP2D is run as is.
+		*/
+		void set_num_threads(int n)
+		{
+			if (n < 0)
+				throw LocalisedException
+				("wrong number of threads", __FILE__, __LINE__);
+			_num_threads = n;
+		}
+		int num_threads() const
+		{
+			return _num_threads;
+		}
 		stir::Succeeded process()
 		{
+			stir::shared_ptr<Image3DF> sptr_image;
 			if (!_is_set_up) {
-				stir::shared_ptr<Image3DF> sptr_image(construct_target_image_ptr());
+				sptr_image.reset(construct_target_image_ptr());
 				_sptr_image_data.reset(new STIRImageData(sptr_image));
-				return reconstruct(sptr_image);
 			}
 			else
-				return reconstruct(_sptr_image_data->data_sptr());
+				sptr_image = _sptr_image_data->data_sptr();
+			if (_num_threads != 1)
+				return reconstruct_in_slabs_(sptr_image);
+			return reconstruct(sptr_image);
 		}
 		stir::shared_ptr<STIRImageData> get_output()
 		{
@@ -649,7 +1007,11 @@ The actual algorithm is described in
 		}
 	protected:
 		bool _is_set_up;
+		int _num_threads;
+		stir::shared_ptr<PETAcquisitionData> _sptr_input;
 		stir::shared_ptr<STIRImageData> _sptr_image_data;
+
+		stir::Succeeded reconstruct_in_slabs_(stir::shared_ptr<Image3DF> sptr_image);
 	};
 
 }
@@ -0,0 +1,343 @@
+/*
+CCP PETMR Synergistic Image Reconstruction Framework (SIRF)
+Copyright 2019 Rutherford Appleton Laboratory STFC
+
+This is software developed for the Collaborative Computational
+Project in Positron Emission Tomography and Magnetic Resonance imaging
+(http://www.ccppetmr.ac.uk/).
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+http://www.apache.org/licenses/LICENSE-2.0
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+*/
+
+#include <algorithm>
+#include <cstdio>
+
+#include "stir/IndexRange2D.h"
+
+#include "sirf/iUtilities/DataHandle.h"
+#include "sirf/STIR/stir_compressed_data.h"
+
+using namespace stir;
+using namespace sirf;
+
+// shortest run of equal bytes encoded as a run, and longest runs
+static const size_t MIN_RUN = 3;
+static const size_t MAX_RUN = 127 + MIN_RUN;
+static const size_t MAX_LITERAL = 128;
+
+void
+FloatArrayCodec::encode(const float* data, size_t n,
+	std::vector<unsigned char>& code)
+{
+	const size_t m = n*sizeof(float);
+	const unsigned char* bytes = (const unsigned char*)data;
+	std::vector<unsigned char> planes(m);
+	for (size_t i = 0; i < n; i++)
+		for (size_t k = 0; k < sizeof(float); k++)
+			planes[k*n + i] = bytes[i*sizeof(float) + k];
+
+	code.clear();
+	size_t i = 0;
+	while (i < m) {
+		const unsigned char b = planes[i];
+		size_t r = 1;
+		while (i + r < m && r < MAX_RUN && planes[i + r] == b)
+			r++;
+		if (r >= MIN_RUN) {
+			code.push_back((unsigned char)(0x80 | (r - MIN_RUN)));
+			code.push_back(b);
+			i += r;
+			continue;
+		}
+		// literals up to the start of the next run
+		size_t j = i;
+		while (j < m && j - i < MAX_LITERAL) {
+			if (j + 2 < m && planes[j] == planes[j + 1] &&
+				planes[j] == planes[j + 2])
+				break;
+			j++;
+		}
+		code.push_back((unsigned char)(j - i - 1));
+		code.insert(code.end(), planes.begin() + i, planes.begin() + j);
+		i = j;
+	}
+}
+
+void
+FloatArrayCodec::decode(const std::vector<unsigned char>& code,
+	float* data, size_t n)
+{
+	const size_t m = n*sizeof(float);
+	std::vector<unsigned char> planes(m);
+	size_t i = 0;
+	size_t k = 0;
+	while (k < code.size()) {
+		const unsigned char c = code[k++];
+		if (c & 0x80) {
+			const size_t r = (c & 0x7f) + MIN_RUN;
+			if (k >= code.size() || i + r > m)
+				THROW("corrupt compressed data");
+			std::fill(planes.begin() + i, planes.begin() + i + r, code[k++]);
+			i += r;
+		}
+		else {
+			const size_t r = c + 1;
+			if (k + r > code.size() || i + r > m)
+				THROW("corrupt compressed data");
+			std::copy(code.begin() + k, code.begin() + k + r, planes.begin() + i);
+			k += r;
+			i += r;
+		}
+	}
+	if (i != m)
+		THROW("corrupt compressed data");
+	unsigned char* bytes = (unsigned char*)data;
+	for (size_t j = 0; j < n; j++)
+		for (size_t b = 0; b < sizeof(float); b++)
+			bytes[j*sizeof(float) + b] = planes[b*n + j];
+}
+
+ProjDataCompressed::ProjDataCompressed
+(shared_ptr<ExamInfo> sptr_exam_info, shared_ptr<ProjDataInfo> sptr_proj_data_info,
+	int cache_size, const std::string& filename) :
+	ProjData(sptr_exam_info, sptr_proj_data_info),
+	_cache_size(std::max(cache_size, 1)),
+	_filename(filename),
+	_file_end(0)
+{
+	if (_filename.empty()) {
+		_blocks.resize(get_num_segments());
+		return;
+	}
+	FileBlock empty = { 0, 0, 0 };
+	_file_blocks.assign(get_num_segments(), empty);
+	_file.open(_filename.c_str(), std::ios::in | std::ios::out |
+		std::ios::binary | std::ios::trunc);
+	if (!_file) {
+		std::string msg = "cannot create compressed data file " + _filename;
+		THROW(msg.c_str());
+	}
+}
+
+ProjDataCompressed::~ProjDataCompressed()
+{
+	if (_filename.empty())
+		return;
+	_file.close();
+	std::remove(_filename.c_str());
+}
+
+size_t
+ProjDataCompressed::compressed_size() const
+{
+	boost::mutex::scoped_lock lock(_mutex);
+	size_t size = 0;
+	for (size_t i = 0; i < _blocks.size(); i++)
+		size += _blocks[i].size();
+	for (size_t i = 0; i < _file_blocks.size(); i++)
+		size += _file_blocks[i].size;
+	return size;
+}
+
+size_t
+ProjDataCompressed::uncompressed_size() const
+{
+	size_t size = 0;
+	for (int s = get_min_segment_num(); s <= get_max_segment_num(); s++)
+		size += sizeof(float)*get_num_axial_poss(s)*
+		get_num_views()*get_num_tangential_poss();
+	return size;
+}
+
+void
+ProjDataCompressed::write_block_
+(int segment_num, const std::vector<unsigned char>& code) const
+{
+	const int i = segment_num - get_min_segment_num();
+	if (_filename.empty()) {
+		// copying releases the spare capacity left by earlier, less
+		// compressible contents
+		std::vector<unsigned char>(code).swap(_blocks[i]);
+		return;
+	}
+	FileBlock& block = _file_blocks[i];
+	if (code.size() > block.capacity) {
+		block.offset = _file_end;
+		block.capacity = code.size();
+		_file_end += code.size();
+	}
+	block.size = code.size();
+	if (code.empty())
+		return;
+	_file.seekp(block.offset);
+	_file.write((const char*)code.data(), code.size());
+	if (!_file) {
+		std::string msg = "failed to write compressed data file " + _filename;
+		THROW(msg.c_str());
+	}
+}
+
+const std::vector<unsigned char>&
+ProjDataCompressed::read_block_
+(int segment_num, std::vector<unsigned char>& buffer) const
+{
+	const int i = segment_num - get_min_segment_num();
+	if (_filename.empty())
+		return _blocks[i];
+	const FileBlock& block = _file_blocks[i];
+	buffer.resize(block.size);
+	if (buffer.empty())
+		return buffer;
+	_file.seekg(block.offset);
+	_file.read((char*)buffer.data(), buffer.size());
+	if (!_file) {
+		std::string msg = "failed to read compressed data file " + _filename;
+		THROW(msg.c_str());
+	}
+	return buffer;
+}
+
+void
+ProjDataCompressed::compress_(const SegmentBySinogram<float>& s) const
+{
+	std::vector<float> values(s.size_all());
+	std::copy(s.begin_all(), s.end_all(), values.begin());
+	std::vector<unsigned char> code;
+	FloatArrayCodec::encode(values.data(), values.size(), code);
+	write_block_(s.get_segment_num(), code);
+}
+
+void
+ProjDataCompressed::decompress_(SegmentBySinogram<float>& s) const
+{
+	std::vector<unsigned char> buffer;
+	const std::vector<unsigned char>& code = read_block_(s.get_segment_num(), buffer);
+	// a segment never written to is all zeros
+	if (code.empty()) {
+		s.fill(0.0f);
+		return;
+	}
+	std::vector<float> values(s.size_all());
+	FloatArrayCodec::decode(code, values.data(), values.size());
+	std::copy(values.begin(), values.end(), s.begin_all());
+}
+
+SegmentBySinogram<float>&
+ProjDataCompressed::cached_segment_(int segment_num, bool modify) const
+{
+	if (segment_num < get_min_segment_num() || segment_num > get_max_segment_num())
+		THROW("segment number out of range");
+	std::list<CachedSegment>::iterator iter = _cache.begin();
+	for (; iter != _cache.end(); ++iter)
+		if (iter->segment_num == segment_num)
+			break;
+	if (iter != _cache.end())
+		_cache.splice(_cache.begin(), _cache, iter);
+	else {
+		if ((int)_cache.size() >= _cache_size) {
+			CachedSegment& lru = _cache.back();
+			if (lru.modified)
+				compress_(*lru.sptr_segment);
+			_cache.pop_back();
+		}
+		CachedSegment cs;
+		cs.segment_num = segment_num;
+		cs.sptr_segment.reset(new SegmentBySinogram<float>
+			(get_empty_segment_by_sinogram(segment_num)));
+		cs.modified = false;
+		decompress_(*cs.sptr_segment);
+		_cache.push_front(cs);
+	}
+	if (modify)
+		_cache.front().modified = true;
+	return *_cache.front().sptr_segment;
+}
+
+Viewgram<float>
+ProjDataCompressed::get_viewgram(const int view_num, const int segment_num,
+	const bool make_num_tangential_poss_odd) const
+{
+	boost::mutex::scoped_lock lock(_mutex);
+	Viewgram<float> v =
+		cached_segment_(segment_num, false).get_viewgram(view_num);
+	if (make_num_tangential_poss_odd && get_num_tangential_poss() % 2 == 0)
+		v.grow(IndexRange2D(get_min_axial_pos_num(segment_num),
+		get_max_axial_pos_num(segment_num),
+		get_min_tangential_pos_num(), get_max_tangential_pos_num() + 1));
+	return v;
+}
+
+Succeeded
+ProjDataCompressed::set_viewgram(const Viewgram<float>& v)
+{
+	boost::mutex::scoped_lock lock(_mutex);
+	cached_segment_(v.get_segment_num(), true).set_viewgram(v);
+	return Succeeded::yes;
+}
+
+Sinogram<float>
+ProjDataCompressed::get_sinogram(const int ax_pos_num, const int segment_num,
+	const bool make_num_tangential_poss_odd) const
+{
+	boost::mutex::scoped_lock lock(_mutex);
+	Sinogram<float> s =
+		cached_segment_(segment_num, false).get_sinogram(ax_pos_num);
+	if (make_num_tangential_poss_odd && get_num_tangential_poss() % 2 == 0)
+		s.grow(IndexRange2D(get_min_view_num(), get_max_view_num(),
+		get_min_tangential_pos_num(), get_max_tangential_pos_num() + 1));
+	return s;
+}
+
+Succeeded
+ProjDataCompressed::set_sinogram(const Sinogram<float>& s)
+{
+	boost::mutex::scoped_lock lock(_mutex);
+	cached_segment_(s.get_segment_num(), true).set_sinogram(s);
+	return Succeeded::yes;
+}
+
+SegmentBySinogram<float>
+ProjDataCompressed::get_segment_by_sinogram(const int segment_num) const
+{
+	boost::mutex::scoped_lock lock(_mutex);
+	return cached_segment_(segment_num, false);
+}
+
+SegmentByView<float>
+ProjDataCompressed::get_segment_by_view(const int segment_num) const
+{
+	return SegmentByView<float>(get_segment_by_sinogram(segment_num));
+}
+
+Succeeded
+ProjDataCompressed::set_segment(const SegmentBySinogram<float>& s)
+{
+	const int segment_num = s.get_segment_num();
+	if (segment_num < get_min_segment_num() || segment_num > get_max_segment_num())
+		THROW("segment number out of range");
+	boost::mutex::scoped_lock lock(_mutex);
+	compress_(s);
+	// the cached copy, if any, is now out of date
+	for (std::list<CachedSegment>::iterator iter = _cache.begin();
+		iter != _cache.end(); ++iter)
+		if (iter->segment_num == segment_num) {
+			_cache.erase(iter);
+			break;
+		}
+	return Succeeded::yes;
+}
+
+Succeeded
+ProjDataCompressed::set_segment(const SegmentByView<float>& s)
+{
+	return set_segment(SegmentBySinogram<float>(s));
+}
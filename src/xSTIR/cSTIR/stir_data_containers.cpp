@@ -19,6 +19,11 @@ limitations under the License.
 
 */
 
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <utility>
+
 #include "sirf/STIR/stir_data_containers.h"
 #include "stir/KeyParser.h"
 #include "stir/is_null_ptr.h"
@@ -32,24 +37,280 @@ using namespace sirf;
 std::string PETAcquisitionData::_storage_scheme;
 shared_ptr<PETAcquisitionData> PETAcquisitionData::_template;
 
+// In-memory version of STIR SSRB(ProjData&, const ProjData&, bool):
+// the input segments contributing to an output segment are read at once,
+// and the output sinograms are computed in parallel, each as the sum of
+// the matching input sinograms, with view mashing and tangential trimming
+// done in the same pass
+static void
+parallel_SSRB(ProjData& out, const ProjData& in, bool do_norm)
+{
+	const ProjDataInfoCylindrical* ptr_in_info =
+		dynamic_cast<const ProjDataInfoCylindrical*>(in.get_proj_data_info_ptr());
+	const ProjDataInfoCylindrical* ptr_out_info =
+		dynamic_cast<const ProjDataInfoCylindrical*>(out.get_proj_data_info_ptr());
+	if (!ptr_in_info || !ptr_out_info) {
+		SSRB(out, in, do_norm);
+		return;
+	}
+	const int num_views_to_combine = in.get_num_views() / out.get_num_views();
+	const int num_views = out.get_num_views();
+	const int in_min_view = in.get_min_view_num();
+	const int out_min_view = out.get_min_view_num();
+	const int min_tang = out.get_min_tangential_pos_num();
+	const int num_tang = out.get_num_tangential_poss();
+
+	for (int out_seg = out.get_min_segment_num();
+		out_seg <= out.get_max_segment_num(); out_seg++) {
+		const int out_min_rd = ptr_out_info->get_min_ring_difference(out_seg);
+		const int out_max_rd = ptr_out_info->get_max_ring_difference(out_seg);
+		std::vector<int> in_segs;
+		for (int in_seg = in.get_min_segment_num();
+			in_seg <= in.get_max_segment_num(); in_seg++) {
+			const int min_rd = ptr_in_info->get_min_ring_difference(in_seg);
+			const int max_rd = ptr_in_info->get_max_ring_difference(in_seg);
+			if (min_rd >= out_min_rd && max_rd <= out_max_rd)
+				in_segs.push_back(in_seg);
+			else if (min_rd <= out_max_rd && max_rd >= out_min_rd)
+				THROW("SSRB: ring differences of input and output segments overlap");
+		}
+		SegmentBySinogram<float> out_segment =
+			out.get_empty_segment_by_sinogram(out_seg);
+		const int out_min_ax = out.get_min_axial_pos_num(out_seg);
+		const int num_out_ax = out.get_num_axial_poss(out_seg);
+
+		std::vector<SegmentBySinogram<float> > in_segments;
+		for (size_t i = 0; i < in_segs.size(); i++)
+			in_segments.push_back(in.get_segment_by_sinogram(in_segs[i]));
+		// input sinograms (segment index, axial position) for each output one
+		std::vector<std::vector<std::pair<int, int> > > sources(num_out_ax);
+		for (int oa = 0; oa < num_out_ax; oa++) {
+			const float out_m =
+				ptr_out_info->get_m(Bin(out_seg, 0, out_min_ax + oa, 0));
+			for (size_t i = 0; i < in_segs.size(); i++)
+				for (int ia = in.get_min_axial_pos_num(in_segs[i]);
+					ia <= in.get_max_axial_pos_num(in_segs[i]); ia++)
+					if (std::fabs(out_m -
+						ptr_in_info->get_m(Bin(in_segs[i], 0, ia, 0))) < 1E-4)
+						sources[oa].push_back(std::make_pair((int)i, ia));
+		}
+
+#pragma omp parallel for schedule(dynamic)
+		for (int oa = 0; oa < num_out_ax; oa++) {
+			const std::vector<std::pair<int, int> >& src = sources[oa];
+			const int ax = out_min_ax + oa;
+			for (size_t k = 0; k < src.size(); k++) {
+				const SegmentBySinogram<float>& in_segment = in_segments[src[k].first];
+				for (int iv = 0; iv < num_views*num_views_to_combine; iv++) {
+					const float* x = &in_segment[src[k].second][in_min_view + iv][min_tang];
+					float* y = &out_segment[ax][out_min_view + iv / num_views_to_combine][min_tang];
+					for (int t = 0; t < num_tang; t++)
+						y[t] += x[t];
+				}
+			}
+			if (do_norm && src.size() > 0) {
+				const float s = 1.0f / (src.size()*num_views_to_combine);
+				for (int v = 0; v < num_views; v++) {
+					float* y = &out_segment[ax][out_min_view + v][min_tang];
+					for (int t = 0; t < num_tang; t++)
+						y[t] *= s;
+				}
+			}
+		}
+		out.set_segment(out_segment);
+	}
+}
+
+shared_ptr<PETAcquisitionData>
+PETAcquisitionData::single_slice_rebinned_data(
+	const int num_segments_to_combine,
+	const int num_views_to_combine,
+	const int num_tang_poss_to_trim,
+	const bool do_normalisation,
+	const int max_in_segment_num_to_process
+	)
+{
+	shared_ptr<ProjDataInfo> out_proj_data_info_sptr(
+		SSRB(*data()->get_proj_data_info_ptr(),
+		num_segments_to_combine,
+		num_views_to_combine,
+		num_tang_poss_to_trim,
+		max_in_segment_num_to_process
+		));
+	shared_ptr<PETAcquisitionData>
+		sptr(same_acquisition_data
+		(data()->get_exam_info_sptr(), out_proj_data_info_sptr));
+	if (dynamic_cast<ProjDataInMemory*>(data().get()) &&
+		dynamic_cast<ProjDataInMemory*>(sptr->data().get()))
+		parallel_SSRB(*sptr->data(), *data(), do_normalisation);
+	else
+		SSRB(*sptr, *data(), do_normalisation);
+	return sptr;
+}
+
+void
+PETAcquisitionData::mark_all_zero_()
+{
+	SinogramFlags flags;
+	for (int s = _data->get_min_segment_num(); s <= _data->get_max_segment_num(); s++)
+		flags.push_back(std::vector<unsigned char>(_data->get_num_axial_poss(s), 1));
+	set_zero_sinograms_(flags);
+}
+
+// Zero flags of the sinograms of segment s (all 0 if not known)
+static void
+segment_zero_flags(const PETAcquisitionData::SinogramFlags& flags,
+	int min_seg, const SegmentBySinogram<float>& seg, std::vector<unsigned char>& z)
+{
+	const size_t n = seg.get_num_axial_poss();
+	const int i = seg.get_segment_num() - min_seg;
+	if (i >= 0 && i < (int)flags.size() && flags[i].size() == n)
+		z = flags[i];
+	else
+		z.assign(n, 0);
+}
+
+static bool
+same_shape(const SegmentBySinogram<float>& a, const SegmentBySinogram<float>& b)
+{
+	return a.get_min_axial_pos_num() == b.get_min_axial_pos_num() &&
+		a.get_max_axial_pos_num() == b.get_max_axial_pos_num() &&
+		a.get_min_view_num() == b.get_min_view_num() &&
+		a.get_max_view_num() == b.get_max_view_num() &&
+		a.get_min_tangential_pos_num() == b.get_min_tangential_pos_num() &&
+		a.get_max_tangential_pos_num() == b.get_max_tangential_pos_num();
+}
+
+// seg = op(sx, sy), sinogram by sinogram, skipping those for which op says
+// the result is zero given the zero flags of the arguments (seg must be
+// zero on entry); z gets the zero flags of the result
+template<class Op>
+static void
+binary_segment_op(const SegmentBySinogram<float>& sx,
+	const std::vector<unsigned char>& zx,
+	const SegmentBySinogram<float>& sy,
+	const std::vector<unsigned char>& zy,
+	SegmentBySinogram<float>& seg, std::vector<unsigned char>& z, const Op& op)
+{
+	z.assign(seg.get_num_axial_poss(), 0);
+	if (!same_shape(seg, sx) || !same_shape(seg, sy)) {
+		SegmentBySinogram<float>::full_iterator seg_iter;
+		SegmentBySinogram<float>::const_full_iterator sx_iter;
+		SegmentBySinogram<float>::const_full_iterator sy_iter;
+		for (seg_iter = seg.begin_all(),
+			sx_iter = sx.begin_all(), sy_iter = sy.begin_all();
+			seg_iter != seg.end_all() &&
+			sx_iter != sx.end_all() && sy_iter != sy.end_all();
+		/*empty*/)
+			*seg_iter++ = op(*sx_iter++, *sy_iter++);
+		return;
+	}
+	const int min_ax = seg.get_min_axial_pos_num();
+	for (int i = 0; i < (int)z.size(); i++) {
+		if (op.zero(zx[i] != 0, zy[i] != 0)) {
+			z[i] = 1;
+			continue;
+		}
+		Array<2, float>& s = seg[min_ax + i];
+		const Array<2, float>& x = sx[min_ax + i];
+		const Array<2, float>& y = sy[min_ax + i];
+		Array<2, float>::full_iterator s_iter = s.begin_all();
+		Array<2, float>::const_full_iterator x_iter = x.begin_all();
+		Array<2, float>::const_full_iterator y_iter = y.begin_all();
+		while (s_iter != s.end_all())
+			*s_iter++ = op(*x_iter++, *y_iter++);
+	}
+}
+
+struct AxpbyOp {
+	float a;
+	float b;
+	AxpbyOp(float a_, float b_) : a(a_), b(b_) {}
+	float operator()(float x, float y) const
+	{
+		return float(a*double(x) + b*double(y));
+	}
+	bool zero(bool zx, bool zy) const
+	{
+		return (zx || a == 0) && (zy || b == 0);
+	}
+};
+
+struct MultiplyOp {
+	float operator()(float x, float y) const
+	{
+		return x*y;
+	}
+	bool zero(bool zx, bool zy) const
+	{
+		return zx || zy;
+	}
+};
+
+static double
+segment_norm2(const SegmentBySinogram<float>& seg,
+	const std::vector<unsigned char>& z)
+{
+	double t = 0;
+	const int min_ax = seg.get_min_axial_pos_num();
+	for (int i = 0; i < (int)z.size(); i++) {
+		if (z[i])
+			continue;
+		const Array<2, float>& s = seg[min_ax + i];
+		for (Array<2, float>::const_full_iterator iter = s.begin_all();
+			iter != s.end_all();) {
+			double r = *iter++;
+			t += r*r;
+		}
+	}
+	return t;
+}
+
+static double
+segment_dot(const SegmentBySinogram<float>& seg,
+	const std::vector<unsigned char>& z,
+	const SegmentBySinogram<float>& sx,
+	const std::vector<unsigned char>& zx)
+{
+	double t = 0;
+	SegmentBySinogram<float>::const_full_iterator seg_iter;
+	SegmentBySinogram<float>::const_full_iterator sx_iter;
+	if (!same_shape(seg, sx)) {
+		for (seg_iter = seg.begin_all(), sx_iter = sx.begin_all();
+			seg_iter != seg.end_all() && sx_iter != sx.end_all();
+			/*empty*/)
+			t += (*seg_iter++)*double(*sx_iter++);
+		return t;
+	}
+	const int min_ax = seg.get_min_axial_pos_num();
+	for (int i = 0; i < (int)z.size(); i++) {
+		if (z[i] || zx[i])
+			continue;
+		const Array<2, float>& s = seg[min_ax + i];
+		const Array<2, float>& x = sx[min_ax + i];
+		Array<2, float>::const_full_iterator s_iter = s.begin_all();
+		Array<2, float>::const_full_iterator x_iter = x.begin_all();
+		while (s_iter != s.end_all())
+			t += (*s_iter++)*double(*x_iter++);
+	}
+	return t;
+}
+
 float
 PETAcquisitionData::norm() const
 {
+	const int min_seg = data()->get_min_segment_num();
+	std::vector<unsigned char> z;
 	double t = 0.0;
 	for (int s = 0; s <= get_max_segment_num(); ++s)
 	{
 		SegmentBySinogram<float> seg = get_segment_by_sinogram(s);
-		SegmentBySinogram<float>::full_iterator seg_iter;
-		for (seg_iter = seg.begin_all(); seg_iter != seg.end_all();) {
-			double r = *seg_iter++;
-			t += r*r;
-		}
+		segment_zero_flags(_zero_sinograms, min_seg, seg, z);
+		t += segment_norm2(seg, z);
 		if (s != 0) {
 			seg = get_segment_by_sinogram(-s);
-			for (seg_iter = seg.begin_all(); seg_iter != seg.end_all();) {
-				double r = *seg_iter++;
-				t += r*r;
-			}
+			segment_zero_flags(_zero_sinograms, min_seg, seg, z);
+			t += segment_norm2(seg, z);
 		}
 	}
 	return sqrt((float)t);
@@ -62,76 +323,77 @@ PETAcquisitionData::dot(const DataContainer& a_x, void* ptr) const
 	DYNAMIC_CAST(const PETAcquisitionData, x, a_x);
 	int n = get_max_segment_num();
 	int nx = x.get_max_segment_num();
+	const int min_seg = data()->get_min_segment_num();
+	const int min_seg_x = x.data()->get_min_segment_num();
+	std::vector<unsigned char> z;
+	std::vector<unsigned char> zx;
 	double t = 0;
 	for (int s = 0; s <= n && s <= nx; ++s)
 	{
 		SegmentBySinogram<float> seg = get_segment_by_sinogram(s);
 		SegmentBySinogram<float> sx = x.get_segment_by_sinogram(s);
-		SegmentBySinogram<float>::full_iterator seg_iter;
-		SegmentBySinogram<float>::full_iterator sx_iter;
-		for (seg_iter = seg.begin_all(), sx_iter = sx.begin_all();
-			seg_iter != seg.end_all() && sx_iter != sx.end_all();
-			/*empty*/) {
-			t += (*seg_iter++)*double(*sx_iter++);
-		}
+		segment_zero_flags(_zero_sinograms, min_seg, seg, z);
+		segment_zero_flags(x.zero_sinograms(), min_seg_x, sx, zx);
+		t += segment_dot(seg, z, sx, zx);
 		if (s != 0) {
 			seg = get_segment_by_sinogram(-s);
 			sx = x.get_segment_by_sinogram(-s);
-			for (seg_iter = seg.begin_all(), sx_iter = sx.begin_all();
-				seg_iter != seg.end_all() && sx_iter != sx.end_all();
-				/*empty*/)
-				t += (*seg_iter++)*double(*sx_iter++);
+			segment_zero_flags(_zero_sinograms, min_seg, seg, z);
+			segment_zero_flags(x.zero_sinograms(), min_seg_x, sx, zx);
+			t += segment_dot(seg, z, sx, zx);
 		}
 	}
 	float* ptr_t = (float*)ptr;
 	*ptr_t = (float)t;
 }
 
+template<class Op>
 void
-PETAcquisitionData::axpby(
-const void* ptr_a, const DataContainer& a_x,
-const void* ptr_b, const DataContainer& a_y
-)
+PETAcquisitionData::binary_op_
+(const PETAcquisitionData& x, const PETAcquisitionData& y, const Op& op)
 {
-	float a = *(float*)ptr_a;
-	float b = *(float*)ptr_b;
-	DYNAMIC_CAST(const PETAcquisitionData, x, a_x);
-	DYNAMIC_CAST(const PETAcquisitionData, y, a_y);
-	//PETAcquisitionData& x = (PETAcquisitionData&)a_x;
-	//PETAcquisitionData& y = (PETAcquisitionData&)a_y;
+	// x or y may be this object, whose flags are dropped by set_segment()
+	const SinogramFlags flags_x = x.zero_sinograms();
+	const SinogramFlags flags_y = y.zero_sinograms();
+	const bool track = flags_x.size() > 0 || flags_y.size() > 0;
+	const int min_seg = _data->get_min_segment_num();
+	const int min_seg_x = x.data()->get_min_segment_num();
+	const int min_seg_y = y.data()->get_min_segment_num();
+	SinogramFlags flags(_data->get_num_segments());
+	std::vector<unsigned char> zx;
+	std::vector<unsigned char> zy;
 	int n = get_max_segment_num();
 	int nx = x.get_max_segment_num();
 	int ny = y.get_max_segment_num();
 	for (int s = 0; s <= n && s <= nx && s <= ny; ++s)
 	{
-		SegmentBySinogram<float> seg = get_empty_segment_by_sinogram(s);
-		SegmentBySinogram<float> sx = x.get_segment_by_sinogram(s);
-		SegmentBySinogram<float> sy = y.get_segment_by_sinogram(s);
-		SegmentBySinogram<float>::full_iterator seg_iter;
-		SegmentBySinogram<float>::full_iterator sx_iter;
-		SegmentBySinogram<float>::full_iterator sy_iter;
-		for (seg_iter = seg.begin_all(),
-			sx_iter = sx.begin_all(), sy_iter = sy.begin_all();
-			seg_iter != seg.end_all() &&
-			sx_iter != sx.end_all() && sy_iter != sy.end_all();
-		/*empty*/) {
-			*seg_iter++ = float(a*double(*sx_iter++) + b*double(*sy_iter++));
-		}
-		set_segment(seg);
-		if (s != 0) {
-			seg = get_empty_segment_by_sinogram(-s);
-			sx = x.get_segment_by_sinogram(-s);
-			sy = y.get_segment_by_sinogram(-s);
-			for (seg_iter = seg.begin_all(),
-				sx_iter = sx.begin_all(), sy_iter = sy.begin_all();
-				seg_iter != seg.end_all() &&
-				sx_iter != sx.end_all() && sy_iter != sy.end_all();
-			/*empty*/) {
-				*seg_iter++ = float(a*double(*sx_iter++) + b*double(*sy_iter++));
-			}
+		for (int sign = 1; sign >= -1; sign -= 2) {
+			if (s == 0 && sign < 0)
+				break;
+			SegmentBySinogram<float> seg = get_empty_segment_by_sinogram(sign*s);
+			SegmentBySinogram<float> sx = x.get_segment_by_sinogram(sign*s);
+			SegmentBySinogram<float> sy = y.get_segment_by_sinogram(sign*s);
+			segment_zero_flags(flags_x, min_seg_x, sx, zx);
+			segment_zero_flags(flags_y, min_seg_y, sy, zy);
+			binary_segment_op(sx, zx, sy, zy, seg, flags[sign*s - min_seg], op);
 			set_segment(seg);
 		}
 	}
+	if (track)
+		set_zero_sinograms_(flags);
+}
+
+void
+PETAcquisitionData::axpby(
+const void* ptr_a, const DataContainer& a_x,
+const void* ptr_b, const DataContainer& a_y
+)
+{
+	float a = *(float*)ptr_a;
+	float b = *(float*)ptr_b;
+	DYNAMIC_CAST(const PETAcquisitionData, x, a_x);
+	DYNAMIC_CAST(const PETAcquisitionData, y, a_y);
+	binary_op_(x, y, AxpbyOp(a, b));
 }
 
 void
@@ -177,39 +439,7 @@ const DataContainer& a_y
 	//PETAcquisitionData& y = (PETAcquisitionData&)a_y;
 	DYNAMIC_CAST(const PETAcquisitionData, x, a_x);
 	DYNAMIC_CAST(const PETAcquisitionData, y, a_y);
-	int n = get_max_segment_num();
-	int nx = x.get_max_segment_num();
-	int ny = y.get_max_segment_num();
-	for (int s = 0; s <= n && s <= nx && s <= ny; ++s)
-	{
-		SegmentBySinogram<float> seg = get_empty_segment_by_sinogram(s);
-		SegmentBySinogram<float> sx = x.get_segment_by_sinogram(s);
-		SegmentBySinogram<float> sy = y.get_segment_by_sinogram(s);
-		SegmentBySinogram<float>::full_iterator seg_iter;
-		SegmentBySinogram<float>::full_iterator sx_iter;
-		SegmentBySinogram<float>::full_iterator sy_iter;
-		for (seg_iter = seg.begin_all(),
-			sx_iter = sx.begin_all(), sy_iter = sy.begin_all();
-			seg_iter != seg.end_all() &&
-			sx_iter != sx.end_all() && sy_iter != sy.end_all();
-		/*empty*/) {
-			*seg_iter++ = (*sx_iter++) * (*sy_iter++);
-		}
-		set_segment(seg);
-		if (s != 0) {
-			seg = get_empty_segment_by_sinogram(-s);
-			sx = x.get_segment_by_sinogram(-s);
-			sy = y.get_segment_by_sinogram(-s);
-			for (seg_iter = seg.begin_all(),
-				sx_iter = sx.begin_all(), sy_iter = sy.begin_all();
-				seg_iter != seg.end_all() &&
-				sx_iter != sx.end_all() && sy_iter != sy.end_all();
-			/*empty*/) {
-				*seg_iter++ = (*sx_iter++) * (*sy_iter++);
-			}
-			set_segment(seg);
-		}
-	}
+	binary_op_(x, y, MultiplyOp());
 }
 
 void
@@ -315,6 +545,26 @@ STIRImageData::dot(const DataContainer& a_x, void* ptr) const
 {
 	//STIRImageData& x = (STIRImageData&)a_x;
 	DYNAMIC_CAST(const STIRImageData, x, a_x);
+	const ImageRowTable<const float> rows(data());
+	const ImageRowTable<const float> rows_x(x.data());
+	if (rows.same_size(rows_x)) {
+		const long long n = rows.num_rows();
+		const int nx = rows.nx;
+		double s = 0.0;
+#pragma omp parallel for schedule(static) reduction(+:s)
+		for (long long r = 0; r < n; r++) {
+			const float* u = rows.row(size_t(r));
+			const float* v = rows_x.row(size_t(r));
+			double t = 0.0;
+#pragma omp simd reduction(+:t)
+			for (int i = 0; i < nx; i++)
+				t += double(u[i]) * v[i];
+			s += t;
+		}
+		float* ptr_s = (float*)ptr;
+		*ptr_s = (float)s;
+		return;
+	}
 #if defined(_MSC_VER) && _MSC_VER < 1900
 	Image3DF::const_full_iterator iter;
 	Image3DF::const_full_iterator iter_x;
@@ -343,6 +593,23 @@ const void* ptr_b, const DataContainer& a_y)
 	float b = *(float*)ptr_b;
 	DYNAMIC_CAST(const STIRImageData, x, a_x);
 	DYNAMIC_CAST(const STIRImageData, y, a_y);
+	const ImageRowTable<float> rows(data());
+	const ImageRowTable<const float> rows_x(x.data());
+	const ImageRowTable<const float> rows_y(y.data());
+	if (rows.same_size(rows_x) && rows.same_size(rows_y)) {
+		const long long n = rows.num_rows();
+		const int nx = rows.nx;
+#pragma omp parallel for schedule(static)
+		for (long long r = 0; r < n; r++) {
+			float* u = rows.row(size_t(r));
+			const float* v = rows_x.row(size_t(r));
+			const float* w = rows_y.row(size_t(r));
+#pragma omp simd
+			for (int i = 0; i < nx; i++)
+				u[i] = a * v[i] + b * w[i];
+		}
+		return;
+	}
 	//STIRImageData& x = (STIRImageData&)a_x;
 	//STIRImageData& y = (STIRImageData&)a_y;
 #if defined(_MSC_VER) && _MSC_VER < 1900
@@ -366,6 +633,22 @@ const void* ptr_b, const DataContainer& a_y)
 float
 STIRImageData::norm() const
 {
+	const ImageRowTable<const float> rows(data());
+	if (rows.regular()) {
+		const long long n = rows.num_rows();
+		const int nx = rows.nx;
+		double s = 0.0;
+#pragma omp parallel for schedule(static) reduction(+:s)
+		for (long long r = 0; r < n; r++) {
+			const float* u = rows.row(size_t(r));
+			double t = 0.0;
+#pragma omp simd reduction(+:t)
+			for (int i = 0; i < nx; i++)
+				t += double(u[i]) * u[i];
+			s += t;
+		}
+		return (float)sqrt(s);
+	}
 #if defined(_MSC_VER) && _MSC_VER < 1900
 	//Array<3, float>::const_full_iterator iter;
 	Image3DF::const_full_iterator iter;
@@ -391,6 +674,23 @@ const DataContainer& a_y)
 	//STIRImageData& y = (STIRImageData&)a_y;
 	DYNAMIC_CAST(const STIRImageData, x, a_x);
 	DYNAMIC_CAST(const STIRImageData, y, a_y);
+	const ImageRowTable<float> rows(data());
+	const ImageRowTable<const float> rows_x(x.data());
+	const ImageRowTable<const float> rows_y(y.data());
+	if (rows.same_size(rows_x) && rows.same_size(rows_y)) {
+		const long long n = rows.num_rows();
+		const int nx = rows.nx;
+#pragma omp parallel for schedule(static)
+		for (long long r = 0; r < n; r++) {
+			float* u = rows.row(size_t(r));
+			const float* v = rows_x.row(size_t(r));
+			const float* w = rows_y.row(size_t(r));
+#pragma omp simd
+			for (int i = 0; i < nx; i++)
+				u[i] = v[i] * w[i];
+		}
+		return;
+	}
 #if defined(_MSC_VER) && _MSC_VER < 1900
 	Image3DF::full_iterator iter;
 	Image3DF::const_full_iterator iter_x;
@@ -418,6 +718,40 @@ const DataContainer& a_y)
 	//STIRImageData& y = (STIRImageData&)a_y;
 	DYNAMIC_CAST(const STIRImageData, x, a_x);
 	DYNAMIC_CAST(const STIRImageData, y, a_y);
+	const ImageRowTable<float> rows(data());
+	const ImageRowTable<const float> rows_x(x.data());
+	const ImageRowTable<const float> rows_y(y.data());
+	if (rows.same_size(rows_x) && rows.same_size(rows_y)) {
+		const long long n = rows.num_rows();
+		const int nx = rows.nx;
+		// maximal absolute values of rows of y, then of y
+		std::vector<float> row_max(n);
+#pragma omp parallel for schedule(static)
+		for (long long r = 0; r < n; r++) {
+			const float* w = rows_y.row(size_t(r));
+			float vmax = 0.0;
+			for (int i = 0; i < nx; i++)
+				vmax = std::max(vmax, std::abs(w[i]));
+			row_max[r] = vmax;
+		}
+		float vmin = 1e-6 * *std::max_element(row_max.begin(), row_max.end());
+		if (vmin == 0.0)
+			THROW("division by zero in STIRImageData::divide");
+#pragma omp parallel for schedule(static)
+		for (long long r = 0; r < n; r++) {
+			float* u = rows.row(size_t(r));
+			const float* v = rows_x.row(size_t(r));
+			const float* w = rows_y.row(size_t(r));
+#pragma omp simd
+			for (int i = 0; i < nx; i++) {
+				float vy = w[i];
+				// branch-free version of the clamping below
+				float t = std::max(std::abs(vy), vmin);
+				u[i] = v[i] / (vy < 0 ? -t : t);
+			}
+		}
+		return;
+	}
 #if defined(_MSC_VER) && _MSC_VER < 1900
 	Image3DF::full_iterator iter;
 	Image3DF::const_full_iterator iter_x;
@@ -484,57 +818,56 @@ STIRImageData::get_voxel_sizes(float* vsize) const
 void
 STIRImageData::get_data(float* data) const
 {
-	Image3DF& image = *_data;
-	Coordinate3D<int> min_indices;
-	Coordinate3D<int> max_indices;
-	if (!image.get_regular_range(min_indices, max_indices))
+	const ImageRowTable<const float> rows(*_data);
+	if (!rows.regular())
 		throw LocalisedException("irregular STIR image", __FILE__, __LINE__);
-		//return -1;
-	//std::cout << "trying new const iterator...\n";
-	STIRImageData::Iterator_const iter(begin());
-	for (int i = 0; iter != end(); ++i, ++iter)
-		data[i] = *iter;
-	//std::copy(begin(), end(), data);
-	//std::copy(image.begin_all(), image.end_all(), data);
-	//auto iter = image.begin_all();
-	//for (int i = 0; iter != image.end_all(); i++, iter++)
-	//	data[i] = *iter;
-	//for (int z = min_indices[1], i = 0; z <= max_indices[1]; z++) {
-	//	for (int y = min_indices[2]; y <= max_indices[2]; y++) {
-	//		for (int x = min_indices[3]; x <= max_indices[3]; x++, i++) {
-	//			data[i] = image[z][y][x];
-	//		}
-	//	}
-	//}
-	//return 0;
+	const int nx = rows.nx;
+	if (rows.contiguous) {
+		memcpy(data, rows.row(size_t(0)), rows.size()*sizeof(float));
+		return;
+	}
+	const long long n = rows.num_rows();
+#pragma omp parallel for schedule(static)
+	for (long long r = 0; r < n; r++)
+		memcpy(data + r*nx, rows.row(size_t(r)), nx*sizeof(float));
 }
 
 void
 STIRImageData::set_data(const float* data)
 {
-	Image3DF& image = *_data;
-	Coordinate3D<int> min_indices;
-	Coordinate3D<int> max_indices;
-	if (!image.get_regular_range(min_indices, max_indices))
+	const ImageRowTable<float> rows(*_data);
+	if (!rows.regular())
 		throw LocalisedException("irregular STIR image", __FILE__, __LINE__);
-	//return -1;
-	size_t n = 1;
-	for (int i = 0; i < 3; i++)
-		n *= (max_indices[i + 1] - min_indices[i + 1] + 1);
-	//std::cout << "trying new iterator...\n";
-	STIRImageData::Iterator iter(begin());
-	for (int i = 0; iter != end(); ++i, ++iter)
-		*iter = data[i];
-	//std::copy(data, data + n, begin());
-	//std::copy(data, data + n, image.begin_all());
-	//for (int z = min_indices[1], i = 0; z <= max_indices[1]; z++) {
-	//	for (int y = min_indices[2]; y <= max_indices[2]; y++) {
-	//		for (int x = min_indices[3]; x <= max_indices[3]; x++, i++) {
-	//			image[z][y][x] = data[i];
-	//		}
-	//	}
-	//}
-	//return 0;
+	const int nx = rows.nx;
+	if (rows.contiguous) {
+		memcpy(rows.row(size_t(0)), data, rows.size()*sizeof(float));
+		return;
+	}
+	const long long n = rows.num_rows();
+#pragma omp parallel for schedule(static)
+	for (long long r = 0; r < n; r++)
+		memcpy(rows.row(size_t(r)), data + r*nx, nx*sizeof(float));
+}
+
+void
+STIRImageData::fill(const STIRImageData& x)
+{
+	const ImageRowTable<float> rows(*_data);
+	const ImageRowTable<const float> rows_x(x.data());
+	if (!rows.same_size(rows_x)) {
+		*_data = x.data();
+		return;
+	}
+	const int nx = rows.nx;
+	if (rows.contiguous && rows_x.contiguous) {
+		memcpy(rows.row(size_t(0)), rows_x.row(size_t(0)),
+			rows.size()*sizeof(float));
+		return;
+	}
+	const long long n = rows.num_rows();
+#pragma omp parallel for schedule(static)
+	for (long long r = 0; r < n; r++)
+		memcpy(rows.row(size_t(r)), rows_x.row(size_t(r)), nx*sizeof(float));
 }
 
 void
@@ -0,0 +1,238 @@
+/*
+CCP PETMR Synergistic Image Reconstruction Framework (SIRF)
+Copyright 2019 Rutherford Appleton Laboratory STFC
+
+This is software developed for the Collaborative Computational
+Project in Positron Emission Tomography and Magnetic Resonance imaging
+(http://www.ccppetmr.ac.uk/).
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+http://www.apache.org/licenses/LICENSE-2.0
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+*/
+
+#include <algorithm>
+
+#include <boost/algorithm/string.hpp>
+
+#include "stir/SegmentBySinogram.h"
+#include "stir/Sinogram.h"
+#include "stir/Viewgram.h"
+
+#include "sirf/iUtilities/DataHandle.h"
+#include "sirf/STIR/stir_data_cursor.h"
+
+using namespace stir;
+using namespace sirf;
+
+PETAcquisitionDataCursor::PETAcquisitionDataCursor
+(shared_ptr<PETAcquisitionData> sptr_ad, Unit unit) :
+	_sptr_ad(sptr_ad), _unit(unit)
+{
+	if (!sptr_ad.get())
+		THROW("cannot create a cursor over undefined acquisition data");
+	const int n = proj_data_().get_max_segment_num();
+	for (int s = 0; s <= n; s++) {
+		_segments.push_back(s);
+		if (s != 0)
+			_segments.push_back(-s);
+	}
+	reset();
+}
+
+PETAcquisitionDataCursor::Unit
+PETAcquisitionDataCursor::unit(const std::string& name)
+{
+	if (boost::iequals(name, "segment"))
+		return SEGMENT;
+	if (boost::iequals(name, "viewgram") || boost::iequals(name, "view"))
+		return VIEWGRAM;
+	if (boost::iequals(name, "sinogram"))
+		return SINOGRAM;
+	std::string msg = "unknown acquisition data block unit " + name;
+	THROW(msg.c_str());
+}
+
+void
+PETAcquisitionDataCursor::reset()
+{
+	_started = false;
+	_seg = 0;
+	_pos = 0;
+	_first_sinogram = 0;
+}
+
+bool
+PETAcquisitionDataCursor::next()
+{
+	const ProjData& pd = proj_data_();
+	if (!_started) {
+		_started = true;
+		_seg = 0;
+		_first_sinogram = 0;
+	}
+	else if (_seg < _segments.size()) {
+		const int s = _segments[_seg];
+		if (_unit == SINOGRAM) {
+			_first_sinogram++;
+			if (_pos < pd.get_max_axial_pos_num(s)) {
+				_pos++;
+				return true;
+			}
+		}
+		else if (_unit == VIEWGRAM && _pos < pd.get_max_view_num()) {
+			_pos++;
+			return true;
+		}
+		else
+			_first_sinogram += pd.get_num_axial_poss(s);
+		_seg++;
+	}
+	if (_seg >= _segments.size())
+		return false;
+	if (_unit == SINOGRAM)
+		_pos = pd.get_min_axial_pos_num(_segments[_seg]);
+	else if (_unit == VIEWGRAM)
+		_pos = pd.get_min_view_num();
+	else
+		_pos = 0;
+	return true;
+}
+
+const ProjData&
+PETAcquisitionDataCursor::proj_data_() const
+{
+	// const access keeps the zero sinogram flags
+	const PETAcquisitionData& ad = *_sptr_ad;
+	return *ad.data();
+}
+
+void
+PETAcquisitionDataCursor::check_valid_() const
+{
+	if (!valid())
+		THROW("acquisition data cursor is not on a block");
+}
+
+int
+PETAcquisitionDataCursor::segment_num() const
+{
+	check_valid_();
+	return _segments[_seg];
+}
+
+int
+PETAcquisitionDataCursor::min_axial_pos_num() const
+{
+	check_valid_();
+	if (_unit == SINOGRAM)
+		return _pos;
+	return proj_data_().get_min_axial_pos_num(_segments[_seg]);
+}
+
+int
+PETAcquisitionDataCursor::num_sinograms() const
+{
+	check_valid_();
+	if (_unit == SINOGRAM)
+		return 1;
+	return proj_data_().get_num_axial_poss(_segments[_seg]);
+}
+
+int
+PETAcquisitionDataCursor::min_view_num() const
+{
+	check_valid_();
+	if (_unit == VIEWGRAM)
+		return _pos;
+	return proj_data_().get_min_view_num();
+}
+
+int
+PETAcquisitionDataCursor::num_views() const
+{
+	check_valid_();
+	if (_unit == VIEWGRAM)
+		return 1;
+	return proj_data_().get_num_views();
+}
+
+int
+PETAcquisitionDataCursor::num_tangential_poss() const
+{
+	return proj_data_().get_num_tangential_poss();
+}
+
+int
+PETAcquisitionDataCursor::first_sinogram() const
+{
+	check_valid_();
+	return _first_sinogram;
+}
+
+void
+PETAcquisitionDataCursor::get_info(int* info) const
+{
+	info[SEGMENT_NUM] = segment_num();
+	info[MIN_AXIAL_POS_NUM] = min_axial_pos_num();
+	info[NUM_SINOGRAMS] = num_sinograms();
+	info[MIN_VIEW_NUM] = min_view_num();
+	info[NUM_VIEWS] = num_views();
+	info[NUM_TANGENTIAL_POSS] = num_tangential_poss();
+	info[FIRST_SINOGRAM] = first_sinogram();
+}
+
+void
+PETAcquisitionDataCursor::get_block(float* data) const
+{
+	check_valid_();
+	const ProjData& pd = proj_data_();
+	const int s = _segments[_seg];
+	if (_unit == SEGMENT) {
+		SegmentBySinogram<float> seg = pd.get_segment_by_sinogram(s);
+		std::copy(seg.begin_all_const(), seg.end_all_const(), data);
+	}
+	else if (_unit == VIEWGRAM) {
+		Viewgram<float> v = pd.get_viewgram(_pos, s);
+		std::copy(v.begin_all_const(), v.end_all_const(), data);
+	}
+	else {
+		Sinogram<float> sino = pd.get_sinogram(_pos, s);
+		std::copy(sino.begin_all_const(), sino.end_all_const(), data);
+	}
+}
+
+void
+PETAcquisitionDataCursor::set_block(const float* data)
+{
+	check_valid_();
+	// non-const access drops the zero sinogram flags
+	ProjData& pd = *_sptr_ad->data();
+	const int s = _segments[_seg];
+	const size_t n = size();
+	Succeeded ok = Succeeded::yes;
+	if (_unit == SEGMENT) {
+		SegmentBySinogram<float> seg = pd.get_empty_segment_by_sinogram(s);
+		std::copy(data, data + n, seg.begin_all());
+		ok = pd.set_segment(seg);
+	}
+	else if (_unit == VIEWGRAM) {
+		Viewgram<float> v = pd.get_empty_viewgram(_pos, s);
+		std::copy(data, data + n, v.begin_all());
+		ok = pd.set_viewgram(v);
+	}
+	else {
+		Sinogram<float> sino = pd.get_empty_sinogram(_pos, s);
+		std::copy(data, data + n, sino.begin_all());
+		ok = pd.set_sinogram(sino);
+	}
+	if (ok != Succeeded::yes)
+		THROW("failed to write acquisition data block");
+}
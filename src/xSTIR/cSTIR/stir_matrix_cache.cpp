@@ -0,0 +1,288 @@
+/*
+CCP PETMR Synergistic Image Reconstruction Framework (SIRF)
+Copyright 2019 Rutherford Appleton Laboratory STFC
+
+This is software developed for the Collaborative Computational
+Project in Positron Emission Tomography and Magnetic Resonance imaging
+(http://www.ccppetmr.ac.uk/).
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+http://www.apache.org/licenses/LICENSE-2.0
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+*/
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <sstream>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+
+#include "stir/stream.h"
+#include "stir/recon_buildblock/DataSymmetriesForBins.h"
+
+#include "sirf/iUtilities/DataHandle.h"
+#include "sirf/STIR/stir_data_containers.h"
+#include "sirf/STIR/stir_matrix_cache.h"
+
+using namespace stir;
+using namespace sirf;
+
+namespace bip = boost::interprocess;
+
+static const char MATRIX_CACHE_MAGIC[8] = { 'S', 'I', 'R', 'F', 'P', 'M', 'C', '1' };
+
+const char* const
+ProjMatrixByBinFromCache::registered_name = "SIRF Cache";
+
+// FNV-1a: unlike std::hash, gives the same value in every process and build
+static uint64_t
+fnv1a_hash(const std::string& s)
+{
+	uint64_t h = 14695981039346656037ULL;
+	for (size_t i = 0; i < s.size(); i++) {
+		h ^= (unsigned char)s[i];
+		h *= 1099511628211ULL;
+	}
+	return h;
+}
+
+static bool
+bin_record_less(const ProjMatrixByBinFromCache::BinRecord& r, const Bin& b)
+{
+	if (r.segment != b.segment_num())
+		return r.segment < b.segment_num();
+	if (r.view != b.view_num())
+		return r.view < b.view_num();
+	if (r.axial_pos != b.axial_pos_num())
+		return r.axial_pos < b.axial_pos_num();
+	return r.tangential_pos < b.tangential_pos_num();
+}
+
+ProjMatrixByBinFromCache::ProjMatrixByBinFromCache() : _verbose(false),
+	_ptr_header(0), _ptr_index(0), _ptr_elems(0)
+{
+	// the elements are already in (shared) memory, no point in copying them
+	enable_cache(false);
+}
+
+ProjMatrixByBinFromCache::ProjMatrixByBinFromCache
+(shared_ptr<ProjMatrixByBin> sptr_source, const std::string& cache_path) :
+	_sptr_source(sptr_source), _cache_path(cache_path), _verbose(false),
+	_ptr_header(0), _ptr_index(0), _ptr_elems(0)
+{
+	enable_cache(false);
+}
+
+std::string
+ProjMatrixByBinFromCache::key
+(ProjMatrixByBin& matrix, ProjDataInfo& pdi, const Image3DF& image)
+{
+	const Voxels3DF* ptr_voxels = dynamic_cast<const Voxels3DF*>(&image);
+	if (!ptr_voxels)
+		THROW("projection matrix cache requires voxels on cartesian grid");
+	const Voxels3DF& voxels = *ptr_voxels;
+	std::ostringstream key;
+	key << pdi.parameter_info();
+	key << "image min indices: " << voxels.get_min_indices() << '\n';
+	key << "image max indices: " << voxels.get_max_indices() << '\n';
+	key << "voxel size: " << voxels.get_voxel_size() << '\n';
+	key << "origin: " << voxels.get_origin() << '\n';
+	key << matrix.parameter_info();
+	return key.str();
+}
+
+void
+ProjMatrixByBinFromCache::write(const std::string& filename,
+	const std::string& key, ProjMatrixByBin& matrix, const ProjDataInfo& pdi)
+{
+	const DataSymmetriesForBins& symmetries = *matrix.get_symmetries_ptr();
+
+	// write to a scratch file first and rename it when complete, so that
+	// other processes never map a partially written cache
+	std::string tmp = filename + "." + SIRFUtilities::scratch_file_name();
+	std::ofstream out(tmp.c_str(),
+		std::ios::out | std::ios::binary | std::ios::trunc);
+	if (!out) {
+		std::string msg = "cannot create projection matrix cache file " + tmp;
+		THROW(msg.c_str());
+	}
+
+	Header header;
+	memcpy(header.magic, MATRIX_CACHE_MAGIC, sizeof(header.magic));
+	header.key_length = key.size();
+	header.num_bins = 0;
+	header.num_elems = 0;
+	header.elems_offset = sizeof(Header) + key.size();
+	header.elems_offset += (8 - header.elems_offset % 8) % 8;
+	header.index_offset = 0;
+	out.write((const char*)&header, sizeof(Header));
+	out.write(key.c_str(), key.size());
+	out.seekp(header.elems_offset);
+
+	std::vector<BinRecord> index;
+	std::vector<Element> elems;
+	ProjMatrixElemsForOneBin lor;
+	Bin bin;
+	for (bin.segment_num() = pdi.get_min_segment_num();
+		bin.segment_num() <= pdi.get_max_segment_num();
+		++bin.segment_num())
+		for (bin.view_num() = pdi.get_min_view_num();
+			bin.view_num() <= pdi.get_max_view_num();
+			++bin.view_num())
+			for (bin.axial_pos_num() = pdi.get_min_axial_pos_num(bin.segment_num());
+				bin.axial_pos_num() <= pdi.get_max_axial_pos_num(bin.segment_num());
+				++bin.axial_pos_num())
+				for (bin.tangential_pos_num() = pdi.get_min_tangential_pos_num();
+					bin.tangential_pos_num() <= pdi.get_max_tangential_pos_num();
+					++bin.tangential_pos_num()) {
+					if (!symmetries.is_basic(bin))
+						continue;
+					matrix.get_proj_matrix_elems_for_one_bin(lor, bin);
+					BinRecord r;
+					r.segment = bin.segment_num();
+					r.view = bin.view_num();
+					r.axial_pos = bin.axial_pos_num();
+					r.tangential_pos = bin.tangential_pos_num();
+					r.first = header.num_elems;
+					r.count = lor.size();
+					index.push_back(r);
+					elems.resize(lor.size());
+					size_t i = 0;
+					for (ProjMatrixElemsForOneBin::const_iterator
+						iter = lor.begin(); iter != lor.end(); ++iter, ++i) {
+						Element& e = elems[i];
+						e.z = (int16_t)iter->coord1();
+						e.y = (int16_t)iter->coord2();
+						e.x = (int16_t)iter->coord3();
+						e.unused = 0;
+						e.value = iter->get_value();
+					}
+					if (elems.size() > 0)
+						out.write((const char*)&elems[0],
+							elems.size()*sizeof(Element));
+					header.num_elems += lor.size();
+				}
+	// loops above visit bins in the order of BinRecord comparison,
+	// so the index is already sorted
+	header.num_bins = index.size();
+	header.index_offset = header.elems_offset + header.num_elems*sizeof(Element);
+	if (index.size() > 0)
+		out.write((const char*)&index[0], index.size()*sizeof(BinRecord));
+	out.seekp(0);
+	out.write((const char*)&header, sizeof(Header));
+	out.close();
+	if (!out) {
+		std::remove(tmp.c_str());
+		std::string msg = "failed to write projection matrix cache file " + tmp;
+		THROW(msg.c_str());
+	}
+	boost::filesystem::rename(tmp, filename);
+}
+
+void
+ProjMatrixByBinFromCache::set_up(
+	const shared_ptr<ProjDataInfo>& sptr_pdi,
+	const shared_ptr<Image3DF>& sptr_image)
+{
+	if (!_sptr_source.get())
+		THROW("projection matrix cache: source matrix not set");
+
+	// elements store voxel indices as int16
+	const Voxels3DF* ptr_voxels = dynamic_cast<const Voxels3DF*>(sptr_image.get());
+	if (!ptr_voxels)
+		THROW("projection matrix cache requires voxels on cartesian grid");
+	const BasicCoordinate<3, int> min_indices = ptr_voxels->get_min_indices();
+	const BasicCoordinate<3, int> max_indices = ptr_voxels->get_max_indices();
+	for (int i = 1; i <= 3; i++)
+		if (min_indices[i] < std::numeric_limits<int16_t>::min() ||
+			max_indices[i] > std::numeric_limits<int16_t>::max())
+			THROW("projection matrix cache: image indices out of int16 range");
+
+	ProjMatrixByBin::set_up(sptr_pdi, sptr_image);
+	// this only computes symmetries and geometry, elements are computed lazily
+	_sptr_source->set_up(sptr_pdi, sptr_image);
+	symmetries_sptr.reset(_sptr_source->get_symmetries_ptr()->clone());
+
+	std::string k = key(*_sptr_source, *sptr_pdi, *sptr_image);
+	char buff[32];
+	sprintf(buff, "sirf_pm_%016llx.bin", (unsigned long long)fnv1a_hash(k));
+	boost::filesystem::path path(_cache_path);
+	boost::filesystem::create_directories(path);
+	_filename = (path / buff).string();
+
+	if (!boost::filesystem::exists(_filename)) {
+		if (_verbose)
+			std::cout << "computing projection matrix cache " << _filename << "...";
+		write(_filename, k, *_sptr_source, *sptr_pdi);
+		// the source matrix now holds all elements in memory, release them
+		_sptr_source->clear_cache();
+		if (_verbose)
+			std::cout << "ok\n";
+	}
+	map_(k);
+}
+
+void
+ProjMatrixByBinFromCache::map_(const std::string& key)
+{
+	bip::file_mapping file(_filename.c_str(), bip::read_only);
+	_sptr_region.reset(new bip::mapped_region(file, bip::read_only));
+	const char* base = (const char*)_sptr_region->get_address();
+	size_t size = _sptr_region->get_size();
+	_ptr_header = (const Header*)base;
+	if (size < sizeof(Header) ||
+		memcmp(_ptr_header->magic, MATRIX_CACHE_MAGIC, sizeof(_ptr_header->magic))
+		|| _ptr_header->key_length != key.size()
+		|| size < sizeof(Header) + key.size()
+		|| key.compare(0, key.size(), base + sizeof(Header), key.size())
+		|| size < _ptr_header->index_offset +
+		_ptr_header->num_bins*sizeof(BinRecord)) {
+		_ptr_header = 0;
+		_sptr_region.reset();
+		std::string msg = "projection matrix cache file " + _filename +
+			" is corrupt or was created for a different matrix";
+		THROW(msg.c_str());
+	}
+	_ptr_elems = (const Element*)(base + _ptr_header->elems_offset);
+	_ptr_index = (const BinRecord*)(base + _ptr_header->index_offset);
+}
+
+const ProjMatrixByBinFromCache::BinRecord*
+ProjMatrixByBinFromCache::find(const Bin& bin) const
+{
+	const BinRecord* end = _ptr_index + _ptr_header->num_bins;
+	const BinRecord* r = std::lower_bound(_ptr_index, end, bin, bin_record_less);
+	if (r == end || r->segment != bin.segment_num() || r->view != bin.view_num()
+		|| r->axial_pos != bin.axial_pos_num()
+		|| r->tangential_pos != bin.tangential_pos_num())
+		return 0;
+	return r;
+}
+
+void
+ProjMatrixByBinFromCache::calculate_proj_matrix_elems_for_one_bin
+(ProjMatrixElemsForOneBin& lor) const
+{
+	if (!_ptr_header)
+		THROW("projection matrix cache not set up");
+	const Bin bin = lor.get_bin();
+	const BinRecord* r = find(bin);
+	if (!r)
+		return;
+	lor.reserve(r->count);
+	const Element* e = _ptr_elems + r->first;
+	for (uint64_t i = 0; i < r->count; i++, e++)
+		lor.push_back(ProjMatrixElemsForOneBinValue
+			(Coordinate3D<int>(e->z, e->y, e->x), e->value));
+}
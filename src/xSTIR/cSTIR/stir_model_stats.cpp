@@ -0,0 +1,108 @@
+/*
+CCP PETMR Synergistic Image Reconstruction Framework (SIRF)
+Copyright 2019 Rutherford Appleton Laboratory STFC
+
+This is software developed for the Collaborative Computational
+Project in Positron Emission Tomography and Magnetic Resonance imaging
+(http://www.ccppetmr.ac.uk/).
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+http://www.apache.org/licenses/LICENSE-2.0
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+*/
+
+#include <fstream>
+#include <sstream>
+
+#include <boost/algorithm/string.hpp>
+
+#include "sirf/iUtilities/DataHandle.h"
+#include "sirf/STIR/stir_model_stats.h"
+
+using namespace sirf;
+
+static const char* const STAGE_NAMES[AcquisitionModelStatistics::NUM_STAGES] = {
+	"projection", "additive", "normalisation", "background", "allocation"
+};
+
+void
+AcquisitionModelStatistics::reset()
+{
+	boost::mutex::scoped_lock lock(_mutex);
+	for (int s = 0; s < NUM_STAGES; s++) {
+		_stages[s].wall_time = 0;
+		_stages[s].cpu_time = 0;
+		_stages[s].calls = 0;
+		_stages[s].bytes = 0;
+	}
+	_forward_calls = 0;
+	_backward_calls = 0;
+}
+
+void
+AcquisitionModelStatistics::add
+(Stage stage, double wall_time, double cpu_time, double bytes)
+{
+	boost::mutex::scoped_lock lock(_mutex);
+	StageStatistics& s = _stages[stage];
+	s.wall_time += wall_time;
+	s.cpu_time += cpu_time;
+	s.calls++;
+	s.bytes += bytes;
+}
+
+const char*
+AcquisitionModelStatistics::stage_name(Stage s)
+{
+	if (s < 0 || s >= NUM_STAGES)
+		THROW("unknown acquisition model stage");
+	return STAGE_NAMES[s];
+}
+
+AcquisitionModelStatistics::Stage
+AcquisitionModelStatistics::stage(const std::string& name)
+{
+	for (int s = 0; s < NUM_STAGES; s++)
+		if (boost::iequals(name, STAGE_NAMES[s]))
+			return (Stage)s;
+	return NUM_STAGES;
+}
+
+std::string
+AcquisitionModelStatistics::json() const
+{
+	boost::mutex::scoped_lock lock(_mutex);
+	std::ostringstream out;
+	out.precision(9);
+	out << "{\n  \"forward_calls\": " << _forward_calls
+		<< ",\n  \"backward_calls\": " << _backward_calls
+		<< ",\n  \"stages\": {";
+	for (int s = 0; s < NUM_STAGES; s++) {
+		const StageStatistics& st = _stages[s];
+		out << (s ? ",\n" : "\n") << "    \"" << STAGE_NAMES[s] << "\": {"
+			<< "\"wall_time\": " << st.wall_time
+			<< ", \"cpu_time\": " << st.cpu_time
+			<< ", \"calls\": " << st.calls
+			<< ", \"bytes\": " << st.bytes << "}";
+	}
+	out << "\n  }\n}\n";
+	return out.str();
+}
+
+void
+AcquisitionModelStatistics::write_json(const std::string& filename) const
+{
+	std::ofstream out(filename.c_str());
+	if (!out) {
+		std::string msg = "cannot create file " + filename;
+		THROW(msg.c_str());
+	}
+	out << json();
+}
@@ -0,0 +1,296 @@
+/*
+CCP PETMR Synergistic Image Reconstruction Framework (SIRF)
+Copyright 2019 Rutherford Appleton Laboratory STFC
+
+This is software developed for the Collaborative Computational
+Project in Positron Emission Tomography and Magnetic Resonance imaging
+(http://www.ccppetmr.ac.uk/).
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+http://www.apache.org/licenses/LICENSE-2.0
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+*/
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <sstream>
+
+#include "stir/IndexRange3D.h"
+
+#include "sirf/iUtilities/DataHandle.h"
+#include "sirf/STIR/stir_multiresolution.h"
+
+using namespace stir;
+using namespace sirf;
+
+static double
+total_sensitivity(const PoissonLogLhLinModMean3DF& obj_fun, int num_subsets)
+{
+	const int n = obj_fun.get_use_subset_sensitivities() ? num_subsets : 1;
+	double s = 0;
+	for (int i = 0; i < n; i++) {
+		const Image3DF& sens = obj_fun.get_subset_sensitivity(i);
+		s = std::accumulate(sens.begin_all(), sens.end_all(), s);
+	}
+	return s;
+}
+
+// index range of a grid with f times larger voxels covering the indices
+// min_i to max_i, and the origin shift centring it on the same points
+static void
+coarse_range(int min_i, int max_i, int f, float voxel_size,
+	int& min_c, int& max_c, float& shift)
+{
+	const int n = (max_i - min_i + f) / f;
+	const double centre = 0.5*(min_i + max_i);
+	min_c = (int)std::floor(centre / f - 0.5*(n - 1) + 0.5);
+	max_c = min_c + n - 1;
+	shift = (float)(voxel_size*(centre - 0.5*f*(min_c + max_c)));
+}
+
+// a new matrix configured as the given one
+static shared_ptr<ProjMatrixByBin>
+matrix_like(const shared_ptr<ProjMatrixByBin>& sptr_matrix)
+{
+	if (!sptr_matrix.get())
+		THROW("multiresolution reconstruction: acquisition model has no matrix");
+	RayTracingMatrix* ptr_rt = dynamic_cast<RayTracingMatrix*>(sptr_matrix.get());
+	if (!ptr_rt)
+		THROW("multiresolution reconstruction supports ray tracing matrices only");
+	// all parameters are copied via their text form
+	shared_ptr<RayTracingMatrix> sptr_rt(new RayTracingMatrix);
+	std::istringstream parameters(ptr_rt->parameter_info());
+	if (!sptr_rt->parse(parameters))
+		THROW("failed to copy the ray tracing matrix parameters");
+	return sptr_rt;
+}
+
+void
+PETMultiresolutionReconstruction::add_level(int factor, int num_subiterations)
+{
+	if (factor < 1)
+		THROW("multiresolution level factor must be positive");
+	if (num_subiterations < 0)
+		THROW("number of subiterations must be non-negative");
+	Level level;
+	level.factor = factor;
+	level.num_subiterations = num_subiterations;
+	level.sensitivity = 0;
+	_levels.push_back(level);
+	_is_set_up = false;
+}
+
+void
+PETMultiresolutionReconstruction::reset_()
+{
+	for (size_t i = 0; i < _levels.size(); i++)
+		_levels[i].sptr_recon.reset();
+	_is_set_up = false;
+}
+
+Succeeded
+PETMultiresolutionReconstruction::set_up(shared_ptr<STIRImageData> sptr_image)
+{
+	if (!_sptr_ad.get())
+		THROW("multiresolution reconstruction: acquisition data not set");
+	if (!_sptr_am.get())
+		THROW("multiresolution reconstruction: acquisition model not set");
+	if (_levels.size() < 1)
+		THROW("multiresolution reconstruction: no levels");
+	if (_levels.back().factor != 1)
+		THROW("the last multiresolution level must have factor 1");
+	if (!dynamic_cast<const Voxels3DF*>(&sptr_image->data()))
+		THROW("multiresolution reconstruction needs a voxelised image");
+
+	// levels set up for another image geometry cannot be reused
+	if (!_sptr_image.get() ||
+		!sptr_image->data().has_same_characteristics(_sptr_image->data()))
+		reset_();
+	_sptr_image = sptr_image;
+	for (size_t i = 0; i < _levels.size(); i++) {
+		Level& level = _levels[i];
+		if (level.sptr_recon.get())
+			continue;
+		if (set_up_level_(level, (int)i) != Succeeded::yes) {
+			level.sptr_recon.reset();
+			return Succeeded::no;
+		}
+	}
+	_is_set_up = true;
+	return Succeeded::yes;
+}
+
+Succeeded
+PETMultiresolutionReconstruction::set_up_level_(Level& level, int level_num)
+{
+	const Voxels3DF& v = dynamic_cast<const Voxels3DF&>(_sptr_image->data());
+	const int f = level.factor;
+	if (f == 1) {
+		// the full resolution level uses the grid of the image itself,
+		// so that process() copies its result back unchanged
+		shared_ptr<Image3DF> sptr_v(v.get_empty_copy());
+		level.sptr_image.reset(new STIRImageData(sptr_v));
+	}
+	else {
+		int min_y, max_y, min_x, max_x;
+		Coord3DF vs = v.get_voxel_size();
+		Coord3DF origin = v.get_origin();
+		float shift;
+		coarse_range(v.get_min_y(), v.get_max_y(), f, vs.y(), min_y, max_y, shift);
+		origin.y() += shift;
+		coarse_range(v.get_min_x(), v.get_max_x(), f, vs.x(), min_x, max_x, shift);
+		origin.x() += shift;
+		vs.x() *= f;
+		vs.y() *= f;
+		Voxels3DF voxels(IndexRange3D(v.get_min_z(), v.get_max_z(),
+			min_y, max_y, min_x, max_x), origin, vs);
+		voxels.fill(0.0);
+		level.sptr_image.reset(new STIRImageData(voxels));
+	}
+
+	level.sptr_am.reset(new AcqModUsingMatrix3DF);
+	AcqModUsingMatrix3DF& am = *level.sptr_am;
+	am.set_matrix(matrix_like(_sptr_am->matrix_sptr()));
+	am.set_matrix_cache_path(_sptr_am->matrix_cache_path());
+	am.set_use_sparse_matrix(_sptr_am->use_sparse_matrix());
+	if (_sptr_am->additive_term_sptr().get())
+		am.set_additive_term(_sptr_am->additive_term_sptr());
+	if (_sptr_am->asm_sptr().get())
+		am.set_asm(_sptr_am->asm_sptr());
+	if (am.set_up(_sptr_ad, level.sptr_image) != Succeeded::yes)
+		return Succeeded::no;
+
+	level.sptr_obj.reset(new PoissonLogLhLinModMeanProjData3DF);
+	level.sptr_obj->set_acquisition_data(_sptr_ad);
+	level.sptr_obj->set_acquisition_model(level.sptr_am);
+
+	level.sptr_recon.reset(new OSMAPOSLReconstruction3DF);
+	OSMAPOSLReconstruction3DF& recon = *level.sptr_recon;
+	recon.set_objective_function_sptr(level.sptr_obj);
+	recon.set_num_subsets(_num_subsets);
+	const int n = std::max(level.num_subiterations, 1);
+	if (_output_filename_prefix.size() > 0) {
+		std::stringstream prefix;
+		prefix << _output_filename_prefix << "_level" << level_num;
+		recon.set_num_subiterations(n);
+		recon.set_save_interval(n);
+		recon.set_output_filename_prefix(prefix.str());
+	}
+	else {
+		// STIR writes the estimate at the last subiteration and at multiples
+		// of the save interval, neither of which process() reaches then
+		recon.set_num_subiterations(n + 1);
+		recon.set_save_interval(n + 1);
+	}
+	if (recon.set_up(level.sptr_image) != Succeeded::yes)
+		return Succeeded::no;
+	level.sensitivity = total_sensitivity(*level.sptr_obj, _num_subsets);
+	if (level.sensitivity <= 0)
+		THROW("multiresolution level has zero sensitivity");
+	return Succeeded::yes;
+}
+
+void
+PETMultiresolutionReconstruction::resample(const Voxels3DF& in, Voxels3DF& out)
+{
+	if (in.get_min_z() != out.get_min_z() || in.get_max_z() != out.get_max_z())
+		THROW("resampled images must have the same planes");
+	const Coord3DF& vs_in = in.get_voxel_size();
+	const Coord3DF& vs_out = out.get_voxel_size();
+	const Coord3DF& org_in = in.get_origin();
+	const Coord3DF& org_out = out.get_origin();
+	const int min_y = in.get_min_y();
+	const int max_y = in.get_max_y();
+	const int min_x = in.get_min_x();
+	const int max_x = in.get_max_x();
+
+	// interpolation indices and weights are the same for all planes
+	const int ny = out.get_y_size();
+	const int nx = out.get_x_size();
+	std::vector<int> y0(ny), y1(ny), x0(nx), x1(nx);
+	std::vector<float> wy(ny), wx(nx);
+	for (int j = 0; j < ny; j++) {
+		const int y = out.get_min_y() + j;
+		float t = (org_out.y() + y*vs_out.y() - org_in.y()) / vs_in.y();
+		t = std::min(std::max(t, (float)min_y), (float)max_y);
+		y0[j] = std::min((int)std::floor(t), max_y);
+		y1[j] = std::min(y0[j] + 1, max_y);
+		wy[j] = t - y0[j];
+	}
+	for (int i = 0; i < nx; i++) {
+		const int x = out.get_min_x() + i;
+		float t = (org_out.x() + x*vs_out.x() - org_in.x()) / vs_in.x();
+		t = std::min(std::max(t, (float)min_x), (float)max_x);
+		x0[i] = std::min((int)std::floor(t), max_x);
+		x1[i] = std::min(x0[i] + 1, max_x);
+		wx[i] = t - x0[i];
+	}
+
+	const int min_z = out.get_min_z();
+	const long long nz = out.get_z_size();
+#pragma omp parallel for
+	for (long long k = 0; k < nz; k++) {
+		const int z = min_z + (int)k;
+		for (int j = 0; j < ny; j++) {
+			const Array<1, float>& r0 = in[z][y0[j]];
+			const Array<1, float>& r1 = in[z][y1[j]];
+			Array<1, float>& row = out[z][out.get_min_y() + j];
+			for (int i = 0; i < nx; i++) {
+				const float a = r0[x0[i]] + wx[i] * (r0[x1[i]] - r0[x0[i]]);
+				const float b = r1[x0[i]] + wx[i] * (r1[x1[i]] - r1[x0[i]]);
+				row[out.get_min_x() + i] = a + wy[j] * (b - a);
+			}
+		}
+	}
+}
+
+void
+PETMultiresolutionReconstruction::transfer_(const Image3DF& image,
+	double sensitivity, const Level& level, Image3DF& out) const
+{
+	resample(dynamic_cast<const Voxels3DF&>(image),
+		dynamic_cast<Voxels3DF&>(out));
+	const float scale = (float)(sensitivity / level.sensitivity);
+	for (Image3DF::full_iterator iter = out.begin_all();
+		iter != out.end_all(); ++iter)
+		*iter *= scale;
+}
+
+void
+PETMultiresolutionReconstruction::process(STIRImageData& image)
+{
+	if (!_is_set_up)
+		THROW("multiresolution reconstruction not set up");
+	Image3DF& x = image.data();
+	if (!x.has_same_characteristics(_sptr_image->data()))
+		THROW("image differs in geometry from multiresolution set-up image");
+
+	// the initial estimate is at full resolution, i.e. that of the last level
+	shared_ptr<Image3DF> sptr_x(_levels[0].sptr_image->data().clone());
+	transfer_(x, _levels.back().sensitivity, _levels[0], *sptr_x);
+	for (size_t l = 0; l < _levels.size(); l++) {
+		Level& level = _levels[l];
+		OSMAPOSLReconstruction3DF& recon = *level.sptr_recon;
+		xSTIR_IterativeReconstruction3DF& ir =
+			(xSTIR_IterativeReconstruction3DF&)recon;
+		ir.subiteration() = ir.get_start_subiteration_num();
+		for (int i = 0; i < level.num_subiterations; i++)
+			recon.update(*sptr_x);
+		if (l + 1 < _levels.size()) {
+			const Level& next = _levels[l + 1];
+			shared_ptr<Image3DF> sptr_next(next.sptr_image->data().clone());
+			transfer_(*sptr_x, level.sensitivity, next, *sptr_next);
+			sptr_x = sptr_next;
+		}
+	}
+	// the last level has the grid of x
+	std::copy(sptr_x->begin_all(), sptr_x->end_all(), x.begin_all());
+}
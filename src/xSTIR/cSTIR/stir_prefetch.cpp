@@ -0,0 +1,195 @@
+/*
+CCP PETMR Synergistic Image Reconstruction Framework (SIRF)
+Copyright 2019 Rutherford Appleton Laboratory STFC
+
+This is software developed for the Collaborative Computational
+Project in Positron Emission Tomography and Magnetic Resonance imaging
+(http://www.ccppetmr.ac.uk/).
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+http://www.apache.org/licenses/LICENSE-2.0
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+*/
+
+#include <boost/bind.hpp>
+
+#include "stir/recon_buildblock/find_basic_vs_nums_in_subsets.h"
+
+#include "sirf/STIR/stir_prefetch.h"
+
+using namespace stir;
+using namespace sirf;
+
+ProjDataWithPrefetch::ProjDataWithPrefetch
+(shared_ptr<ProjData> sptr_source, size_t memory_budget) :
+	ProjData(sptr_source->get_exam_info_sptr(),
+	shared_ptr<ProjDataInfo>(sptr_source->get_proj_data_info_ptr()->clone())),
+	_sptr_source(sptr_source), _budget(memory_budget),
+	_cached_bytes(0), _hits(0), _misses(0), _generation(0), _stop(false)
+{}
+
+ProjDataWithPrefetch::~ProjDataWithPrefetch()
+{
+	stop_();
+}
+
+size_t
+ProjDataWithPrefetch::viewgram_bytes_(int segment_num) const
+{
+	return sizeof(float)*get_num_tangential_poss()*get_num_axial_poss(segment_num);
+}
+
+void
+ProjDataWithPrefetch::stop_()
+{
+	_stop = true;
+	if (_thread.joinable())
+		_thread.join();
+	_stop = false;
+}
+
+void
+ProjDataWithPrefetch::clear()
+{
+	stop_();
+	boost::mutex::scoped_lock lock(_cache_mutex);
+	_cache.clear();
+	_cached_bytes = 0;
+}
+
+void
+ProjDataWithPrefetch::prefetch(const std::vector<ViewSegmentNumbers>& vs_nums)
+{
+	stop_();
+	_generation++;
+	{
+		// keep what the previous call prefetched for the current subset
+		boost::mutex::scoped_lock lock(_cache_mutex);
+		std::map<Key, Entry>::iterator iter = _cache.begin();
+		while (iter != _cache.end()) {
+			if (iter->second.generation + 1 < _generation) {
+				_cached_bytes -= viewgram_bytes_(iter->first.first);
+				_cache.erase(iter++);
+			}
+			else
+				++iter;
+		}
+	}
+	if (_budget > 0)
+		_thread = boost::thread
+		(boost::bind(&ProjDataWithPrefetch::run_, this, vs_nums, _generation));
+}
+
+void
+ProjDataWithPrefetch::prefetch_subset(
+	const DataSymmetriesForViewSegmentNumbers& symmetries,
+	int min_segment_num, int max_segment_num,
+	int subset_num, int num_subsets)
+{
+	std::vector<ViewSegmentNumbers> basic_vs =
+		detail::find_basic_vs_nums_in_subset(*get_proj_data_info_ptr(),
+		symmetries, min_segment_num, max_segment_num, subset_num, num_subsets);
+	std::vector<ViewSegmentNumbers> vs_nums;
+	for (size_t i = 0; i < basic_vs.size(); i++) {
+		std::vector<ViewSegmentNumbers> related;
+		symmetries.get_related_view_segment_numbers(related, basic_vs[i]);
+		vs_nums.insert(vs_nums.end(), related.begin(), related.end());
+	}
+	prefetch(vs_nums);
+}
+
+void
+ProjDataWithPrefetch::run_(std::vector<ViewSegmentNumbers> vs_nums, unsigned gen)
+{
+	for (size_t i = 0; i < vs_nums.size() && !_stop; i++) {
+		const Key key(vs_nums[i].segment_num(), vs_nums[i].view_num());
+		const size_t bytes = viewgram_bytes_(key.first);
+		{
+			boost::mutex::scoped_lock lock(_cache_mutex);
+			if (_cache.find(key) != _cache.end())
+				continue;
+			if (_cached_bytes + bytes > _budget)
+				return;
+			// reserve the memory now, so that get_viewgram need not wait
+			_cached_bytes += bytes;
+		}
+		shared_ptr<Viewgram<float> > sptr_v;
+		{
+			boost::mutex::scoped_lock lock(_source_mutex);
+			sptr_v.reset(new Viewgram<float>
+				(_sptr_source->get_viewgram(key.second, key.first)));
+		}
+		boost::mutex::scoped_lock lock(_cache_mutex);
+		Entry& e = _cache[key];
+		e.sptr_viewgram = sptr_v;
+		e.generation = gen;
+	}
+}
+
+Viewgram<float>
+ProjDataWithPrefetch::get_viewgram(const int view_num, const int segment_num,
+	const bool make_num_tangential_poss_odd) const
+{
+	if (!make_num_tangential_poss_odd) {
+		shared_ptr<Viewgram<float> > sptr_v;
+		{
+			boost::mutex::scoped_lock lock(_cache_mutex);
+			std::map<Key, Entry>::iterator iter =
+				_cache.find(Key(segment_num, view_num));
+			if (iter != _cache.end()) {
+				sptr_v = iter->second.sptr_viewgram;
+				_cache.erase(iter);
+				_cached_bytes -= viewgram_bytes_(segment_num);
+				_hits++;
+			}
+			else
+				_misses++;
+		}
+		if (sptr_v.get())
+			return *sptr_v;
+	}
+	boost::mutex::scoped_lock lock(_source_mutex);
+	return _sptr_source->get_viewgram
+		(view_num, segment_num, make_num_tangential_poss_odd);
+}
+
+Succeeded
+ProjDataWithPrefetch::set_viewgram(const Viewgram<float>& v)
+{
+	{
+		boost::mutex::scoped_lock lock(_cache_mutex);
+		std::map<Key, Entry>::iterator iter =
+			_cache.find(Key(v.get_segment_num(), v.get_view_num()));
+		if (iter != _cache.end()) {
+			_cache.erase(iter);
+			_cached_bytes -= viewgram_bytes_(v.get_segment_num());
+		}
+	}
+	boost::mutex::scoped_lock lock(_source_mutex);
+	return _sptr_source->set_viewgram(v);
+}
+
+Sinogram<float>
+ProjDataWithPrefetch::get_sinogram(const int ax_pos_num, const int segment_num,
+	const bool make_num_tangential_poss_odd) const
+{
+	boost::mutex::scoped_lock lock(_source_mutex);
+	return _sptr_source->get_sinogram
+		(ax_pos_num, segment_num, make_num_tangential_poss_odd);
+}
+
+Succeeded
+ProjDataWithPrefetch::set_sinogram(const Sinogram<float>& s)
+{
+	// a sinogram crosses all views, so prefetched viewgrams become stale
+	clear();
+	boost::mutex::scoped_lock lock(_source_mutex);
+	return _sptr_source->set_sinogram(s);
+}
@@ -0,0 +1,395 @@
+/*
+CCP PETMR Synergistic Image Reconstruction Framework (SIRF)
+Copyright 2019 Rutherford Appleton Laboratory STFC
+
+This is software developed for the Collaborative Computational
+Project in Positron Emission Tomography and Magnetic Resonance imaging
+(http://www.ccppetmr.ac.uk/).
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+http://www.apache.org/licenses/LICENSE-2.0
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+*/
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "stir/ArrayFilterUsingRealDFTWithPadding.h"
+#include "stir/IndexRange.h"
+#include "stir/common.h"
+
+#include "sirf/iUtilities/DataHandle.h"
+#include "sirf/STIR/stir_data_containers.h"
+#include "sirf/STIR/stir_separable_filter.h"
+
+using namespace stir;
+using namespace sirf;
+
+const char* const
+SeparableImageFilter::registered_name = "SIRF Separable";
+
+static const char* const AXIS_NAMES[3] = { "z", "y", "x" };
+
+SeparableImageFilter::SeparableImageFilter()
+{
+	set_defaults();
+}
+
+void
+SeparableImageFilter::set_defaults()
+{
+	base_type::set_defaults();
+	_fwhms.assign(3, 0.0f);
+	_metz_powers.assign(3, 0.0f);
+	_max_kernel_sizes.assign(3, -1);
+	_user_kernels.assign(3, std::vector<float>());
+	_kernels.assign(3, std::vector<float>(1, 1.0f));
+	_fft_threshold = 63;
+}
+
+void
+SeparableImageFilter::initialise_keymap()
+{
+	base_type::initialise_keymap();
+	parser.add_start_key("SIRF Separable Filter Parameters");
+	for (int a = 0; a < 3; a++) {
+		std::string dir = std::string(AXIS_NAMES[a]) + "-dir ";
+		parser.add_key(dir + "filter FWHM (in mm)", &_fwhms[a]);
+		parser.add_key(dir + "filter Metz power", &_metz_powers[a]);
+		parser.add_key(dir + "maximum kernel size", &_max_kernel_sizes[a]);
+	}
+	parser.add_key("FFT threshold", &_fft_threshold);
+	parser.add_stop_key("END SIRF Separable Filter Parameters");
+}
+
+bool
+SeparableImageFilter::post_processing()
+{
+	for (int a = 0; a < 3; a++)
+		if (_fwhms[a] < 0 || _metz_powers[a] < 0) {
+			warning("SeparableImageFilter: FWHMs and Metz powers must be non-negative");
+			return true;
+		}
+	return false;
+}
+
+int
+SeparableImageFilter::check_axis_(int axis)
+{
+	if (axis < 0 || axis > 2)
+		THROW("filter axis must be 0 (z), 1 (y) or 2 (x)");
+	return axis;
+}
+
+void
+SeparableImageFilter::set_fwhm(int axis, float fwhm)
+{
+	if (fwhm < 0)
+		THROW("filter FWHM must be non-negative");
+	_fwhms[check_axis_(axis)] = fwhm;
+	reset();
+}
+
+void
+SeparableImageFilter::set_metz_power(int axis, float power)
+{
+	if (power < 0)
+		THROW("Metz power must be non-negative");
+	_metz_powers[check_axis_(axis)] = power;
+	reset();
+}
+
+void
+SeparableImageFilter::set_max_kernel_size(int axis, int size)
+{
+	_max_kernel_sizes[check_axis_(axis)] = size;
+	reset();
+}
+
+void
+SeparableImageFilter::set_kernel(int axis, const std::vector<float>& kernel)
+{
+	if (kernel.size() % 2 == 0 && kernel.size() > 0)
+		THROW("filter kernel length must be odd");
+	_user_kernels[check_axis_(axis)] = kernel;
+	reset();
+}
+
+void
+SeparableImageFilter::metz_kernel(float fwhm, float power, int max_half_length,
+	std::vector<float>& kernel)
+{
+	kernel.assign(1, 1.0f);
+	if (fwhm <= 0 || max_half_length < 1)
+		return;
+	// Gaussian of standard deviation s (in voxels) has the frequency
+	// response G(w) = exp(-s^2 w^2/2), and the Metz filter of power N
+	// (1 - (1 - G^2)^(N + 1))/G; the kernel is its inverse DTFT
+	const double s = fwhm / (2 * std::sqrt(2 * std::log(2.0)));
+	const int h = std::min(max_half_length,
+		(int)std::ceil(5 * s*std::sqrt(power + 1.0)) + 1);
+	const int ns = std::max(2048, 16 * h);
+	const double dw = _PI / ns;
+	std::vector<double> response(ns);
+	for (int i = 0; i < ns; i++) {
+		const double w = (i + 0.5)*dw;
+		const double g = std::exp(-0.5*s*s*w*w);
+		const double g2 = g*g;
+		// avoid cancellation where 1 - (1 - g^2)^(N + 1) ~ (N + 1) g^2
+		if (g2 < 1e-8)
+			response[i] = (power + 1)*g;
+		else
+			response[i] = (1 - std::pow(1 - g2, power + 1.0)) / g;
+	}
+	std::vector<double> k(h + 1);
+	for (int j = 0; j <= h; j++) {
+		double v = 0;
+		for (int i = 0; i < ns; i++)
+			v += response[i] * std::cos(j*(i + 0.5)*dw);
+		k[j] = v*dw / _PI;
+	}
+	// drop the negligible tail
+	int n = h;
+	while (n > 0 && std::fabs(k[n]) < 1e-6*std::fabs(k[0]))
+		n--;
+	double sum = k[0];
+	for (int j = 1; j <= n; j++)
+		sum += 2 * k[j];
+	kernel.resize(2 * n + 1);
+	for (int j = 0; j <= n; j++)
+		kernel[n + j] = kernel[n - j] = (float)(k[j] / sum);
+}
+
+void
+SeparableImageFilter::get_geometry_(const Image3DF& image,
+	std::vector<float>& voxel_sizes, std::vector<int>& sizes)
+{
+	voxel_sizes.clear();
+	sizes.clear();
+	const Voxels3DF* ptr_voxels = dynamic_cast<const Voxels3DF*>(&image);
+	if (!ptr_voxels)
+		return;
+	for (int a = 0; a < 3; a++)
+		voxel_sizes.push_back(ptr_voxels->get_voxel_size()[a + 1]);
+	sizes.push_back(ptr_voxels->get_z_size());
+	sizes.push_back(ptr_voxels->get_y_size());
+	sizes.push_back(ptr_voxels->get_x_size());
+}
+
+void
+SeparableImageFilter::compute_kernels_(const std::vector<float>& voxel_sizes,
+	const std::vector<int>& sizes, std::vector<std::vector<float> >& kernels) const
+{
+	kernels.resize(3);
+	for (int a = 0; a < 3; a++) {
+		if (_user_kernels[a].size() > 0) {
+			kernels[a] = _user_kernels[a];
+			continue;
+		}
+		if (_fwhms[a] <= 0) {
+			kernels[a].assign(1, 1.0f);
+			continue;
+		}
+		if (sizes.size() < 1)
+			THROW("separable filter needs voxel sizes of a voxelised image");
+		int max_half = sizes[a] - 1;
+		if (_max_kernel_sizes[a] > 0)
+			max_half = std::min(max_half, (_max_kernel_sizes[a] - 1) / 2);
+		metz_kernel(_fwhms[a] / voxel_sizes[a], _metz_powers[a], max_half,
+			kernels[a]);
+	}
+}
+
+Succeeded
+SeparableImageFilter::virtual_set_up(const Image3DF& image)
+{
+	get_geometry_(image, _voxel_sizes, _sizes);
+	compute_kernels_(_voxel_sizes, _sizes, _kernels);
+	return Succeeded::yes;
+}
+
+// out[i] = sum_j k[j] in[i + 2h - j], in being padded by h zeros on each side
+static void
+convolve_padded(const float* in, const std::vector<float>& k, float* out, int n)
+{
+	const int len = (int)k.size();
+	std::fill(out, out + n, 0.0f);
+	for (int j = 0; j < len; j++) {
+		const float w = k[j];
+		const float* src = in + len - 1 - j;
+		for (int i = 0; i < n; i++)
+			out[i] += w*src[i];
+	}
+}
+
+// direct convolution along x: rows are independent
+static void
+filter_x(const ImageRowTable<float>& rows, const std::vector<float>& k)
+{
+	const int nx = rows.nx;
+	const int h = (int)k.size() / 2;
+	const long long nr = (long long)rows.num_rows();
+#pragma omp parallel
+	{
+		std::vector<float> pad(nx + 2 * h, 0.0f);
+		std::vector<float> acc(nx);
+#pragma omp for
+		for (long long r = 0; r < nr; r++) {
+			float* row = rows.row((size_t)r);
+			std::copy(row, row + nx, pad.begin() + h);
+			convolve_padded(&pad[0], k, &acc[0], nx);
+			std::copy(acc.begin(), acc.end(), row);
+		}
+	}
+}
+
+// direct convolution along y: each plane is filtered by one thread,
+// output rows accumulating whole input rows
+static void
+filter_y(const ImageRowTable<float>& rows, const std::vector<float>& k)
+{
+	const int ny = rows.ny;
+	const int nx = rows.nx;
+	const int h = (int)k.size() / 2;
+	const long long nz = rows.nz;
+#pragma omp parallel
+	{
+		std::vector<float> plane(size_t(ny)*nx);
+#pragma omp for
+		for (long long z = 0; z < nz; z++) {
+			for (int y = 0; y < ny; y++)
+				memcpy(&plane[size_t(y)*nx], rows.row((int)z, y), nx*sizeof(float));
+			for (int y = 0; y < ny; y++) {
+				float* row = rows.row((int)z, y);
+				std::fill(row, row + nx, 0.0f);
+				for (int j = 0; j < (int)k.size(); j++) {
+					const int yy = y + h - j;
+					if (yy < 0 || yy >= ny)
+						continue;
+					const float w = k[j];
+					const float* src = &plane[size_t(yy)*nx];
+					for (int x = 0; x < nx; x++)
+						row[x] += w*src[x];
+				}
+			}
+		}
+	}
+}
+
+// direct convolution along z: output planes are shared between threads
+static void
+filter_z(const ImageRowTable<float>& rows, const std::vector<float>& k)
+{
+	const int ny = rows.ny;
+	const int nx = rows.nx;
+	const int nz = rows.nz;
+	const int h = (int)k.size() / 2;
+	std::vector<float> copy(rows.size());
+	for (size_t r = 0; r < rows.num_rows(); r++)
+		memcpy(&copy[r*nx], rows.row(r), nx*sizeof(float));
+#pragma omp parallel for
+	for (long long z = 0; z < nz; z++) {
+		for (int y = 0; y < ny; y++) {
+			float* row = rows.row((int)z, y);
+			std::fill(row, row + nx, 0.0f);
+			for (int j = 0; j < (int)k.size(); j++) {
+				const long long zz = z + h - j;
+				if (zz < 0 || zz >= nz)
+					continue;
+				const float w = k[j];
+				const float* src = &copy[(size_t(zz)*ny + y)*nx];
+				for (int x = 0; x < nx; x++)
+					row[x] += w*src[x];
+			}
+		}
+	}
+}
+
+// convolution along an axis via zero-padded real DFT, line by line
+static void
+filter_fft(const ImageRowTable<float>& rows, int axis, const std::vector<float>& k)
+{
+	const int dims[3] = { rows.nz, rows.ny, rows.nx };
+	const int n = dims[axis];
+	const int h = (int)k.size() / 2;
+	Array<1, float> kernel(IndexRange<1>(-h, h));
+	for (int j = -h; j <= h; j++)
+		kernel[j] = k[j + h];
+	ArrayFilterUsingRealDFTWithPadding<1, float> filter;
+	if (filter.set_kernel(kernel) != Succeeded::yes)
+		THROW("failed to set up FFT filter kernel");
+
+	// lines are indexed by the two other coordinates
+	const int n1 = axis == 0 ? rows.ny : rows.nz;
+	const int n2 = axis == 2 ? rows.ny : rows.nx;
+	const long long nl = (long long)n1*n2;
+#pragma omp parallel
+	{
+		Array<1, float> in(IndexRange<1>(0, n - 1));
+		Array<1, float> out(IndexRange<1>(0, n - 1));
+#pragma omp for
+		for (long long l = 0; l < nl; l++) {
+			const int i1 = (int)(l / n2);
+			const int i2 = (int)(l % n2);
+			for (int i = 0; i < n; i++)
+				in[i] = axis == 0 ? rows.row(i, i1)[i2] :
+				axis == 1 ? rows.row(i1, i)[i2] : rows.row(i1, i2)[i];
+			filter(out, in);
+			for (int i = 0; i < n; i++) {
+				float* ptr = axis == 0 ? &rows.row(i, i1)[i2] :
+					axis == 1 ? &rows.row(i1, i)[i2] : &rows.row(i1, i2)[i];
+				*ptr = out[i];
+			}
+		}
+	}
+}
+
+void
+SeparableImageFilter::virtual_apply(Image3DF& data) const
+{
+	const ImageRowTable<float> rows(data);
+	if (!rows.regular())
+		THROW("separable filter needs a regular image");
+	// the kernels computed by set_up() are used unless the image geometry
+	// differs from that of the set-up image
+	std::vector<float> voxel_sizes;
+	std::vector<int> sizes;
+	get_geometry_(data, voxel_sizes, sizes);
+	bool same = sizes == _sizes;
+	for (size_t a = 0; same && a < voxel_sizes.size(); a++)
+		same = std::fabs(voxel_sizes[a] - _voxel_sizes[a]) <= 1e-4*_voxel_sizes[a];
+	std::vector<std::vector<float> > kernels;
+	if (!same)
+		compute_kernels_(voxel_sizes, sizes, kernels);
+	const std::vector<std::vector<float> >& ks = same ? _kernels : kernels;
+	for (int a = 0; a < 3; a++) {
+		const std::vector<float>& k = ks[a];
+		if (k.size() < 2 && (k.size() < 1 || k[0] == 1.0f))
+			continue;
+		if ((int)k.size() > _fft_threshold)
+			filter_fft(rows, a, k);
+		else if (a == 0)
+			filter_z(rows, k);
+		else if (a == 1)
+			filter_y(rows, k);
+		else
+			filter_x(rows, k);
+	}
+}
+
+void
+SeparableImageFilter::virtual_apply(Image3DF& out, const Image3DF& in) const
+{
+	if (!out.has_same_characteristics(in))
+		THROW("separable filter input and output differ in geometry");
+	std::copy(in.begin_all(), in.end_all(), out.begin_all());
+	virtual_apply(out);
+}
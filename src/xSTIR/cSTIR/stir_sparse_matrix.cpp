@@ -0,0 +1,680 @@
+/*
+CCP PETMR Synergistic Image Reconstruction Framework (SIRF)
+Copyright 2019 Rutherford Appleton Laboratory STFC
+
+This is software developed for the Collaborative Computational
+Project in Positron Emission Tomography and Magnetic Resonance imaging
+(http://www.ccppetmr.ac.uk/).
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+http://www.apache.org/licenses/LICENSE-2.0
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+*/
+
+#include <algorithm>
+#include <map>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "stir/SegmentBySinogram.h"
+#include "stir/SymmetryOperation.h"
+#include "stir/recon_buildblock/DataSymmetriesForBins.h"
+#include "stir/recon_buildblock/find_basic_vs_nums_in_subsets.h"
+
+#include "sirf/STIR/stir_sparse_matrix.h"
+
+using namespace stir;
+using namespace sirf;
+
+const char* const
+ForwardProjectorByBinUsingSparseMatrix::registered_name = "SIRF Sparse Matrix";
+const char* const
+BackProjectorByBinUsingSparseMatrix::registered_name = "SIRF Sparse Matrix";
+const char* const
+ProjectorByBinPairUsingSparseMatrix::registered_name = "SIRF Sparse Matrix";
+
+// frames are processed in groups of this size, so that the partial sums
+// of a matrix row for all frames in a group stay in registers
+static const int FRAMES_CHUNK = 8;
+// bound on the memory taken by the per-thread backprojection images
+static const size_t BACKWARD_BUFFER_BYTES = size_t(1) << 30;
+
+static int
+num_threads()
+{
+#ifdef _OPENMP
+	return omp_get_max_threads();
+#else
+	return 1;
+#endif
+}
+
+static int
+thread_num()
+{
+#ifdef _OPENMP
+	return omp_get_thread_num();
+#else
+	return 0;
+#endif
+}
+
+bool
+PETSparseProjMatrix::SymmetryOp::operator<(const SymmetryOp& op) const
+{
+	for (int i = 0; i < 3; i++) {
+		if (axis[i] != op.axis[i])
+			return axis[i] < op.axis[i];
+		if (sign[i] != op.sign[i])
+			return sign[i] < op.sign[i];
+		if (shift[i] != op.shift[i])
+			return shift[i] < op.shift[i];
+	}
+	return false;
+}
+
+// finds the affine map c' = sign*c[axis] + shift performed by a STIR
+// symmetry operation on voxel coordinates by applying it to the origin
+// and to the unit vectors
+static PETSparseProjMatrix::SymmetryOp
+probe_symmetry_op(const SymmetryOperation& so)
+{
+	PETSparseProjMatrix::SymmetryOp op;
+	Coordinate3D<int> c(0, 0, 0);
+	so.transform_image_coordinates(c);
+	for (int k = 0; k < 3; k++) {
+		op.shift[k] = c[k + 1];
+		op.axis[k] = -1;
+		op.sign[k] = 0;
+	}
+	for (int j = 0; j < 3; j++) {
+		Coordinate3D<int> e(0, 0, 0);
+		e[j + 1] = 1;
+		so.transform_image_coordinates(e);
+		for (int k = 0; k < 3; k++) {
+			int d = e[k + 1] - op.shift[k];
+			if (d == 0)
+				continue;
+			if ((d != 1 && d != -1) || op.axis[k] >= 0)
+				THROW("unsupported projection matrix symmetry");
+			op.axis[k] = j;
+			op.sign[k] = d;
+		}
+	}
+	for (int k = 0; k < 3; k++)
+		if (op.axis[k] < 0)
+			THROW("unsupported projection matrix symmetry");
+	return op;
+}
+
+void
+PETSparseProjMatrix::set_up(const ProjDataInfo& pdi, const Voxels3DF& image)
+{
+	const ProjMatrixByBinFromCache& matrix = *_sptr_matrix;
+	if (!matrix.index())
+		THROW("sparse matrix: projection matrix cache not set up");
+	const DataSymmetriesForBins& symmetries = *matrix.get_symmetries_ptr();
+
+	int min_seg = pdi.get_min_segment_num();
+	int max_seg = pdi.get_max_segment_num();
+	_sptr_pdi.reset(pdi.clone());
+	_sptr_image_template.reset(image.get_empty_copy());
+	_min_seg = min_seg;
+	_min_view = pdi.get_min_view_num();
+	_num_views = pdi.get_num_views();
+	_min_tang = pdi.get_min_tangential_pos_num();
+	_num_tang = pdi.get_num_tangential_poss();
+	_min_z = image.get_min_index();
+	_nz = image.get_max_index() - _min_z + 1;
+	_min_y = image[_min_z].get_min_index();
+	_ny = image[_min_z].get_max_index() - _min_y + 1;
+	_min_x = image[_min_z][_min_y].get_min_index();
+	_nx = image[_min_z][_min_y].get_max_index() - _min_x + 1;
+
+	int num_segs = max_seg - min_seg + 1;
+	_seg_first_line.assign(num_segs, 0);
+	_seg_last_line.assign(num_segs, 0);
+	_seg_min_axial.assign(num_segs, 0);
+	size_t num_lines = 0;
+	// segments in the order of ProjData::copy_to(): 0, 1, -1, 2, -2, ...
+	for (int s = 0; s <= std::max(max_seg, -min_seg); s++) {
+		for (int sign = 1; sign >= -1; sign -= 2) {
+			int seg = sign*s;
+			if (seg < min_seg || seg > max_seg || (s == 0 && sign < 0))
+				continue;
+			int i = seg - min_seg;
+			_seg_min_axial[i] = pdi.get_min_axial_pos_num(seg);
+			_seg_first_line[i] = num_lines;
+			num_lines += size_t(pdi.get_num_axial_poss(seg))*_num_views;
+			_seg_last_line[i] = num_lines;
+		}
+	}
+
+	// runs are found in the STIR bin order and then sorted by line
+	std::vector<Run> runs;
+	std::vector<size_t> run_line;
+	std::map<SymmetryOp, int> op_num;
+	_ops.clear();
+	_line_first_run.assign(num_lines + 1, 0);
+	const BinRecord* index = matrix.index();
+	for (int seg = min_seg; seg <= max_seg; seg++) {
+		for (int ax = pdi.get_min_axial_pos_num(seg);
+			ax <= pdi.get_max_axial_pos_num(seg); ax++) {
+			for (int view = _min_view; view < _min_view + _num_views; view++) {
+				size_t line = line_index(seg, view, ax);
+				size_t line_start = runs.size();
+				for (int tang = _min_tang; tang < _min_tang + _num_tang; tang++) {
+					Bin bin(seg, view, ax, tang);
+					shared_ptr<SymmetryOperation> sptr_so
+						(symmetries.find_symmetry_operation_from_basic_bin(bin).release());
+					SymmetryOp op = probe_symmetry_op(*sptr_so);
+					std::map<SymmetryOp, int>::iterator iter = op_num.find(op);
+					int n;
+					if (iter == op_num.end()) {
+						n = (int)_ops.size();
+						op_num[op] = n;
+						_ops.push_back(op);
+					}
+					else
+						n = iter->second;
+					const BinRecord* r = matrix.find(bin);
+					if (!r)
+						THROW("sparse matrix: basic bin missing from the matrix cache");
+					int64_t basic = r - index;
+					if (runs.size() > line_start) {
+						Run& run = runs.back();
+						int len = run.tang_last - run.tang_first + 1;
+						int64_t d = basic - run.basic_first;
+						if (run.op == n &&
+							(len == 1 ? (d == 1 || d == -1) : d == len*run.basic_step)) {
+							if (len == 1)
+								run.basic_step = (int)d;
+							run.tang_last = tang;
+							continue;
+						}
+					}
+					Run run;
+					run.tang_first = tang;
+					run.tang_last = tang;
+					run.op = n;
+					run.basic_step = 1;
+					run.basic_first = basic;
+					runs.push_back(run);
+					run_line.push_back(line);
+					_line_first_run[line + 1]++;
+				}
+			}
+		}
+	}
+	for (size_t line = 0; line < num_lines; line++)
+		_line_first_run[line + 1] += _line_first_run[line];
+	_runs.resize(runs.size());
+	std::vector<size_t> next(_line_first_run.begin(), _line_first_run.end() - 1);
+	for (size_t i = 0; i < runs.size(); i++)
+		_runs[next[run_line[i]]++] = runs[i];
+}
+
+void
+PETSparseProjMatrix::check_geometry
+(const ProjDataInfo& pdi, const Image3DF& image) const
+{
+	if (!_sptr_image_template.get())
+		THROW("sparse matrix not set up");
+	if (pdi != *_sptr_pdi)
+		THROW("sparse projectors: acquisition geometry differs from set_up()");
+	// index ranges, voxel sizes and origin
+	if (!_sptr_image_template->has_same_characteristics(image))
+		THROW("sparse projectors: image geometry differs from set_up()");
+}
+
+template<typename T>
+void
+PETSparseProjMatrix::flat_image_rows_(T* image, ImageRows<T>& ir) const
+{
+	ir.min_z = _min_z;
+	ir.max_z = _min_z + _nz - 1;
+	ir.min_y = _min_y;
+	ir.max_y = _min_y + _ny - 1;
+	ir.min_x = _min_x;
+	ir.max_x = _min_x + _nx - 1;
+	ir.ny = _ny;
+	ir.rows.resize(size_t(_nz)*_ny);
+	for (size_t i = 0; i < ir.rows.size(); i++)
+		ir.rows[i] = image + i*_nx;
+}
+
+void
+PETSparseProjMatrix::forward_line(size_t line, int min_tang, int max_tang,
+	const ImageRows<const float>* images, int num_frames, float* const* out) const
+{
+	const BinRecord* index = _sptr_matrix->index();
+	const Element* elems = _sptr_matrix->elements();
+	// all frames have the same geometry
+	const ImageRows<const float>& image = images[0];
+	for (size_t ir = _line_first_run[line]; ir < _line_first_run[line + 1]; ir++) {
+		const Run& run = _runs[ir];
+		const SymmetryOp& op = _ops[run.op];
+		int t0 = std::max(run.tang_first, min_tang);
+		int t1 = std::min(run.tang_last, max_tang);
+		for (int t = t0; t <= t1; t++) {
+			const BinRecord& r =
+				index[run.basic_first + int64_t(t - run.tang_first)*run.basic_step];
+			for (int f0 = 0; f0 < num_frames; f0 += FRAMES_CHUNK) {
+				int nf = std::min(FRAMES_CHUNK, num_frames - f0);
+				const ImageRows<const float>* im = images + f0;
+				double sum[FRAMES_CHUNK] = { 0 };
+				const Element* e = elems + r.first;
+				for (uint64_t i = 0; i < r.count; i++, e++) {
+					int c[3] = { e->z, e->y, e->x };
+					int z = op.sign[0] * c[op.axis[0]] + op.shift[0];
+					int y = op.sign[1] * c[op.axis[1]] + op.shift[1];
+					int x = op.sign[2] * c[op.axis[2]] + op.shift[2];
+					if (z < image.min_z || z > image.max_z || y < image.min_y ||
+						y > image.max_y || x < image.min_x || x > image.max_x)
+						continue;
+					size_t row = size_t(z - image.min_z)*image.ny + y - image.min_y;
+					int col = x - image.min_x;
+					for (int f = 0; f < nf; f++)
+						sum[f] += e->value * im[f].rows[row][col];
+				}
+				for (int f = 0; f < nf; f++)
+					out[f0 + f][t - min_tang] = (float)sum[f];
+			}
+		}
+	}
+}
+
+void
+PETSparseProjMatrix::backward_line(size_t line, int min_tang, int max_tang,
+	const float* const* in, ImageRows<float>* images, int num_frames) const
+{
+	const BinRecord* index = _sptr_matrix->index();
+	const Element* elems = _sptr_matrix->elements();
+	const ImageRows<float>& image = images[0];
+	for (size_t ir = _line_first_run[line]; ir < _line_first_run[line + 1]; ir++) {
+		const Run& run = _runs[ir];
+		const SymmetryOp& op = _ops[run.op];
+		int t0 = std::max(run.tang_first, min_tang);
+		int t1 = std::min(run.tang_last, max_tang);
+		for (int t = t0; t <= t1; t++) {
+			const BinRecord& r =
+				index[run.basic_first + int64_t(t - run.tang_first)*run.basic_step];
+			for (int f0 = 0; f0 < num_frames; f0 += FRAMES_CHUNK) {
+				int nf = std::min(FRAMES_CHUNK, num_frames - f0);
+				ImageRows<float>* im = images + f0;
+				float v[FRAMES_CHUNK];
+				bool nonzero = false;
+				for (int f = 0; f < nf; f++) {
+					v[f] = in[f0 + f][t - min_tang];
+					nonzero = nonzero || v[f] != 0;
+				}
+				if (!nonzero)
+					continue;
+				const Element* e = elems + r.first;
+				for (uint64_t i = 0; i < r.count; i++, e++) {
+					int c[3] = { e->z, e->y, e->x };
+					int z = op.sign[0] * c[op.axis[0]] + op.shift[0];
+					int y = op.sign[1] * c[op.axis[1]] + op.shift[1];
+					int x = op.sign[2] * c[op.axis[2]] + op.shift[2];
+					if (z < image.min_z || z > image.max_z || y < image.min_y ||
+						y > image.max_y || x < image.min_x || x > image.max_x)
+						continue;
+					size_t row = size_t(z - image.min_z)*image.ny + y - image.min_y;
+					int col = x - image.min_x;
+					for (int f = 0; f < nf; f++)
+						im[f].rows[row][col] += e->value * v[f];
+				}
+			}
+		}
+	}
+}
+
+void
+PETSparseProjMatrix::subset_lines(size_t first, size_t last,
+	int subset_num, int num_subsets, std::vector<char>& in_subset) const
+{
+	in_subset.assign(last - first, num_subsets < 2);
+	if (num_subsets < 2)
+		return;
+	const DataSymmetriesForBins& symmetries = *_sptr_matrix->get_symmetries_ptr();
+	const ProjDataInfo& pdi = *_sptr_pdi;
+	int min_seg = pdi.get_min_segment_num();
+	int max_seg = pdi.get_max_segment_num();
+	// views in the subset, by segment
+	std::vector<char> views(size_t(max_seg - min_seg + 1)*_num_views, 0);
+	std::vector<ViewSegmentNumbers> basic_vs =
+		detail::find_basic_vs_nums_in_subset(pdi, symmetries,
+		min_seg, max_seg, subset_num, num_subsets);
+	std::vector<ViewSegmentNumbers> related;
+	for (size_t i = 0; i < basic_vs.size(); i++) {
+		symmetries.get_related_view_segment_numbers(related, basic_vs[i]);
+		for (size_t j = 0; j < related.size(); j++) {
+			int seg = related[j].segment_num();
+			if (seg >= min_seg && seg <= max_seg)
+				views[size_t(seg - min_seg)*_num_views +
+				related[j].view_num() - _min_view] = 1;
+		}
+	}
+	for (int seg = min_seg; seg <= max_seg; seg++) {
+		size_t seg_first, seg_last;
+		segment_lines(seg, seg_first, seg_last);
+		size_t l0 = std::max(seg_first, first);
+		size_t l1 = std::min(seg_last, last);
+		const char* seg_views = &views[size_t(seg - min_seg)*_num_views];
+		for (size_t line = l0; line < l1; line++)
+			in_subset[line - first] = seg_views[(line - seg_first) % _num_views];
+	}
+}
+
+void
+PETSparseProjMatrix::forward(const std::vector<ImageRows<const float> >& images,
+	size_t first, size_t last, float* const* data,
+	int subset_num, int num_subsets) const
+{
+	// each line is written by one thread only, no synchronisation needed
+	int nf = (int)images.size();
+	long long n = last - first;
+	std::vector<char> in_subset;
+	subset_lines(first, last, subset_num, num_subsets, in_subset);
+#pragma omp parallel
+	{
+		std::vector<float*> out(nf);
+#pragma omp for schedule(dynamic, 16)
+		for (long long i = 0; i < n; i++) {
+			size_t line = first + i;
+			if (!in_subset[i])
+				continue;
+			int t0, t1;
+			bool in_support = line_range_(line, t0, t1);
+			for (int f = 0; f < nf; f++) {
+				out[f] = data[f] + i*_num_tang;
+				// bins outside the support are not computed
+				if (!in_support) {
+					std::fill(out[f], out[f] + _num_tang, 0.0f);
+					continue;
+				}
+				std::fill(out[f], out[f] + t0 - _min_tang, 0.0f);
+				std::fill(out[f] + t1 + 1 - _min_tang, out[f] + _num_tang, 0.0f);
+				out[f] += t0 - _min_tang;
+			}
+			if (in_support)
+				forward_line(line, t0, t1, &images[0], nf, &out[0]);
+		}
+	}
+}
+
+void
+PETSparseProjMatrix::backward(const float* const* data, size_t first, size_t last,
+	std::vector<ImageRows<float> >& images, int subset_num, int num_subsets) const
+{
+	int nf = (int)images.size();
+	long long n = last - first;
+	std::vector<char> in_subset;
+	subset_lines(first, last, subset_num, num_subsets, in_subset);
+	const ImageRows<float>& image = images[0];
+	size_t nx = image.max_x - image.min_x + 1;
+	size_t nr = image.rows.size();
+	size_t nv = nr*nx;
+
+	// lines related by symmetries update the same voxels, so each thread
+	// accumulates into its own images, and the images are summed up after;
+	// frames are processed in groups to keep the memory used bounded
+	int nt = num_threads();
+	int group = nf;
+	while (group > 1 && size_t(nt)*group*nv*sizeof(float) > BACKWARD_BUFFER_BYTES)
+		group = (group + 1) / 2;
+	nt = (int)std::min(size_t(nt),
+		std::max(size_t(1), BACKWARD_BUFFER_BYTES / (group*nv*sizeof(float))));
+
+	if (nt < 2) {
+		std::vector<const float*> in(nf);
+		for (long long i = 0; i < n; i++) {
+			size_t line = first + i;
+			if (!in_subset[i])
+				continue;
+			int t0, t1;
+			if (!line_range_(line, t0, t1))
+				continue;
+			for (int f = 0; f < nf; f++)
+				in[f] = data[f] + i*_num_tang + t0 - _min_tang;
+			backward_line(line, t0, t1, &in[0], &images[0], nf);
+		}
+		return;
+	}
+
+	for (int f0 = 0; f0 < nf; f0 += group) {
+		int ng = std::min(group, nf - f0);
+		std::vector<std::vector<float> > buff(nt);
+#pragma omp parallel num_threads(nt)
+		{
+			std::vector<float>& b = buff[thread_num()];
+			b.assign(ng*nv, 0.0f);
+			std::vector<ImageRows<float> > ir(ng, image);
+			for (int g = 0; g < ng; g++)
+				for (size_t r = 0; r < nr; r++)
+					ir[g].rows[r] = &b[g*nv + r*nx];
+			std::vector<const float*> in(ng);
+#pragma omp for schedule(dynamic, 16)
+			for (long long i = 0; i < n; i++) {
+				size_t line = first + i;
+				if (!in_subset[i])
+					continue;
+				int t0, t1;
+				if (!line_range_(line, t0, t1))
+					continue;
+				for (int g = 0; g < ng; g++)
+					in[g] = data[f0 + g] + i*_num_tang + t0 - _min_tang;
+				backward_line(line, t0, t1, &in[0], &ir[0], ng);
+			}
+		}
+		long long nk = (long long)ng*nr;
+#pragma omp parallel for
+		for (long long k = 0; k < nk; k++) {
+			int g = (int)(k / nr);
+			size_t r = k % nr;
+			float* row = images[f0 + g].rows[r];
+			for (int t = 0; t < nt; t++) {
+				if (buff[t].empty())
+					continue;
+				const float* b = &buff[t][g*nv + r*nx];
+				for (size_t x = 0; x < nx; x++)
+					row[x] += b[x];
+			}
+		}
+	}
+}
+
+void
+PETSparseProjMatrix::set_line_support(const std::vector<int>& min_tang,
+	const std::vector<int>& max_tang)
+{
+	if (min_tang.size() != max_tang.size() ||
+		(min_tang.size() > 0 && min_tang.size() != num_lines()))
+		THROW("line support size does not match the number of lines");
+	_support_min_tang = min_tang;
+	_support_max_tang = max_tang;
+}
+
+void
+PETSparseProjMatrix::forward(const float* image, float* data,
+	int subset_num, int num_subsets) const
+{
+	std::vector<ImageRows<const float> > ir(1);
+	flat_image_rows_(image, ir[0]);
+	forward(ir, 0, num_lines(), &data, subset_num, num_subsets);
+}
+
+void
+PETSparseProjMatrix::backward(const float* data, float* image,
+	int subset_num, int num_subsets) const
+{
+	std::vector<ImageRows<float> > ir(1);
+	flat_image_rows_(image, ir[0]);
+	backward(&data, 0, num_lines(), ir, subset_num, num_subsets);
+}
+
+void
+ForwardProjectorByBinUsingSparseMatrix::actual_forward_project
+(RelatedViewgrams<float>& viewgrams, const Image3DF& image,
+	const int min_axial_pos_num, const int max_axial_pos_num,
+	const int min_tangential_pos_num, const int max_tangential_pos_num)
+{
+	PETSparseProjMatrix::ImageRows<const float> ir;
+	PETSparseProjMatrix::image_rows(image, ir);
+	for (RelatedViewgrams<float>::iterator iter = viewgrams.begin();
+		iter != viewgrams.end(); ++iter) {
+		Viewgram<float>& viewgram = *iter;
+		int seg = viewgram.get_segment_num();
+		int view = viewgram.get_view_num();
+		for (int ax = min_axial_pos_num; ax <= max_axial_pos_num; ax++)
+			_sptr_matrix->forward_line(_sptr_matrix->line_index(seg, view, ax),
+				min_tangential_pos_num, max_tangential_pos_num, ir,
+				&viewgram[ax][min_tangential_pos_num]);
+	}
+}
+
+void
+BackProjectorByBinUsingSparseMatrix::actual_back_project
+(Image3DF& image, const RelatedViewgrams<float>& viewgrams,
+	const int min_axial_pos_num, const int max_axial_pos_num,
+	const int min_tangential_pos_num, const int max_tangential_pos_num)
+{
+	PETSparseProjMatrix::ImageRows<float> ir;
+	PETSparseProjMatrix::image_rows(image, ir);
+	for (RelatedViewgrams<float>::const_iterator iter = viewgrams.begin();
+		iter != viewgrams.end(); ++iter) {
+		const Viewgram<float>& viewgram = *iter;
+		int seg = viewgram.get_segment_num();
+		int view = viewgram.get_view_num();
+		for (int ax = min_axial_pos_num; ax <= max_axial_pos_num; ax++)
+			_sptr_matrix->backward_line(_sptr_matrix->line_index(seg, view, ax),
+				min_tangential_pos_num, max_tangential_pos_num,
+				&viewgram[ax][min_tangential_pos_num], ir);
+	}
+}
+
+ProjectorByBinPairUsingSparseMatrix::ProjectorByBinPairUsingSparseMatrix
+(shared_ptr<ProjMatrixByBinFromCache> sptr_matrix) : _sptr_matrix(sptr_matrix),
+	_verbose(false)
+{}
+
+Succeeded
+ProjectorByBinPairUsingSparseMatrix::set_up(
+	const shared_ptr<ProjDataInfo>& sptr_pdi,
+	const shared_ptr<Image3DF>& sptr_image)
+{
+	if (!_sptr_matrix.get())
+		return Succeeded::no;
+	const Voxels3DF* ptr_voxels = dynamic_cast<const Voxels3DF*>(sptr_image.get());
+	if (!ptr_voxels)
+		return Succeeded::no;
+	_sptr_matrix->set_up(sptr_pdi, sptr_image);
+	_sptr_sparse.reset(new PETSparseProjMatrix(_sptr_matrix));
+	if (_verbose)
+		std::cout << "setting up sparse matrix...";
+	_sptr_sparse->set_up(*sptr_pdi, *ptr_voxels);
+	if (_verbose)
+		std::cout << "ok (" << _sptr_sparse->num_runs() << " runs, "
+			<< _sptr_sparse->num_symmetry_ops() << " symmetries)\n";
+	forward_projector_sptr.reset
+		(new ForwardProjectorByBinUsingSparseMatrix(_sptr_sparse));
+	back_projector_sptr.reset
+		(new BackProjectorByBinUsingSparseMatrix(_sptr_sparse));
+	forward_projector_sptr->set_up(sptr_pdi, sptr_image);
+	back_projector_sptr->set_up(sptr_pdi, sptr_image);
+	return Succeeded::yes;
+}
+
+void
+ProjectorByBinPairUsingSparseMatrix::forward(const std::vector<ProjData*>& pds,
+	const std::vector<const Image3DF*>& images,
+	int subset_num, int num_subsets, bool zero) const
+{
+	if (!_sptr_sparse.get())
+		THROW("sparse matrix projectors not set up");
+	size_t nf = images.size();
+	for (size_t f = 0; f < nf; f++)
+		_sptr_sparse->check_geometry(*pds[f]->get_proj_data_info_sptr(), *images[f]);
+	std::vector<PETSparseProjMatrix::ImageRows<const float> > ir(nf);
+	for (size_t f = 0; f < nf; f++)
+		PETSparseProjMatrix::image_rows(*images[f], ir[f]);
+	std::vector<std::vector<float> > data(nf);
+	std::vector<float*> ptr(nf);
+	for (int seg = pds[0]->get_min_segment_num();
+		seg <= pds[0]->get_max_segment_num(); seg++) {
+		// a segment by sinogram is stored line by line in the order of
+		// the sparse matrix lines, but not necessarily contiguously
+		for (size_t f = 0; f < nf; f++) {
+			SegmentBySinogram<float> segment = (zero || num_subsets < 2) ?
+				pds[f]->get_empty_segment_by_sinogram(seg) :
+				pds[f]->get_segment_by_sinogram(seg);
+			data[f].resize(segment.size_all());
+			std::copy(segment.begin_all(), segment.end_all(), data[f].begin());
+			ptr[f] = &data[f][0];
+		}
+		size_t first, last;
+		_sptr_sparse->segment_lines(seg, first, last);
+		_sptr_sparse->forward(ir, first, last, &ptr[0], subset_num, num_subsets);
+		for (size_t f = 0; f < nf; f++) {
+			SegmentBySinogram<float> segment =
+				pds[f]->get_empty_segment_by_sinogram(seg);
+			std::copy(data[f].begin(), data[f].end(), segment.begin_all());
+			pds[f]->set_segment(segment);
+		}
+	}
+}
+
+void
+ProjectorByBinPairUsingSparseMatrix::backward(const std::vector<Image3DF*>& images,
+	const std::vector<const ProjData*>& pds, int subset_num, int num_subsets) const
+{
+	if (!_sptr_sparse.get())
+		THROW("sparse matrix projectors not set up");
+	size_t nf = images.size();
+	for (size_t f = 0; f < nf; f++)
+		_sptr_sparse->check_geometry(*pds[f]->get_proj_data_info_sptr(), *images[f]);
+	std::vector<PETSparseProjMatrix::ImageRows<float> > ir(nf);
+	for (size_t f = 0; f < nf; f++)
+		PETSparseProjMatrix::image_rows(*images[f], ir[f]);
+	std::vector<std::vector<float> > data(nf);
+	std::vector<const float*> ptr(nf);
+	for (int seg = pds[0]->get_min_segment_num();
+		seg <= pds[0]->get_max_segment_num(); seg++) {
+		for (size_t f = 0; f < nf; f++) {
+			SegmentBySinogram<float> segment = pds[f]->get_segment_by_sinogram(seg);
+			data[f].resize(segment.size_all());
+			std::copy(segment.begin_all(), segment.end_all(), data[f].begin());
+			ptr[f] = &data[f][0];
+		}
+		size_t first, last;
+		_sptr_sparse->segment_lines(seg, first, last);
+		_sptr_sparse->backward(&ptr[0], first, last, ir, subset_num, num_subsets);
+	}
+}
+
+void
+ProjectorByBinPairUsingSparseMatrix::forward(ProjData& pd, const Image3DF& image,
+	int subset_num, int num_subsets, bool zero) const
+{
+	std::vector<ProjData*> pds(1, &pd);
+	std::vector<const Image3DF*> images(1, &image);
+	forward(pds, images, subset_num, num_subsets, zero);
+}
+
+void
+ProjectorByBinPairUsingSparseMatrix::backward(Image3DF& image, const ProjData& pd,
+	int subset_num, int num_subsets) const
+{
+	std::vector<Image3DF*> images(1, &image);
+	std::vector<const ProjData*> pds(1, &pd);
+	backward(images, pds, subset_num, num_subsets);
+}
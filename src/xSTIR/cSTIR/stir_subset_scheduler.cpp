@@ -0,0 +1,257 @@
+/*
+CCP PETMR Synergistic Image Reconstruction Framework (SIRF)
+Copyright 2019 Rutherford Appleton Laboratory STFC
+
+This is software developed for the Collaborative Computational
+Project in Positron Emission Tomography and Magnetic Resonance imaging
+(http://www.ccppetmr.ac.uk/).
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+http://www.apache.org/licenses/LICENSE-2.0
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+*/
+
+#include <algorithm>
+#include <cmath>
+#include <istream>
+#include <ostream>
+
+#include <boost/algorithm/string.hpp>
+
+#include "sirf/iUtilities/DataHandle.h"
+#include "sirf/STIR/stir_subset_scheduler.h"
+
+using namespace sirf;
+
+SubsetScheduler::SubsetScheduler
+(int num_subsets, const std::string& policy, unsigned int seed) :
+	_num_subsets(1), _policy("sequential"), _seed(seed), _generator(seed),
+	_weights(1, 1.0f), _num_calls(0)
+{
+	set_num_subsets(num_subsets);
+	set_policy(policy);
+}
+
+void
+SubsetScheduler::set_num_subsets(int n)
+{
+	if (n < 1)
+		THROW("number of subsets must be positive");
+	_num_subsets = n;
+	_weights.assign(n, 1.0f);
+	reset();
+}
+
+void
+SubsetScheduler::set_policy(const std::string& policy)
+{
+	if (!boost::iequals(policy, "sequential") &&
+		!boost::iequals(policy, "herman_meyer") &&
+		!boost::iequals(policy, "golden_ratio") &&
+		!boost::iequals(policy, "random") &&
+		!boost::iequals(policy, "importance")) {
+		std::string msg = "unknown subset ordering policy " + policy;
+		THROW(msg.c_str());
+	}
+	_policy = boost::to_lower_copy(policy);
+	reset();
+}
+
+void
+SubsetScheduler::set_seed(unsigned int seed)
+{
+	_seed = seed;
+	_generator.seed(seed);
+	reset();
+}
+
+void
+SubsetScheduler::reset()
+{
+	_upcoming.clear();
+	_num_calls = 0;
+}
+
+void
+SubsetScheduler::check_subset_(int subset_num) const
+{
+	if (subset_num < 0 || subset_num >= _num_subsets)
+		THROW("subset number out of range");
+}
+
+void
+SubsetScheduler::set_weight(int subset_num, float weight)
+{
+	check_subset_(subset_num);
+	if (!(weight >= 0))
+		THROW("subset weight must be non-negative");
+	_weights[subset_num] = weight;
+	// the next importance sample was drawn with the old weights
+	if (_policy == "importance")
+		_upcoming.clear();
+}
+
+float
+SubsetScheduler::weight(int subset_num) const
+{
+	check_subset_(subset_num);
+	return _weights[subset_num];
+}
+
+std::vector<int>
+SubsetScheduler::herman_meyer_order(int n)
+{
+	std::vector<int> factors;
+	int m = n;
+	for (int p = 2; p*p <= m; p++)
+		while (m % p == 0) {
+			factors.push_back(p);
+			m /= p;
+		}
+	if (m > 1)
+		factors.push_back(m);
+	std::vector<int> order(n);
+	for (int i = 0; i < n; i++) {
+		// reverse the digits of i in the mixed radix given by the factors
+		int k = i;
+		int place = n;
+		int s = 0;
+		for (size_t j = 0; j < factors.size(); j++) {
+			place /= factors[j];
+			s += (k % factors[j]) * place;
+			k /= factors[j];
+		}
+		order[i] = s;
+	}
+	return order;
+}
+
+std::vector<int>
+SubsetScheduler::golden_ratio_order(int n)
+{
+	const double g = (std::sqrt(5.0) - 1) / 2;
+	std::vector<bool> used(n, false);
+	std::vector<int> order(n);
+	double pos = 0;
+	for (int i = 0; i < n; i++) {
+		int best = -1;
+		double best_dist = n;
+		for (int s = 0; s < n; s++) {
+			if (used[s])
+				continue;
+			double d = std::fabs(s - pos);
+			d = std::min(d, n - d);
+			if (d < best_dist) {
+				best_dist = d;
+				best = s;
+			}
+		}
+		used[best] = true;
+		order[i] = best;
+		pos = std::fmod(pos + g*n, (double)n);
+	}
+	return order;
+}
+
+void
+SubsetScheduler::schedule_()
+{
+	const int n = _num_subsets;
+	if (_policy == "importance") {
+		float total = 0;
+		for (int i = 0; i < n; i++)
+			total += _weights[i];
+		if (total <= 0)
+			THROW("all subset weights are zero");
+		std::discrete_distribution<int> dist(_weights.begin(), _weights.end());
+		_upcoming.push_back(dist(_generator));
+		return;
+	}
+	std::vector<int> order;
+	if (_policy == "herman_meyer")
+		order = herman_meyer_order(n);
+	else if (_policy == "golden_ratio")
+		order = golden_ratio_order(n);
+	else {
+		order.resize(n);
+		for (int i = 0; i < n; i++)
+			order[i] = i;
+		if (_policy == "random")
+			std::shuffle(order.begin(), order.end(), _generator);
+	}
+	_upcoming.insert(_upcoming.end(), order.begin(), order.end());
+}
+
+int
+SubsetScheduler::peek()
+{
+	if (_upcoming.empty())
+		schedule_();
+	return _upcoming.front();
+}
+
+int
+SubsetScheduler::next()
+{
+	int s = peek();
+	_upcoming.pop_front();
+	_num_calls++;
+	return s;
+}
+
+void
+SubsetScheduler::save_state(std::ostream& out) const
+{
+	out << _policy << ' ' << _num_subsets << ' ' << _seed << ' '
+		<< _num_calls << '\n';
+	out.precision(9);
+	for (int i = 0; i < _num_subsets; i++)
+		out << _weights[i] << ' ';
+	out << '\n' << _upcoming.size();
+	for (size_t i = 0; i < _upcoming.size(); i++)
+		out << ' ' << _upcoming[i];
+	out << '\n' << _generator << '\n';
+}
+
+void
+SubsetScheduler::load_state(std::istream& in)
+{
+	std::string policy;
+	int num_subsets;
+	unsigned int seed;
+	long long num_calls;
+	in >> policy >> num_subsets >> seed >> num_calls;
+	if (!in || num_subsets < 1)
+		THROW("corrupted subset scheduler state");
+	set_num_subsets(num_subsets);
+	set_policy(policy);
+	std::vector<float> weights(num_subsets);
+	for (int i = 0; i < num_subsets; i++)
+		in >> weights[i];
+	size_t num_upcoming;
+	in >> num_upcoming;
+	std::deque<int> upcoming;
+	for (size_t i = 0; i < num_upcoming && in; i++) {
+		int subset_num;
+		in >> subset_num;
+		upcoming.push_back(subset_num);
+	}
+	std::mt19937 generator;
+	in >> generator;
+	if (!in)
+		THROW("corrupted subset scheduler state");
+	for (size_t i = 0; i < upcoming.size(); i++)
+		check_subset_(upcoming[i]);
+	_seed = seed;
+	_weights = weights;
+	_upcoming = upcoming;
+	_num_calls = num_calls;
+	_generator = generator;
+}
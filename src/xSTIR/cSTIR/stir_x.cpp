@@ -19,10 +19,30 @@ limitations under the License.
 
 */
 
+#include <stdint.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+
 #include "stir/common.h"
 #include "stir/IO/stir_ecat_common.h"
 #include "stir/is_null_ptr.h"
 #include "stir/error.h"
+#include "stir/IndexRange3D.h"
+#include "stir/ViewSegmentNumbers.h"
+#include "stir/recon_buildblock/find_basic_vs_nums_in_subsets.h"
+#include "stir/recon_buildblock/DataSymmetriesForBins.h"
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include <boost/filesystem.hpp>
 
 #include "sirf/STIR/stir_x.h"
 
@@ -471,6 +491,11 @@ PETAcquisitionModel::set_up(
 {
 	Succeeded s = Succeeded::no;
 	if (sptr_projectors_.get()) {
+		ProjectorByBinPairUsingSparseMatrix* ptr_spp =
+			dynamic_cast<ProjectorByBinPairUsingSparseMatrix*>
+			(sptr_projectors_.get());
+		if (ptr_spp)
+			ptr_spp->set_verbose(verbose_);
 		s = sptr_projectors_->set_up
 			(sptr_acq->get_proj_data_info_sptr(), sptr_image->data_sptr());
 		sptr_acq_template_ = sptr_acq;
@@ -480,44 +505,322 @@ PETAcquisitionModel::set_up(
 		if (sptr_asm_ && sptr_asm_->data())
 			s = sptr_asm_->set_up(sptr_acq->get_proj_data_info_sptr());
 	}
+	if (s == Succeeded(Succeeded::yes))
+		set_up_support_();
 	return s;
 }
 
+void
+PETAcquisitionModel::set_image_support(shared_ptr<STIRImageData> sptr_mask)
+{
+	sptr_image_support_ = sptr_mask;
+	if (sptr_acq_template_.get())
+		set_up_support_();
+}
+
+void
+PETAcquisitionModel::cancel_image_support()
+{
+	sptr_image_support_.reset();
+	if (sptr_acq_template_.get())
+		set_up_support_();
+}
+
+void
+PETAcquisitionModel::set_up_support_()
+{
+	// the support is found by unrestricted projection
+	ProjectorByBinPairUsingSparseMatrix* ptr_spp =
+		dynamic_cast<ProjectorByBinPairUsingSparseMatrix*>(sptr_projectors_.get());
+	shared_ptr<PETSparseProjMatrix> sptr_sparse;
+	if (ptr_spp) {
+		sptr_sparse = ptr_spp->sparse_matrix_sptr();
+		sptr_sparse->set_line_support(std::vector<int>(), std::vector<int>());
+	}
+	sptr_acq_support_.reset();
+	support_extent_.clear();
+	support_zero_sinograms_.clear();
+	support_fraction_ = 1.0f;
+	if (!sptr_image_support_.get())
+		return;
+
+	const Image3DF& support = sptr_image_support_->data();
+	if (!support.has_same_characteristics(sptr_image_template_->data()))
+		THROW("image support has different characteristics from image template");
+	shared_ptr<Image3DF> sptr_mask(support.get_empty_copy());
+	Image3DF::const_full_iterator s_iter = support.begin_all();
+	for (Image3DF::full_iterator iter = sptr_mask->begin_all();
+		iter != sptr_mask->end_all(); ++iter, ++s_iter)
+		*iter = *s_iter > 0 ? 1.0f : 0.0f;
+
+	if (verbose_)
+		std::cout << "projecting image support...";
+	shared_ptr<PETAcquisitionData> sptr_ad =
+		sptr_acq_template_->new_acquisition_data();
+	if (ptr_spp)
+		ptr_spp->forward(*sptr_ad->data(), *sptr_mask, 0, 1, true);
+	else
+		sptr_projectors_->get_forward_projector_sptr()->forward_project
+			(*sptr_ad->data(), *sptr_mask, 0, 1, true);
+
+	const ProjData& pd = *sptr_ad->data();
+	const int min_seg = pd.get_min_segment_num();
+	const int max_seg = pd.get_max_segment_num();
+	const int min_view = pd.get_min_view_num();
+	const int max_view = pd.get_max_view_num();
+	const int num_views = pd.get_num_views();
+	const int min_tang = pd.get_min_tangential_pos_num();
+	const int max_tang = pd.get_max_tangential_pos_num();
+	support_extent_.assign(size_t(max_seg - min_seg + 1)*num_views, -1);
+	// lines outside the support have empty tangential ranges
+	std::vector<int> line_min;
+	std::vector<int> line_max;
+	if (sptr_sparse.get()) {
+		line_min.assign(sptr_sparse->num_lines(), max_tang + 1);
+		line_max.assign(sptr_sparse->num_lines(), min_tang - 1);
+	}
+	size_t num_bins = 0;
+	size_t num_in = 0;
+	for (int seg = min_seg; seg <= max_seg; seg++) {
+		SegmentBySinogram<float> segment = pd.get_segment_by_sinogram(seg);
+		const int min_ax = pd.get_min_axial_pos_num(seg);
+		const int max_ax = pd.get_max_axial_pos_num(seg);
+		std::vector<unsigned char> zero(max_ax - min_ax + 1, 1);
+		for (int ax = min_ax; ax <= max_ax; ax++) {
+			for (int view = min_view; view <= max_view; view++) {
+				int lo = max_tang + 1;
+				int hi = min_tang - 1;
+				for (int tang = min_tang; tang <= max_tang; tang++)
+					if (segment[ax][view][tang] > 0) {
+						lo = std::min(lo, tang);
+						hi = std::max(hi, tang);
+						num_in++;
+					}
+				num_bins += max_tang - min_tang + 1;
+				if (lo > hi)
+					continue;
+				zero[ax - min_ax] = 0;
+				int& extent = support_extent_[size_t(seg - min_seg)*num_views + view - min_view];
+				extent = std::max(extent, std::max(std::abs(lo), std::abs(hi)));
+				if (sptr_sparse.get()) {
+					size_t line = sptr_sparse->line_index(seg, view, ax);
+					line_min[line] = lo;
+					line_max[line] = hi;
+				}
+			}
+		}
+		support_zero_sinograms_.push_back(zero);
+	}
+	if (sptr_sparse.get())
+		sptr_sparse->set_line_support(line_min, line_max);
+	sptr_acq_support_ = sptr_ad;
+	support_fraction_ = num_bins > 0 ? float(num_in) / num_bins : 1.0f;
+	if (verbose_)
+		std::cout << "ok (" << 100 * support_fraction_ << "% of bins in support)\n";
+}
+
+void
+PETAcquisitionModel::mask_image_(Image3DF& image) const
+{
+	const Image3DF& mask = sptr_image_support_->data();
+	Image3DF::const_full_iterator m_iter = mask.begin_all();
+	for (Image3DF::full_iterator iter = image.begin_all();
+		iter != image.end_all(); ++iter, ++m_iter)
+		if (!(*m_iter > 0))
+			*iter = 0.0f;
+}
+
+bool
+PETAcquisitionModel::support_tang_range_(
+	const DataSymmetriesForViewSegmentNumbers& symm,
+	const ViewSegmentNumbers& vs, int& min_tang, int& max_tang) const
+{
+	const ProjDataInfo& pdi = *sptr_acq_template_->get_proj_data_info_sptr();
+	min_tang = pdi.get_min_tangential_pos_num();
+	max_tang = pdi.get_max_tangential_pos_num();
+	if (!has_support_())
+		return true;
+	// symmetries may reflect tangential positions, hence the symmetric range
+	std::vector<ViewSegmentNumbers> related;
+	symm.get_related_view_segment_numbers(related, vs);
+	int extent = -1;
+	for (size_t i = 0; i < related.size(); i++)
+		extent = std::max(extent, support_extent_
+			[size_t(related[i].segment_num() - pdi.get_min_segment_num())*
+			pdi.get_num_views() + related[i].view_num() - pdi.get_min_view_num()]);
+	if (extent < 0)
+		return false;
+	min_tang = std::max(min_tang, -extent);
+	max_tang = std::min(max_tang, extent);
+	return true;
+}
+
+void
+PETAcquisitionModel::forward_vs_(const std::vector<ProjData*>& pds,
+	const std::vector<const Image3DF*>& images,
+	int subset_num, int num_subsets, bool zero)
+{
+	size_t nf = images.size();
+	shared_ptr<ForwardProjectorByBin> sptr_fp =
+		sptr_projectors_->get_forward_projector_sptr();
+	shared_ptr<DataSymmetriesForViewSegmentNumbers>
+		sptr_symm(sptr_fp->get_symmetries_used()->clone());
+	const ProjDataInfo& pdi = *pds[0]->get_proj_data_info_sptr();
+	std::vector<ViewSegmentNumbers> vs_nums =
+		detail::find_basic_vs_nums_in_subset(pdi, *sptr_symm,
+		pdi.get_min_segment_num(), pdi.get_max_segment_num(),
+		subset_num, num_subsets);
+	if (zero)
+		for (size_t f = 0; f < nf; f++)
+			pds[f]->fill(0.0f);
+	for (size_t i = 0; i < vs_nums.size(); i++) {
+		int min_tang;
+		int max_tang;
+		bool in_support =
+			support_tang_range_(*sptr_symm, vs_nums[i], min_tang, max_tang);
+		if (!in_support && zero)
+			continue;
+		for (size_t f = 0; f < nf; f++) {
+			RelatedViewgrams<float> viewgrams =
+				pds[f]->get_empty_related_viewgrams(vs_nums[i], sptr_symm);
+			if (in_support)
+				sptr_fp->forward_project(viewgrams, *images[f],
+				viewgrams.get_min_axial_pos_num(),
+				viewgrams.get_max_axial_pos_num(), min_tang, max_tang);
+			pds[f]->set_related_viewgrams(viewgrams);
+		}
+	}
+}
+
+void
+PETAcquisitionModel::backward_vs_(const std::vector<Image3DF*>& images,
+	const std::vector<const ProjData*>& pds, int subset_num, int num_subsets)
+{
+	size_t nf = images.size();
+	shared_ptr<BackProjectorByBin> sptr_bp =
+		sptr_projectors_->get_back_projector_sptr();
+	shared_ptr<DataSymmetriesForViewSegmentNumbers>
+		sptr_symm(sptr_bp->get_symmetries_used()->clone());
+	const ProjDataInfo& pdi = *pds[0]->get_proj_data_info_sptr();
+	std::vector<ViewSegmentNumbers> vs_nums =
+		detail::find_basic_vs_nums_in_subset(pdi, *sptr_symm,
+		pdi.get_min_segment_num(), pdi.get_max_segment_num(),
+		subset_num, num_subsets);
+	for (size_t i = 0; i < vs_nums.size(); i++) {
+		int min_tang;
+		int max_tang;
+		// LORs outside the support only reach voxels outside it
+		if (!support_tang_range_(*sptr_symm, vs_nums[i], min_tang, max_tang))
+			continue;
+		for (size_t f = 0; f < nf; f++) {
+			RelatedViewgrams<float> viewgrams =
+				pds[f]->get_related_viewgrams(vs_nums[i], sptr_symm);
+			sptr_bp->back_project(*images[f], viewgrams,
+				viewgrams.get_min_axial_pos_num(),
+				viewgrams.get_max_axial_pos_num(), min_tang, max_tang);
+		}
+	}
+}
+
+static double
+acquisition_bytes(const PETAcquisitionData& ad)
+{
+	const ProjDataInfo& pdi = *ad.get_proj_data_info_sptr();
+	double n = 0;
+	for (int s = pdi.get_min_segment_num(); s <= pdi.get_max_segment_num(); s++)
+		n += double(pdi.get_num_axial_poss(s))*
+		pdi.get_num_views()*pdi.get_num_tangential_poss();
+	return n*sizeof(float);
+}
+
+static double
+image_bytes(const Image3DF& image)
+{
+	return double(image.size_all())*sizeof(float);
+}
+
 void 
 PETAcquisitionModel::forward(PETAcquisitionData& ad, const STIRImageData& image,
 	int subset_num, int num_subsets, bool zero)
 {
-	shared_ptr<ProjData> sptr_fd = ad.data();
-	sptr_projectors_->get_forward_projector_sptr()->forward_project
-		(*sptr_fd, image.data(), subset_num, num_subsets, zero);
+	stats_.count_forward();
+	project_(ad, image, subset_num, num_subsets, zero);
+	add_terms_(ad);
+}
+
+void
+PETAcquisitionModel::project_(PETAcquisitionData& ad, const STIRImageData& image,
+	int subset_num, int num_subsets, bool zero)
+{
+	// a reference, not a shared pointer: the zero flags set below are only
+	// kept if no one else holds the data
+	ProjData& fd = *ad.data();
+	const Image3DF* ptr_image = &image.data();
+	StageTimer timer(stats_, AcquisitionModelStatistics::PROJECTION,
+		acquisition_bytes(ad) / num_subsets + image_bytes(*ptr_image));
+	shared_ptr<Image3DF> sptr_masked;
+	if (has_support_()) {
+		sptr_masked.reset(ptr_image->clone());
+		mask_image_(*sptr_masked);
+		ptr_image = sptr_masked.get();
+	}
+	ProjectorByBinPairUsingSparseMatrix* ptr_spp =
+		dynamic_cast<ProjectorByBinPairUsingSparseMatrix*>(sptr_projectors_.get());
+	if (ptr_spp)
+		ptr_spp->forward(fd, *ptr_image, subset_num, num_subsets, zero);
+	else if (has_support_()) {
+		std::vector<ProjData*> pds(1, &fd);
+		std::vector<const Image3DF*> images(1, ptr_image);
+		forward_vs_(pds, images, subset_num, num_subsets, zero);
+	}
+	else
+		sptr_projectors_->get_forward_projector_sptr()->forward_project
+			(fd, *ptr_image, subset_num, num_subsets, zero);
+	// all bins not projected are zero
+	if (has_support_() && (zero || num_subsets < 2))
+		ad.set_zero_sinograms(support_zero_sinograms_);
+}
 
+void
+PETAcquisitionModel::add_terms_(PETAcquisitionData& ad)
+{
 	float one = 1.0;
+	const double bytes = acquisition_bytes(ad);
 
 	if (sptr_add_.get()) {
-		std::cout << "additive term added...";
+		if (verbose_)
+			std::cout << "additive term added...";
+		StageTimer timer(stats_, AcquisitionModelStatistics::ADDITIVE, 3 * bytes);
 		ad.axpby(&one, ad, &one, *sptr_add_);
 		//ad.axpby(1.0, ad, 1.0, *sptr_add_);
-		std::cout << "ok\n";
+		if (verbose_)
+			std::cout << "ok\n";
 	}
-	else
+	else if (verbose_)
 		std::cout << "no additive term added\n";
 
 	PETAcquisitionSensitivityModel* sm = sptr_asm_.get();
 	if (sm && sm->data() && !sm->data()->is_trivial()) {
-		std::cout << "applying unnormalisation...";
+		if (verbose_)
+			std::cout << "applying unnormalisation...";
+		StageTimer timer(stats_, AcquisitionModelStatistics::NORMALISATION, 2 * bytes);
 		sptr_asm_->unnormalise(ad);
-		std::cout << "ok\n";
+		if (verbose_)
+			std::cout << "ok\n";
 	}
-	else
+	else if (verbose_)
 		std::cout << "no unnormalisation applied\n";
 
 	if (sptr_background_.get()) {
-		std::cout << "background term added...";
+		if (verbose_)
+			std::cout << "background term added...";
+		StageTimer timer(stats_, AcquisitionModelStatistics::BACKGROUND, 3 * bytes);
 		ad.axpby(&one, ad, &one, *sptr_background_);
 		//ad.axpby(1.0, ad, 1.0, *sptr_background_);
-		std::cout << "ok\n";
+		if (verbose_)
+			std::cout << "ok\n";
 	}
-	else
+	else if (verbose_)
 		std::cout << "no background term added\n";
 }
 
@@ -526,7 +829,11 @@ PETAcquisitionModel::forward(const STIRImageData& image,
 	int subset_num, int num_subsets)
 {
 	shared_ptr<PETAcquisitionData> sptr_ad;
-	sptr_ad = sptr_acq_template_->new_acquisition_data();
+	{
+		StageTimer timer(stats_, AcquisitionModelStatistics::ALLOCATION,
+			acquisition_bytes(*sptr_acq_template_));
+		sptr_ad = sptr_acq_template_->new_acquisition_data();
+	}
 	shared_ptr<ProjData> sptr_fd = sptr_ad->data();
 	//if (num_subsets > 1)
 	//	sptr_fd->fill(0.0f);
@@ -570,30 +877,1050 @@ shared_ptr<STIRImageData>
 PETAcquisitionModel::backward(PETAcquisitionData& ad, 
 	int subset_num, int num_subsets)
 {
+	stats_.count_backward();
 	shared_ptr<STIRImageData> sptr_id;
-	sptr_id = sptr_image_template_->new_image_data();
+	{
+		StageTimer timer(stats_, AcquisitionModelStatistics::ALLOCATION,
+			image_bytes(sptr_image_template_->data()));
+		sptr_id = sptr_image_template_->new_image_data();
+	}
 	shared_ptr<Image3DF> sptr_im = sptr_id->data_sptr();
+	const double bytes = acquisition_bytes(ad);
 
 	//if (sptr_normalisation_.get() && !sptr_normalisation_->is_trivial()) {
 	PETAcquisitionSensitivityModel* sm = sptr_asm_.get();
+	PETAcquisitionData* ptr_ad = &ad;
+	shared_ptr<PETAcquisitionData> sptr_ad;
 	if (sm && sm->data() && !sm->data()->is_trivial()) {
-		std::cout << "applying unnormalisation...";
-		shared_ptr<PETAcquisitionData> sptr_ad(ad.new_acquisition_data());
+		if (verbose_)
+			std::cout << "applying unnormalisation...";
+		{
+			StageTimer timer(stats_, AcquisitionModelStatistics::ALLOCATION, bytes);
+			sptr_ad = ad.new_acquisition_data();
+		}
+		StageTimer timer(stats_, AcquisitionModelStatistics::NORMALISATION, 3 * bytes);
 		sptr_ad->fill(ad);
 		sptr_asm_->unnormalise(*sptr_ad);
 		//sptr_normalisation_->undo(*sptr_ad->data(), 0, 1);
-		std::cout << "ok\n";
+		ptr_ad = sptr_ad.get();
+		if (verbose_)
+			std::cout << "ok\n";
+	}
+	if (verbose_)
 		std::cout << "backprojecting...";
-		sptr_projectors_->get_back_projector_sptr()->back_project
-			(*sptr_im, *sptr_ad, subset_num, num_subsets);
+	{
+		StageTimer timer(stats_, AcquisitionModelStatistics::PROJECTION,
+			bytes / num_subsets + image_bytes(*sptr_im));
+		back_project_(*sptr_im, *ptr_ad, subset_num, num_subsets);
+		if (has_support_())
+			mask_image_(*sptr_im);
+	}
+	if (verbose_)
 		std::cout << "ok\n";
+
+	return sptr_id;
+}
+
+void
+PETAcquisitionModel::back_project_(Image3DF& image, PETAcquisitionData& ad,
+	int subset_num, int num_subsets)
+{
+	ProjectorByBinPairUsingSparseMatrix* ptr_spp =
+		dynamic_cast<ProjectorByBinPairUsingSparseMatrix*>(sptr_projectors_.get());
+	if (ptr_spp)
+		ptr_spp->backward(image, *ad.data(), subset_num, num_subsets);
+	else if (has_support_()) {
+		std::vector<Image3DF*> images(1, &image);
+		std::vector<const ProjData*> pds(1, ad.data().get());
+		backward_vs_(images, pds, subset_num, num_subsets);
 	}
-	else {
-		std::cout << "backprojecting...";
+	else
 		sptr_projectors_->get_back_projector_sptr()->back_project
-			(*sptr_im, ad, subset_num, num_subsets);
-		std::cout << "ok\n";
+			(image, ad, subset_num, num_subsets);
+}
+
+Succeeded
+PETAcquisitionModelUsingMatrix::set_up(
+	shared_ptr<PETAcquisitionData> sptr_acq,
+	shared_ptr<STIRImageData> sptr_image)
+{
+	if (!sptr_matrix_.get())
+		return Succeeded::no;
+	if (use_sparse_matrix_) {
+		if (matrix_cache_path_.size() < 1)
+			THROW("sparse matrix projectors require a matrix cache path");
+		shared_ptr<ProjMatrixByBinFromCache> sptr_cache
+			(new ProjMatrixByBinFromCache(sptr_matrix_, matrix_cache_path_));
+		sptr_cache->set_verbose(verbose_);
+		this->sptr_projectors_.reset
+			(new ProjectorByBinPairUsingSparseMatrix(sptr_cache));
+	}
+	else {
+		shared_ptr<ProjectorPairUsingMatrix> sptr_pp(new ProjectorPairUsingMatrix);
+		if (matrix_cache_path_.size() > 0) {
+			shared_ptr<ProjMatrixByBinFromCache> sptr_cache
+				(new ProjMatrixByBinFromCache(sptr_matrix_, matrix_cache_path_));
+			sptr_cache->set_verbose(verbose_);
+			sptr_pp->set_proj_matrix_sptr(sptr_cache);
+		}
+		else
+			sptr_pp->set_proj_matrix_sptr(sptr_matrix_);
+		this->sptr_projectors_ = sptr_pp;
 	}
+	return PETAcquisitionModel::set_up(sptr_acq, sptr_image);
+}
 
-	return sptr_id;
+void
+PETAcquisitionModel::forward(const std::vector<PETAcquisitionData*>& ads,
+	const std::vector<const STIRImageData*>& images,
+	int subset_num, int num_subsets, bool zero)
+{
+	if (ads.size() != images.size())
+		THROW("numbers of acquisition data and images to project differ");
+	if (images.size() < 1)
+		return;
+	size_t nf = images.size();
+	double bytes = 0;
+	for (size_t f = 0; f < nf; f++) {
+		stats_.count_forward();
+		bytes += acquisition_bytes(*ads[f]) / num_subsets +
+			image_bytes(images[f]->data());
+	}
+	{
+		StageTimer timer(stats_, AcquisitionModelStatistics::PROJECTION, bytes);
+		std::vector<ProjData*> pds(nf);
+		std::vector<const Image3DF*> ims(nf);
+		std::vector<shared_ptr<Image3DF> > masked;
+		for (size_t f = 0; f < nf; f++) {
+			pds[f] = ads[f]->data().get();
+			ims[f] = &images[f]->data();
+			if (has_support_()) {
+				shared_ptr<Image3DF> sptr_im(ims[f]->clone());
+				mask_image_(*sptr_im);
+				masked.push_back(sptr_im);
+				ims[f] = sptr_im.get();
+			}
+		}
+
+		ProjectorByBinPairUsingSparseMatrix* ptr_spp =
+			dynamic_cast<ProjectorByBinPairUsingSparseMatrix*>(sptr_projectors_.get());
+		if (ptr_spp)
+			ptr_spp->forward(pds, ims, subset_num, num_subsets, zero);
+		else
+			forward_vs_(pds, ims, subset_num, num_subsets, zero);
+	}
+
+	for (size_t f = 0; f < nf; f++) {
+		if (has_support_() && (zero || num_subsets < 2))
+			ads[f]->set_zero_sinograms(support_zero_sinograms_);
+		add_terms_(*ads[f]);
+	}
+}
+
+void
+PETAcquisitionModel::backward(const std::vector<STIRImageData*>& images,
+	const std::vector<PETAcquisitionData*>& ads,
+	int subset_num, int num_subsets)
+{
+	if (ads.size() != images.size())
+		THROW("numbers of acquisition data and images to project differ");
+	if (images.size() < 1)
+		return;
+	size_t nf = images.size();
+
+	PETAcquisitionSensitivityModel* sm = sptr_asm_.get();
+	bool unnormalise = sm && sm->data() && !sm->data()->is_trivial();
+	std::vector<shared_ptr<PETAcquisitionData> > unnormalised;
+	std::vector<const ProjData*> pds(nf);
+	std::vector<Image3DF*> ims(nf);
+	double bytes = 0;
+	for (size_t f = 0; f < nf; f++) {
+		stats_.count_backward();
+		PETAcquisitionData* ptr_ad = ads[f];
+		const double ad_bytes = acquisition_bytes(*ptr_ad);
+		if (unnormalise) {
+			shared_ptr<PETAcquisitionData> sptr_ad;
+			{
+				StageTimer timer(stats_,
+					AcquisitionModelStatistics::ALLOCATION, ad_bytes);
+				sptr_ad = ptr_ad->new_acquisition_data();
+			}
+			StageTimer timer(stats_,
+				AcquisitionModelStatistics::NORMALISATION, 3 * ad_bytes);
+			sptr_ad->fill(*ptr_ad);
+			sptr_asm_->unnormalise(*sptr_ad);
+			unnormalised.push_back(sptr_ad);
+			ptr_ad = sptr_ad.get();
+		}
+		pds[f] = ptr_ad->data().get();
+		ims[f] = &images[f]->data();
+		bytes += ad_bytes / num_subsets + image_bytes(*ims[f]);
+	}
+
+	StageTimer timer(stats_, AcquisitionModelStatistics::PROJECTION, bytes);
+	for (size_t f = 0; f < nf; f++)
+		ims[f]->fill(0.0f);
+	ProjectorByBinPairUsingSparseMatrix* ptr_spp =
+		dynamic_cast<ProjectorByBinPairUsingSparseMatrix*>(sptr_projectors_.get());
+	if (ptr_spp)
+		ptr_spp->backward(ims, pds, subset_num, num_subsets);
+	else
+		backward_vs_(ims, pds, subset_num, num_subsets);
+	if (has_support_())
+		for (size_t f = 0; f < nf; f++)
+			mask_image_(*ims[f]);
+}
+
+Succeeded
+xSTIR_FBP2DReconstruction::reconstruct_in_slabs_(shared_ptr<Image3DF> sptr_image)
+{
+	int nt = _num_threads;
+#ifdef _OPENMP
+	if (nt < 1)
+		nt = omp_get_max_threads();
+#else
+	nt = 1;
+#endif
+	const ProjDataInfoCylindrical* ptr_cyl =
+		dynamic_cast<const ProjDataInfoCylindrical*>
+		(proj_data_ptr->get_proj_data_info_ptr());
+	if (nt < 2 || !ptr_cyl)
+		return reconstruct(sptr_image);
+
+	// the slices are reconstructed from direct sinograms, which are
+	// obtained from the oblique ones by SSRB as in STIR FBP2D
+	shared_ptr<ProjData> sptr_pd = proj_data_ptr;
+	int n = num_segments_to_combine;
+	if (n < 0)
+		n = sptr_pd->get_num_segments();
+	if (n > 1) {
+		shared_ptr<ProjDataInfo> sptr_info(SSRB(*ptr_cyl, n, 1, 0, (n - 1) / 2));
+		shared_ptr<ProjData> sptr_ssrb
+			(new ProjDataInMemory(sptr_pd->get_exam_info_sptr(), sptr_info));
+		SSRB(*sptr_ssrb, *sptr_pd);
+		sptr_pd = sptr_ssrb;
+	}
+	int min_ax = sptr_pd->get_min_axial_pos_num(0);
+	int num_ax = sptr_pd->get_max_axial_pos_num(0) - min_ax + 1;
+
+	// STIR places the axial positions of segment 0 symmetrically about the
+	// centre of the image, so a slab of sinograms is reconstructed into
+	// the planes of an image of the slab's size; these are the slab's own
+	// planes of the whole image if there is one plane per axial position
+	const Voxels3DF* ptr_voxels = dynamic_cast<const Voxels3DF*>(sptr_image.get());
+	const ProjDataInfoCylindrical* ptr_info =
+		dynamic_cast<const ProjDataInfoCylindrical*>
+		(sptr_pd->get_proj_data_info_ptr());
+	if (!ptr_voxels || !ptr_info ||
+		sptr_image->get_length() != num_ax ||
+		std::abs(ptr_voxels->get_voxel_size().z() -
+		ptr_info->get_axial_sampling(0)) >
+		1e-3*ptr_info->get_axial_sampling(0))
+		return reconstruct(sptr_image);
+	nt = std::min(nt, num_ax);
+	int min_z = sptr_image->get_min_index();
+	int min_y = (*sptr_image)[min_z].get_min_index();
+	int max_y = (*sptr_image)[min_z].get_max_index();
+	int min_x = (*sptr_image)[min_z][min_y].get_min_index();
+	int max_x = (*sptr_image)[min_z][min_y].get_max_index();
+
+	// each slab is reconstructed by its own STIR object with its own
+	// backprojector and ramp filter, the sinograms being copied serially
+	// beforehand
+	std::vector<shared_ptr<ProjData> > slab_data(nt);
+	for (int t = 0; t < nt; t++) {
+		int a0 = min_ax + t*num_ax / nt;
+		int a1 = min_ax + (t + 1)*num_ax / nt - 1;
+		shared_ptr<ProjDataInfo> sptr_info(sptr_pd->get_proj_data_info_ptr()->clone());
+		sptr_info->reduce_segment_range(0, 0);
+		sptr_info->set_min_axial_pos_num(a0, 0);
+		sptr_info->set_max_axial_pos_num(a1, 0);
+		slab_data[t].reset
+			(new ProjDataInMemory(sptr_pd->get_exam_info_sptr(), sptr_info));
+		for (int a = a0; a <= a1; a++)
+			slab_data[t]->set_sinogram(sptr_pd->get_sinogram(a, 0));
+	}
+
+	int failed = 0;
+#pragma omp parallel for num_threads(nt) schedule(static, 1) reduction(+:failed)
+	for (int t = 0; t < nt; t++) {
+		int a0 = min_ax + t*num_ax / nt;
+		int a1 = min_ax + (t + 1)*num_ax / nt - 1;
+		shared_ptr<Image3DF> sptr_slab(new Voxels3DF
+			(sptr_image->get_exam_info_sptr(),
+			IndexRange3D(0, a1 - a0, min_y, max_y, min_x, max_x),
+			ptr_voxels->get_origin(), ptr_voxels->get_voxel_size()));
+		FBP2DReconstruction recon(slab_data[t], alpha_ramp, fc_ramp, pad_in_s, 1);
+		if (recon.reconstruct(sptr_slab) != Succeeded::yes) {
+			failed++;
+			continue;
+		}
+		// the planes of different slabs are disjoint
+		for (int a = a0; a <= a1; a++)
+			(*sptr_image)[min_z + a - min_ax] = (*sptr_slab)[a - a0];
+	}
+	if (failed)
+		return Succeeded::no;
+	return Succeeded::yes;
+}
+
+void
+xSTIR_QuadraticPrior3DF::compute_gradient(Image3DF& prior_gradient,
+	const Image3DF& current_image_estimate)
+{
+	const float pf = get_penalisation_factor();
+	if (pf == 0) {
+		prior_gradient.fill(0);
+		return;
+	}
+	// STIR writes the gradient to file in this case
+	if (gradient_filename_prefix.size() > 0) {
+		QuadraticPrior<float>::compute_gradient
+			(prior_gradient, current_image_estimate);
+		return;
+	}
+	const Voxels3DF* ptr_voxels =
+		dynamic_cast<const Voxels3DF*>(&current_image_estimate);
+	if (!ptr_voxels)
+		THROW("QuadraticPrior: image must be voxels on cartesian grid");
+
+	if (weights.get_length() == 0) {
+		// same weights as STIR computes: inverse distance in units of x-size
+		const CartesianCoordinate3D<float> gs = ptr_voxels->get_grid_spacing();
+		const int min_dz = only_2D ? 0 : -1;
+		const int max_dz = only_2D ? 0 : 1;
+		weights = Array<3, float>(IndexRange3D(min_dz, max_dz, -1, 1, -1, 1));
+		for (int z = min_dz; z <= max_dz; z++)
+			for (int y = -1; y <= 1; y++)
+				for (int x = -1; x <= 1; x++)
+					if (z == 0 && y == 0 && x == 0)
+						weights[0][0][0] = 0;
+					else
+						weights[z][y][x] = gs.x() /
+						std::sqrt(square(x*gs.x()) + square(y*gs.y()) +
+							square(z*gs.z()));
+	}
+
+	shared_ptr<Image3DF> sptr_kappa = get_kappa_sptr();
+	const bool do_kappa = !is_null_ptr(sptr_kappa);
+	if (do_kappa && !sptr_kappa->has_same_characteristics(current_image_estimate))
+		THROW("QuadraticPrior: kappa image has different characteristics");
+
+	// non-zero weights as a flat list of (dz, dy, dx, w)
+	std::vector<int> offsets;
+	std::vector<float> w;
+	for (int dz = weights.get_min_index(); dz <= weights.get_max_index(); dz++)
+		for (int dy = weights[dz].get_min_index();
+			dy <= weights[dz].get_max_index(); dy++)
+			for (int dx = weights[dz][dy].get_min_index();
+				dx <= weights[dz][dy].get_max_index(); dx++)
+				if (weights[dz][dy][dx] != 0) {
+					offsets.push_back(dz);
+					offsets.push_back(dy);
+					offsets.push_back(dx);
+					w.push_back(weights[dz][dy][dx]);
+				}
+	const int nw = w.size();
+
+	const ImageRowTable<const float> u(current_image_estimate);
+	const ImageRowTable<float> g(prior_gradient);
+	const ImageRowTable<const float> k(do_kappa ?
+		*sptr_kappa : current_image_estimate);
+	if (!u.regular())
+		THROW("QuadraticPrior: image with regular range expected");
+	if (!g.same_size(u))
+		THROW("QuadraticPrior: gradient and image sizes differ");
+	const int nz = u.nz;
+	const int ny = u.ny;
+	const int nx = u.nx;
+	const long long num_rows = (long long)nz*ny;
+
+#pragma omp parallel
+	{
+		std::vector<float> acc(nx);
+#pragma omp for schedule(static)
+		for (long long r = 0; r < num_rows; r++) {
+			const int z = int(r / ny);
+			const int y = int(r % ny);
+			const float* c = u.row(z, y);
+			const float* kc = k.row(z, y);
+			float* a = &acc[0];
+			std::fill(acc.begin(), acc.end(), 0.0f);
+			for (int i = 0; i < nw; i++) {
+				const int zn = z + offsets[3 * i];
+				const int yn = y + offsets[3 * i + 1];
+				if (zn < 0 || zn >= nz || yn < 0 || yn >= ny)
+					continue;
+				const int dx = offsets[3 * i + 2];
+				const int x0 = std::max(0, -dx);
+				const int x1 = nx - std::max(0, dx);
+				const float wi = w[i];
+				const float* n = u.row(zn, yn) + dx;
+				if (do_kappa) {
+					const float* kn = k.row(zn, yn) + dx;
+#pragma omp simd
+					for (int x = x0; x < x1; x++)
+						a[x] += wi*(c[x] - n[x])*kc[x] * kn[x];
+				}
+				else {
+#pragma omp simd
+					for (int x = x0; x < x1; x++)
+						a[x] += wi*(c[x] - n[x]);
+				}
+			}
+			float* out = g.row(z, y);
+#pragma omp simd
+			for (int x = 0; x < nx; x++)
+				out[x] = pf*a[x];
+		}
+	}
+}
+
+Succeeded
+xSTIR_PLSPrior3DF::set_up(shared_ptr<Image3DF> const& target_sptr)
+{
+	Succeeded s = PLSPrior<float>::set_up(target_sptr);
+	if (s == Succeeded::yes && !is_null_ptr(get_anatomical_image_sptr()))
+		update_anatomical_gradient_(*target_sptr);
+	return s;
+}
+
+void
+xSTIR_PLSPrior3DF::update_anatomical_gradient_(const Image3DF& image)
+{
+	shared_ptr<Image3DF> sptr_anat = get_anatomical_image_sptr();
+	if (is_null_ptr(sptr_anat))
+		THROW("PLSPrior: anatomical image not set");
+	const float eta = get_eta();
+	if (sptr_anat == _sptr_xi_source && eta == _xi_eta && only_2D == _xi_only_2D)
+		return;
+	if (!sptr_anat->has_same_characteristics(image))
+		THROW("PLSPrior: anatomical image has different characteristics");
+
+	const ImageRowTable<const float> v(*sptr_anat);
+	if (!v.regular())
+		THROW("PLSPrior: anatomical image with regular range expected");
+	const int nz = v.nz;
+	const int ny = v.ny;
+	const int nx = v.nx;
+	const size_t n = size_t(nz)*ny*nx;
+	for (int i = 0; i < 3; i++)
+		_xi[i].assign(n, 0.0f);
+	const long long num_rows = (long long)nz*ny;
+	const float eta2 = eta*eta;
+	const bool do_z = !only_2D;
+
+#pragma omp parallel for schedule(static)
+	for (long long r = 0; r < num_rows; r++) {
+		const int z = int(r / ny);
+		const int y = int(r % ny);
+		const float* c = v.row(z, y);
+		const float* cy = y + 1 < ny ? v.row(z, y + 1) : c;
+		const float* cz = do_z && z + 1 < nz ? v.row(z + 1, y) : c;
+		float* xz = &_xi[0][size_t(r)*nx];
+		float* xy = &_xi[1][size_t(r)*nx];
+		float* xx = &_xi[2][size_t(r)*nx];
+		// differences with the row itself are zero at the upper edges
+#pragma omp simd
+		for (int x = 0; x < nx - 1; x++)
+			xx[x] = c[x + 1] - c[x];
+		xx[nx - 1] = 0;
+#pragma omp simd
+		for (int x = 0; x < nx; x++) {
+			xy[x] = cy[x] - c[x];
+			xz[x] = cz[x] - c[x];
+			const float norm =
+				std::sqrt(eta2 + xz[x] * xz[x] + xy[x] * xy[x] + xx[x] * xx[x]);
+			if (norm > 0) {
+				xz[x] /= norm;
+				xy[x] /= norm;
+				xx[x] /= norm;
+			}
+		}
+	}
+	_sptr_xi_source = sptr_anat;
+	_xi_eta = eta;
+	_xi_only_2D = only_2D;
+}
+
+double
+xSTIR_PLSPrior3DF::penalty_(const Image3DF& image, bool compute_q)
+{
+	update_anatomical_gradient_(image);
+	shared_ptr<Image3DF> sptr_kappa = get_kappa_sptr();
+	const bool do_kappa = !is_null_ptr(sptr_kappa);
+	if (do_kappa && !sptr_kappa->has_same_characteristics(image))
+		THROW("PLSPrior: kappa image has different characteristics");
+
+	const ImageRowTable<const float> u(image);
+	const ImageRowTable<const float> k(do_kappa ? *sptr_kappa : image);
+	if (!u.regular())
+		THROW("PLSPrior: image with regular range expected");
+	const int nz = u.nz;
+	const int ny = u.ny;
+	const int nx = u.nx;
+	if (_xi[0].size() != size_t(nz)*ny*nx)
+		THROW("PLSPrior: image and anatomical image sizes differ");
+	if (compute_q)
+		for (int i = 0; i < 3; i++)
+			_q[i].resize(_xi[0].size());
+	const long long num_rows = (long long)nz*ny;
+	const float alpha2 = get_alpha()*get_alpha();
+	const bool do_z = !only_2D;
+	double sum = 0;
+
+#pragma omp parallel reduction(+:sum)
+	{
+		std::vector<float> gz(nx);
+		std::vector<float> gy(nx);
+		std::vector<float> gx(nx);
+#pragma omp for schedule(static)
+		for (long long r = 0; r < num_rows; r++) {
+			const int z = int(r / ny);
+			const int y = int(r % ny);
+			const size_t i0 = size_t(r)*nx;
+			const float* c = u.row(z, y);
+			const float* cy = y + 1 < ny ? u.row(z, y + 1) : c;
+			const float* cz = do_z && z + 1 < nz ? u.row(z + 1, y) : c;
+			const float* kc = k.row(z, y);
+			const float* xz = &_xi[0][i0];
+			const float* xy = &_xi[1][i0];
+			const float* xx = &_xi[2][i0];
+#pragma omp simd
+			for (int x = 0; x < nx - 1; x++)
+				gx[x] = c[x + 1] - c[x];
+			gx[nx - 1] = 0;
+			double row_sum = 0;
+#pragma omp simd reduction(+:row_sum)
+			for (int x = 0; x < nx; x++) {
+				gy[x] = cy[x] - c[x];
+				gz[x] = cz[x] - c[x];
+				const float ip = gz[x] * xz[x] + gy[x] * xy[x] + gx[x] * xx[x];
+				const float t = alpha2 +
+					gz[x] * gz[x] + gy[x] * gy[x] + gx[x] * gx[x] - ip*ip;
+				// t >= alpha^2 in exact arithmetic, as |xi| < 1
+				const float psi = std::sqrt(std::max(t, alpha2));
+				const float kappa = do_kappa ? kc[x] : 1.0f;
+				row_sum += kappa*psi;
+				const float s = psi > 0 ? kappa / psi : 0.0f;
+				gz[x] = s*(gz[x] - ip*xz[x]);
+				gy[x] = s*(gy[x] - ip*xy[x]);
+				gx[x] = s*(gx[x] - ip*xx[x]);
+			}
+			sum += row_sum;
+			if (compute_q) {
+				std::copy(gz.begin(), gz.end(), _q[0].begin() + i0);
+				std::copy(gy.begin(), gy.end(), _q[1].begin() + i0);
+				std::copy(gx.begin(), gx.end(), _q[2].begin() + i0);
+			}
+		}
+	}
+	return sum;
+}
+
+double
+xSTIR_PLSPrior3DF::compute_value(const Image3DF& current_image_estimate)
+{
+	const float pf = get_penalisation_factor();
+	if (pf == 0)
+		return 0.0;
+	return pf*penalty_(current_image_estimate, false);
+}
+
+void
+xSTIR_PLSPrior3DF::compute_gradient(Image3DF& prior_gradient,
+	const Image3DF& current_image_estimate)
+{
+	const float pf = get_penalisation_factor();
+	if (pf == 0) {
+		prior_gradient.fill(0);
+		return;
+	}
+	penalty_(current_image_estimate, true);
+
+	// the gradient is minus the backward difference divergence of q
+	const ImageRowTable<float> g(prior_gradient);
+	const int nz = g.nz;
+	const int ny = g.ny;
+	const int nx = g.nx;
+	if (_q[0].size() != size_t(nz)*ny*nx)
+		THROW("PLSPrior: gradient and image sizes differ");
+	const long long num_rows = (long long)nz*ny;
+	const bool do_z = !only_2D;
+	const float* qz = &_q[0][0];
+	const float* qy = &_q[1][0];
+	const float* qx = &_q[2][0];
+
+#pragma omp parallel for schedule(static)
+	for (long long r = 0; r < num_rows; r++) {
+		const int z = int(r / ny);
+		const int y = int(r % ny);
+		const size_t i = size_t(r)*nx;
+		float* out = g.row(z, y);
+		out[0] = -qx[i];
+#pragma omp simd
+		for (int x = 1; x < nx; x++)
+			out[x] = qx[i + x - 1] - qx[i + x];
+		if (y > 0) {
+#pragma omp simd
+			for (int x = 0; x < nx; x++)
+				out[x] += qy[i - nx + x] - qy[i + x];
+		}
+		else {
+#pragma omp simd
+			for (int x = 0; x < nx; x++)
+				out[x] -= qy[i + x];
+		}
+		if (do_z) {
+			const size_t slice = size_t(ny)*nx;
+			if (z > 0) {
+#pragma omp simd
+				for (int x = 0; x < nx; x++)
+					out[x] += qz[i - slice + x] - qz[i + x];
+			}
+			else {
+#pragma omp simd
+				for (int x = 0; x < nx; x++)
+					out[x] -= qz[i + x];
+			}
+		}
+#pragma omp simd
+		for (int x = 0; x < nx; x++)
+			out[x] *= pf;
+	}
+}
+
+Succeeded
+xSTIR_PoissonLogLikelihoodWithLinearModelForMeanAndListModeDataWithProjMatrixByBin3DF::
+set_up(shared_ptr<Image3DF> const& sptr_image)
+{
+	// STIR opens the listmode file in post_processing(), which is not called
+	// when the parameters are set by the methods of this class
+	if (is_null_ptr(list_mode_data_sptr) && post_processing())
+		return Succeeded::no;
+	Succeeded s = stir::PoissonLogLikelihoodWithLinearModelForMeanAndListModeDataWithProjMatrixByBin
+		<Image3DF>::set_up(sptr_image);
+	if (s == Succeeded::yes)
+		load_additive_term_();
+	return s;
+}
+
+void
+xSTIR_PoissonLogLikelihoodWithLinearModelForMeanAndListModeDataWithProjMatrixByBin3DF::
+load_additive_term_()
+{
+	// the additive term is looked up for every event, so it is kept in memory
+	_add_segments.clear();
+	if (is_null_ptr(additive_proj_data_sptr))
+		return;
+	const ProjDataInfo& pdi = *proj_data_info_cyl_uncompressed_ptr;
+	const ProjData& add = *additive_proj_data_sptr;
+	if (add.get_min_segment_num() > pdi.get_min_segment_num() ||
+		add.get_max_segment_num() < pdi.get_max_segment_num())
+		THROW("listmode additive term does not cover the listmode data segments");
+	_add_min_seg = pdi.get_min_segment_num();
+	for (int seg = pdi.get_min_segment_num(); seg <= pdi.get_max_segment_num(); seg++)
+		_add_segments.push_back(shared_ptr<SegmentBySinogram<float> >
+			(new SegmentBySinogram<float>(add.get_segment_by_sinogram(seg))));
+}
+
+void
+xSTIR_PoissonLogLikelihoodWithLinearModelForMeanAndListModeDataWithProjMatrixByBin3DF::
+compute_sub_gradient_without_penalty_plus_sensitivity
+(Image3DF& gradient, const Image3DF& current_estimate, const int subset_num)
+{
+	const double start_time = frame_defs.get_start_time(current_frame_num);
+	const double end_time = frame_defs.get_end_time(current_frame_num);
+	const float max_quotient = 10000.F;
+	const ProjDataInfo& pdi = *proj_data_info_cyl_uncompressed_ptr;
+	// the additive term may have been set after set_up()
+	if (!is_null_ptr(additive_proj_data_sptr) && _add_segments.size() < 1)
+		load_additive_term_();
+	shared_ptr<DataSymmetriesForBins>
+		sptr_symm(PM_sptr->get_symmetries_ptr()->clone());
+	shared_ptr<CListRecord> sptr_record = list_mode_data_sptr->get_empty_record_sptr();
+	CListRecord& record = *sptr_record;
+	// rows of the cached matrix are read from a read-only mapped file
+	const bool lock = !dynamic_cast<ProjMatrixByBinFromCache*>(PM_sptr.get());
+
+	int nt = 1;
+#ifdef _OPENMP
+	nt = omp_get_max_threads();
+#endif
+	// each thread backprojects into its own image
+	gradient.fill(0);
+	std::vector<shared_ptr<Image3DF> > thread_grads;
+	std::vector<Image3DF*> grads(1, &gradient);
+	for (int t = 1; t < nt; t++) {
+		thread_grads.push_back(shared_ptr<Image3DF>(gradient.get_empty_copy()));
+		grads.push_back(thread_grads.back().get());
+	}
+
+	list_mode_data_sptr->reset();
+	std::vector<Bin> bins;
+	std::vector<float> add_values;
+	bins.reserve(_batch_size);
+	double current_time = 0;
+	long long num_events = 0;
+	bool more_events = true;
+	while (more_events) {
+		// list mode data are sequential, so the events are read by one thread
+		bins.clear();
+		add_values.clear();
+		while ((int)bins.size() < _batch_size) {
+			if (list_mode_data_sptr->get_next_record(record) == Succeeded::no) {
+				more_events = false;
+				break;
+			}
+			if (record.is_time()) {
+				current_time = record.time().get_time_in_secs();
+				if (do_time_frame && current_time >= end_time) {
+					more_events = false;
+					break;
+				}
+				continue;
+			}
+			if (do_time_frame && current_time < start_time)
+				continue;
+			if (!record.is_event() || !record.event().is_prompt())
+				continue;
+			Bin bin;
+			bin.set_bin_value(1.0f);
+			record.event().get_bin(bin, pdi);
+			if (bin.get_bin_value() != 1.0f ||
+				bin.segment_num() < pdi.get_min_segment_num() ||
+				bin.segment_num() > pdi.get_max_segment_num() ||
+				bin.tangential_pos_num() < pdi.get_min_tangential_pos_num() ||
+				bin.tangential_pos_num() > pdi.get_max_tangential_pos_num() ||
+				bin.axial_pos_num() < pdi.get_min_axial_pos_num(bin.segment_num()) ||
+				bin.axial_pos_num() > pdi.get_max_axial_pos_num(bin.segment_num()))
+				continue;
+			if (num_subsets > 1) {
+				Bin basic_bin = bin;
+				sptr_symm->find_basic_bin(basic_bin);
+				if (basic_bin.view_num() % num_subsets != subset_num)
+					continue;
+			}
+			bins.push_back(bin);
+			if (_add_segments.size() > 0)
+				add_values.push_back((*_add_segments[bin.segment_num() - _add_min_seg])
+				[bin.axial_pos_num()][bin.view_num()][bin.tangential_pos_num()]);
+		}
+		num_events += bins.size();
+
+		const long long n = bins.size();
+		const bool add = add_values.size() > 0;
+#pragma omp parallel num_threads(nt)
+		{
+#ifdef _OPENMP
+			Image3DF& grad = *grads[omp_get_thread_num()];
+#else
+			Image3DF& grad = *grads[0];
+#endif
+			ProjMatrixElemsForOneBin row;
+#pragma omp for schedule(dynamic, 256)
+			for (long long i = 0; i < n; i++) {
+				Bin bin = bins[i];
+				if (lock) {
+#pragma omp critical(SIRF_LISTMODE_MATRIX)
+					PM_sptr->get_proj_matrix_elems_for_one_bin(row, bin);
+				}
+				else
+					PM_sptr->get_proj_matrix_elems_for_one_bin(row, bin);
+				Bin fwd_bin = bin;
+				fwd_bin.set_bin_value(0.0f);
+				row.forward_project(fwd_bin, current_estimate);
+				float fwd = fwd_bin.get_bin_value();
+				if (add)
+					fwd += add_values[i];
+				// each event counts 1
+				if (1.0f > max_quotient*fwd)
+					continue;
+				bin.set_bin_value(1.0f / fwd);
+				row.back_project(grad, bin);
+			}
+		}
+	}
+	for (size_t t = 0; t < thread_grads.size(); t++)
+		gradient += *thread_grads[t];
+	if (_verbose)
+		std::cout << num_events << " events processed\n";
+}
+
+void
+xSTIR_OSMAPOSLReconstruction3DF::set_up_prefetch()
+{
+	PoissonLogLikelihoodWithLinearModelForMeanAndProjData<Image3DF>* ptr_obj =
+		dynamic_cast<PoissonLogLikelihoodWithLinearModelForMeanAndProjData
+		<Image3DF>*>(get_objective_function_sptr().get());
+	if (!ptr_obj) {
+		_sptr_prefetch.reset();
+		return;
+	}
+	shared_ptr<ProjData> sptr_pd = ptr_obj->get_proj_data_sptr();
+	// undo the wrapping done by a previous set_up
+	ProjDataWithPrefetch* ptr_pf =
+		dynamic_cast<ProjDataWithPrefetch*>(sptr_pd.get());
+	if (ptr_pf)
+		sptr_pd = ptr_pf->source_sptr();
+	if (_prefetch_memory > 0 &&
+		!dynamic_cast<ProjDataInMemory*>(sptr_pd.get())) {
+		_sptr_prefetch.reset(new ProjDataWithPrefetch
+			(sptr_pd, size_t(_prefetch_memory) << 20));
+		ptr_obj->set_proj_data_sptr(_sptr_prefetch);
+	}
+	else {
+		_sptr_prefetch.reset();
+		if (ptr_pf)
+			ptr_obj->set_proj_data_sptr(sptr_pd);
+	}
+}
+
+void
+xSTIR_OSMAPOSLReconstruction3DF::update(Image3DF& image)
+{
+	int next_subset = -1;
+	if (_sptr_scheduler.get()) {
+		SubsetScheduler& scheduler = *_sptr_scheduler;
+		if (randomise_subset_order)
+			THROW("subset scheduler cannot be used with randomised subset order");
+		if (scheduler.num_subsets() != num_subsets)
+			THROW("subset scheduler number of subsets differs from reconstruction's");
+		const int subset = scheduler.next();
+		// STIR derives the subset number from the subiteration number
+		const int shift = (subiteration_num - start_subiteration_num) % num_subsets;
+		start_subset_num = (subset - shift + num_subsets) % num_subsets;
+		if (get_subset_num() != subset)
+			THROW("failed to select the subset given by the scheduler");
+		next_subset = scheduler.peek();
+	}
+	// the order of subsets is only known in advance if it is not random
+	else if (!randomise_subset_order)
+		next_subset = (get_subset_num() + 1) % num_subsets;
+
+	if (_sptr_prefetch.get() && next_subset >= 0) {
+		PoissonLogLikelihoodWithLinearModelForMeanAndProjData<Image3DF>& obj =
+			dynamic_cast<PoissonLogLikelihoodWithLinearModelForMeanAndProjData
+			<Image3DF>&>(*get_objective_function_sptr());
+		const ProjDataInfo& pdi = *_sptr_prefetch->get_proj_data_info_ptr();
+		const int max_seg = std::min(obj.get_max_segment_num_to_process(),
+			pdi.get_max_segment_num());
+		const int min_seg = std::max(-max_seg, pdi.get_min_segment_num());
+		_sptr_prefetch->prefetch_subset
+			(*obj.get_projector_pair().get_symmetries_used(),
+			min_seg, max_seg, next_subset, num_subsets);
+	}
+	((xSTIR_IterativeReconstruction3DF*)this)->update(image);
+}
+
+static const char RECON_STATE_MAGIC[8] = { 'S', 'I', 'R', 'F', 'R', 'S', 'T', '2' };
+
+struct ReconstructionStateHeader {
+	char magic[8];
+	int32_t subiteration_num;
+	int32_t start_subiteration_num;
+	int32_t start_subset_num;
+	int32_t num_subsets;
+	int32_t num_sensitivities;
+	int32_t nz;
+	int32_t ny;
+	int32_t nx;
+	// size of the subset scheduler state text, 0 if none
+	int32_t scheduler_state_size;
+};
+
+static void
+write_image_rows(std::ostream& out, const Image3DF& image)
+{
+	const ImageRowTable<const float> rows(image);
+	if (!rows.regular())
+		THROW("image with regular range expected");
+	for (size_t r = 0; r < rows.num_rows(); r++)
+		out.write((const char*)rows.row(r), rows.nx*sizeof(float));
+}
+
+static void
+read_image_rows(std::istream& in, Image3DF& image)
+{
+	const ImageRowTable<float> rows(image);
+	if (!rows.regular())
+		THROW("image with regular range expected");
+	for (size_t r = 0; r < rows.num_rows(); r++)
+		in.read((char*)rows.row(r), rows.nx*sizeof(float));
+}
+
+// scratch directory removed with its contents when going out of scope
+class ScratchDirectory {
+public:
+	ScratchDirectory(const boost::filesystem::path& path) : _path(path)
+	{
+		boost::filesystem::create_directory(_path);
+	}
+	~ScratchDirectory()
+	{
+		boost::system::error_code ec;
+		boost::filesystem::remove_all(_path, ec);
+	}
+	std::string file(const std::string& name) const
+	{
+		return (_path / name).string();
+	}
+private:
+	boost::filesystem::path _path;
+};
+
+// the sensitivity files are removed with their scratch directory, so that
+// any later set-up must recompute the sensitivities
+static void
+forget_sensitivity_files(PoissonLogLhLinModMean3DF& obj, int num_sens)
+{
+	obj.set_recompute_sensitivity(true);
+	if (num_sens == 1)
+		obj.set_sensitivity_filename("");
+}
+
+void
+xSTIR_IterativeReconstruction3DF::save_state
+(const std::string& filename, const Image3DF& image,
+	const SubsetScheduler* ptr_scheduler)
+{
+	const ImageRowTable<const float> rows(image);
+	if (!rows.regular())
+		THROW("cannot save reconstruction state of irregular image");
+	PoissonLogLhLinModMean3DF* ptr_obj =
+		dynamic_cast<PoissonLogLhLinModMean3DF*>
+		(get_objective_function_sptr().get());
+
+	std::string scheduler_state;
+	if (ptr_scheduler) {
+		std::ostringstream state;
+		ptr_scheduler->save_state(state);
+		scheduler_state = state.str();
+	}
+
+	ReconstructionStateHeader header;
+	memcpy(header.magic, RECON_STATE_MAGIC, sizeof(header.magic));
+	header.subiteration_num = subiteration_num;
+	header.start_subiteration_num = start_subiteration_num;
+	header.start_subset_num = start_subset_num;
+	header.num_subsets = num_subsets;
+	header.num_sensitivities = 0;
+	if (ptr_obj)
+		header.num_sensitivities =
+		ptr_obj->get_use_subset_sensitivities() ? num_subsets : 1;
+	header.nz = rows.nz;
+	header.ny = rows.ny;
+	header.nx = rows.nx;
+	header.scheduler_state_size = (int32_t)scheduler_state.size();
+
+	// write to a scratch file first, so that a job killed while saving
+	// leaves the previous state intact
+	std::string tmp = filename + "." + SIRFUtilities::scratch_file_name();
+	std::ofstream out(tmp.c_str(),
+		std::ios::out | std::ios::binary | std::ios::trunc);
+	if (!out) {
+		std::string msg = "cannot create reconstruction state file " + tmp;
+		THROW(msg.c_str());
+	}
+	out.write((const char*)&header, sizeof(header));
+	write_image_rows(out, image);
+	for (int i = 0; i < header.num_sensitivities; i++)
+		write_image_rows(out, ptr_obj->get_subset_sensitivity(i));
+	out.write(scheduler_state.c_str(), scheduler_state.size());
+	out.close();
+	if (!out) {
+		std::remove(tmp.c_str());
+		std::string msg = "failed to write reconstruction state file " + tmp;
+		THROW(msg.c_str());
+	}
+	boost::filesystem::rename(tmp, filename);
+}
+
+Succeeded
+xSTIR_IterativeReconstruction3DF::load_state
+(const std::string& filename, shared_ptr<Image3DF> sptr_image,
+	SubsetScheduler* ptr_scheduler)
+{
+	std::ifstream in(filename.c_str(), std::ios::in | std::ios::binary);
+	if (!in) {
+		std::string msg = "cannot open reconstruction state file " + filename;
+		THROW(msg.c_str());
+	}
+	ReconstructionStateHeader header;
+	in.read((char*)&header, sizeof(header));
+	if (!in || memcmp(header.magic, RECON_STATE_MAGIC, sizeof(header.magic))) {
+		std::string msg = filename + " is not a reconstruction state file";
+		THROW(msg.c_str());
+	}
+	if (header.scheduler_state_size > 0 && !ptr_scheduler)
+		THROW("reconstruction state includes subset scheduler state, "
+			"but no subset scheduler is set");
+	const ImageRowTable<float> rows(*sptr_image);
+	if (rows.nz != header.nz || rows.ny != header.ny || rows.nx != header.nx)
+		THROW("image sizes differ from those in reconstruction state file");
+	read_image_rows(in, *sptr_image);
+
+	PoissonLogLhLinModMean3DF* ptr_obj =
+		dynamic_cast<PoissonLogLhLinModMean3DF*>
+		(get_objective_function_sptr().get());
+	const int num_sens = header.num_sensitivities;
+	if (num_sens > 0 && !ptr_obj)
+		THROW("saved sensitivities require Poisson log-likelihood objective");
+	// STIR objective functions read precomputed sensitivities from files,
+	// which are only needed until set-up has read them
+	shared_ptr<ScratchDirectory> sptr_sens_dir;
+	if (num_sens > 0) {
+		sptr_sens_dir.reset(new ScratchDirectory
+			(filename + "." + SIRFUtilities::scratch_file_name()));
+		shared_ptr<Image3DF> sptr_sens(sptr_image->get_empty_copy());
+		STIRImageData sens(sptr_sens);
+		for (int i = 0; i < num_sens; i++) {
+			read_image_rows(in, *sptr_sens);
+			if (num_sens == 1)
+				sens.write(sptr_sens_dir->file("sens.hv"));
+			else
+				sens.write(sptr_sens_dir->file("sens_" + std::to_string(i) + ".hv"));
+		}
+		if (num_sens == 1) {
+			ptr_obj->set_use_subset_sensitivities(false);
+			ptr_obj->set_sensitivity_filename(sptr_sens_dir->file("sens.hv"));
+		}
+		else {
+			ptr_obj->set_use_subset_sensitivities(true);
+			ptr_obj->set_subsensitivity_filenames
+				(sptr_sens_dir->file("sens_%d.hv"));
+		}
+		ptr_obj->set_recompute_sensitivity(false);
+	}
+	std::string scheduler_state(header.scheduler_state_size, ' ');
+	if (header.scheduler_state_size > 0)
+		in.read(&scheduler_state[0], scheduler_state.size());
+	if (!in) {
+		std::string msg = "reconstruction state file " + filename + " is truncated";
+		THROW(msg.c_str());
+	}
+
+	set_num_subsets(header.num_subsets);
+	Succeeded s = Succeeded::no;
+	try {
+		if (!post_process())
+			s = setup(sptr_image);
+	}
+	catch (...) {
+		if (num_sens > 0)
+			forget_sensitivity_files(*ptr_obj, num_sens);
+		throw;
+	}
+	if (num_sens > 0)
+		forget_sensitivity_files(*ptr_obj, num_sens);
+	if (s == Succeeded::yes) {
+		start_subiteration_num = header.start_subiteration_num;
+		start_subset_num = header.start_subset_num;
+		subiteration_num = header.subiteration_num;
+		if (ptr_scheduler && header.scheduler_state_size > 0) {
+			std::istringstream state(scheduler_state);
+			ptr_scheduler->load_state(state);
+		}
+	}
+	return s;
 }
@@ -0,0 +1,230 @@
+/*
+CCP PETMR Synergistic Image Reconstruction Framework (SIRF)
+Copyright 2019 Rutherford Appleton Laboratory STFC
+
+This is software developed for the Collaborative Computational
+Project in Positron Emission Tomography and Magnetic Resonance imaging
+(http://www.ccppetmr.ac.uk/).
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+http://www.apache.org/licenses/LICENSE-2.0
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+*/
+
+/*!
+\file
+\ingroup STIR Extensions
+\brief Test of the compressed acquisition data storage: FloatArrayCodec
+round trips at the run and literal length limits, and ProjDataCompressed
+in memory and in a file against the data written to it.
+
+\author Evgueni Ovtchinnikov
+\author CCP PETMR
+*/
+
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "stir/ExamInfo.h"
+#include "stir/ProjDataInfo.h"
+#include "stir/Scanner.h"
+
+#include "sirf/STIR/stir_compressed_data.h"
+
+using namespace stir;
+using namespace sirf;
+
+// the floats whose byte planes (all first bytes, then all second bytes
+// etc.) are the given bytes
+static std::vector<float> floats_with_planes(const std::vector<unsigned char>& planes)
+{
+	if (planes.size() % sizeof(float))
+		throw std::runtime_error("byte planes of wrong size");
+	const size_t n = planes.size() / sizeof(float);
+	std::vector<float> values(n);
+	unsigned char* bytes = (unsigned char*)values.data();
+	for (size_t i = 0; i < n; i++)
+		for (size_t k = 0; k < sizeof(float); k++)
+			bytes[i*sizeof(float) + k] = planes[k*n + i];
+	return values;
+}
+
+static void append(std::vector<unsigned char>& planes, size_t count,
+	unsigned char byte)
+{
+	planes.insert(planes.end(), count, byte);
+}
+
+// encodes and decodes values, checking the result bit by bit and, if
+// expected_size > 0, the size of the code
+static void round_trip(const std::vector<float>& values, size_t expected_size,
+	const std::string& what)
+{
+	std::vector<unsigned char> code;
+	FloatArrayCodec::encode(values.data(), values.size(), code);
+	if (expected_size > 0 && code.size() != expected_size)
+		throw std::runtime_error(what + ": wrong code size " +
+			std::to_string(code.size()) + ", expected " +
+			std::to_string(expected_size));
+	std::vector<float> decoded(values.size());
+	FloatArrayCodec::decode(code, decoded.data(), decoded.size());
+	if (memcmp(decoded.data(), values.data(), values.size()*sizeof(float)))
+		throw std::runtime_error(what + ": decoded values differ");
+}
+
+static void test_codec()
+{
+	std::cout << "testing FloatArrayCodec...\n";
+	std::vector<unsigned char> planes;
+
+	// runs of exactly 3 (the shortest) and 130 (the longest) bytes, and
+	// literals of exactly 1 and 128 (the longest) bytes, each coded as
+	// a control byte followed by the run byte or the literal bytes
+	append(planes, 3, 0xAA);
+	append(planes, 1, 0x01);
+	append(planes, 130, 0xBB);
+	for (int i = 0; i < 128; i++)
+		append(planes, 1, (unsigned char)i);
+	append(planes, 3, 0xCC);
+	// the last 3 bytes make one literal
+	append(planes, 1, 0x02);
+	append(planes, 1, 0x03);
+	append(planes, 1, 0x04);
+	round_trip(floats_with_planes(planes), 2 + 2 + 2 + 129 + 2 + 4,
+		"runs of 3 and 130, literals of 1 and 128");
+
+	// a run of 131 is a run of 130 followed by a literal, as is a run of 2
+	planes.clear();
+	append(planes, 131, 0xDD);
+	append(planes, 2, 0x05);
+	append(planes, 1, 0x06);
+	append(planes, 1, 0x07);
+	append(planes, 1, 0x08);
+	round_trip(floats_with_planes(planes), 2 + 7, "run of 131");
+
+	// a literal of 129 is a literal of 128 followed by one of 1, and
+	// then a run of 3 at the end of the data
+	planes.clear();
+	for (int i = 0; i < 129; i++)
+		append(planes, 1, (unsigned char)i);
+	append(planes, 3, 0xEE);
+	round_trip(floats_with_planes(planes), 129 + 2 + 2, "literal of 129");
+
+	// a single float, all zeros, and random values including NaNs
+	round_trip(std::vector<float>(1, 1.5f), 0, "single value");
+	round_trip(std::vector<float>(1000, 0.0f), 0, "zeros");
+	std::mt19937 generator(1);
+	std::uniform_int_distribution<unsigned int> distribution;
+	std::vector<float> values(999);
+	for (size_t i = 0; i < values.size(); i++) {
+		unsigned int bits = distribution(generator);
+		memcpy(&values[i], &bits, sizeof(float));
+	}
+	round_trip(values, 0, "random bits");
+	// low-count data: mostly zeros and small integers
+	std::poisson_distribution<int> counts(0.1);
+	for (size_t i = 0; i < values.size(); i++)
+		values[i] = (float)counts(generator);
+	round_trip(values, 0, "low counts");
+}
+
+static float value(int segment, int ax, int view, int tang)
+{
+	// mostly zero, as low-count data
+	if ((ax + view + tang) % 31)
+		return 0.0f;
+	return float(segment * 1000 + ax * 100 + view + 0.5f * tang);
+}
+
+static void check_segment(const ProjData& pd, int segment, float scale,
+	const std::string& what)
+{
+	SegmentBySinogram<float> s = pd.get_segment_by_sinogram(segment);
+	for (int ax = s.get_min_axial_pos_num(); ax <= s.get_max_axial_pos_num(); ax++)
+		for (int view = s.get_min_view_num(); view <= s.get_max_view_num(); view++)
+			for (int tang = s.get_min_tangential_pos_num();
+				tang <= s.get_max_tangential_pos_num(); tang++)
+				if (s[ax][view][tang] != scale * value(segment, ax, view, tang))
+					throw std::runtime_error(what + ": wrong value");
+}
+
+static void test_proj_data(const std::string& filename)
+{
+	const std::string what = filename.empty() ?
+		"ProjDataCompressed in memory" : "ProjDataCompressed in a file";
+	std::cout << "testing " << what << "...\n";
+	shared_ptr<Scanner> sptr_scanner(new Scanner(Scanner::E953));
+	shared_ptr<ProjDataInfo> sptr_pdi(ProjDataInfo::construct_proj_data_info
+		(sptr_scanner, 1, 3, 48, 40, false));
+	shared_ptr<ExamInfo> sptr_ei(new ExamInfo);
+	{
+		// a cache of one segment, so that segments are evicted and
+		// recompressed all the time
+		ProjDataCompressed pd(sptr_ei, sptr_pdi, 1, filename);
+		if (!filename.empty() && !std::ifstream(filename.c_str()))
+			throw std::runtime_error(what + ": no file created");
+		const int min_seg = pd.get_min_segment_num();
+		const int max_seg = pd.get_max_segment_num();
+		for (int segment = min_seg; segment <= max_seg; segment++)
+			check_segment(pd, segment, 0.0f, what + " never written to");
+
+		// whole segments, then viewgram by viewgram with a scale making
+		// the segments less compressible, so that they are rewritten
+		// elsewhere in the file
+		for (int segment = min_seg; segment <= max_seg; segment++) {
+			SegmentBySinogram<float> s = pd.get_empty_segment_by_sinogram(segment);
+			for (int ax = s.get_min_axial_pos_num();
+				ax <= s.get_max_axial_pos_num(); ax++)
+				for (int view = s.get_min_view_num();
+					view <= s.get_max_view_num(); view++)
+					for (int tang = s.get_min_tangential_pos_num();
+						tang <= s.get_max_tangential_pos_num(); tang++)
+						s[ax][view][tang] = value(segment, ax, view, tang);
+			pd.set_segment(s);
+		}
+		for (int segment = min_seg; segment <= max_seg; segment++)
+			check_segment(pd, segment, 1.0f, what + " set_segment");
+		if (pd.compressed_size() * 4 > pd.uncompressed_size())
+			throw std::runtime_error(what + ": sparse data poorly compressed");
+
+		const float scale = 1.1f;
+		for (int view = pd.get_min_view_num(); view <= pd.get_max_view_num(); view++)
+			for (int segment = min_seg; segment <= max_seg; segment++) {
+				Viewgram<float> v = pd.get_viewgram(view, segment);
+				v *= scale;
+				pd.set_viewgram(v);
+			}
+		for (int segment = min_seg; segment <= max_seg; segment++)
+			check_segment(pd, segment, scale, what + " set_viewgram");
+	}
+	if (!filename.empty() && std::ifstream(filename.c_str()))
+		throw std::runtime_error(what + ": file not removed");
+}
+
+int main()
+{
+	try {
+		test_codec();
+		test_proj_data("");
+		test_proj_data("test_compressed_data.tmp");
+	}
+	catch (const std::exception& error) {
+		std::cerr << "\nHere's the error:\n\t" << error.what() << "\n\n";
+		return EXIT_FAILURE;
+	}
+	std::cout << "done.\n";
+	return EXIT_SUCCESS;
+}
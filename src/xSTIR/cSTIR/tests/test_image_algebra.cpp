@@ -0,0 +1,184 @@
+/*
+CCP PETMR Synergistic Image Reconstruction Framework (SIRF)
+Copyright 2019 Rutherford Appleton Laboratory STFC
+
+This is software developed for the Collaborative Computational
+Project in Positron Emission Tomography and Magnetic Resonance imaging
+(http://www.ccppetmr.ac.uk/).
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+http://www.apache.org/licenses/LICENSE-2.0
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+*/
+
+/*!
+\file
+\ingroup STIR Extensions
+\brief Test of the STIRImageData row kernels: get_data, set_data, fill,
+axpby, multiply, divide, dot and norm against voxel by voxel loops.
+
+\author Evgueni Ovtchinnikov
+\author CCP PETMR
+*/
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "stir/IndexRange3D.h"
+
+#include "sirf/STIR/stir_data_containers.h"
+
+using namespace stir;
+using namespace sirf;
+
+// index ranges not starting at 0, and rows of odd length
+static const int MIN_Z = 0, MAX_Z = 6;
+static const int MIN_Y = -9, MAX_Y = 8;
+static const int MIN_X = -11, MAX_X = 13;
+
+static STIRImageData make_image(unsigned int seed, float min_value, float max_value)
+{
+	Voxels3DF voxels(IndexRange3D(MIN_Z, MAX_Z, MIN_Y, MAX_Y, MIN_X, MAX_X),
+		CartesianCoordinate3D<float>(0, 0, 0),
+		CartesianCoordinate3D<float>(2.5F, 2.0F, 2.0F));
+	std::mt19937 generator(seed);
+	std::uniform_real_distribution<float> distribution(min_value, max_value);
+	for (int z = MIN_Z; z <= MAX_Z; z++)
+		for (int y = MIN_Y; y <= MAX_Y; y++)
+			for (int x = MIN_X; x <= MAX_X; x++)
+				voxels[z][y][x] = distribution(generator);
+	return STIRImageData(voxels);
+}
+
+static void check(double d, double tol, const std::string& what)
+{
+	if (!(d <= tol))
+		throw std::runtime_error(what + ": wrong result");
+}
+
+// maximal relative difference between u and f(z, y, x)
+template<class F>
+static double difference(const STIRImageData& u, F f)
+{
+	const Image3DF& image = u.data();
+	double d = 0;
+	for (int z = MIN_Z; z <= MAX_Z; z++)
+		for (int y = MIN_Y; y <= MAX_Y; y++)
+			for (int x = MIN_X; x <= MAX_X; x++) {
+				const double v = f(z, y, x);
+				d = std::max(d,
+					std::abs(image[z][y][x] - v) / std::max(1.0, std::abs(v)));
+			}
+	return d;
+}
+
+int main()
+{
+	try {
+		const STIRImageData x = make_image(1, -1.0f, 1.0f);
+		const STIRImageData y = make_image(2, 0.5f, 2.0f);
+		const Image3DF& vx = x.data();
+		const Image3DF& vy = y.data();
+		const size_t n = size_t(MAX_Z - MIN_Z + 1)*(MAX_Y - MIN_Y + 1)*
+			(MAX_X - MIN_X + 1);
+
+		std::cout << "get_data, set_data and fill...\n";
+		std::vector<float> data(n);
+		x.get_data(&data[0]);
+		size_t i = 0;
+		for (int z = MIN_Z; z <= MAX_Z; z++)
+			for (int yy = MIN_Y; yy <= MAX_Y; yy++)
+				for (int xx = MIN_X; xx <= MAX_X; xx++, i++)
+					if (data[i] != vx[z][yy][xx])
+						throw std::runtime_error("get_data: wrong order or values");
+		STIRImageData u = make_image(3, 0.0f, 1.0f);
+		u.set_data(&data[0]);
+		check(difference(u, [&](int z, int yy, int xx)
+		{ return vx[z][yy][xx]; }), 0, "set_data");
+		STIRImageData v = make_image(4, 0.0f, 1.0f);
+		v.fill(y);
+		check(difference(v, [&](int z, int yy, int xx)
+		{ return vy[z][yy][xx]; }), 0, "fill");
+
+		std::cout << "axpby, multiply and divide...\n";
+		const float a = 1.5f;
+		const float b = -0.25f;
+		u.axpby(&a, x, &b, y);
+		check(difference(u, [&](int z, int yy, int xx)
+		{ return a*vx[z][yy][xx] + b*vy[z][yy][xx]; }), 1e-6, "axpby");
+		// in place, the result aliasing an argument
+		STIRImageData w(x);
+		w.axpby(&a, w, &b, y);
+		check(difference(w, [&](int z, int yy, int xx)
+		{ return a*vx[z][yy][xx] + b*vy[z][yy][xx]; }), 1e-6, "in-place axpby");
+		u.multiply(x, y);
+		check(difference(u, [&](int z, int yy, int xx)
+		{ return vx[z][yy][xx] * vy[z][yy][xx]; }), 1e-6, "multiply");
+		u.divide(x, y);
+		check(difference(u, [&](int z, int yy, int xx)
+		{ return vx[z][yy][xx] / vy[z][yy][xx]; }), 1e-6, "divide");
+
+		// values of either sign below 1e-6 of the maximum are clamped
+		STIRImageData s(x);
+		Image3DF& vs = s.data();
+		vs[MIN_Z][MIN_Y][MIN_X] = 0;
+		vs[MAX_Z][MAX_Y][MAX_X] = -1e-9f;
+		vs[MIN_Z][0][0] = 1e-9f;
+		float vmax = 0;
+		for (int z = MIN_Z; z <= MAX_Z; z++)
+			for (int yy = MIN_Y; yy <= MAX_Y; yy++)
+				for (int xx = MIN_X; xx <= MAX_X; xx++)
+					vmax = std::max(vmax, std::abs(vs[z][yy][xx]));
+		const float vmin = 1e-6f*vmax;
+		u.divide(y, s);
+		check(difference(u, [&](int z, int yy, int xx) {
+			const float t = vs[z][yy][xx];
+			const float c = t >= 0 ? std::max(t, vmin) : std::min(t, -vmin);
+			return vy[z][yy][xx] / c; }), 1e-6, "divide with clamping");
+		STIRImageData zero(x);
+		zero.fill(0.0f);
+		bool thrown = false;
+		try {
+			u.divide(x, zero);
+		}
+		catch (...) {
+			thrown = true;
+		}
+		if (!thrown)
+			throw std::runtime_error("divide by zero image: no exception");
+
+		std::cout << "dot and norm...\n";
+		double dot = 0;
+		double norm2 = 0;
+		for (int z = MIN_Z; z <= MAX_Z; z++)
+			for (int yy = MIN_Y; yy <= MAX_Y; yy++)
+				for (int xx = MIN_X; xx <= MAX_X; xx++) {
+					dot += double(vx[z][yy][xx]) * vy[z][yy][xx];
+					norm2 += double(vx[z][yy][xx]) * vx[z][yy][xx];
+				}
+		float d;
+		x.dot(y, &d);
+		check(std::abs(d - dot) / std::abs(dot), 1e-6, "dot");
+		check(std::abs(x.norm() - std::sqrt(norm2)) / std::sqrt(norm2), 1e-6,
+			"norm");
+	}
+	catch (const std::exception& error) {
+		std::cerr << "\nHere's the error:\n\t" << error.what() << "\n\n";
+		return EXIT_FAILURE;
+	}
+	std::cout << "done.\n";
+	return EXIT_SUCCESS;
+}
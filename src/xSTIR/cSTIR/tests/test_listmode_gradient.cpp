@@ -0,0 +1,158 @@
+/*
+CCP PETMR Synergistic Image Reconstruction Framework (SIRF)
+Copyright 2019 Rutherford Appleton Laboratory STFC
+
+This is software developed for the Collaborative Computational
+Project in Positron Emission Tomography and Magnetic Resonance imaging
+(http://www.ccppetmr.ac.uk/).
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+http://www.apache.org/licenses/LICENSE-2.0
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+*/
+
+/*!
+\file
+\ingroup STIR Extensions
+\brief Test of the event-batched multithreaded listmode gradient: the
+sub-gradient of xSTIR_PoissonLogLikelihoodWithLinearModelForMeanAndListModeDataWithProjMatrixByBin3DF
+must be that of the STIR objective function it overrides, with and without
+subsets and an additive term, for any batch size.
+
+Uses the mMR listmode data in $SIRF_PATH/data/examples/PET/mMR.
+
+\author Evgueni Ovtchinnikov
+\author CCP PETMR
+*/
+
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+#include "stir/recon_buildblock/ProjMatrixByBinUsingRayTracing.h"
+
+#include "sirf/STIR/stir_x.h"
+#include "sirf/common/getenv.h"
+
+using namespace stir;
+using namespace sirf;
+
+typedef stir::PoissonLogLikelihoodWithLinearModelForMeanAndListModeDataWithProjMatrixByBin
+<Image3DF> STIRListModeObjective;
+
+/*
+Sets up only what the gradient needs: computing the sensitivity of the
+full listmode geometry would take far longer than the test itself.
+*/
+class ListModeObjective : public PoissonLogLhLinModMeanListData3DF {
+public:
+	void set_up_gradient(shared_ptr<ProjDataInfo> sptr_pdi,
+		shared_ptr<Image3DF> sptr_image)
+	{
+		if (post_processing())
+			throw std::runtime_error("listmode objective: post_processing failed");
+		proj_data_info_cyl_uncompressed_ptr = sptr_pdi;
+		PM_sptr->set_up(sptr_pdi, sptr_image);
+	}
+	void stir_gradient(Image3DF& gradient, const Image3DF& image, int subset_num)
+	{
+		gradient.fill(0);
+		STIRListModeObjective::compute_sub_gradient_without_penalty_plus_sensitivity
+			(gradient, image, subset_num);
+	}
+};
+
+// relative l2 distance between a and b
+static double difference(const Image3DF& a, const Image3DF& b)
+{
+	double d = 0;
+	double s = 0;
+	Image3DF::const_full_iterator ia = a.begin_all();
+	Image3DF::const_full_iterator ib = b.begin_all();
+	for (; ia != a.end_all(); ++ia, ++ib) {
+		d += (*ia - *ib)*(*ia - *ib);
+		s += (*ib)*(*ib);
+	}
+	return std::sqrt(d / s);
+}
+
+static void check(double d, double tol, const std::string& what)
+{
+	if (!(d <= tol))
+		throw std::runtime_error(what + ": relative difference too large");
+}
+
+int main()
+{
+	try {
+		std::string SIRF_path = sirf::getenv("SIRF_PATH");
+		if (SIRF_path.length() < 1) {
+			std::cout << "SIRF_PATH not defined, cannot find data" << std::endl;
+			return EXIT_FAILURE;
+		}
+		std::string path = SIRF_path + "/data/examples/PET/mMR/";
+
+		// few segments and a coarse image keep the test short
+		shared_ptr<ProjDataInfo> sptr_pdi =
+			PETAcquisitionData::proj_data_info_from_scanner("Siemens mMR", 1, 2);
+		shared_ptr<Image3DF> sptr_image(new Voxels3DF(*sptr_pdi, 0.25F,
+			CartesianCoordinate3D<float>(0, 0, 0),
+			CartesianCoordinate3D<int>(-1, 45, 45)));
+		// a smooth positive image
+		Image3DF& image = *sptr_image;
+		for (int z = image.get_min_index(); z <= image.get_max_index(); z++)
+			for (int y = image[z].get_min_index(); y <= image[z].get_max_index(); y++)
+				for (int x = image[z][y].get_min_index();
+					x <= image[z][y].get_max_index(); x++)
+					image[z][y][x] = 1 + 0.5f*std::cos(0.2f*x)*std::sin(0.3f*y + 0.1f*z);
+
+		ListModeObjective obj_fun;
+		obj_fun.set_input_file((path + "list.l.hdr").c_str());
+		obj_fun.set_proj_matrix(shared_ptr<ProjMatrixByBin>
+			(new ProjMatrixByBinUsingRayTracing));
+		obj_fun.set_up_gradient(sptr_pdi, sptr_image);
+
+		shared_ptr<PETAcquisitionData> sptr_add(new PETAcquisitionDataInMemory
+			(shared_ptr<ExamInfo>(new ExamInfo), sptr_pdi));
+		sptr_add->fill(0.1f);
+
+		shared_ptr<Image3DF> sptr_g(image.get_empty_copy());
+		shared_ptr<Image3DF> sptr_stir_g(image.get_empty_copy());
+		const int batch_sizes[] = { 1 << 20, 1000 };
+		for (int add = 0; add < 2; add++) {
+			if (add)
+				obj_fun.set_additive_term(sptr_add);
+			for (int num_subsets = 1; num_subsets <= 2; num_subsets++) {
+				obj_fun.set_num_subsets(num_subsets);
+				const int subset_num = num_subsets - 1;
+				obj_fun.stir_gradient(*sptr_stir_g, image, subset_num);
+				for (int b = 0; b < 2; b++) {
+					const std::string what = std::string("listmode gradient") +
+						(add ? " with additive term" : "") + ", " +
+						std::to_string(num_subsets) + " subset(s), batch size " +
+						std::to_string(batch_sizes[b]);
+					std::cout << what << '\n';
+					obj_fun.set_batch_size(batch_sizes[b]);
+					obj_fun.compute_sub_gradient_without_penalty_plus_sensitivity
+						(*sptr_g, image, subset_num);
+					check(difference(*sptr_g, *sptr_stir_g), 1e-4, what);
+				}
+			}
+		}
+	}
+	catch (const std::exception& error) {
+		std::cerr << "\nHere's the error:\n\t" << error.what() << "\n\n";
+		return EXIT_FAILURE;
+	}
+	std::cout << "done.\n";
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,191 @@
+/*
+CCP PETMR Synergistic Image Reconstruction Framework (SIRF)
+Copyright 2019 Rutherford Appleton Laboratory STFC
+
+This is software developed for the Collaborative Computational
+Project in Positron Emission Tomography and Magnetic Resonance imaging
+(http://www.ccppetmr.ac.uk/).
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+http://www.apache.org/licenses/LICENSE-2.0
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+*/
+
+/*!
+\file
+\ingroup STIR Extensions
+\brief Test of the multithreaded priors against STIR: the gradient of
+xSTIR_QuadraticPrior3DF and the value and gradient of xSTIR_PLSPrior3DF
+must be those of stir::QuadraticPrior and stir::PLSPrior, with and
+without kappa, in 3D and 2D.
+
+\author Evgueni Ovtchinnikov
+\author CCP PETMR
+*/
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <string>
+
+#include "stir/IndexRange3D.h"
+#include "stir/recon_buildblock/PLSPrior.h"
+#include "stir/recon_buildblock/QuadraticPrior.h"
+
+#include "sirf/STIR/stir_x.h"
+
+using namespace stir;
+using namespace sirf;
+
+static shared_ptr<Image3DF> new_image()
+{
+	// odd sizes and an anisotropic grid, so that no edge or weight
+	// is special
+	return shared_ptr<Image3DF>(new Voxels3DF(
+		IndexRange3D(0, 8, -10, 9, -12, 10),
+		CartesianCoordinate3D<float>(0, 0, 0),
+		CartesianCoordinate3D<float>(3.375F, 2.08F, 2.08F)));
+}
+
+// a smooth positive image with noise
+static shared_ptr<Image3DF> make_image(unsigned int seed)
+{
+	shared_ptr<Image3DF> sptr_image = new_image();
+	std::mt19937 generator(seed);
+	std::uniform_real_distribution<float> noise(0.0f, 0.3f);
+	Image3DF& image = *sptr_image;
+	for (int z = image.get_min_index(); z <= image.get_max_index(); z++)
+		for (int y = image[z].get_min_index(); y <= image[z].get_max_index(); y++)
+			for (int x = image[z][y].get_min_index();
+				x <= image[z][y].get_max_index(); x++)
+				image[z][y][x] = 1 + std::cos(0.3f*x)*std::sin(0.2f*y + 0.4f*z) +
+				noise(generator);
+	return sptr_image;
+}
+
+// a piecewise constant image: the anatomical gradient has edges in all
+// directions
+static shared_ptr<Image3DF> make_anatomical_image()
+{
+	shared_ptr<Image3DF> sptr_image = new_image();
+	Image3DF& image = *sptr_image;
+	for (int z = image.get_min_index(); z <= image.get_max_index(); z++)
+		for (int y = image[z].get_min_index(); y <= image[z].get_max_index(); y++)
+			for (int x = image[z][y].get_min_index();
+				x <= image[z][y].get_max_index(); x++)
+				image[z][y][x] = (x*x + y*y < 49 ? 4.0f : 1.0f) +
+				(z > 4 ? 2.0f : 0.0f) + (x > 5 ? 1.5f : 0.0f);
+	return sptr_image;
+}
+
+// relative l2 distance between a and b
+static double difference(const Image3DF& a, const Image3DF& b)
+{
+	double d = 0;
+	double s = 0;
+	Image3DF::const_full_iterator ia = a.begin_all();
+	Image3DF::const_full_iterator ib = b.begin_all();
+	for (; ia != a.end_all(); ++ia, ++ib) {
+		d += (*ia - *ib)*(*ia - *ib);
+		s += (*ib)*(*ib);
+	}
+	return std::sqrt(d / s);
+}
+
+static void check(double d, double tol, const std::string& what)
+{
+	if (!(d <= tol))
+		throw std::runtime_error(what + ": relative difference too large");
+}
+
+static void check_gradients(GeneralisedPrior<Image3DF>& prior,
+	GeneralisedPrior<Image3DF>& stir_prior, const Image3DF& image,
+	const std::string& what)
+{
+	shared_ptr<Image3DF> sptr_g(image.get_empty_copy());
+	shared_ptr<Image3DF> sptr_stir_g(image.get_empty_copy());
+	prior.compute_gradient(*sptr_g, image);
+	stir_prior.compute_gradient(*sptr_stir_g, image);
+	check(difference(*sptr_g, *sptr_stir_g), 1e-4, what + " gradient");
+}
+
+static void test_quadratic(bool only_2D, bool do_kappa)
+{
+	const std::string what = std::string("QuadraticPrior") +
+		(only_2D ? " 2D" : " 3D") + (do_kappa ? " with kappa" : "");
+	std::cout << what << '\n';
+	shared_ptr<Image3DF> sptr_image = make_image(1);
+	shared_ptr<Image3DF> sptr_kappa = make_image(2);
+
+	xSTIR_QuadraticPrior3DF prior;
+	prior.only2D(only_2D);
+	prior.set_penalisation_factor(0.7f);
+	QuadraticPrior<float> stir_prior(only_2D, 0.7f);
+	if (do_kappa) {
+		prior.set_kappa_sptr(sptr_kappa);
+		stir_prior.set_kappa_sptr(sptr_kappa);
+	}
+	if (prior.set_up(sptr_image) != Succeeded::yes ||
+		stir_prior.set_up(sptr_image) != Succeeded::yes)
+		throw std::runtime_error(what + ": set_up failed");
+	check_gradients(prior, stir_prior, *sptr_image, what);
+}
+
+static void test_pls(bool only_2D, bool do_kappa)
+{
+	const std::string what = std::string("PLSPrior") +
+		(only_2D ? " 2D" : " 3D") + (do_kappa ? " with kappa" : "");
+	std::cout << what << '\n';
+	shared_ptr<Image3DF> sptr_image = make_image(3);
+	shared_ptr<Image3DF> sptr_kappa = make_image(4);
+	shared_ptr<Image3DF> sptr_anat = make_anatomical_image();
+
+	xSTIR_PLSPrior3DF prior;
+	PLSPrior<float> stir_prior;
+	PLSPrior<float>* priors[] = { &prior, &stir_prior };
+	for (int i = 0; i < 2; i++) {
+		PLSPrior<float>& p = *priors[i];
+		p.set_only_2D(only_2D);
+		p.set_alpha(0.1f);
+		p.set_eta(0.5f);
+		p.set_penalisation_factor(0.7f);
+		p.set_anatomical_image_sptr(sptr_anat);
+		if (do_kappa)
+			p.set_kappa_sptr(sptr_kappa);
+		if (p.set_up(sptr_image) != Succeeded::yes)
+			throw std::runtime_error(what + ": set_up failed");
+	}
+
+	const double value = prior.compute_value(*sptr_image);
+	const double stir_value = stir_prior.compute_value(*sptr_image);
+	check(std::abs(value - stir_value) / std::abs(stir_value), 1e-4,
+		what + " value");
+	check_gradients(prior, stir_prior, *sptr_image, what);
+}
+
+int main()
+{
+	try {
+		for (int only_2D = 0; only_2D < 2; only_2D++)
+			for (int do_kappa = 0; do_kappa < 2; do_kappa++) {
+				test_quadratic(only_2D != 0, do_kappa != 0);
+				test_pls(only_2D != 0, do_kappa != 0);
+			}
+	}
+	catch (const std::exception& error) {
+		std::cerr << "\nHere's the error:\n\t" << error.what() << "\n\n";
+		return EXIT_FAILURE;
+	}
+	std::cout << "done.\n";
+	return EXIT_SUCCESS;
+}
@@ -22,6 +22,7 @@ Object-Oriented wrap for the cSTIR-to-Python interface pystir.py
 
 import abc
 import inspect
+import json
 import numpy
 import os
 try:
@@ -473,6 +474,52 @@ class TruncateToCylinderProcessor(ImageDataProcessor):
                (self.handle, 'TruncateToCylindricalFOVImageProcessor',\
                 'strictly_less_than_radius') != 0
 
+class SeparableFilter(ImageDataProcessor):
+    '''
+    Class for the separable Gaussian/Metz image filter (e.g. for use as an
+    inter-iteration filter), convolving the image along z, y and x in
+    turn using multiple threads; long kernels are applied via FFT.
+    Per-axis parameters are given as (z, y, x) triples.
+    '''
+    def __init__(self, fwhms=None, metz_powers=None):
+        self.handle = None
+        self.name = 'SeparableImageFilter'
+        self.handle = pystir.cSTIR_newObject(self.name)
+        check_status(self.handle)
+        if fwhms is not None:
+            self.set_fwhms(fwhms)
+        if metz_powers is not None:
+            self.set_metz_powers(metz_powers)
+    def __del__(self):
+        if self.handle is not None:
+            pyiutil.deleteDataHandle(self.handle)
+    def set_fwhms(self, fwhms):
+        '''Sets the FWHMs (in mm) along z, y and x (0 for no filtering).'''
+        for axis, fwhm in zip('zyx', fwhms):
+            parms.set_float_par(self.handle, self.name, 'fwhm_' + axis, fwhm)
+    def get_fwhms(self):
+        return tuple(parms.float_par(self.handle, self.name, 'fwhm_' + axis)
+                     for axis in 'zyx')
+    def set_metz_powers(self, powers):
+        '''Sets the Metz filter powers along z, y and x (0 for Gaussian).'''
+        for axis, power in zip('zyx', powers):
+            parms.set_float_par\
+                (self.handle, self.name, 'metz_power_' + axis, power)
+    def get_metz_powers(self):
+        return tuple(parms.float_par\
+                     (self.handle, self.name, 'metz_power_' + axis)
+                     for axis in 'zyx')
+    def set_max_kernel_sizes(self, sizes):
+        '''Sets the largest kernel lengths along z, y and x (-1: no limit).'''
+        for axis, size in zip('zyx', sizes):
+            parms.set_int_par\
+                (self.handle, self.name, 'max_kernel_size_' + axis, size)
+    def set_fft_threshold(self, length):
+        '''Kernels longer than length are applied via FFT.'''
+        parms.set_int_par(self.handle, self.name, 'fft_threshold', length)
+    def get_fft_threshold(self):
+        return parms.int_par(self.handle, self.name, 'fft_threshold')
+
 class RayTracingMatrix:
     '''
     Class for objects holding sparse matrix representation of the ray
@@ -559,6 +606,11 @@ class AcquisitionData(DataContainer):
         scheme = 'memory':
             all acquisition data generated from now on will be kept in RAM
             (avoid if data is very large)
+        scheme = 'compressed':
+            all acquisition data generated from now on will be kept in
+            scratch files losslessly compressed segment by segment (uses
+            less disk space and I/O than 'file' at the cost of compression
+            time, most effective for sparse or low-count data)
         '''
         try_calling(pystir.cSTIR_setAcquisitionDataStorageScheme(scheme))
     @staticmethod
@@ -666,6 +718,15 @@ class AcquisitionData(DataContainer):
             raise error('Wrong fill value.' + \
                 ' Should be numpy.ndarray, AcquisitionData, float or int')
         return self
+    def blocks(self, unit='sinogram'):
+        '''
+        Returns an AcquisitionDataCursor over segment, viewgram or sinogram
+        blocks of this object; iterating over it yields the cursor
+        positioned on each block, e.g.
+            for block in acq_data.blocks('segment'):
+                block.fill(2*block.as_array())
+        '''
+        return AcquisitionDataCursor(self, unit)
     def get_uniform_copy(self, value = 0):
         ''' 
         Returns a true copy of this object filled with a given value;
@@ -740,6 +801,93 @@ class AcquisitionData(DataContainer):
 
 DataContainer.register(AcquisitionData)
 
+class AcquisitionDataCursor:
+    '''
+    Class for block-by-block access to acquisition data.
+
+    The cursor visits segments in the order in which they are stored by
+    AcquisitionData.as_array() (0, 1, -1, 2, -2,...), and views or axial
+    positions within a segment in ascending order, so that large
+    file-based data can be processed with one block in memory.
+    Each block is a NumPy array of shape
+    (number of sinograms, number of views, number of tangential positions).
+    Segment and sinogram blocks are slabs of the array a returned by
+    as_array(): a[s : s + number of sinograms], s being first_sinogram.
+    Viewgram blocks are not slabs of a and must be placed using
+    min_view_num too: a[s : s + number of sinograms, v : v + 1], v being
+    min_view_num minus the smallest view number (0 for STIR data).
+    '''
+    INFO_KEYS = ('segment_num', 'min_axial_pos_num', 'num_sinograms', \
+        'min_view_num', 'num_views', 'num_tangential_poss', 'first_sinogram')
+    def __init__(self, acq_data, unit='sinogram'):
+        '''
+        acq_data: an AcquisitionData object;
+        unit    : 'segment', 'viewgram' or 'sinogram'.
+        '''
+        self.handle = None
+        assert_validity(acq_data, AcquisitionData)
+        self.read_only = acq_data.read_only
+        self.handle = pystir.cSTIR_acquisitionDataCursor(acq_data.handle, unit)
+        check_status(self.handle)
+    def __del__(self):
+        if self.handle is not None:
+            pyiutil.deleteDataHandle(self.handle)
+    def __iter__(self):
+        '''
+        Iterates over all blocks from the first one, yielding this cursor
+        positioned on each block in turn.
+        '''
+        self.reset()
+        while self.next():
+            yield self
+    def reset(self):
+        '''Moves the cursor before the first block.'''
+        try_calling(pystir.cSTIR_resetAcquisitionDataCursor(self.handle))
+    def next(self):
+        '''
+        Moves the cursor to the next block (the first one after reset),
+        returns False if there are no more blocks.
+        '''
+        h = pystir.cSTIR_nextAcquisitionDataBlock(self.handle)
+        check_status(h)
+        more = pyiutil.intDataFromHandle(h)
+        pyiutil.deleteDataHandle(h)
+        return more != 0
+    def info(self):
+        '''
+        Returns a dictionary of the current block index metadata:
+        segment_num, min_axial_pos_num, num_sinograms, min_view_num,
+        num_views, num_tangential_poss and first_sinogram.
+        '''
+        info = numpy.ndarray((len(self.INFO_KEYS),), dtype = numpy.int32)
+        try_calling(pystir.cSTIR_getAcquisitionDataBlockInfo\
+            (self.handle, info.ctypes.data))
+        return dict(zip(self.INFO_KEYS, [int(i) for i in info]))
+    def shape(self):
+        info = self.info()
+        return (info['num_sinograms'], info['num_views'], \
+            info['num_tangential_poss'])
+    def as_array(self):
+        '''Returns a copy of the current block as a NumPy ndarray.'''
+        array = numpy.ndarray(self.shape(), dtype = numpy.float32)
+        try_calling(pystir.cSTIR_getAcquisitionDataBlock\
+            (self.handle, array.ctypes.data))
+        return array
+    def fill(self, value):
+        '''
+        Overwrites the current block with values from a NumPy ndarray
+        of the block shape.
+        '''
+        if self.read_only:
+            raise error('Cannot fill read-only object, consider filling a clone')
+        shape = self.shape()
+        if value.size != numpy.prod(shape):
+            raise error('Wrong block size: %d values, %d expected' \
+                % (value.size, numpy.prod(shape)))
+        v = numpy.ascontiguousarray(value, dtype = numpy.float32)
+        try_calling(pystir.cSTIR_setAcquisitionDataBlock\
+            (self.handle, v.ctypes.data))
+
 class ListmodeToSinograms:
     '''
     Class for listmode-to-sinogram converter.
@@ -980,6 +1128,8 @@ class AcquisitionModel:
         assert_validity(img_templ, ImageData)
         try_calling(pystir.cSTIR_setupAcquisitionModel\
             (self.handle, acq_templ.handle, img_templ.handle))
+        self.acq_templ = acq_templ
+        self.img_templ = img_templ
     def set_additive_term(self, at):
         ''' 
         Sets the additive term a in the acquisition model;
@@ -1004,6 +1154,66 @@ class AcquisitionModel:
         assert_validity(asm, AcquisitionSensitivityModel)
         parms.set_parameter\
             (self.handle, 'AcquisitionModel', 'asm', asm.handle)
+    def set_image_support(self, support=None):
+        '''
+        Sets the image support, e.g. a thresholded mu-map or sensitivity
+        image, to be used by projections;
+        support:  an ImageData object, positive inside the support,
+                  or None to cancel the support.
+        Images are zeroed outside the support before forward projection and
+        after backprojection, and the bins whose LORs miss the support are
+        skipped by both projections.
+        '''
+        if support is None:
+            parms.set_int_par\
+                (self.handle, 'AcquisitionModel', 'cancel_image_support', 1)
+            return
+        assert_validity(support, ImageData)
+        parms.set_parameter\
+            (self.handle, 'AcquisitionModel', 'image_support', support.handle)
+    def get_acquisition_support(self):
+        '''
+        Returns the forward projection of the binary image support
+        (positive for the bins in the support), available after set_up.
+        '''
+        ad = AcquisitionData()
+        ad.handle = pystir.cSTIR_parameter\
+            (self.handle, 'AcquisitionModel', 'acquisition_support')
+        check_status(ad.handle)
+        return ad
+    def get_support_fraction(self):
+        '''
+        Returns the fraction of bins in the acquisition support.
+        '''
+        return parms.float_par\
+            (self.handle, 'AcquisitionModel', 'support_fraction')
+    def set_verbose(self, flag):
+        '''
+        Enables or disables progress messages from projections.
+        '''
+        parms.set_int_par\
+            (self.handle, 'AcquisitionModel', 'verbose', int(flag))
+    def get_statistics(self):
+        '''
+        Returns a dictionary of the numbers of forward and backward
+        projections performed so far and, for each of the stages
+        'projection', 'additive', 'normalisation', 'background' and
+        'allocation', the accumulated wall clock and CPU times (seconds),
+        the number of calls and the estimated number of bytes moved.
+        '''
+        return json.loads(parms.char_par\
+            (self.handle, 'AcquisitionModel', 'statistics_json'))
+    def reset_statistics(self):
+        '''
+        Zeroes the accumulated statistics.
+        '''
+        try_calling(pystir.cSTIR_resetAcquisitionModelStatistics(self.handle))
+    def write_statistics(self, filename):
+        '''
+        Writes the accumulated statistics to a JSON file.
+        '''
+        try_calling(pystir.cSTIR_writeAcquisitionModelStatistics\
+            (self.handle, filename))
     def forward(self, image, subset_num = 0, num_subsets = 1, ad = None):
         ''' 
         Returns the forward projection of image;
@@ -1030,6 +1240,47 @@ class AcquisitionModel:
             (self.handle, ad.handle, subset_num, num_subsets)
         check_status(image.handle)
         return image
+    def forward_frames(self, images, subset_num = 0, num_subsets = 1):
+        '''
+        Returns the list of forward projections of a list of images
+        (e.g. time frames or gates) sharing the geometry;
+        all images are projected in one pass over the view-segments,
+        which is faster than projecting them one by one; set_up() must
+        have been called;
+        images:  a list of ImageData objects.
+        '''
+        if getattr(self, 'acq_templ', None) is None:
+            raise error('forward_frames: acquisition model not set up')
+        vec = SIRF.DataHandleVector()
+        for image in images:
+            assert_validity(image, ImageData)
+            vec.push_back(image.handle)
+        ads = [AcquisitionData(self.acq_templ) for image in images]
+        ad_vec = SIRF.DataHandleVector()
+        for ad in ads:
+            ad_vec.push_back(ad.handle)
+        try_calling(pystir.cSTIR_acquisitionModelFwdFrames \
+            (self.handle, vec.handle, subset_num, num_subsets, ad_vec.handle))
+        return ads
+    def backward_frames(self, ads, subset_num = 0, num_subsets = 1):
+        '''
+        Returns the list of backward projections of a list of acquisition
+        data sharing the geometry, computed in one pass as in forward_frames;
+        ads:  a list of AcquisitionData objects.
+        '''
+        if getattr(self, 'img_templ', None) is None:
+            raise error('backward_frames: acquisition model not set up')
+        vec = SIRF.DataHandleVector()
+        for ad in ads:
+            assert_validity(ad, AcquisitionData)
+            vec.push_back(ad.handle)
+        images = [self.img_templ.get_uniform_copy(0.0) for ad in ads]
+        im_vec = SIRF.DataHandleVector()
+        for image in images:
+            im_vec.push_back(image.handle)
+        try_calling(pystir.cSTIR_acquisitionModelBwdFrames \
+            (self.handle, vec.handle, subset_num, num_subsets, im_vec.handle))
+        return images
 
 class AcquisitionModelUsingMatrix(AcquisitionModel):
     ''' 
@@ -1061,6 +1312,39 @@ class AcquisitionModelUsingMatrix(AcquisitionModel):
         # TODO will need to allow for different matrices here
         assert_validity(matrix, RayTracingMatrix)
         parms.set_parameter(self.handle, self.name, 'matrix', matrix.handle)
+    def set_matrix_cache_path(self, path):
+        '''
+        Sets the directory for the persistent cache of the matrix.
+
+        If set, the matrix is computed once for given scanner, acquisition
+        data and image geometries and matrix parameters, and stored in a
+        file in this directory; set_up() then memory-maps this file, which
+        is shared by all processes on the same node;
+        path:  directory name (Python str), '' disables the cache.
+        '''
+        parms.set_char_par(self.handle, self.name, 'matrix_cache_path', path)
+    def get_matrix_cache_path(self):
+        '''
+        Returns the directory for the persistent cache of the matrix.
+        '''
+        return parms.char_par(self.handle, self.name, 'matrix_cache_path')
+    def set_use_sparse_matrix(self, flag=True):
+        '''
+        Selects the compressed sparse matrix projectors.
+
+        The rows of the matrix that are not related by symmetries are
+        cached as described in set_matrix_cache_path (a cache path must be
+        set, otherwise set_up() raises an error), and the projections
+        are computed by multithreaded sparse matrix-vector products that
+        apply the symmetries on the fly;
+        flag:  Python bool.
+        '''
+        parms.set_int_par(self.handle, self.name, 'sparse_matrix', int(flag))
+    def get_use_sparse_matrix(self):
+        '''
+        Returns True if the compressed sparse matrix projectors are used.
+        '''
+        return parms.int_par(self.handle, self.name, 'sparse_matrix') != 0
 ##    def get_matrix(self):
 ##        ''' 
 ##        Returns the ray tracing matrix used for projecting;
@@ -1339,10 +1623,15 @@ class PoissonLogLikelihoodWithLinearModelForMean(ObjectiveFunction):
     def __del__(self):
         if self.handle is not None:
             pyiutil.deleteDataHandle(self.handle)
-##    def set_sensitivity_filename(self, name):
-##        parms.set_char_par\
-##            (self.handle, 'PoissonLogLikelihoodWithLinearModelForMean',\
-##             'sensitivity_filename', name)
+    def set_sensitivity_filename(self, name):
+        '''
+        Sets the name of the file with the sensitivity image, which is read
+        rather than computed by set_up() if set_recompute_sensitivity(False)
+        is called.
+        '''
+        parms.set_char_par\
+            (self.handle, 'PoissonLogLikelihoodWithLinearModelForMean',\
+             'sensitivity_filename', name)
 ##    def set_use_subset_sensitivities(self, flag):
 ##        parms.set_char_par\
 ##            (self.handle, 'PoissonLogLikelihoodWithLinearModelForMean',\
@@ -1423,6 +1712,139 @@ class PoissonLogLikelihoodWithLinearModelForMeanAndProjData\
         parms.set_parameter\
             (self.handle, self.name, 'acquisition_data', ad.handle)
 
+class PoissonLogLikelihoodWithLinearModelForMeanAndListModeDataWithProjMatrixByBin\
+(PoissonLogLikelihoodWithLinearModelForMean):
+    '''
+    Class for Poisson log-likelihood objective function for listmode data.
+    The gradient is computed from the listmode events read in batches,
+    projecting only the LORs hit by the events (in parallel threads).
+    To avoid recomputing sensitivity, use set_sensitivity_filename()
+    with a precomputed sensitivity image and set_recompute_sensitivity(False).
+    '''
+    def __init__(self):
+        self.handle = None
+        self.name = \
+            'PoissonLogLikelihoodWithLinearModelForMeanAndListModeDataWithProjMatrixByBin'
+        self.handle = pystir.cSTIR_newObject(self.name)
+        check_status(self.handle)
+    def __del__(self):
+        if self.handle is not None:
+            pyiutil.deleteDataHandle(self.handle)
+    def set_listmode_file(self, name):
+        '''Sets the name of the file containing listmode data.
+        '''
+        parms.set_char_par(self.handle, self.name, 'listmode_file', name)
+    def set_matrix(self, matrix):
+        '''Sets the projection matrix (e.g. RayTracingMatrix).
+        '''
+        assert_validity(matrix, RayTracingMatrix)
+        parms.set_parameter(self.handle, self.name, 'matrix', matrix.handle)
+    def set_additive_term(self, at):
+        '''
+        Sets the additive term (e.g. scatter plus randoms) in the geometry
+        of the uncompressed listmode data.
+        '''
+        assert_validity(at, AcquisitionData)
+        parms.set_parameter(self.handle, self.name, 'additive_term', at.handle)
+    def set_batch_size(self, n):
+        '''Sets the number of events read and projected at a time.
+        '''
+        parms.set_int_par(self.handle, self.name, 'batch_size', n)
+    def get_batch_size(self):
+        return parms.int_par(self.handle, self.name, 'batch_size')
+    def set_verbose(self, flag):
+        '''
+        Enables or disables reporting the number of events processed
+        by each gradient computation.
+        '''
+        parms.set_int_par(self.handle, self.name, 'verbose', int(flag))
+
+class SubsetScheduler:
+    '''
+    Class for objects generating the order in which subsets are processed
+    by ordered subsets and stochastic gradient reconstruction algorithms.
+    Policies:
+    'sequential': 0, 1, ..., n - 1, 0, 1, ...
+    'herman_meyer': Herman-Meyer order, consecutive subsets as far apart
+        (in view angle) as possible
+    'golden_ratio': consecutive subsets a golden ratio fraction apart
+    'random': random order without replacement in each pass through subsets
+    'importance': random with replacement, subsets chosen with probabilities
+        proportional to their weights (e.g. norms of their gradients)
+    '''
+    name = 'SubsetScheduler'
+
+    def __init__(self, num_subsets=1, policy='sequential', seed=None):
+        self.handle = None
+        self.handle = pystir.cSTIR_newObject(self.name)
+        check_status(self.handle)
+        parms.set_int_par(self.handle, self.name, 'num_subsets', num_subsets)
+        parms.set_char_par(self.handle, self.name, 'policy', policy)
+        if seed is not None:
+            parms.set_int_par(self.handle, self.name, 'seed', seed)
+    def __del__(self):
+        if self.handle is not None:
+            pyiutil.deleteDataHandle(self.handle)
+    def set_num_subsets(self, n):
+        parms.set_int_par(self.handle, self.name, 'num_subsets', n)
+    def get_num_subsets(self):
+        return parms.int_par(self.handle, self.name, 'num_subsets')
+    def set_policy(self, policy):
+        parms.set_char_par(self.handle, self.name, 'policy', policy)
+    def get_policy(self):
+        return parms.char_par(self.handle, self.name, 'policy')
+    def set_seed(self, seed):
+        '''
+        Sets the seed of the random number generator and restarts the order.
+        '''
+        parms.set_int_par(self.handle, self.name, 'seed', seed)
+    def get_seed(self):
+        return parms.int_par(self.handle, self.name, 'seed')
+    def next(self):
+        '''
+        Returns the subset to process next and advances the schedule.
+        '''
+        handle = pystir.cSTIR_nextSubset(self.handle)
+        check_status(handle)
+        s = pyiutil.intDataFromHandle(handle)
+        pyiutil.deleteDataHandle(handle)
+        return s
+    def peek(self):
+        '''
+        Returns the subset next() would return, without advancing.
+        '''
+        handle = pystir.cSTIR_peekSubset(self.handle)
+        check_status(handle)
+        s = pyiutil.intDataFromHandle(handle)
+        pyiutil.deleteDataHandle(handle)
+        return s
+    def reset(self):
+        '''
+        Restarts the order from the beginning of a pass through subsets.
+        '''
+        try_calling(pystir.cSTIR_resetSubsetScheduler(self.handle))
+    def set_weight(self, subset, weight):
+        '''
+        Sets the weight of a subset used by 'importance' policy.
+        '''
+        try_calling(pystir.cSTIR_setSubsetWeight(self.handle, subset, weight))
+    def set_weights(self, weights):
+        for subset in range(len(weights)):
+            self.set_weight(subset, weights[subset])
+    def set_weights_from_gradients(self, obj_fun, image):
+        '''
+        Sets the weights of subsets to the norms of the respective subset
+        gradients of the objective function obj_fun at image.
+        '''
+        n = self.get_num_subsets()
+        for subset in range(n):
+            grad = obj_fun.get_subset_gradient(image, subset)
+            self.set_weight(subset, grad.norm())
+    def __iter__(self):
+        return self
+    def __next__(self):
+        return self.next()
+
 class Reconstructor:
     '''
     Class for a generic PET reconstructor.
@@ -1503,6 +1925,16 @@ class FBP2DReconstructor:
         parms.set_float_par(self.handle, 'FBP2D', 'fc', v)
     def set_output_image_size_xy(self, xy):
         parms.set_int_par(self.handle, 'FBP2D', 'xy', xy)
+    def set_num_threads(self, n):
+        '''
+        Sets the number of threads reconstructing slabs of slices in
+        parallel; 1 (default) runs STIR FBP2D as is, 0 uses all available
+        threads. Slabs are only used if the image has one plane per direct
+        sinogram, otherwise STIR FBP2D is run as is.
+        '''
+        parms.set_int_par(self.handle, 'FBP2D', 'num_threads', n)
+    def get_num_threads(self):
+        return parms.int_par(self.handle, 'FBP2D', 'num_threads')
     def set_up(self, image):
         '''Sets up the reconstructor.
         '''
@@ -1658,6 +2090,34 @@ class IterativeReconstructor(Reconstructor):
         self.set_current_estimate(image)
         self.update_current_estimate()
         return self.get_current_estimate()
+    def save_state(self, filename, image=None):
+        '''
+        Saves the image estimate (the current one if image is None),
+        iteration counters, sensitivity images and the state of the subset
+        scheduler (if one is set) to a binary file, from which
+        a reconstruction can be resumed by load_state().
+        '''
+        if image is None:
+            image = self.image
+        if image is None:
+            raise error('current estimate not set')
+        assert_validity(image, ImageData)
+        try_calling(pystir.cSTIR_saveReconstructionState\
+                    (self.handle, image.handle, filename))
+    def load_state(self, filename, image):
+        '''
+        Restores the state saved by save_state() into this reconstructor
+        (configured as the one that saved it, but not set up) and image
+        (of the same sizes as the saved estimate), and sets the
+        reconstructor up without recomputing the sensitivities;
+        image becomes the current estimate. If the saved state includes
+        that of a subset scheduler, a subset scheduler must be set,
+        and continues from the saved position.
+        '''
+        assert_validity(image, ImageData)
+        try_calling(pystir.cSTIR_loadReconstructionState\
+                    (self.handle, image.handle, filename))
+        self.set_current_estimate(image)
 
 class OSMAPOSLReconstructor(IterativeReconstructor):
     '''
@@ -1675,6 +2135,25 @@ class OSMAPOSLReconstructor(IterativeReconstructor):
     def __del__(self):
         if self.handle is not None:
             pyiutil.deleteDataHandle(self.handle)
+    def set_prefetch_memory(self, mb):
+        '''
+        Sets the memory (in MB) for reading the acquisition data of the next
+        subset on a background thread while the current one is processed;
+        has effect only if the acquisition data are stored in files;
+        0 (default) disables prefetching.
+        '''
+        parms.set_int_par(self.handle, self.name, 'prefetch_memory', mb)
+    def get_prefetch_memory(self):
+        return parms.int_par(self.handle, self.name, 'prefetch_memory')
+    def set_subset_scheduler(self, scheduler):
+        '''
+        Makes each update process the subset given by scheduler
+        (a SubsetScheduler with the same number of subsets) rather than
+        the next one in the default order.
+        '''
+        assert_validity(scheduler, SubsetScheduler)
+        parms.set_parameter\
+            (self.handle, self.name, 'subset_scheduler', scheduler.handle)
 ##    def set_MAP_model(self, model):
 ##        parms.set_char_par\
 ##            (self.handle, self.name, 'MAP_model', model)
@@ -1705,6 +2184,75 @@ class OSSPSReconstructor(IterativeReconstructor):
         parms.set_float_par\
             (self.handle, self.name, 'relaxation_parameter', value)
 
+class MultiresolutionReconstructor:
+    '''
+    Class for coarse-to-fine OSMAPOSL reconstruction: the reconstruction
+    runs through levels added by add_level(), each on the image grid
+    downsampled transaxially by an integer factor, the estimate being
+    interpolated to the grid of the next level at the end of each level;
+    the last level must have factor 1 (full resolution).
+    The projection matrix, sensitivities and reconstruction of each level
+    are set up once by set_up() and reused by subsequent reconstruct() calls.
+    '''
+    def __init__(self, num_subsets=1):
+        self.handle = None
+        self.name = 'MultiresolutionReconstruction'
+        self.handle = pystir.cSTIR_newObject(self.name)
+        check_status(self.handle)
+        parms.set_int_par(self.handle, self.name, 'num_subsets', num_subsets)
+    def __del__(self):
+        if self.handle is not None:
+            pyiutil.deleteDataHandle(self.handle)
+    def set_acquisition_data(self, ad):
+        assert_validity(ad, AcquisitionData)
+        parms.set_parameter\
+            (self.handle, self.name, 'acquisition_data', ad.handle)
+    def set_acquisition_model(self, am):
+        '''
+        Sets the acquisition model whose additive term, acquisition
+        sensitivity model and matrix parameters are used at every level.
+        '''
+        assert_validity(am, AcquisitionModelUsingMatrix)
+        parms.set_parameter\
+            (self.handle, self.name, 'acquisition_model', am.handle)
+    def set_num_subsets(self, n):
+        parms.set_int_par(self.handle, self.name, 'num_subsets', n)
+    def get_num_subsets(self):
+        return parms.int_par(self.handle, self.name, 'num_subsets')
+    def set_output_filename_prefix(self, prefix):
+        '''
+        Makes each level write its image at the end of the level to files
+        <prefix>_levelN_<subiteration>; no files are written by default.
+        '''
+        parms.set_char_par\
+            (self.handle, self.name, 'output_filename_prefix', prefix)
+    def add_level(self, factor, num_subiterations):
+        '''
+        Appends a level running num_subiterations subiterations on the
+        image grid with the numbers of voxels in x and y divided by factor.
+        '''
+        try_calling(pystir.cSTIR_addMultiresolutionLevel\
+            (self.handle, factor, num_subiterations))
+    def clear_levels(self):
+        parms.set_int_par(self.handle, self.name, 'clear_levels', 1)
+    def get_num_levels(self):
+        return parms.int_par(self.handle, self.name, 'num_levels')
+    def set_up(self, image):
+        '''
+        Sets up all levels for the geometry of image (full resolution).
+        '''
+        assert_validity(image, ImageData)
+        try_calling(pystir.cSTIR_setupMultiresolutionReconstruction\
+            (self.handle, image.handle))
+    def reconstruct(self, image):
+        '''
+        Reconstructs starting from the initial estimate image,
+        which is replaced by the result.
+        '''
+        assert_validity(image, ImageData)
+        try_calling(pystir.cSTIR_runMultiresolutionReconstruction\
+            (self.handle, image.handle))
+
 def make_Poisson_loglikelihood(acq_data, model = 'LinearModelForMean'):
     '''
     Selects the objective function based on the acquisition data and acquisition
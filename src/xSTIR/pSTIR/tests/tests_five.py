@@ -0,0 +1,55 @@
+# -*- coding: utf-8 -*-
+"""sirf.STIR FBP2D reconstruction tests
+v{version}
+
+Usage:
+  tests_five [--help | options]
+
+Options:
+  -r, --record   record the measurements rather than check them
+  -v, --verbose  report each test status
+
+{author}
+
+{licence}
+"""
+from sirf.STIR import *
+from sirf.Utilities import runner, RE_PYEXT, __license__
+__version__ = "0.2.3"
+__author__ = "Evgueni Ovtchinnikov, Casper da Costa-Luis"
+
+
+def test_main(rec=False, verb=False, throw=True):
+    datafile = RE_PYEXT.sub(".txt", __file__)
+    test = pTest(datafile, rec, throw=throw)
+    test.verbose = verb
+
+    msg_red = MessageRedirector()
+
+    data_path = examples_data_path('PET')
+    raw_data_file = existing_filepath(data_path, 'my_forward_projection.hs')
+    acq_data = AcquisitionData(raw_data_file)
+
+    if verb:
+        print('Checking slab-parallel FBP2D against serial FBP2D:')
+    recon = FBP2DReconstructor()
+    recon.set_input(acq_data)
+    recon.reconstruct()
+    image = recon.get_output().clone()
+
+    recon = FBP2DReconstructor()
+    recon.set_input(acq_data)
+    recon.set_num_threads(4)
+    recon.reconstruct()
+    slab_image = recon.get_output()
+    # the images coincide, so that the cosine of the angle between them
+    # and the ratio of their norms are 1
+    test.check(slab_image.dot(image) / (slab_image.norm() * image.norm()),
+               rel_tol=1e-5)
+    test.check(slab_image.norm() / image.norm(), rel_tol=1e-5)
+
+    return test.failed, test.ntest
+
+
+if __name__ == "__main__":
+    runner(test_main, __doc__, __version__, __author__)
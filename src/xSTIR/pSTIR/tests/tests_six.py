@@ -0,0 +1,89 @@
+# -*- coding: utf-8 -*-
+"""sirf.STIR sparse matrix projector tests
+v{version}
+
+Usage:
+  tests_six [--help | options]
+
+Options:
+  -r, --record   record the measurements rather than check them
+  -v, --verbose  report each test status
+
+{author}
+
+{licence}
+"""
+import shutil
+import tempfile
+from sirf.STIR import *
+from sirf.Utilities import error, runner, RE_PYEXT, __license__
+__version__ = "0.2.3"
+__author__ = "Evgueni Ovtchinnikov, Casper da Costa-Luis"
+
+
+def test_main(rec=False, verb=False, throw=True):
+    datafile = RE_PYEXT.sub(".txt", __file__)
+    test = pTest(datafile, rec, throw=throw)
+    test.verbose = verb
+
+    msg_red = MessageRedirector()
+
+    data_path = examples_data_path('PET')
+    raw_data_file = existing_filepath(data_path, 'my_forward_projection.hs')
+    acq_data = AcquisitionData(raw_data_file)
+
+    image = acq_data.create_uniform_image(0.0)
+    shape = EllipticCylinder()
+    shape.set_length(400)
+    shape.set_radii((40, 100))
+    shape.set_origin((10, 60, 0))
+    image.add_shape(shape, scale=1)
+    shape.set_radii((30, 30))
+    shape.set_origin((10, -30, 0))
+    image.add_shape(shape, scale=2)
+
+    if verb:
+        print('Checking sparse matrix projectors against ray tracing:')
+    cache_path = tempfile.mkdtemp()
+    try:
+        acq_model = AcquisitionModelUsingRayTracingMatrix()
+        acq_model.set_up(acq_data, image)
+        sparse_model = AcquisitionModelUsingRayTracingMatrix()
+        sparse_model.set_matrix_cache_path(cache_path)
+        sparse_model.set_use_sparse_matrix()
+        sparse_model.set_up(acq_data, image)
+
+        # both project with the same matrix, so that the cosine of the
+        # angle between the projections and the ratio of their norms are 1
+        fwd = acq_model.forward(image)
+        sparse_fwd = sparse_model.forward(image)
+        test.check(sparse_fwd.dot(fwd) / (sparse_fwd.norm() * fwd.norm()))
+        test.check(sparse_fwd.norm() / fwd.norm())
+        bwd = acq_model.backward(acq_data)
+        sparse_bwd = sparse_model.backward(acq_data)
+        test.check(sparse_bwd.dot(bwd) / (sparse_bwd.norm() * bwd.norm()))
+        test.check(sparse_bwd.norm() / bwd.norm())
+
+        # geometries other than those of set_up are rejected
+        other_image = acq_data.create_uniform_image(1.0, xy=(15, 15))
+        try:
+            sparse_model.forward(other_image)
+            raised = False
+        except error:
+            raised = True
+        test.check_if_equal(True, raised)
+        other_acq_data = acq_data.rebin(1, num_views_to_combine=2)
+        try:
+            sparse_model.backward(other_acq_data)
+            raised = False
+        except error:
+            raised = True
+        test.check_if_equal(True, raised)
+    finally:
+        shutil.rmtree(cache_path, ignore_errors=True)
+
+    return test.failed, test.ntest
+
+
+if __name__ == "__main__":
+    runner(test_main, __doc__, __version__, __author__)